@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Alignment of every allocation and the default size of the blocks an
+ * arena grows by
+ */
+#define ARENA_ALIGN (16u)
+#define ARENA_BLOCK_SIZE (64u * 1024u)
+
+/**
+ * A block obtained from malloc once the first buffer is full
+ */
+typedef struct arena_block
+{
+	struct arena_block *next; /**< The block before this one */
+	size_t size; /**< Bytes of data */
+	char data[] __attribute__((aligned(ARENA_ALIGN))); /**< The storage */
+} arena_block;
+
+/**
+ * A bump allocator: allocations are carved out of a buffer (then out of
+ * blocks from malloc) and all of them are released at once
+ */
+typedef struct arena
+{
+	char *base; /**< The buffer being carved */
+	size_t size; /**< Its size */
+	size_t used; /**< Bytes of it handed out */
+	char *initial; /**< The buffer given to arena_init (or NULL) */
+	size_t initial_size; /**< Its size */
+	size_t block_size; /**< Size of the blocks the arena grows by */
+	arena_block *blocks; /**< The blocks from malloc, latest first */
+	int shared; /**< Allocations may come from several threads */
+	pthread_mutex_t mutex; /**< Lock of a shared arena */
+} arena;
+
+extern void arena_init(arena *pool, void *buffer, size_t size, size_t block_size, int shared);
+extern void *arena_alloc(arena *pool, size_t size);
+extern char *arena_strdup(arena *pool, const char *string);
+extern void arena_release(arena *pool);
+
+#endif /* ARENA_H */
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "wrapper.h"
+
+/**
+ * A list of <KEY>:<VALUE> pairs to send to a single rank
+ *
+ * For CREATE_LINKS and BIND_MOUNTS the key is the source and the value
+ * is the destination.
+ */
+typedef struct pair_batch
+{
+	int count; /**< The number of pairs */
+	char **keys; /**< The keys */
+	char **values; /**< The values */
+} pair_batch;
+
+extern int send_pair_batches(parallel_wrapper *par_wrapper, CMD command, pair_batch *batches);
+
+#endif /* BATCH_H */
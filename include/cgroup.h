@@ -0,0 +1,41 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include "wrapper.h"
+
+/**
+ * Names of the job cgroup and of the leaf the wrapper moves itself into
+ * (followed by the pid of the wrapper)
+ */
+#define CGROUP_JOB_PREFIX "parallel_wrapper_job."
+#define CGROUP_LEAF_PREFIX "parallel_wrapper."
+
+/**
+ * memory.high as a percentage of the enclosing memory.max, unless set
+ * with --mem-high
+ */
+#define CGROUP_HIGH_PERCENT (90u)
+
+/**
+ * Resource usage of the job cgroup
+ */
+typedef struct cgroup_usage
+{
+	uint64_t cpu_usec; /**< CPU time (user + system) in microseconds */
+	uint64_t memory_bytes; /**< Current memory use */
+	uint64_t memory_peak; /**< Peak memory use (0 if not reported) */
+	uint64_t memory_high_events; /**< Times the job was throttled at memory.high */
+	uint64_t io_read_bytes; /**< Bytes read from block devices */
+	uint64_t io_write_bytes; /**< Bytes written to block devices */
+} cgroup_usage;
+
+extern char *cgroup_self_path(void);
+extern int cgroup_create(parallel_wrapper *par_wrapper);
+extern int cgroup_enter(parallel_wrapper *par_wrapper);
+extern int cgroup_populated(parallel_wrapper *par_wrapper);
+extern int cgroup_signal(parallel_wrapper *par_wrapper, int signal);
+extern int cgroup_kill(parallel_wrapper *par_wrapper);
+extern int cgroup_read_usage(parallel_wrapper *par_wrapper, cgroup_usage *usage);
+extern void cgroup_remove(parallel_wrapper *par_wrapper);
+
+#endif /* CGROUP_H */
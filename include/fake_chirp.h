@@ -0,0 +1,76 @@
+#ifndef FAKE_CHIRP_H
+#define FAKE_CHIRP_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Limits of the stand-in chirp server
+ */
+#define FAKE_CHIRP_ATTRS (256u)
+#define FAKE_CHIRP_LINE (4096u)
+
+/**
+ * Faults injected into the answers (all off when zeroed)
+ */
+typedef struct fake_chirp_faults
+{
+	uint32_t latency_us; /**< Delay of every answer */
+	uint32_t jitter_us; /**< Up to this much more delay (uniform) */
+	double error_rate; /**< Fraction of requests answered with BUSY */
+	double drop_rate; /**< Fraction of requests whose connection is closed unanswered */
+	uint64_t seed; /**< Seed of the fault generator (0: fixed default) */
+} fake_chirp_faults;
+
+/**
+ * A job attribute
+ */
+typedef struct fake_chirp_attr
+{
+	char *name; /**< Name of the attribute */
+	char *value; /**< ClassAd expression (strings are quoted) */
+} fake_chirp_attr;
+
+/**
+ * A client connection
+ */
+typedef struct fake_chirp_client
+{
+	int fd; /**< The connection */
+	int length; /**< Bytes of an incomplete request in line */
+	char line[FAKE_CHIRP_LINE]; /**< Request being received */
+	uint64_t due_us; /**< When the delayed answer is sent (0: none pending) */
+	int out_length; /**< Bytes of the delayed answer */
+	char out[FAKE_CHIRP_LINE + 32]; /**< The delayed answer */
+} fake_chirp_client;
+
+/**
+ * A chirp server on the loopback interface standing in for the starter's
+ * I/O proxy (cookie, get_job_attr and set_job_attr only)
+ */
+typedef struct fake_chirp
+{
+	pthread_t thread; /**< The server thread */
+	pthread_mutex_t mutex; /**< Lock on the attributes */
+	int listen_fd; /**< The listening socket */
+	int wake_fd[2]; /**< Pipe which stops the server */
+	uint16_t port; /**< The port of the server */
+	int num_attrs; /**< Attributes held */
+	fake_chirp_attr attrs[FAKE_CHIRP_ATTRS]; /**< The job ad */
+	int num_clients; /**< Clients connected */
+	int max_clients; /**< Size of clients */
+	fake_chirp_client **clients; /**< The connections */
+	fake_chirp_faults faults; /**< Faults injected */
+	uint64_t random; /**< State of the fault generator */
+	uint64_t requests; /**< Requests served */
+	uint64_t errors; /**< Requests answered with an injected error */
+	uint64_t drops; /**< Connections dropped by injection */
+} fake_chirp;
+
+extern fake_chirp *fake_chirp_start(void);
+extern int fake_chirp_set(fake_chirp *chirp, const char *name, const char *value);
+extern void fake_chirp_set_faults(fake_chirp *chirp, const fake_chirp_faults *faults);
+extern int fake_chirp_write_config(fake_chirp *chirp, const char *dir);
+extern void fake_chirp_stop(fake_chirp *chirp);
+
+#endif /* FAKE_CHIRP_H */
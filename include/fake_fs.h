@@ -0,0 +1,8 @@
+#ifndef FAKE_FS_H
+#define FAKE_FS_H
+
+#include "wrapper.h"
+
+extern int create_fake_fs(parallel_wrapper *par_wrapper, char *fake_fs, char *local_fs);
+
+#endif /* FAKE_FS_H */
@@ -0,0 +1,93 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Events kept by the flight recorder (a power of two) and the name of
+ * its dump in the scratch directory
+ */
+#define FLIGHT_EVENTS (16384u)
+#define FLIGHT_FILE "flight.bin"
+
+/**
+ * Dump file identification ("PWFR" little endian) and layout version
+ */
+#define FLIGHT_MAGIC (0x52465750u)
+#define FLIGHT_VERSION (1u)
+
+/**
+ * Kinds of events
+ */
+typedef enum FLIGHT_TYPE
+{
+	FLIGHT_NONE = 0, /**< Empty slot */
+	FLIGHT_PACKET_IN, /**< A packet was received (command, seq, peer) */
+	FLIGHT_PACKET_OUT, /**< A packet was sent (command, seq, peer) */
+	FLIGHT_STATE, /**< A state transition (FLIGHT_STATE_CODE in command, detail in value) */
+	FLIGHT_TIMER /**< A timer fired (FLIGHT_TIMER_CODE in command) */
+} FLIGHT_TYPE;
+
+/**
+ * State transitions
+ */
+typedef enum FLIGHT_STATE_CODE
+{
+	FLIGHT_STARTED = 1, /**< The wrapper started (value: rank) */
+	FLIGHT_REGISTERED, /**< A rank registered with the MASTER (value: rank) */
+	FLIGHT_LAUNCHED, /**< The local processes were started (value: count) */
+	FLIGHT_RANK_EXITED, /**< The processes of a rank exited (value: rank) */
+	FLIGHT_TIMED_OUT, /**< A rank missed its keep-alives (value: rank) */
+	FLIGHT_SIGNALLED, /**< A signal arrived (value: signal) */
+	FLIGHT_TERMINATED, /**< TERM arrived from the MASTER (value: return code) */
+	FLIGHT_CLEANUP /**< The teardown began (value: return code) */
+} FLIGHT_STATE_CODE;
+
+/**
+ * Timers
+ */
+typedef enum FLIGHT_TIMER_CODE
+{
+	FLIGHT_KEEP_ALIVE = 1, /**< Keep-alive round (value: number of ranks) */
+	FLIGHT_SAMPLE /**< Telemetry sample (value: 0 if the job was read) */
+} FLIGHT_TIMER_CODE;
+
+/**
+ * One event (32 bytes)
+ */
+typedef struct flight_event
+{
+	uint64_t time_us; /**< Monotonic time of the event */
+	uint32_t index; /**< Low bits of the event number + 1 (written last, 0: empty) */
+	uint32_t seq; /**< Sequence number of the packet */
+	uint32_t peer_addr; /**< IPv4 address of the peer (network order) */
+	uint16_t peer_port; /**< Port of the peer (host order) */
+	uint8_t type; /**< FLIGHT_TYPE */
+	uint8_t command; /**< CMD of the packet, or the state/timer code */
+	int32_t value; /**< Detail of a state transition or timer */
+	uint32_t thread; /**< Thread which recorded the event */
+} flight_event;
+
+/**
+ * Header of a dump (followed by FLIGHT_EVENTS events in slot order)
+ */
+typedef struct flight_header
+{
+	uint32_t magic; /**< FLIGHT_MAGIC */
+	uint16_t version; /**< FLIGHT_VERSION */
+	uint16_t event_size; /**< sizeof(flight_event) */
+	uint32_t capacity; /**< Number of slots */
+	int32_t rank; /**< Rank of the wrapper */
+	uint64_t recorded; /**< Events recorded since startup */
+	uint64_t mono_us; /**< Monotonic time of the dump */
+	uint64_t wall_us; /**< Wall-clock time of the dump */
+} flight_header;
+
+extern void flight_init(int rank);
+extern void flight_record(int type, int command, uint32_t seq, int32_t value, const struct sockaddr *peer);
+extern void flight_packet(int type, const char *message, const struct sockaddr *peer);
+extern int flight_write(const char *path);
+extern int flight_dump(const char *scratch_dir);
+
+#endif /* FLIGHT_H */
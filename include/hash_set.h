@@ -0,0 +1,37 @@
+#ifndef HASH_SET_H
+#define HASH_SET_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * The initial number of buckets in a hash set (power of two)
+ */
+#define HASH_SET_MIN_BUCKETS (64u)
+
+struct hash_set_entry
+{
+	struct hash_set_entry *next; /**< Next entry in this bucket */
+	uint32_t hash; /**< Cached hash of the key */
+	char *key; /**< The (owned) key */
+};
+
+/**
+ * A thread-safe set of strings
+ */
+typedef struct hash_set
+{
+	pthread_mutex_t mutex; /**< Protects the set */
+	struct hash_set_entry **buckets; /**< Chained buckets */
+	uint32_t mask; /**< Number of buckets - 1 */
+	int num_elements; /**< The number of keys in the set */
+} hash_set;
+
+extern hash_set *hash_set_get(void);
+extern int hash_set_add(hash_set *set, const char *key);
+extern int hash_set_contains(hash_set *set, const char *key);
+extern int hash_set_remove(hash_set *set, const char *key);
+extern char **hash_set_take_all(hash_set *set, int *count);
+extern uint32_t hash_string(const char *key);
+
+#endif /* HASH_SET_H */
@@ -0,0 +1,43 @@
+#ifndef KVS_H
+#define KVS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * The initial number of buckets in a key-value store (power of two)
+ */
+#define KVS_MIN_BUCKETS (64u)
+
+struct kvs_entry
+{
+	struct kvs_entry *next; /**< Next entry in this bucket */
+	struct kvs_entry *next_dirty; /**< Next entry in the dirty list */
+	uint32_t hash; /**< Cached hash of the key */
+	int dirty; /**< Flag noting the entry has not been published */
+	char *key; /**< The (owned) key */
+	char *value; /**< The (owned) value */
+};
+
+/**
+ * A thread-safe string to string map which tracks unpublished entries
+ */
+typedef struct kvs
+{
+	pthread_mutex_t mutex; /**< Protects the store */
+	struct kvs_entry **buckets; /**< Chained buckets */
+	struct kvs_entry *dirty; /**< Entries which have not been published */
+	uint32_t mask; /**< Number of buckets - 1 */
+	int num_elements; /**< The number of keys in the store */
+	int num_dirty; /**< The length of the dirty list */
+} kvs;
+
+extern kvs *kvs_get(void);
+extern void kvs_free(kvs *store);
+extern int kvs_put(kvs *store, const char *key, const char *value, int dirty);
+extern int kvs_lookup(kvs *store, const char *key, char *value, size_t value_len);
+extern int kvs_take_dirty(kvs *store, char ***keys, char ***values);
+extern void kvs_free_pairs(char **keys, char **values, int count);
+
+#endif /* KVS_H */
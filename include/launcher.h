@@ -0,0 +1,12 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include "wrapper.h"
+
+extern void set_job_environment(parallel_wrapper *par_wrapper);
+extern int launch_job(parallel_wrapper *par_wrapper);
+extern int launch_local(parallel_wrapper *par_wrapper);
+extern int wait_local(parallel_wrapper *par_wrapper);
+extern int report_exit(parallel_wrapper *par_wrapper, int return_code);
+
+#endif /* LAUNCHER_H */
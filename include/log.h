@@ -9,10 +9,25 @@ typedef enum PRINT_LEVEL
 	PRNT_INFO = 3
 } PRINT_LEVEL;
 
+/**
+ * The longest log line (longer ones are truncated) and the number of
+ * lines queued for the writer thread
+ */
+#define LOG_LINE_MAX (2048)
+#define LOG_RING_SLOTS (128u)
+
 #define print(type, format, ...) print_message(type, __FILE__, __LINE__, format, ##__VA_ARGS__)
 #define debug(type, format, ...) debug_message(type, __FILE__, __LINE__, format, ##__VA_ARGS__)
 
 extern int verbose;
+extern int log_json;
+
+/**
+ * Start the writer thread and write out the queued lines (also at exit)
+ */
+extern int log_start(void);
+extern void log_flush(void);
+extern int log_busy(void);
 
 /**
  * Print a DEBUG message 
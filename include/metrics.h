@@ -0,0 +1,79 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/**
+ * Counters are striped over METRICS_SHARDS cache lines, one per thread
+ * (round robin), so that concurrent handler threads rarely share one.
+ * Commands are indexed by their CMD value (below METRICS_COMMANDS).
+ */
+#define METRICS_SHARDS (16u)
+#define METRICS_COMMANDS (32u)
+
+/**
+ * Log-linear (HDR-style) histogram buckets: every power of two is split
+ * into 2^HISTOGRAM_SUB_BITS buckets, for a relative error of at most
+ * 1/8, up to 2^40 microseconds
+ */
+#define HISTOGRAM_SUB_BITS (3u)
+#define HISTOGRAM_BUCKETS (320u)
+
+/**
+ * Name of the snapshot in the scratch directory (Prometheus text format)
+ */
+#define METRICS_FILE "metrics.prom"
+
+/**
+ * A histogram of microsecond latencies (updated without locks)
+ */
+typedef struct histogram
+{
+	uint64_t count; /**< Number of values recorded */
+	uint64_t sum; /**< Sum of the values */
+	uint64_t max; /**< Largest value */
+	uint64_t buckets[HISTOGRAM_BUCKETS]; /**< Values per bucket */
+} histogram;
+
+/**
+ * One stripe of the counters (aligned to its own cache line)
+ */
+typedef struct metrics_shard
+{
+	uint64_t sent[METRICS_COMMANDS]; /**< Packets sent per command */
+	uint64_t received[METRICS_COMMANDS]; /**< Packets received per command */
+	uint64_t retransmits; /**< Commands sent again with the same sequence number */
+} __attribute__((aligned(64))) metrics_shard;
+
+/**
+ * Per-rank timings (MASTER only)
+ */
+typedef struct metrics_rank
+{
+	uint64_t registered_us; /**< Time from startup to REGISTER (0: not registered) */
+	uint32_t query_seq; /**< Sequence number of the last QUERY */
+	uint64_t query_sent_us; /**< When the last QUERY was sent */
+	uint64_t rtt_count; /**< Keep-alive round trips measured */
+	uint64_t rtt_sum_us; /**< Sum of the round trips */
+	uint64_t rtt_min_us; /**< Fastest round trip */
+	uint64_t rtt_max_us; /**< Slowest round trip */
+	uint64_t rtt_last_us; /**< Most recent round trip */
+} metrics_rank;
+
+extern int metrics_init(int num_ranks);
+extern uint64_t metrics_now_us(void);
+extern void metrics_count_sent(const char *message);
+extern void metrics_count_received(int command);
+extern void metrics_record_handler(int command, uint64_t usec);
+extern void metrics_registered(int rank);
+extern void metrics_query_sent(int rank, uint32_t seq);
+extern void metrics_query_acked(int rank, uint32_t seq);
+extern void metrics_listening(uint64_t entry_us);
+extern void metrics_teardown(int finished);
+extern void histogram_record(histogram *hist, uint64_t value);
+extern uint64_t histogram_quantile(const histogram *hist, double quantile);
+extern int metrics_write(const char *path);
+extern int metrics_dump(const char *file, const char *scratch_dir);
+
+#endif /* METRICS_H */
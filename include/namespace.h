@@ -0,0 +1,18 @@
+#ifndef NAMESPACE_H
+#define NAMESPACE_H
+
+#include "wrapper.h"
+
+/**
+ * Location of the node-local tmpfs used to back LOCAL_FS
+ */
+#define LOCAL_TMPFS "/dev/shm"
+
+extern int fs_namespace_supported(void);
+extern int add_bind_mount(parallel_wrapper *par_wrapper, char *src, char *dest);
+extern int remove_bind_mount(parallel_wrapper *par_wrapper, const char *dest);
+extern void remove_bind_mounts(parallel_wrapper *par_wrapper);
+extern int enter_fs_namespace(parallel_wrapper *par_wrapper);
+extern void cleanup_bind_mounts(parallel_wrapper *par_wrapper);
+
+#endif /* NAMESPACE_H */
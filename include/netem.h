@@ -0,0 +1,62 @@
+#ifndef NETEM_H
+#define NETEM_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Rules of the network emulator (the first one matching a peer applies)
+ */
+#define NETEM_RULES (8u)
+
+/**
+ * Extra delay of a packet held back for reordering when none is given
+ */
+#define NETEM_DEFAULT_GAP_US (10000u)
+
+/**
+ * Delay distributions
+ */
+typedef enum NETEM_DIST
+{
+	NETEM_UNIFORM = 0, /**< delay + [0, jitter] */
+	NETEM_EXPONENTIAL /**< delay + exponential with mean jitter (long tail) */
+} NETEM_DIST;
+
+/**
+ * Impairments of the packets to (and from) a peer
+ */
+typedef struct netem_rule
+{
+	uint32_t peer_addr; /**< IPv4 address of the peer (network order, 0: any) */
+	uint16_t peer_port; /**< Port of the peer (0: any) */
+	double drop; /**< Fraction of packets sent which are lost */
+	double rx_drop; /**< Fraction of packets received which are lost */
+	double dup; /**< Fraction of packets sent twice */
+	double reorder; /**< Fraction of packets held back behind later ones */
+	uint32_t delay_us; /**< Delay of every packet sent */
+	uint32_t jitter_us; /**< Spread of the delay */
+	uint32_t gap_us; /**< Extra delay of a packet held back */
+	int dist; /**< NETEM_DIST of the spread */
+} netem_rule;
+
+/**
+ * A packet waiting to be sent
+ */
+typedef struct netem_packet
+{
+	uint64_t due_us; /**< Monotonic time it is sent */
+	int socketfd; /**< Socket to send it on */
+	socklen_t addr_len; /**< Length of addr */
+	struct sockaddr_storage addr; /**< Destination */
+	struct netem_packet *next; /**< Next packet due */
+	int length; /**< Bytes of data */
+	char data[]; /**< The packet */
+} netem_packet;
+
+extern int netem_init(const char *spec, int rank);
+extern int netem_sendto(int socketfd, const char *data, int length, const struct sockaddr *addr, socklen_t addr_len);
+extern int netem_drop_received(const struct sockaddr *from);
+extern void netem_report(void);
+
+#endif /* NETEM_H */
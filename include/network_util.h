@@ -20,6 +20,7 @@ extern int get_bound_dgram_socket(uint16_t port);
 extern int get_bound_dgram_socket_by_range(uint16_t start, uint16_t end, uint16_t *port, int *socketfd);
 extern int send_string_to_ip_port(char *ip, uint16_t port, char *string, int socketfd);
 extern int send_string_reply(const struct sockaddr *addr, char *string, int socketfd);
+extern int send_string_to_sockaddr(const struct sockaddr *addr, socklen_t addr_len, char *string, int socketfd);
 extern uint16_t port_from_sockaddr(const struct sockaddr *addr);
 
 #endif
@@ -0,0 +1,59 @@
+#ifndef PENDING_H
+#define PENDING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/**
+ * The minimum number of slots in a pending request table
+ */
+#define PENDING_MIN_SLOTS (64u)
+
+/**
+ * The maximum length of the status carried in an ACK
+ */
+#define PENDING_STATUS_LEN (128u)
+
+typedef enum PENDING_STATE
+{
+	PENDING_FREE = 0, /**< Slot is not in use */
+	PENDING_WAITING, /**< Command sent, waiting on the ACK */
+	PENDING_DONE /**< Matching ACK received */
+} PENDING_STATE;
+
+/**
+ * A single outstanding command
+ */
+typedef struct pending_request
+{
+	uint32_t seq; /**< Sequence number of the command */
+	int rank; /**< The rank the command was sent to */
+	PENDING_STATE state; /**< The state of this request */
+	char status[PENDING_STATUS_LEN]; /**< Optional status returned in the ACK */
+} pending_request;
+
+/**
+ * A table of outstanding commands indexed by sequence number
+ */
+typedef struct pending_table
+{
+	pthread_mutex_t mutex; /**< Protects the table */
+	pthread_cond_t cond; /**< Signalled when a request completes */
+	uint32_t next_seq; /**< The next sequence number to hand out */
+	uint32_t mask; /**< Number of slots - 1 (slots is a power of two) */
+	pending_request *requests; /**< The slots */
+} pending_table;
+
+extern pending_table *pending_get_table(int slots);
+extern uint32_t pending_next_seq(pending_table *table);
+extern int pending_add(pending_table *table, int rank, uint32_t *seq);
+extern int pending_complete(pending_table *table, uint32_t seq, int rank, const char *status);
+extern int pending_get_status(pending_table *table, uint32_t seq, char *status, size_t status_len);
+extern int pending_is_done(pending_table *table, uint32_t seq);
+extern int pending_wait(pending_table *table, uint32_t seq, long int usec);
+extern int pending_wait_all(pending_table *table, uint32_t *seqs, int count, long int usec);
+extern int pending_remove(pending_table *table, uint32_t seq);
+
+#endif /* PENDING_H */
@@ -0,0 +1,75 @@
+#ifndef PMI_H
+#define PMI_H
+
+#include "wrapper.h"
+#include "kvs.h"
+
+/**
+ * Limits advertised to PMI clients
+ */
+#define PMI_KVSNAME_MAX (64u)
+#define PMI_KEYLEN_MAX (64u)
+#define PMI_VALLEN_MAX (512u)
+
+/**
+ * The longest PMI command accepted from a client
+ */
+#define PMI_LINE_MAX (2048u)
+
+/**
+ * The fan-out of the fence tree
+ */
+#define PMI_TREE_ARITY (8u)
+
+/**
+ * The most new keys the root broadcasts at the end of a fence; beyond
+ * this, ranks fetch keys from their parent on demand
+ */
+#define PMI_BROADCAST_MAX (256u)
+
+/**
+ * The job attribute holding the process to node mapping
+ */
+#define PMI_PROCESS_MAPPING "PMI_process_mapping"
+
+/**
+ * The PMI state of a job on this rank
+ */
+typedef struct pmi_job
+{
+	pthread_mutex_t mutex; /**< Protects the job */
+	pthread_cond_t cond; /**< Signalled when a fence completes or a rank exits */
+	int size; /**< The number of processes in the job */
+	int offset; /**< The global rank of the first local process */
+	int num_local; /**< The number of local processes */
+	char kvsname[PMI_KVSNAME_MAX]; /**< The name of the key-value space */
+	kvs *store; /**< The key-value space of the job */
+	kvs *node_store; /**< Node attributes (PMI-2) */
+	uint32_t epoch; /**< The last fence entered by every local process */
+	int arrived; /**< Local processes which have entered the next fence */
+	uint32_t done_epoch; /**< The last fence completed across the job */
+	uint32_t published_epoch; /**< The last fence passed up (or released at the root) */
+	machine *parent; /**< The parent in the fence tree (NULL at the root) */
+	int num_children; /**< The number of children in the fence tree */
+	machine *children[PMI_TREE_ARITY]; /**< The children in the fence tree */
+	uint32_t child_epochs[PMI_TREE_ARITY]; /**< The last fence entered by each child's subtree */
+	char *rank_exited; /**< (MASTER) Flags noting ranks whose processes exited */
+	int num_exited; /**< (MASTER) The number of ranks whose processes exited */
+} pmi_job;
+
+extern pmi_job *pmi_get_job(parallel_wrapper *par_wrapper, int offset, int size, int num_local, const char *mapping);
+extern char *pmi_process_mapping(parallel_wrapper *par_wrapper);
+extern int pmi_tree_order(parallel_wrapper *par_wrapper, int *order);
+extern int pmi_tree_fields(parallel_wrapper *par_wrapper, int *order, int count, int position, char *fields, int fields_len);
+extern int pmi_add_peer(parallel_wrapper *par_wrapper, pmi_job *job, int is_parent, int rank, const char *ip_addr, uint16_t port);
+extern machine *pmi_find_peer(parallel_wrapper *par_wrapper, int rank);
+extern int pmi_serve(parallel_wrapper *par_wrapper, int fd, int rank);
+extern int pmi_receive(parallel_wrapper *par_wrapper, CMD command, char **keys, char **values, int count, char *status);
+extern int pmi_fetch(parallel_wrapper *par_wrapper, const char *key, char *value, int value_len);
+extern int pmi_answer_fetch(parallel_wrapper *par_wrapper, int rank, char *key);
+extern int pmi_fence_enter(parallel_wrapper *par_wrapper, int rank, uint32_t epoch);
+extern int pmi_fence_complete(parallel_wrapper *par_wrapper, uint32_t epoch);
+extern int pmi_rank_exited(parallel_wrapper *par_wrapper, int rank, int return_code);
+extern int pmi_wait_exited(parallel_wrapper *par_wrapper);
+
+#endif /* PMI_H */
@@ -0,0 +1,41 @@
+#ifndef RANKS_H
+#define RANKS_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "arena.h"
+
+/**
+ * Flags of a rank
+ */
+#define RANK_REGISTERED (1u) /**< The rank has registered (or is the MASTER) */
+#define RANK_UNIQUE (2u) /**< The lowest rank on its host */
+
+/**
+ * The state of every rank which the MASTER scans each keep-alive round,
+ * during registration and on teardown, as one contiguous array per field
+ * (indexed by rank). The strings of a rank (IWD, user, CPU map) stay in
+ * its machine record, off these paths.
+ */
+typedef struct rank_table
+{
+	int count; /**< Number of ranks */
+	uint8_t *flags; /**< RANK_* flags */
+	int *cpus; /**< CPUs of each rank */
+	struct timeval *last_alive; /**< Last ACK (or the registration) of each rank */
+	struct sockaddr_in *addrs; /**< Command address of each rank */
+} rank_table;
+
+extern int rank_table_init(rank_table *table, arena *pool, int count);
+extern void rank_table_register(rank_table *table, int rank, const struct sockaddr_in *addr, int cpus);
+extern int rank_table_alive(rank_table *table, int rank, const struct sockaddr *from);
+extern int rank_table_find_unique(rank_table *table);
+
+/**
+ * Is a rank registered ?
+ */
+#define rank_registered(table, rank) \
+	((__atomic_load_n(&(table) -> flags[rank], __ATOMIC_ACQUIRE) & RANK_REGISTERED) != 0)
+
+#endif /* RANKS_H */
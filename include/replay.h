@@ -0,0 +1,54 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * Number of entries in the replay cache (power of two) and the maximum
+ * length of a cached reply
+ */
+#define REPLAY_SLOTS (1024u)
+#define REPLAY_REPLY_LEN (256u)
+
+typedef enum REPLAY_STATE
+{
+	REPLAY_FREE = 0, /**< Entry is not in use */
+	REPLAY_BUSY, /**< The handler for this command is still running */
+	REPLAY_DONE /**< The handler finished and the reply is cached */
+} REPLAY_STATE;
+
+/**
+ * Return values from replay_begin
+ */
+typedef enum REPLAY_RESULT
+{
+	REPLAY_NEW = 0, /**< First copy of this command - run the handler */
+	REPLAY_HIT, /**< Duplicate - the cached reply was copied out */
+	REPLAY_IN_FLIGHT /**< Duplicate of a command that is still being handled */
+} REPLAY_RESULT;
+
+/**
+ * A single cached reply keyed by (peer, sequence)
+ */
+typedef struct replay_entry
+{
+	struct sockaddr_storage peer; /**< The source of the command */
+	uint32_t seq; /**< The sequence number of the command */
+	REPLAY_STATE state; /**< The state of this entry */
+	char reply[REPLAY_REPLY_LEN]; /**< The reply that was sent */
+} replay_entry;
+
+typedef struct replay_cache
+{
+	pthread_mutex_t mutex; /**< Protects the entries */
+	replay_entry entries[REPLAY_SLOTS]; /**< Direct-mapped entries */
+} replay_cache;
+
+extern replay_cache *replay_get_cache(void);
+extern REPLAY_RESULT replay_begin(replay_cache *cache, const struct sockaddr *peer, uint32_t seq, char *reply, size_t reply_len);
+extern void replay_finish(replay_cache *cache, const struct sockaddr *peer, uint32_t seq, const char *reply);
+
+#endif /* REPLAY_H */
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 /**
  * An array of strings with an associated length
  */
@@ -12,6 +13,21 @@ typedef struct strarray
 	char **strings;
 } strarray;
 
+/**
+ * Byte classes of a delimiter table
+ */
+#define TOKEN_CHAR (0)
+#define TOKEN_DELIMITER (1)
+#define TOKEN_END (2)
+
+/**
+ * Class of every byte for tokenize() (TOKEN_END for the terminator)
+ */
+typedef struct delimiter_table
+{
+	unsigned char class[256]; /**< TOKEN_CHAR, TOKEN_DELIMITER or TOKEN_END */
+} delimiter_table;
+
 /**
  * What is a valid strarray ?
  */
@@ -21,10 +37,15 @@ typedef struct strarray
 extern void free_strarray(strarray *array);
 extern strarray *strsplit(char *delim, char *string);
 extern int count_tokens(char *delim, char *string);
+extern void make_delimiter_table(const char *delim, delimiter_table *table);
+extern int tokenize(const delimiter_table *table, char *string, char **tokens, int capacity);
 extern void print_strarray(strarray *array);
 extern int remove_quotes(char *string);
 extern int parse_integer(char *string, int *value);
+extern int parse_uint32(char *string, uint32_t *value);
 extern int trim(char *string);
 extern char *join_paths(const char *path_1, const char *path_2);
+extern int escape_field(const char *string, char *escaped, size_t len);
+extern void unescape_field(char *string);
 
 #endif /* STRING_UTIL_H */
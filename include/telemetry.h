@@ -0,0 +1,76 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "wrapper.h"
+
+/**
+ * Number of reports kept per rank by the MASTER, the default sampling
+ * interval (seconds) and the name of the table in the scratch directory
+ */
+#define TELEMETRY_HISTORY (16u)
+#define SAMPLE_INTERVAL (5)
+#define TELEMETRY_FILE "telemetry"
+
+/**
+ * Prefix of a telemetry report in the status of an ACK to QUERY
+ */
+#define TELEMETRY_PREFIX 'T'
+
+/**
+ * Usage of the local job over one report (deltas, except for RSS)
+ */
+typedef struct telemetry_sample
+{
+	uint32_t id; /**< Report number on the rank */
+	uint32_t interval_ms; /**< Time covered by the report */
+	uint64_t cpu_ms; /**< CPU time used */
+	uint64_t rss_kb; /**< Peak resident memory seen by the sampler */
+	uint64_t ctx_switches; /**< Voluntary and involuntary context switches */
+	uint64_t read_kb; /**< Bytes read from storage (kB) */
+	uint64_t write_kb; /**< Bytes written to storage (kB) */
+} telemetry_sample;
+
+/**
+ * Cumulative usage of the local job
+ */
+typedef struct telemetry_counters
+{
+	uint64_t cpu_ms;
+	uint64_t rss_kb;
+	uint64_t ctx_switches;
+	uint64_t read_kb;
+	uint64_t write_kb;
+} telemetry_counters;
+
+/**
+ * The reports received from one rank (MASTER only)
+ */
+typedef struct telemetry_rank
+{
+	int count; /**< Reports held (up to TELEMETRY_HISTORY) */
+	int next; /**< Next slot of the ring */
+	uint32_t missed; /**< Reports lost in transit */
+	telemetry_counters total; /**< Totals over all reports received */
+	telemetry_sample samples[TELEMETRY_HISTORY]; /**< The most recent reports */
+} telemetry_rank;
+
+typedef struct telemetry
+{
+	pthread_mutex_t mutex; /**< Lock on the whole structure */
+	pthread_mutex_t dump_mutex; /**< Serialises the writers of the telemetry file */
+	int num_ranks; /**< The number of ranks (MASTER only) */
+	telemetry_rank *ranks; /**< The rolling per-rank table (MASTER only) */
+	uint32_t report_id; /**< Number of the last report sent */
+	struct timeval reported_at; /**< When the last report was sent */
+	telemetry_counters reported; /**< Counters at the last report */
+	telemetry_counters current; /**< Counters at the last sample */
+	telemetry_counters raw; /**< Usage of the live processes at the last sample */
+} telemetry;
+
+extern telemetry *telemetry_get(int num_ranks);
+extern void *telemetry_sampler(void *ptr);
+extern int telemetry_report(parallel_wrapper *par_wrapper, char *status, int len);
+extern int telemetry_record(parallel_wrapper *par_wrapper, int rank, const char *status);
+extern int telemetry_dump(parallel_wrapper *par_wrapper);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,22 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include "wrapper.h"
+
+/**
+ * Location of the CPU and NUMA topology in sysfs
+ */
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/**
+ * The longest CPU list produced for a single process (e.g. "0-7,16-23")
+ */
+#define CPU_LIST_MAX (256u)
+
+extern const char *bind_policy_name(BIND_POLICY policy);
+extern char **get_bindings(BIND_POLICY policy, int num_procs, int *nodes);
+extern char *join_bindings(char **bindings, int count);
+extern int bind_to_cpus(const char *cpu_list);
+
+#endif /* TOPOLOGY_H */
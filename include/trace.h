@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "wrapper.h"
+
+/**
+ * Spans kept per rank, the longest span name and the name of the trace
+ * in the scratch directory (Chrome trace-event JSON)
+ */
+#define TRACE_MAX_SPANS (64u)
+#define TRACE_NAME_LEN (32u)
+#define TRACE_FILE "trace.json"
+
+/**
+ * A startup phase (wall-clock microseconds, end_us is 0 while it runs)
+ */
+typedef struct trace_span
+{
+	char name[TRACE_NAME_LEN]; /**< Name of the phase ([a-z_] only) */
+	uint64_t start_us; /**< When the phase began */
+	uint64_t end_us; /**< When the phase ended */
+	int sent; /**< Acknowledged by the MASTER */
+} trace_span;
+
+/**
+ * The spans received from one rank (MASTER only)
+ */
+typedef struct trace_rank
+{
+	int count; /**< Spans held */
+	trace_span spans[TRACE_MAX_SPANS]; /**< The spans */
+} trace_rank;
+
+extern int trace_init(int rank, int num_ranks);
+extern uint64_t trace_now_us(void);
+extern int trace_begin(const char *name);
+extern void trace_end(int span);
+extern int trace_send(parallel_wrapper *par_wrapper);
+extern int trace_record(int rank, char **spans, int count);
+extern int trace_write(const char *path);
+extern int trace_dump(const char *file, const char *scratch_dir);
+
+#endif /* TRACE_H */
@@ -3,6 +3,7 @@
 
 #include "network_util.h"
 #include <setjmp.h>
+#include <pthread.h>
 
 typedef enum CMD
 {
@@ -12,17 +13,63 @@ typedef enum CMD
 	CMD_ACK, /**< I am alive */
 	CMD_SEND_FILE, /**< Send a file to this TCP port */
 	CMD_REGISTER, /**< Register to rank 0 */
-	CMD_CREATE_LINK /**< Create a soft link */
+	CMD_CREATE_LINK, /**< Create a soft link */
+	CMD_CREATE_LINKS, /**< Create a batch of soft links */
+	CMD_BIND_MOUNTS, /**< Record a batch of bind mounts */
+	CMD_LAUNCH, /**< Launch the local processes */
+	CMD_PMI_PUT, /**< Store a batch of PMI key-value pairs */
+	CMD_PMI_FENCE, /**< This rank has entered a PMI fence */
+	CMD_PMI_FENCE_DONE, /**< All ranks have entered a PMI fence */
+	CMD_EXITED, /**< The local processes of a rank have exited */
+	CMD_PMI_BCAST, /**< Cache a batch of PMI pairs and pass them down the tree */
+	CMD_PMI_GET, /**< Fetch a PMI key which was not broadcast */
+	CMD_PMI_VALUE, /**< Cache a batch of fetched PMI pairs */
+	CMD_TRACE /**< The startup spans of a rank */
 } CMD;
 
+/**
+ * One past the highest command (the size of a table indexed by CMD)
+ */
+#define CMD_COUNT (CMD_TRACE + 1)
+
+/**
+ * The longest message the listener accepts (excluding the terminator)
+ */
+#define MAX_MESSAGE (1023u)
+
+/**
+ * The separators of the fields of a message
+ */
+#define MESSAGE_DELIMITERS ":|"
+
+/**
+ * The most fields a message can have (every other byte a delimiter)
+ */
+#define MAX_MESSAGE_TOKENS ((MAX_MESSAGE + 1) / 2)
+
+/**
+ * The maximum number of <KEY>:<VALUE> pairs in a single batch command
+ */
+#define MAX_PAIRS_PER_MESSAGE (64u)
+
 extern int jmpset;
 extern sigjmp_buf jmpbuf;
+extern pthread_t jmpthread;
 extern int disable_timeout;
 
+struct parallel_wrapper;
+
 extern void *udp_server(void *ptr);
-extern int ack(int socketfd, int rank, const struct sockaddr *addr);
-extern int query(int socketfd, char *ip_addr, uint16_t port);
-extern int term(int socketfd, int return_code, char *ip_addr, uint16_t port);
-extern int register_cmd(int socketfd, int rank, int cpus, char *iwd, char *username, char *ip_addr, uint16_t port);
-extern int create_link(int socketfd, char *src, char *dest, char *ip_addr, uint16_t port);
+extern int udp_find_handler(CMD command);
+extern int udp_decode_datagram(struct parallel_wrapper *par_wrapper, const char *datagram, int length);
+extern int query(int socketfd, uint32_t seq, const struct sockaddr_in *addr);
+extern int term(int socketfd, uint32_t seq, int return_code, const struct sockaddr_in *addr);
+extern int register_cmd(int socketfd, uint32_t seq, int rank, int cpus, char *iwd, char *username, char *cpu_map, char *ip_addr, uint16_t port);
+extern int create_link(int socketfd, uint32_t seq, char *src, char *dest, char *ip_addr, uint16_t port);
+extern int send_pairs(int socketfd, CMD command, uint32_t seq, char **keys, char **values, int count, char *ip_addr, uint16_t port, int *packed);
+extern int launch(int socketfd, uint32_t seq, int offset, int size, char *shared_fs, char *mapping, char *tree, char *ip_addr, uint16_t port);
+extern int fence(int socketfd, CMD command, uint32_t seq, uint32_t epoch, int rank, char *ip_addr, uint16_t port);
+extern int fetch(int socketfd, uint32_t seq, char *key, int rank, char *ip_addr, uint16_t port);
+extern int exited(int socketfd, uint32_t seq, int rank, int return_code, char *ip_addr, uint16_t port);
+extern int send_spans(int socketfd, uint32_t seq, int rank, const char *spans, char *ip_addr, uint16_t port);
 #endif /* UDP_H */
@@ -12,30 +12,72 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <signal.h>
 #include "udp.h"
-#include "sll.h"
+#include "hash_set.h"
+#include "pending.h"
+#include "replay.h"
 #include "network_util.h"
 #include "log.h"
+#include "arena.h"
+#include "ranks.h"
 
 #define MASTER (0u)
 #define LOW_PORT (51000u)
 #define HIGH_PORT (61000u)
 #define TIMEOUT (60*5) /* keep-alive timeout 5 minutes */ 
 #define KA_INTERVAL (30) /* keep-alive interval seconds */
+#define KILL_GRACE (5) /* seconds between SIGTERM and SIGKILL of the children */
+#define ABORT_CODE (250) /* exit code of a job aborted by a signal or a keep-alive timeout */
 
-extern int exit_flag;
+extern volatile sig_atomic_t exit_flag; /* The signal which asked us to exit (0: none) */
+extern int cleaning_up;
+extern int dump_pipe[2];
+
+/**
+ * How the fake shared file system is presented when IWDs differ
+ */
+typedef enum FS_MODE
+{
+	FS_MODE_SYMLINK = 0, /**< Per-host symlink to the IWD */
+	FS_MODE_BIND /**< Bind mount in a private mount namespace */
+} FS_MODE;
+
+/**
+ * Who launches the user's processes
+ */
+typedef enum LAUNCH_MODE
+{
+	LAUNCH_MASTER = 0, /**< The master runs the executable (e.g. mpiexec) */
+	LAUNCH_PMI, /**< Every rank runs its processes under the built-in PMI server */
+	LAUNCH_LOCAL /**< Every rank runs its processes without a PMI server */
+} LAUNCH_MODE;
+
+/**
+ * How local processes are pinned to the CPUs of this host
+ */
+typedef enum BIND_POLICY
+{
+	BIND_NONE = 0, /**< Leave placement to the kernel */
+	BIND_COMPACT, /**< One core each, filling a socket before the next */
+	BIND_SCATTER, /**< One core each, round robin across NUMA nodes */
+	BIND_SOCKET /**< Every CPU of one socket, in blocks of consecutive processes */
+} BIND_POLICY;
+
+struct pmi_job;
+struct telemetry;
 
 typedef struct machine
 {
 	uint16_t port; /**< Command Port */
 	int rank; /**< Rank [0, N-1] */
 	int cpus; /**< The number of CPUs for this rank */
-	int unique; /**< Flag noting if this a unique host */
 	char *iwd; /**< Initial working directory */
 	char *ip_addr; /**< The IP address associated with the machine */
 	char *user; /**< The username associated with this machine */
 	char *schedd_iwd; /**< The IWD on the schedd */
-	struct timeval last_alive;
+	char *cpu_map; /**< The CPUs of each local process, e.g. "0;1;2-3" (or NULL) */
+	struct timeval last_alive; /**< Last ACK from this peer (PMI tree) */
 } machine;
 
 typedef struct parallel_wrapper
@@ -47,19 +89,47 @@ typedef struct parallel_wrapper
 	int command_socket; /**< The FD for the command socket */
 	int timeout; /**< The keepalive timeout */
 	int ka_interval; /**< The keepalive interval */
+	FS_MODE fs_mode; /**< How the fake file system is presented */
+	LAUNCH_MODE launch_mode; /**< Who launches the user's processes */
+	BIND_POLICY bind_policy; /**< How local processes are pinned */
+	char **bindings; /**< The CPU list of each local process (NULL entries are unbound) */
+	int *binding_nodes; /**< The NUMA node of each local process (-1 if unknown) */
+	int mem_high; /**< memory.high of the job in MB (0: derived from memory.max) */
+	char *cgroup; /**< The cgroup v2 directory of the job (NULL: tracked by process group) */
+	int sample_interval; /**< Seconds between telemetry samples (0: disabled) */
+	char *telemetry_file; /**< Where the MASTER writes the telemetry table (NULL: scratch dir) */
+	char *metrics_file; /**< Where the metrics snapshot is written (NULL: scratch dir) */
+	char *trace_file; /**< Where the MASTER writes the startup trace (NULL: scratch dir) */
+	char *netem_spec; /**< Network impairments to emulate (NULL: none) */
+	int num_local_pids; /**< The number of local processes launched */
+	int num_binds; /**< The number of bind mounts */
 	pid_t child_pid; /**< The child pid */
 	pid_t pgid; /* Process group id */
+	pid_t *local_pids; /**< The local processes (PMI launch mode) */
 	uint16_t low_port; /**< The lower port */
 	uint16_t high_port; /**< High port */
 	machine *this_machine; /**< This machine */
 	machine *master; /**< The master machine */
 	pthread_t listener; /**< The pthread associated with the network listener */
 	pthread_mutex_t mutex; /**< Semaphore */
+	pthread_cond_t cond; /**< Signalled when the job is handed to this rank */
 	char *scratch_dir; /**< The scratch directory to use */
 	char *shared_fs; /**< The shared file system */
+	char *local_fs; /**< The node-local file system (bind mode) */
 	char **executable; /**< Array holding the passed executable and args */
 	machine **machines; /**< All machines (for the master only) */
-	sl_list *symlinks; /**< List of symlinks */
+	machine *machine_store; /**< Contiguous storage of machines (in job_arena) */
+	arena job_arena; /**< Records which live as long as the job */
+	rank_table ranks; /**< Flags, CPUs, liveness and address of every rank (for the master only) */
+	hash_set *symlinks; /**< Set of symlink destinations */
+	hash_set *mount_points; /**< Set of mount points we created */
+	hash_set *created_dirs; /**< Set of bind sources we created */
+	char **bind_src; /**< Directories to bind mount for the child */
+	char **bind_dest; /**< Mount points for the child */
+	pending_table *pending; /**< Commands awaiting an ACK */
+	replay_cache *replay; /**< Replies to commands we have already handled */
+	struct pmi_job *pmi; /**< The PMI state of the job (PMI launch mode) */
+	struct telemetry *telemetry; /**< Resource usage of the job (per-rank table on the MASTER) */
 } parallel_wrapper;
 
 /**
@@ -83,6 +153,9 @@ extern int chirp_info(parallel_wrapper *par_wrapper);
 
 extern void handle_exit_signal(int signal);
 
+extern void handle_dump_signal(int signal);
+
+extern int claim_cleanup(void);
 extern void cleanup(parallel_wrapper *par_wrapper, int return_code);
 
 extern void set_environment_vars(parallel_wrapper *par_wrapper);
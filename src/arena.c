@@ -0,0 +1,133 @@
+/**
+ * Arena allocator
+ *
+ * Used for memory whose lifetime is known up front: the scratch space of
+ * a message (released when its handler completes) and the records of
+ * the job (released at exit). An allocation is a pointer bump; the first
+ * buffer can be supplied by the caller (e.g. inside the message, aligned
+ * to ARENA_ALIGN), and blocks from malloc are only taken once it is full.
+ */
+
+#include "arena.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void *carve(arena *pool, size_t size);
+
+/**
+ * Prepare an arena
+ *
+ * @param pool The arena
+ * @param buffer The first buffer to carve (NULL: start with a block)
+ * @param size The size of buffer
+ * @param block_size Size of the blocks taken from malloc (0: ARENA_BLOCK_SIZE)
+ * @param shared Nonzero if several threads allocate from the arena
+ */
+void arena_init(arena *pool, void *buffer, size_t size, size_t block_size, int shared)
+{
+	memset(pool, 0, sizeof(arena));
+	pool -> initial = (char *) buffer;
+	pool -> initial_size = buffer == NULL ? 0 : size;
+	pool -> base = pool -> initial;
+	pool -> size = pool -> initial_size;
+	pool -> block_size = block_size == 0 ? ARENA_BLOCK_SIZE : block_size;
+	pool -> shared = shared;
+	if (shared)
+	{
+		pthread_mutex_init(&pool -> mutex, NULL);
+	}
+}
+
+/**
+ * Allocate zeroed memory from an arena (aligned to ARENA_ALIGN)
+ *
+ * @param pool The arena
+ * @param size The number of bytes
+ * @return The memory, or NULL on failure
+ */
+void *arena_alloc(arena *pool, size_t size)
+{
+	if (! pool -> shared)
+	{
+		return carve(pool, size);
+	}
+	pthread_mutex_lock(&pool -> mutex);
+	void *memory = carve(pool, size);
+	pthread_mutex_unlock(&pool -> mutex);
+	return memory;
+}
+
+/**
+ * Copy a string into an arena
+ *
+ * @return The copy, or NULL on failure (or if string is NULL)
+ */
+char *arena_strdup(arena *pool, const char *string)
+{
+	if (string == (char *)NULL)
+	{
+		return NULL;
+	}
+	size_t length = strlen(string) + 1;
+	char *copy = (char *) arena_alloc(pool, length);
+	if (copy != (char *)NULL)
+	{
+		memcpy(copy, string, length);
+	}
+	return copy;
+}
+
+/**
+ * Release every allocation of an arena at once
+ *
+ * The blocks from malloc are freed; the first buffer is kept, so the
+ * arena can be used again.
+ */
+void arena_release(arena *pool)
+{
+	while (pool -> blocks != (arena_block *)NULL)
+	{
+		arena_block *block = pool -> blocks;
+		pool -> blocks = block -> next;
+		free(block);
+	}
+	pool -> base = pool -> initial;
+	pool -> size = pool -> initial_size;
+	pool -> used = 0;
+}
+
+/**
+ * Bump allocate (with the lock of a shared arena held)
+ */
+static void *carve(arena *pool, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	if (pool -> base == (char *)NULL || pool -> size - pool -> used < size)
+	{
+		/* Large requests get a block of their own (the current one stays in use) */
+		int large = size > pool -> block_size / 4;
+		size_t block_size = large ? size : pool -> block_size;
+		arena_block *block = (arena_block *) malloc(sizeof(arena_block) + block_size);
+		if (block == (arena_block *)NULL)
+		{
+			print(PRNT_WARN, "Unable to grow an arena by %zu bytes\n", block_size);
+			return NULL;
+		}
+		block -> size = block_size;
+		block -> next = pool -> blocks;
+		pool -> blocks = block;
+		if (large)
+		{
+			memset(block -> data, 0, size);
+			return block -> data;
+		}
+		pool -> base = block -> data;
+		pool -> size = block_size;
+		pool -> used = 0;
+	}
+	void *memory = pool -> base + pool -> used;
+	pool -> used += size;
+	memset(memory, 0, size);
+	return memory;
+}
@@ -0,0 +1,175 @@
+/**
+ * Batched <KEY>:<VALUE> commands with per-message retransmission
+ */
+
+#include "batch.h"
+#include "pmi.h"
+#include "string_util.h"
+
+/**
+ * A single batch message (a slice of one rank's batch)
+ */
+struct pair_request
+{
+	int rank; /**< The destination rank */
+	int offset; /**< The first pair in the batch carried by this message */
+	int count; /**< The number of pairs carried by this message */
+};
+
+static int complete_requests(parallel_wrapper *par_wrapper, CMD command, pair_batch *batches,
+	struct pair_request *requests, uint32_t *seqs, int count);
+
+/**
+ * Send a batch of <KEY>:<VALUE> pairs to each of a set of ranks
+ *
+ * Sends each rank its batch as pair commands (a batch that does not fit
+ * in one datagram is split across several). All messages are
+ * outstanding at once; only those which have not been acknowledged are
+ * retransmitted. The per-pair status returned in each ACK is checked
+ * once every message has been answered. When the pending table is full,
+ * the messages already sent are completed (freeing their slots) before
+ * the rest are sent.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param command CMD_CREATE_LINKS, CMD_BIND_MOUNTS or a PMI pair command
+ * @param batches An array of num_procs batches (count == 0 means no pairs)
+ * @return The number of pairs which were rejected or could not be sent
+ */
+int send_pair_batches(parallel_wrapper *par_wrapper, CMD command, pair_batch *batches)
+{
+	int i;
+	int total = 0;
+	int failures = 0;
+	if (batches == (pair_batch *)NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < par_wrapper -> num_procs; i++)
+	{
+		total += batches[i].count;
+	}
+	if (total == 0)
+	{
+		return 0;
+	}
+	/* At most one message per pair */
+	struct pair_request *requests = (struct pair_request *)calloc(total, sizeof(struct pair_request));
+	uint32_t *seqs = (uint32_t *)calloc(total, sizeof(uint32_t));
+	if (requests == (struct pair_request *)NULL || seqs == (uint32_t *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for batch requests\n");
+		free(requests);
+		free(seqs);
+		return total;
+	}
+
+	/* Split each batch into messages and send them */
+	int num_requests = 0;
+	int completed = 0; /* The requests before this one have been completed */
+	for (i = 0; i < par_wrapper -> num_procs; i++)
+	{
+		machine *host = pmi_find_peer(par_wrapper, i);
+		int offset = 0;
+		if (host == (machine *)NULL || batches[i].count == 0)
+		{
+			continue;
+		}
+		while (offset < batches[i].count)
+		{
+			uint32_t seq;
+			int packed = 0;
+			if (pending_add(par_wrapper -> pending, i, &seq) != 0)
+			{
+				if (num_requests > completed)
+				{
+					/* Table full - wait for the messages in flight to free their slots */
+					failures += complete_requests(par_wrapper, command, batches, requests + completed,
+						seqs + completed, num_requests - completed);
+					completed = num_requests;
+					continue;
+				}
+				print(PRNT_ERR, "Unable to allocate a sequence number for command %d\n", command);
+				failures += batches[i].count - offset;
+				break;
+			}
+			send_pairs(par_wrapper -> command_socket, command, seq, batches[i].keys + offset,
+				batches[i].values + offset, batches[i].count - offset, host -> ip_addr,
+				host -> port, &packed);
+			if (packed == 0)
+			{
+				/* This pair can never be sent */
+				pending_remove(par_wrapper -> pending, seq);
+				failures++;
+				offset++;
+				continue;
+			}
+			requests[num_requests].rank = i;
+			requests[num_requests].offset = offset;
+			requests[num_requests].count = packed;
+			seqs[num_requests] = seq;
+			num_requests++;
+			offset += packed;
+		}
+	}
+	failures += complete_requests(par_wrapper, command, batches, requests + completed, seqs + completed,
+		num_requests - completed);
+	free(requests);
+	free(seqs);
+	return failures;
+}
+
+/**
+ * Retransmit messages until each is acknowledged, then check the
+ * per-pair status of their ACKs and release their slots
+ *
+ * @return The number of pairs which were rejected
+ */
+static int complete_requests(parallel_wrapper *par_wrapper, CMD command, pair_batch *batches,
+	struct pair_request *requests, uint32_t *seqs, int count)
+{
+	int i, j, RC;
+	int failures = 0;
+	/* Retransmit unanswered messages until every message is acknowledged */
+	while ((RC = pending_wait_all(par_wrapper -> pending, seqs, count, 100000)) != 0)
+	{
+		debug(PRNT_INFO, "Waiting for ACK (command %d) for %d messages\n", command, RC);
+		for (j = 0; j < count; j++)
+		{
+			if (pending_is_done(par_wrapper -> pending, seqs[j]))
+			{
+				continue;
+			}
+			int packed = 0;
+			struct pair_request *request = &requests[j];
+			machine *host = pmi_find_peer(par_wrapper, request -> rank);
+			send_pairs(par_wrapper -> command_socket, command, seqs[j], 
+				batches[request -> rank].keys + request -> offset,
+				batches[request -> rank].values + request -> offset, request -> count,
+				host -> ip_addr, host -> port, &packed);
+		}
+	}
+
+	/* Check the per-pair status returned with each ACK */
+	for (j = 0; j < count; j++)
+	{
+		char status[PENDING_STATUS_LEN];
+		struct pair_request *request = &requests[j];
+		if (pending_get_status(par_wrapper -> pending, seqs[j], status, PENDING_STATUS_LEN) != 0)
+		{
+			status[0] = '\0';
+		}
+		for (i = 0; i < request -> count; i++)
+		{
+			if (i < (int) strlen(status) && status[i] == '0')
+			{
+				continue;
+			}
+			print(PRNT_WARN, "Rank %d rejected %s -> %s (command %d)\n", request -> rank,
+				batches[request -> rank].keys[request -> offset + i],
+				batches[request -> rank].values[request -> offset + i], command);
+			failures++;
+		}
+		pending_remove(par_wrapper -> pending, seqs[j]);
+	}
+	return failures;
+}
@@ -0,0 +1,365 @@
+/**
+ * Microbenchmarks of the message parsing and dispatch hot paths
+ *
+ * Every datagram is split into its fields (tokenize), its command and
+ * sequence number parsed (parse_integer, parse_uint32), its handler
+ * looked up and its fields decoded against the schema of the command
+ * before the handler runs. This times that path for a typical message
+ * of each command, both on its own ("parse") and as the listener runs
+ * it, message allocation included ("decode"), and the string helpers on
+ * their own, reporting nanoseconds and heap allocations per operation:
+ *
+ *     make -C compile bench
+ *     bench [-n iterations] [-r repeats] [-c csv]
+ *
+ * Every case runs a fixed number of iterations, repeats times, on one
+ * CPU; the median and the best repeat are reported so that numbers can
+ * be compared across releases (on the same machine).
+ */
+
+#define _GNU_SOURCE
+#include "wrapper.h"
+#include "string_util.h"
+#include "udp.h"
+#include "telemetry.h"
+#include <sched.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCH_MAX_REPEATS (101)
+#define BENCH_MESSAGE_LEN (MAX_MESSAGE + 1)
+
+/* Normally defined by main.c */
+pthread_mutex_t keep_alive_mutex;
+
+/**
+ * One benchmark
+ */
+typedef struct bench_case
+{
+	const char *name; /**< Name in the report */
+	void (*run)(struct bench_case *bench); /**< One operation */
+	char message[BENCH_MESSAGE_LEN]; /**< Input of the operation */
+	int length; /**< Length of message */
+	uint64_t sink; /**< Results (so that nothing is optimised away) */
+} bench_case;
+
+/**
+ * Heap allocations counted by the wrappers of the allocator below
+ */
+static uint64_t allocations = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void run_parse(bench_case *bench);
+static void run_decode(bench_case *bench);
+static void run_strsplit(bench_case *bench);
+static void run_count_tokens(bench_case *bench);
+static void run_trim(bench_case *bench);
+static void run_remove_quotes(bench_case *bench);
+static void run_parse_integer(bench_case *bench);
+static void run_find_handler(bench_case *bench);
+static int add_case(const char *name, void (*run)(bench_case *), const char *format, ...);
+static void measure(bench_case *bench, int iterations, int repeats, FILE *csv);
+static int compare_doubles(const void *a, const void *b);
+static uint64_t now_ns(void);
+
+static bench_case cases[32];
+static int num_cases = 0;
+static delimiter_table message_delimiters;
+static parallel_wrapper bench_wrapper;
+
+/**
+ * Count the allocations of the process (forwarding to glibc)
+ */
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	allocations++;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+int main(int argc, char **argv)
+{
+	int i, c;
+	int iterations = 200000;
+	int repeats = 9;
+	FILE *csv = NULL;
+	char pairs[BENCH_MESSAGE_LEN];
+	char links[BENCH_MESSAGE_LEN];
+	char spans[BENCH_MESSAGE_LEN];
+	while ((c = getopt(argc, argv, "hn:r:c:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			case 'c':
+				csv = fopen(optarg, "w");
+				if (csv == (FILE *)NULL)
+				{
+					fprintf(stderr, "Unable to open %s\n", optarg);
+					return 1;
+				}
+				break;
+			default:
+				printf("Usage: %s [-n iterations] [-r repeats (odd, at most %d)] [-c csv]\n", argv[0],
+					BENCH_MAX_REPEATS);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (iterations < 1 || repeats < 1 || repeats > BENCH_MAX_REPEATS)
+	{
+		fprintf(stderr, "Invalid number of iterations or repeats\n");
+		return 1;
+	}
+	/* Stay on one CPU so that repeats are comparable */
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+	{
+		for (i = 0; i < CPU_SETSIZE && ! CPU_ISSET(i, &cpus); i++);
+		CPU_ZERO(&cpus);
+		CPU_SET(i, &cpus);
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	}
+
+	make_delimiter_table(MESSAGE_DELIMITERS, &message_delimiters);
+	/* Batches as the senders pack them */
+	int length = 0;
+	for (i = 0; i < 16; i++)
+	{
+		length += snprintf(pairs + length, BENCH_MESSAGE_LEN - length, ":PMI_process_mapping_%d:(vector,(0,%d,1))", i, i);
+	}
+	length = 0;
+	for (i = 0; i < 8; i++)
+	{
+		length += snprintf(links + length, BENCH_MESSAGE_LEN - length, ":/home/user/job/input_%d.dat|/tmp/job/input_%d.dat",
+			i, i);
+	}
+	length = 0;
+	const char *phases[] = {"parse_args", "get_ip_addr", "bind_port", "create_scratch", "chirp_info",
+		"registration", "create_machine_file", "launch_job"};
+	for (i = 0; i < 8; i++)
+	{
+		length += snprintf(spans + length, BENCH_MESSAGE_LEN - length, "%s%s,%llu,%llu", i == 0 ? "" : "|", phases[i],
+			1760000000000000ull + 1000 * i, 1760000000000500ull + 1000 * i);
+	}
+
+	add_case("parse QUERY", run_parse, "%d:%u", CMD_QUERY, 4711u);
+	add_case("parse ACK", run_parse, "%d:%u:%d", CMD_ACK, 4711u, 37);
+	add_case("parse ACK (telemetry)", run_parse, "%d:%u:%d:%c12,1,5566778,123456789,4567,8192,0", CMD_ACK, 4711u, 37,
+		TELEMETRY_PREFIX);
+	add_case("parse TERM", run_parse, "%d:%u:%d", CMD_TERM, 4711u, 0);
+	add_case("parse REGISTER", run_parse, "%d:%u:%d:%s:%d:%s", CMD_REGISTER, 4711u, 37, "/home/user/job", 4, "user");
+	add_case("parse CREATE_LINKS", run_parse, "%d:%u%s", CMD_CREATE_LINKS, 4711u, links);
+	add_case("parse LAUNCH", run_parse, "%d:%u:%d:%d:%s:%s:%s", CMD_LAUNCH, 4711u, 0, 64, "/tmp/condor_hydra_4711",
+		"(vector,(0,64,1))", "0,1,2,3,4,5,6,7");
+	add_case("parse PMI_PUT", run_parse, "%d:%u%s", CMD_PMI_PUT, 4711u, pairs);
+	add_case("parse PMI_FENCE", run_parse, "%d:%u:%u:%d", CMD_PMI_FENCE, 4711u, 3u, 37);
+	add_case("parse EXITED", run_parse, "%d:%u:%d:%d", CMD_EXITED, 4711u, 37, 0);
+	add_case("parse TRACE", run_parse, "%d:%u:%d:%s", CMD_TRACE, 4711u, 37, spans);
+	add_case("decode QUERY", run_decode, "%d:%u", CMD_QUERY, 4711u);
+	add_case("decode ACK (telemetry)", run_decode, "%d:%u:%d:%c12,1,5566778,123456789,4567,8192,0", CMD_ACK, 4711u,
+		37, TELEMETRY_PREFIX);
+	add_case("decode REGISTER", run_decode, "%d:%u:%d:%s:%d:%s", CMD_REGISTER, 4711u, 37, "/home/user/job", 4, "user");
+	add_case("decode CREATE_LINKS", run_decode, "%d:%u%s", CMD_CREATE_LINKS, 4711u, links);
+	add_case("decode PMI_PUT", run_decode, "%d:%u%s", CMD_PMI_PUT, 4711u, pairs);
+	add_case("decode TRACE", run_decode, "%d:%u:%d:%s", CMD_TRACE, 4711u, 37, spans);
+	add_case("strsplit (PMI_PUT)", run_strsplit, "%d:%u%s", CMD_PMI_PUT, 4711u, pairs);
+	add_case("count_tokens (PMI_PUT)", run_count_tokens, "%d:%u%s", CMD_PMI_PUT, 4711u, pairs);
+	add_case("trim", run_trim, "%s", "  \t/home/user/job \r\n");
+	add_case("remove_quotes", run_remove_quotes, "%s", "\"/home/user/job\"");
+	add_case("parse_integer", run_parse_integer, "%s", "4711");
+	add_case("udp_find_handler (all)", run_find_handler, "%s", "");
+
+	printf("%-26s %12s %12s %12s\n", "benchmark", "ns/op", "best ns/op", "allocs/op");
+	if (csv != (FILE *)NULL)
+	{
+		fprintf(csv, "benchmark,iterations,repeats,ns_per_op,best_ns_per_op,allocs_per_op\n");
+	}
+	for (i = 0; i < num_cases; i++)
+	{
+		measure(&cases[i], iterations, repeats, csv);
+	}
+	if (csv != (FILE *)NULL)
+	{
+		fclose(csv);
+	}
+	return 0;
+}
+
+/**
+ * Add a benchmark (the input is formatted like printf)
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int add_case(const char *name, void (*run)(bench_case *), const char *format, ...)
+{
+	va_list args;
+	if (num_cases == sizeof(cases) / sizeof(cases[0]))
+	{
+		return 1;
+	}
+	bench_case *bench = &cases[num_cases++];
+	bench -> name = name;
+	bench -> run = run;
+	va_start(args, format);
+	bench -> length = vsnprintf(bench -> message, BENCH_MESSAGE_LEN, format, args);
+	va_end(args);
+	if (bench -> length >= BENCH_MESSAGE_LEN)
+	{
+		bench -> length = BENCH_MESSAGE_LEN - 1;
+	}
+	return 0;
+}
+
+/**
+ * Time a benchmark and print its line
+ */
+static void measure(bench_case *bench, int iterations, int repeats, FILE *csv)
+{
+	int i, r;
+	double results[BENCH_MAX_REPEATS];
+	/* Warm up the caches (and the allocator) */
+	for (i = 0; i < iterations / 10 + 1; i++)
+	{
+		bench -> run(bench);
+	}
+	uint64_t allocated = allocations;
+	for (r = 0; r < repeats; r++)
+	{
+		uint64_t start = now_ns();
+		for (i = 0; i < iterations; i++)
+		{
+			bench -> run(bench);
+		}
+		results[r] = (double) (now_ns() - start) / iterations;
+	}
+	double allocs = (double) (allocations - allocated) / ((double) iterations * repeats);
+	qsort(results, repeats, sizeof(double), compare_doubles);
+	printf("%-26s %12.1f %12.1f %12.2f\n", bench -> name, results[repeats / 2], results[0], allocs);
+	if (csv != (FILE *)NULL)
+	{
+		fprintf(csv, "\"%s\",%d,%d,%.2f,%.2f,%.3f\n", bench -> name, iterations, repeats, results[repeats / 2],
+			results[0], allocs);
+	}
+}
+
+/**
+ * The path of a datagram from the receive buffer to its handler
+ */
+static void run_parse(bench_case *bench)
+{
+	char buffer[BENCH_MESSAGE_LEN];
+	char *tokens[MAX_MESSAGE_TOKENS];
+	int command = 0;
+	uint32_t seq = 0;
+	memcpy(buffer, bench -> message, bench -> length + 1);
+	int dim = tokenize(&message_delimiters, buffer, tokens, MAX_MESSAGE_TOKENS);
+	if (dim >= 2 && parse_integer(tokens[0], &command) == 0 && parse_uint32(tokens[1], &seq) == 0)
+	{
+		bench -> sink += udp_find_handler((CMD) command) + seq + dim;
+	}
+}
+
+/**
+ * A datagram as the listener handles it: message allocated, split and
+ * decoded against its schema, then freed (the handler is not run)
+ */
+static void run_decode(bench_case *bench)
+{
+	bench -> sink += udp_decode_datagram(&bench_wrapper, bench -> message, bench -> length);
+}
+
+/**
+ * The copying split the listener used before tokenize (for comparison)
+ */
+static void run_strsplit(bench_case *bench)
+{
+	char delim[] = MESSAGE_DELIMITERS;
+	strarray *args = strsplit(delim, bench -> message);
+	bench -> sink += is_valid_strarray(args) ? args -> dim : 0;
+	free_strarray(args);
+}
+
+static void run_count_tokens(bench_case *bench)
+{
+	char delim[] = MESSAGE_DELIMITERS;
+	bench -> sink += count_tokens(delim, bench -> message);
+}
+
+static void run_trim(bench_case *bench)
+{
+	char buffer[BENCH_MESSAGE_LEN];
+	memcpy(buffer, bench -> message, bench -> length + 1);
+	trim(buffer);
+	bench -> sink += buffer[0];
+}
+
+static void run_remove_quotes(bench_case *bench)
+{
+	char buffer[BENCH_MESSAGE_LEN];
+	memcpy(buffer, bench -> message, bench -> length + 1);
+	remove_quotes(buffer);
+	bench -> sink += buffer[0];
+}
+
+static void run_parse_integer(bench_case *bench)
+{
+	int value = 0;
+	parse_integer(bench -> message, &value);
+	bench -> sink += value;
+}
+
+/**
+ * Look up every command once (the cost per lookup is this / commands)
+ */
+static void run_find_handler(bench_case *bench)
+{
+	int command;
+	for (command = CMD_TERM; command <= CMD_TRACE; command++)
+	{
+		bench -> sink += udp_find_handler((CMD) command);
+	}
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double first = *(const double *) a;
+	double second = *(const double *) b;
+	return first < second ? -1 : (first > second);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,463 @@
+/**
+ * cgroup v2 accounting and enforcement for the launched processes
+ *
+ * When this wrapper's cgroup is delegated to it (writable), the launched
+ * processes are placed in a child cgroup of their own. This gives exact
+ * CPU, memory and I/O usage for the whole process tree, lets memory.high
+ * throttle the job before the OOM killer fires, and lets cleanup kill
+ * every process of the job (including any that left the process group
+ * with setsid) through cgroup.kill. Without a delegated cgroup v2 tree
+ * the wrapper falls back to tracking the process group alone.
+ */
+
+#include "cgroup.h"
+#include <errno.h>
+#include <mntent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+static int enable_controllers(const char *cgroup);
+static void set_memory_high(parallel_wrapper *par_wrapper, const char *parent);
+static int read_line(const char *path, char *line, int line_len);
+static int read_key(const char *path, const char *key, uint64_t *value);
+static int write_file(const char *path, const char *contents);
+
+/**
+ * Find the cgroup v2 directory of this process
+ *
+ * @return The (allocated) directory, or NULL without a cgroup v2 hierarchy
+ */
+char *cgroup_self_path(void)
+{
+	char line[1024];
+	char *cgroup = NULL;
+	char *mount_point = NULL;
+	FILE *fp = setmntent("/proc/mounts", "r");
+	struct mntent *entry;
+	while (fp != (FILE *)NULL && (entry = getmntent(fp)) != (struct mntent *)NULL)
+	{
+		if (strcmp(entry -> mnt_type, "cgroup2") == 0)
+		{
+			mount_point = strdup(entry -> mnt_dir);
+			break;
+		}
+	}
+	if (fp != (FILE *)NULL)
+	{
+		endmntent(fp);
+	}
+	if (mount_point == (char *)NULL)
+	{
+		return NULL;
+	}
+	/* The cgroup v2 entry reads "0::/path" */
+	fp = fopen("/proc/self/cgroup", "r");
+	while (fp != (FILE *)NULL && fgets(line, 1024, fp) != (char *)NULL)
+	{
+		if (strncmp(line, "0::", 3) != 0)
+		{
+			continue;
+		}
+		line[strcspn(line, "\n")] = '\0';
+		cgroup = (char *)calloc(strlen(mount_point) + strlen(line) + 1, sizeof(char));
+		if (cgroup != (char *)NULL)
+		{
+			sprintf(cgroup, "%s%s", mount_point, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+		}
+		break;
+	}
+	if (fp != (FILE *)NULL)
+	{
+		fclose(fp);
+	}
+	free(mount_point);
+	return cgroup;
+}
+
+/**
+ * Create the cgroup of the job (when our cgroup is delegated to us)
+ *
+ * The cpu, memory and io controllers are enabled for the job where
+ * available. Since cgroup v2 only allows that in a cgroup without
+ * processes of its own, the wrapper first moves itself into a leaf next
+ * to the job if needed.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure (the job is tracked by process group)
+ */
+int cgroup_create(parallel_wrapper *par_wrapper)
+{
+	char path[1024];
+	char *self = cgroup_self_path();
+	if (self == (char *)NULL)
+	{
+		debug(PRNT_INFO, "No cgroup v2 hierarchy - tracking the job by process group\n");
+		return 1;
+	}
+	snprintf(path, 1024, "%s/cgroup.procs", self);
+	if (access(self, W_OK) != 0 || access(path, W_OK) != 0)
+	{
+		debug(PRNT_INFO, "cgroup %s is not delegated - tracking the job by process group\n", self);
+		free(self);
+		return 2;
+	}
+
+	if (enable_controllers(self) == EBUSY)
+	{
+		snprintf(path, 1024, "%s/%s%d", self, CGROUP_LEAF_PREFIX, (int) getpid());
+		if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0 || errno == EEXIST)
+		{
+			strncat(path, "/cgroup.procs", 1023 - strlen(path));
+			if (write_file(path, "0") == 0)
+			{
+				enable_controllers(self);
+			}
+		}
+	}
+
+	snprintf(path, 1024, "%s/%s%d", self, CGROUP_JOB_PREFIX, (int) getpid());
+	if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+	{
+		print(PRNT_WARN, "Unable to create the job cgroup %s - tracking the job by process group\n", path);
+		free(self);
+		return 3;
+	}
+	par_wrapper -> cgroup = strdup(path);
+	debug(PRNT_INFO, "Job cgroup: %s\n", path);
+	set_memory_high(par_wrapper, self);
+	free(self);
+	return 0;
+}
+
+/**
+ * Move the calling process into the job cgroup (in a forked child, before exec)
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success (or without a job cgroup), otherwise failure
+ */
+int cgroup_enter(parallel_wrapper *par_wrapper)
+{
+	char path[1024];
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return 0;
+	}
+	snprintf(path, 1024, "%s/cgroup.procs", par_wrapper -> cgroup);
+	if (write_file(path, "0") != 0)
+	{
+		print(PRNT_WARN, "Unable to enter the job cgroup\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Returns 1 if any process of the job is still alive in its cgroup, 0 otherwise
+ */
+int cgroup_populated(parallel_wrapper *par_wrapper)
+{
+	char path[1024];
+	uint64_t populated = 0;
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return 0;
+	}
+	snprintf(path, 1024, "%s/cgroup.events", par_wrapper -> cgroup);
+	if (read_key(path, "populated", &populated) != 0)
+	{
+		return 0;
+	}
+	return (populated != 0);
+}
+
+/**
+ * Send a signal to every process in the job cgroup
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param signal The signal to send
+ * @return The number of processes signalled
+ */
+int cgroup_signal(parallel_wrapper *par_wrapper, int signal)
+{
+	char path[1024];
+	char line[64];
+	int count = 0;
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return 0;
+	}
+	snprintf(path, 1024, "%s/cgroup.procs", par_wrapper -> cgroup);
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return 0;
+	}
+	while (fgets(line, 64, fp) != (char *)NULL)
+	{
+		pid_t pid = (pid_t) atoi(line);
+		if (pid > 0 && kill(pid, signal) == 0)
+		{
+			count++;
+		}
+	}
+	fclose(fp);
+	return count;
+}
+
+/**
+ * SIGKILL every process in the job cgroup and wait (up to a second) for them to go
+ *
+ * cgroup.kill kills the whole tree atomically, so processes cannot escape
+ * by forking. Kernels without it get repeated SIGKILLs instead.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 once the cgroup is empty, otherwise failure
+ */
+int cgroup_kill(parallel_wrapper *par_wrapper)
+{
+	int i;
+	char path[1024];
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return 0;
+	}
+	snprintf(path, 1024, "%s/cgroup.kill", par_wrapper -> cgroup);
+	int atomic = (write_file(path, "1") == 0);
+	for (i = 0; i < 10; i++)
+	{
+		if (! cgroup_populated(par_wrapper))
+		{
+			return 0;
+		}
+		if (! atomic)
+		{
+			cgroup_signal(par_wrapper, SIGKILL);
+		}
+		usleep(100000);
+	}
+	print(PRNT_WARN, "Processes remain in the job cgroup %s\n", par_wrapper -> cgroup);
+	return 1;
+}
+
+/**
+ * Read the resource usage of the job from its cgroup
+ *
+ * Counters of controllers which are not enabled are left at 0.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param usage (output) The usage of the job
+ * @return 0 on success, otherwise failure (no job cgroup)
+ */
+int cgroup_read_usage(parallel_wrapper *par_wrapper, cgroup_usage *usage)
+{
+	char path[1024];
+	char line[1024];
+	memset(usage, 0, sizeof(cgroup_usage));
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return 1;
+	}
+	snprintf(path, 1024, "%s/cpu.stat", par_wrapper -> cgroup);
+	read_key(path, "usage_usec", &usage -> cpu_usec);
+	snprintf(path, 1024, "%s/memory.current", par_wrapper -> cgroup);
+	if (read_line(path, line, 1024) == 0)
+	{
+		usage -> memory_bytes = strtoull(line, NULL, 10);
+	}
+	snprintf(path, 1024, "%s/memory.peak", par_wrapper -> cgroup);
+	if (read_line(path, line, 1024) == 0)
+	{
+		usage -> memory_peak = strtoull(line, NULL, 10);
+	}
+	snprintf(path, 1024, "%s/memory.events", par_wrapper -> cgroup);
+	read_key(path, "high", &usage -> memory_high_events);
+
+	/* One line per device: "<MAJ>:<MIN> rbytes=<N> wbytes=<N> ..." */
+	snprintf(path, 1024, "%s/io.stat", par_wrapper -> cgroup);
+	FILE *fp = fopen(path, "r");
+	while (fp != (FILE *)NULL && fgets(line, 1024, fp) != (char *)NULL)
+	{
+		char *field = strstr(line, " rbytes=");
+		if (field != (char *)NULL)
+		{
+			usage -> io_read_bytes += strtoull(field + 8, NULL, 10);
+		}
+		field = strstr(line, " wbytes=");
+		if (field != (char *)NULL)
+		{
+			usage -> io_write_bytes += strtoull(field + 8, NULL, 10);
+		}
+	}
+	if (fp != (FILE *)NULL)
+	{
+		fclose(fp);
+	}
+	return 0;
+}
+
+/**
+ * Remove the (empty) job cgroup
+ */
+void cgroup_remove(parallel_wrapper *par_wrapper)
+{
+	if (par_wrapper -> cgroup == (char *)NULL)
+	{
+		return;
+	}
+	if (rmdir(par_wrapper -> cgroup) != 0)
+	{
+		print(PRNT_WARN, "Unable to remove the job cgroup %s\n", par_wrapper -> cgroup);
+	}
+	free(par_wrapper -> cgroup);
+	par_wrapper -> cgroup = NULL;
+}
+
+/**
+ * Enable the cpu, memory and io controllers (where available) for the
+ * children of a cgroup
+ *
+ * @return 0 on success, otherwise the errno of the failed write
+ */
+static int enable_controllers(const char *cgroup)
+{
+	int i;
+	char path[1024];
+	char available[1024];
+	char control[16];
+	const char *controllers[] = {"cpu", "memory", "io"};
+	int RC = 0;
+	snprintf(path, 1024, "%s/cgroup.controllers", cgroup);
+	if (read_line(path, available, 1024) != 0)
+	{
+		return ENOENT;
+	}
+	snprintf(path, 1024, "%s/cgroup.subtree_control", cgroup);
+	for (i = 0; i < 3; i++)
+	{
+		/* cgroup.controllers is a space separated list, e.g. "cpuset cpu io memory" */
+		int length = strlen(controllers[i]);
+		char *found = available;
+		while ((found = strstr(found, controllers[i])) != (char *)NULL)
+		{
+			if ((found == available || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+			{
+				break;
+			}
+			found += length;
+		}
+		if (found == (char *)NULL)
+		{
+			continue;
+		}
+		snprintf(control, 16, "+%s", controllers[i]);
+		if (write_file(path, control) != 0)
+		{
+			RC = errno;
+		}
+	}
+	return RC;
+}
+
+/**
+ * Apply memory.high to the job cgroup
+ *
+ * The limit is --mem-high when given, otherwise CGROUP_HIGH_PERCENT of
+ * the memory.max of the enclosing cgroup (if it has one), so the job is
+ * throttled and reclaimed before the OOM killer fires.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param parent The cgroup enclosing the job
+ */
+static void set_memory_high(parallel_wrapper *par_wrapper, const char *parent)
+{
+	char path[1024];
+	char value[64];
+	uint64_t high = (uint64_t) par_wrapper -> mem_high * 1024 * 1024;
+	if (high == 0)
+	{
+		snprintf(path, 1024, "%s/memory.max", parent);
+		if (read_line(path, value, 64) != 0 || strcmp(value, "max") == 0)
+		{
+			return;
+		}
+		high = strtoull(value, NULL, 10) / 100 * CGROUP_HIGH_PERCENT;
+	}
+	snprintf(path, 1024, "%s/memory.high", par_wrapper -> cgroup);
+	snprintf(value, 64, "%llu", (unsigned long long) high);
+	if (write_file(path, value) != 0)
+	{
+		print(PRNT_WARN, "Unable to set memory.high of the job (memory controller unavailable)\n");
+		return;
+	}
+	debug(PRNT_INFO, "Set memory.high of the job to %s bytes\n", value);
+}
+
+/**
+ * Read the first line of a (cgroup) file, without the newline
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int read_line(const char *path, char *line, int line_len)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return 1;
+	}
+	if (fgets(line, line_len, fp) == (char *)NULL)
+	{
+		fclose(fp);
+		return 2;
+	}
+	fclose(fp);
+	line[strcspn(line, "\n")] = '\0';
+	return 0;
+}
+
+/**
+ * Read the value of a key from a flat keyed (cgroup) file of "<key> <value>" lines
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int read_key(const char *path, const char *key, uint64_t *value)
+{
+	char line[1024];
+	int length = strlen(key);
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return 1;
+	}
+	while (fgets(line, 1024, fp) != (char *)NULL)
+	{
+		if (strncmp(line, key, length) == 0 && line[length] == ' ')
+		{
+			*value = strtoull(line + length + 1, NULL, 10);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return 2;
+}
+
+/**
+ * Write a string to a (cgroup) file
+ *
+ * @return 0 on success, otherwise failure (errno is set)
+ */
+static int write_file(const char *path, const char *contents)
+{
+	int fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	int length = strlen(contents);
+	int RC = (write(fd, contents, length) == length) ? 0 : 2;
+	int saved = errno;
+	close(fd);
+	errno = saved;
+	return RC;
+}
@@ -1,6 +1,7 @@
 #include "wrapper.h"
 #include "chirp_util.h"
 #include "chirp_client.h"
+#include "trace.h"
 #include <limits.h>
 /**
  * Sends and receives the necessary chirp information back to the schedd
@@ -12,19 +13,23 @@
 int chirp_info(parallel_wrapper *par_wrapper)
 {
 	int RC;
+	int span = trace_begin("chirp_connect");
 	/* Lock the parallel wrapper structure */
 	pthread_mutex_lock(&par_wrapper -> mutex);
 	/* Change to the TMP directory */
 	char *dir = getenv("TMPDIR");
 	char *prev_dir = calloc(1024, sizeof(char));
-	getcwd(prev_dir, 1024);
+	if (getcwd(prev_dir, 1024) == (char *)NULL)
+	{
+		prev_dir[0] = '\0'; /* Nowhere to return to */
+	}
 	if (dir == (char *)NULL)
 	{
 		dir = getenv("_CONDOR_SCRATCH_DIR");
 	}
-	if (dir != (char *)NULL)
+	if (dir != (char *)NULL && chdir(dir) != 0)
 	{
-		chdir(dir);
+		print(PRNT_WARN, "Unable to change to %s to connect to chirp\n", dir);
 	}
 	struct chirp_client *chirp = chirp_client_connect_default();
 	if (chirp == (struct chirp_client *)NULL)
@@ -33,13 +38,15 @@ int chirp_info(parallel_wrapper *par_wrapper)
 		return 1;
 	}
 	/* Change back to the original directory */
-	if (dir != (char *)NULL)
+	if (dir != (char *)NULL && prev_dir[0] != '\0' && chdir(prev_dir) != 0)
 	{
-		chdir(prev_dir);
+		print(PRNT_WARN, "Unable to change back to %s\n", prev_dir);
 	}
 	free(prev_dir);
 	pthread_mutex_unlock(&par_wrapper -> mutex);
+	trace_end(span);
 
+	span = trace_begin("chirp_job_attrs");
 	RC = get_chirp_integer(chirp, "RequestCpus", &par_wrapper -> this_machine -> cpus);
 	if (RC != 0)
 	{
@@ -66,12 +73,17 @@ int chirp_info(parallel_wrapper *par_wrapper)
 	{
 		print(PRNT_WARN, "Failed to get IWD from classad. Assuming the current directory.");
 		par_wrapper -> this_machine -> schedd_iwd = (char *) malloc(1024 * sizeof(char));
-		getcwd(par_wrapper -> this_machine -> schedd_iwd, 1024);
+		if (getcwd(par_wrapper -> this_machine -> schedd_iwd, 1024) == (char *)NULL)
+		{
+			strcpy(par_wrapper -> this_machine -> schedd_iwd, ".");
+		}
 	}	
+	trace_end(span);
 
 	/* Send the MASTER information back to the schedd */
 	if (par_wrapper -> this_machine -> rank == MASTER)
 	{
+		span = trace_begin("chirp_publish_master");
 		/* Get a random number */
 		srand (time(NULL)); /* Initialize random generator */
 		int random = rand() % SHRT_MAX;
@@ -101,16 +113,24 @@ int chirp_info(parallel_wrapper *par_wrapper)
 			print(PRNT_ERR, "Unable to send MasterPort to the chirp server\n");
 			return 4;
 		}
+		trace_end(span);
 	}
 	else /* I am not the master */
 	{
 		char temp_str2[1024];
 		int random;
 		int port;
+		/* Ask straight away (the MASTER has usually published), then back off up to a second */
+		useconds_t delay = 0;
 		print(PRNT_INFO, "Attempting to get Host/IP from the schedd\n");
+		span = trace_begin("chirp_find_master");
 		while ( 1 )
 		{
-			sleep(1);
+			if (delay > 0)
+			{
+				usleep(delay);
+			}
+			delay = delay == 0 ? 10000 : (delay * 2 > 1000000 ? 1000000 : delay * 2);
 			RC = get_chirp_integer(chirp, "RandInt", &random);
 			if (RC != 0)
 			{
@@ -132,6 +152,7 @@ int chirp_info(parallel_wrapper *par_wrapper)
 			par_wrapper -> master -> port = (uint16_t) port;
 			break; /* We have everything we need */
 		}
+		trace_end(span);
 
 		debug(PRNT_INFO, "Received master address/port: %s:%d\n", par_wrapper -> master -> ip_addr, par_wrapper -> master -> port);	
 	}
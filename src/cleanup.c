@@ -1,26 +1,160 @@
 
 #include "wrapper.h"
 #include "scratch.h"
+#include "namespace.h"
+#include "cgroup.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "trace.h"
+#include "flight.h"
+#include "netem.h"
 #include <signal.h>
 #include <setjmp.h>
-int exit_flag = 0;
+#include <errno.h>
+#include <sys/wait.h>
+volatile sig_atomic_t exit_flag = 0;
+int cleaning_up = 0;
+static __thread int cleanup_owner = 0; /**< This thread claimed the cleanup */
+int dump_pipe[2] = {-1, -1};
+static void kill_children(parallel_wrapper *par_wrapper);
+static void report_usage(parallel_wrapper *par_wrapper);
 extern pthread_mutex_t keep_alive_mutex;
 
 /**
  * Signal handler (SIGINT, SIGTERM, SIGHUP...)
+ *
+ * Only async-signal-safe work here: print() could be interrupted halfway
+ * through claiming a log slot, so the listener logs the signal once it
+ * is back from sigsetjmp.
  */
 void handle_exit_signal(int signal) 
 {
-	print(PRNT_INFO, "Received signal %d\n", signal);
-	exit_flag = 1;
-	if (jmpset)
+	flight_record(FLIGHT_STATE, FLIGHT_SIGNALLED, 0, signal, NULL);
+	exit_flag = signal;
+	if (jmpset && pthread_equal(pthread_self(), jmpthread))
 	{	
+		if (log_busy() && dump_pipe[1] >= 0)
+		{
+			/* Interrupted inside the logger - let it finish and wake the select instead */
+			if (write(dump_pipe[1], "X", 1) < 0)
+			{
+				return;
+			}
+			return;
+		}
 		siglongjmp(jmpbuf, 1);
 	}
+	else if (jmpset)
+	{
+		/* jmpbuf lives on the listener's stack - jump there from its own thread */
+		pthread_kill(jmpthread, signal);
+	}
 	else
 	{
-		exit(signal);
+		_exit(signal);
+	}
+}
+
+/**
+ * Signal handler (SIGUSR1): ask the listener to write out the telemetry
+ */
+void handle_dump_signal(int signal)
+{
+	if (dump_pipe[1] >= 0)
+	{
+		/* Only async-signal-safe calls here - a full pipe already has a request */
+		if (write(dump_pipe[1], "D", 1) < 0)
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * Terminate the launched processes: SIGTERM, then SIGKILL once the grace
+ * period expires with any of them still alive
+ *
+ * Members of the job cgroup are signalled too, so processes which left
+ * the process group (e.g. with setsid) do not survive the job.
+ *
+ * @param par_wrapper The parallel wrapper
+ */
+static void kill_children(parallel_wrapper *par_wrapper)
+{
+	int i;
+	pid_t pgid = par_wrapper -> pgid;
+	int signalled = cgroup_signal(par_wrapper, SIGTERM);
+	if (pgid > 0 && killpg(pgid, SIGTERM) == 0)
+	{
+		debug(PRNT_INFO, "Sent SIGTERM to child group %d\n", pgid);
+		signalled++;
+	}
+	else if (pgid > 0 && errno == EPERM)
+	{
+		print(PRNT_WARN, "Unable to kill child group %d - permission denied\n", pgid);
+	}
+	if (signalled == 0)
+	{
+		return;
+	}
+	for (i = 0; i < 10 * KILL_GRACE; i++)
+	{
+		/* Reap our own children - zombies still count as group members */
+		while (waitpid(-1, NULL, WNOHANG) > 0);
+		if ((pgid <= 0 || (killpg(pgid, 0) != 0 && errno == ESRCH)) && ! cgroup_populated(par_wrapper))
+		{
+			return;
+		}
+		usleep(100000);
+	}
+	if (pgid > 0 && killpg(pgid, SIGKILL) == 0)
+	{
+		print(PRNT_WARN, "Child group %d outlived SIGTERM - sent SIGKILL\n", pgid);
+	}
+	if (cgroup_populated(par_wrapper))
+	{
+		print(PRNT_WARN, "Job cgroup outlived SIGTERM - killing it\n");
+		cgroup_kill(par_wrapper);
+	}
+}
+
+/**
+ * Print the resource usage of the job (from its cgroup)
+ */
+static void report_usage(parallel_wrapper *par_wrapper)
+{
+	cgroup_usage usage;
+	if (cgroup_read_usage(par_wrapper, &usage) != 0)
+	{
+		return;
+	}
+	print(PRNT_INFO, "Job used %llu.%06llu s CPU, %llu kB memory (peak %llu kB, %llu throttles), "
+		"%llu kB read, %llu kB written\n",
+		(unsigned long long) (usage.cpu_usec / 1000000), (unsigned long long) (usage.cpu_usec % 1000000),
+		(unsigned long long) (usage.memory_bytes / 1024), (unsigned long long) (usage.memory_peak / 1024),
+		(unsigned long long) usage.memory_high_events, (unsigned long long) (usage.io_read_bytes / 1024),
+		(unsigned long long) (usage.io_write_bytes / 1024));
+}
+
+/**
+ * Claim the cleanup for this thread ahead of calling cleanup (e.g. before
+ * cancelling the listener, whose exit main would otherwise take as the
+ * end of the job)
+ *
+ * @return 0 if this thread owns the cleanup, otherwise another one does
+ */
+int claim_cleanup(void)
+{
+	if (cleanup_owner)
+	{
+		return 0;
+	}
+	if (__sync_lock_test_and_set(&cleaning_up, 1))
+	{
+		return 1;
 	}
+	cleanup_owner = 1;
+	return 0;
 }
 
 /**
@@ -29,64 +163,110 @@ void handle_exit_signal(int signal)
 void cleanup(parallel_wrapper *par_wrapper, int return_code)
 {
 	int i, j;
+	/* Only the first caller cleans up - later callers wait for its exit */
+	if (claim_cleanup() != 0)
+	{
+		pthread_exit(NULL);
+	}
+	metrics_teardown(0);
+	flight_record(FLIGHT_STATE, FLIGHT_CLEANUP, 0, return_code, NULL);
+	/* A second signal must not interrupt the teardown */
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_IGN);
+	signal(SIGHUP, SIG_IGN);
 	/* Try to lock the keep-alive mutex */
 	pthread_mutex_trylock(&keep_alive_mutex);
 	if (par_wrapper -> this_machine -> rank == MASTER && 
 			par_wrapper -> machines != (machine **)NULL)
 	{
 
-		/* Send the term signal (don't send to self) */
-		for (i = 1; i < par_wrapper -> num_procs; i++)
+		uint32_t *seqs = (uint32_t *) calloc(par_wrapper -> num_procs, sizeof(uint32_t));
+		/* Assign a sequence number to the TERM for each rank (don't send to self) */
+		for (i = 1; seqs != (uint32_t *)NULL && i < par_wrapper -> num_procs; i++)
 		{
-			if (par_wrapper -> machines[i] == (machine *)NULL)
+			if (! rank_registered(&par_wrapper -> ranks, i))
 			{
 				continue;
 			}
-			for (j = 0; j < 10; j++)
+			if (pending_add(par_wrapper -> pending, i, &seqs[i]) != 0)
+			{
+				/* No slot to match its ACK - send the TERM once rather than waiting on it */
+				term(par_wrapper -> command_socket, pending_next_seq(par_wrapper -> pending), return_code,
+					&par_wrapper -> ranks.addrs[i]);
+				seqs[i] = 0;
+			}
+		}
+		/* Send the term signal, resending only to ranks which have not ACKed */
+		for (j = 0; seqs != (uint32_t *)NULL && j < 10; j++)
+		{
+			for (i = 1; i < par_wrapper -> num_procs; i++)
+			{
+				if (seqs[i] == 0 || pending_is_done(par_wrapper -> pending, seqs[i]))
+				{
+					continue;
+				}
+				term(par_wrapper -> command_socket, seqs[i], return_code, &par_wrapper -> ranks.addrs[i]);
+			}
+			/* Wait up to 1/10th second for the ACKs */
+			if (pending_wait_all(par_wrapper -> pending, seqs, par_wrapper -> num_procs, 100000) == 0)
 			{
-				term(par_wrapper -> command_socket, return_code, 
-					par_wrapper -> machines[i] -> ip_addr, par_wrapper -> machines[i] -> port);
-				usleep(100000); /* Sleep 1/10th second */
+				break;
 			}
 		}
+		free(seqs);
 	}
 
 	/* If we spawned subgroups, attempt to kill them all */
-	if (par_wrapper -> pgid > 0 && par_wrapper -> child_pid > 0)
+	if (par_wrapper -> pgid > 0 || par_wrapper -> cgroup != (char *)NULL)
 	{
-		int RC = killpg(par_wrapper -> child_pid, SIGTERM);
-		if (RC == EPERM)
-		{
-			print(PRNT_WARN, "Unable to kill child pid %d - permission denied\n");
-		}
-		else if (RC == 0)
-		{
-			debug(PRNT_INFO, "Sent SIGTERM to child group %d\n", par_wrapper -> child_pid);
-		}
+		kill_children(par_wrapper);
+	}
+	report_usage(par_wrapper);
+	cgroup_remove(par_wrapper);
+	/* The final table (the default one goes with the scratch directory) */
+	if (par_wrapper -> telemetry_file != (char *)NULL)
+	{
+		telemetry_dump(par_wrapper);
 	}
 
 	/* Lock the parallel_wrapper structure */
 	pthread_mutex_trylock(&par_wrapper -> mutex);
 
-	/* Clean up the scratch directory */
-	cleanup_scratch(par_wrapper -> scratch_dir);
+	/* Clean up the scratch directory - unless aborted, then it is kept for a post-mortem */
+	if (return_code == ABORT_CODE && flight_dump(par_wrapper -> scratch_dir) == 0)
+	{
+		print(PRNT_WARN, "Aborted - flight recorder written to %s/%s (decode with flight_decode)\n",
+			par_wrapper -> scratch_dir, FLIGHT_FILE);
+	}
+	else
+	{
+		cleanup_scratch(par_wrapper -> scratch_dir);
+	}
 
-	/* Unlink all softlinks */
-	if (is_valid_sll(par_wrapper -> symlinks))
+	/* Unlink all softlinks (detached from the set in one batch) */
+	int num_links = 0;
+	char **links = hash_set_take_all(par_wrapper -> symlinks, &num_links);
+	for (i = 0; i < num_links; i++)
 	{
-		struct sll_element *element = par_wrapper -> symlinks -> head -> next;
-		while (element != (struct sll_element *)NULL)
+		if (unlink(links[i]) != 0)
 		{
-			char *filename = (char *)element -> ptr;
-			if (filename != (char *)NULL)
-			{
-				if (unlink(filename) != 0)
-				{
-					print(PRNT_WARN, "Unable to unlink file %s\n", filename);
-				}
-			}
-			element = element -> next;
+			print(PRNT_WARN, "Unable to unlink file %s\n", links[i]);
 		}
+		free(links[i]);
+	}
+	free(links);
+
+	/* Remove the mount points and tmpfs directories of bind mode */
+	cleanup_bind_mounts(par_wrapper);
+	metrics_teardown(1);
+	netem_report();
+	if (par_wrapper -> metrics_file != (char *)NULL)
+	{
+		metrics_write(par_wrapper -> metrics_file);
+	}
+	if (par_wrapper -> trace_file != (char *)NULL && par_wrapper -> this_machine -> rank == MASTER)
+	{
+		trace_write(par_wrapper -> trace_file);
 	}
 	/* No need to unlock - we are exitting */
 	exit(return_code);
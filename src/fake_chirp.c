@@ -0,0 +1,551 @@
+/**
+ * Stand-in chirp server
+ *
+ * Speaks enough of the chirp protocol for chirp_info() (cookie,
+ * get_job_attr and set_job_attr) on the loopback interface, so that
+ * wrappers can be started without a Condor starter. One thread serves
+ * every connection with poll().
+ *
+ * Answers can be delayed (a schedd round trip), replaced by an error or
+ * dropped along with the connection, at rates drawn from a seeded
+ * generator so that a run can be repeated.
+ */
+
+#include "fake_chirp.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void *serve(void *ptr);
+static int add_client(fake_chirp *chirp, int fd);
+static void remove_client(fake_chirp *chirp, int index);
+static int read_requests(fake_chirp *chirp, fake_chirp_client *client);
+static int process_requests(fake_chirp *chirp, fake_chirp_client *client);
+static int handle_request(fake_chirp *chirp, fake_chirp_client *client, char *request);
+static int respond(fake_chirp *chirp, fake_chirp_client *client, const char *data, int length);
+static int send_delayed(fake_chirp *chirp, fake_chirp_client *client);
+static int reply(int fd, const char *data, int length);
+static uint64_t now_us(void);
+static double next_random(fake_chirp *chirp);
+
+/**
+ * Seed of the fault generator when none is given
+ */
+#define FAKE_CHIRP_SEED (0x9e3779b97f4a7c15ull)
+
+/**
+ * Start a server on 127.0.0.1 (on a port chosen by the kernel)
+ *
+ * @return The server, or NULL on failure
+ */
+fake_chirp *fake_chirp_start(void)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	fake_chirp *chirp = (fake_chirp *) calloc(1, sizeof(fake_chirp));
+	if (chirp == (fake_chirp *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for the chirp server\n");
+		return NULL;
+	}
+	pthread_mutex_init(&chirp -> mutex, NULL);
+	chirp -> random = FAKE_CHIRP_SEED;
+	chirp -> listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (chirp -> listen_fd < 0 || bind(chirp -> listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+		listen(chirp -> listen_fd, SOMAXCONN) != 0 ||
+		getsockname(chirp -> listen_fd, (struct sockaddr *)&address, &length) != 0)
+	{
+		print(PRNT_ERR, "Unable to listen for chirp clients: %s\n", strerror(errno));
+		if (chirp -> listen_fd >= 0)
+		{
+			close(chirp -> listen_fd);
+		}
+		free(chirp);
+		return NULL;
+	}
+	fcntl(chirp -> listen_fd, F_SETFL, O_NONBLOCK);
+	chirp -> port = ntohs(address.sin_port);
+	if (pipe(chirp -> wake_fd) != 0)
+	{
+		print(PRNT_ERR, "Unable to create the chirp server pipe\n");
+		close(chirp -> listen_fd);
+		free(chirp);
+		return NULL;
+	}
+	if (pthread_create(&chirp -> thread, NULL, &serve, (void *)chirp) != 0)
+	{
+		print(PRNT_ERR, "Unable to start the chirp server thread\n");
+		close(chirp -> wake_fd[0]);
+		close(chirp -> wake_fd[1]);
+		close(chirp -> listen_fd);
+		free(chirp);
+		return NULL;
+	}
+	return chirp;
+}
+
+/**
+ * Set (or replace) a job attribute
+ *
+ * @param chirp The server
+ * @param name The name of the attribute
+ * @param value ClassAd expression (a string value must be quoted)
+ * @return 0 on success, otherwise failure
+ */
+int fake_chirp_set(fake_chirp *chirp, const char *name, const char *value)
+{
+	int i;
+	char *copy = strdup(value);
+	if (copy == (char *)NULL)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&chirp -> mutex);
+	for (i = 0; i < chirp -> num_attrs; i++)
+	{
+		if (strcmp(chirp -> attrs[i].name, name) == 0)
+		{
+			free(chirp -> attrs[i].value);
+			chirp -> attrs[i].value = copy;
+			pthread_mutex_unlock(&chirp -> mutex);
+			return 0;
+		}
+	}
+	if (chirp -> num_attrs == FAKE_CHIRP_ATTRS || (chirp -> attrs[i].name = strdup(name)) == (char *)NULL)
+	{
+		pthread_mutex_unlock(&chirp -> mutex);
+		free(copy);
+		return 2;
+	}
+	chirp -> attrs[i].value = copy;
+	chirp -> num_attrs++;
+	pthread_mutex_unlock(&chirp -> mutex);
+	return 0;
+}
+
+/**
+ * Set the faults injected into the answers (and restart the generator)
+ *
+ * @param chirp The server
+ * @param faults The faults (NULL: none)
+ */
+void fake_chirp_set_faults(fake_chirp *chirp, const fake_chirp_faults *faults)
+{
+	pthread_mutex_lock(&chirp -> mutex);
+	if (faults == (fake_chirp_faults *)NULL)
+	{
+		memset(&chirp -> faults, 0, sizeof(fake_chirp_faults));
+	}
+	else
+	{
+		chirp -> faults = *faults;
+	}
+	chirp -> random = chirp -> faults.seed != 0 ? chirp -> faults.seed : FAKE_CHIRP_SEED;
+	pthread_mutex_unlock(&chirp -> mutex);
+}
+
+/**
+ * Write the chirp.config which points chirp_client_connect_default here
+ *
+ * @param chirp The server
+ * @param dir The directory the client runs in
+ * @return 0 on success, otherwise failure
+ */
+int fake_chirp_write_config(fake_chirp *chirp, const char *dir)
+{
+	char path[1024];
+	snprintf(path, 1024, "%s/chirp.config", dir);
+	FILE *fp = fopen(path, "w");
+	if (fp == (FILE *)NULL)
+	{
+		print(PRNT_WARN, "Unable to write %s\n", path);
+		return 1;
+	}
+	fprintf(fp, "127.0.0.1 %u cookie\n", chirp -> port);
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * Stop the server and free it
+ */
+void fake_chirp_stop(fake_chirp *chirp)
+{
+	int i;
+	if (chirp == (fake_chirp *)NULL)
+	{
+		return;
+	}
+	if (write(chirp -> wake_fd[1], "S", 1) == 1)
+	{
+		pthread_join(chirp -> thread, NULL);
+	}
+	while (chirp -> num_clients > 0)
+	{
+		remove_client(chirp, chirp -> num_clients - 1);
+	}
+	for (i = 0; i < chirp -> num_attrs; i++)
+	{
+		free(chirp -> attrs[i].name);
+		free(chirp -> attrs[i].value);
+	}
+	free(chirp -> clients);
+	close(chirp -> wake_fd[0]);
+	close(chirp -> wake_fd[1]);
+	close(chirp -> listen_fd);
+	pthread_mutex_destroy(&chirp -> mutex);
+	free(chirp);
+}
+
+/**
+ * The server thread
+ */
+static void *serve(void *ptr)
+{
+	int i, fd;
+	fake_chirp *chirp = (fake_chirp *)ptr;
+	struct pollfd *fds = NULL;
+	int max_fds = 0;
+	while ( 1 )
+	{
+		/* The stop pipe, the listening socket, then the clients */
+		if (chirp -> num_clients + 2 > max_fds)
+		{
+			max_fds = 2 * (chirp -> num_clients + 2);
+			struct pollfd *larger = (struct pollfd *) realloc(fds, max_fds * sizeof(struct pollfd));
+			if (larger == (struct pollfd *)NULL)
+			{
+				print(PRNT_ERR, "Unable to allocate space for chirp clients\n");
+				break;
+			}
+			fds = larger;
+		}
+		/* Clients with a delayed answer are not read until it is sent */
+		uint64_t now = now_us();
+		int timeout = -1;
+		fds[0].fd = chirp -> wake_fd[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = chirp -> listen_fd;
+		fds[1].events = POLLIN;
+		for (i = 0; i < chirp -> num_clients; i++)
+		{
+			fake_chirp_client *client = chirp -> clients[i];
+			fds[i + 2].fd = client -> fd;
+			fds[i + 2].events = client -> due_us == 0 ? POLLIN : 0;
+			if (client -> due_us != 0)
+			{
+				int wait = client -> due_us > now ? (int) ((client -> due_us - now + 999) / 1000) : 0;
+				if (timeout < 0 || wait < timeout)
+				{
+					timeout = wait;
+				}
+			}
+		}
+		for (i = 0; i < chirp -> num_clients + 2; i++)
+		{
+			fds[i].revents = 0;
+		}
+		if (poll(fds, chirp -> num_clients + 2, timeout) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			print(PRNT_ERR, "Chirp server poll failed: %s\n", strerror(errno));
+			break;
+		}
+		if (fds[0].revents != 0)
+		{
+			break;
+		}
+		/* Serve the clients before accepting (accepting moves them) */
+		now = now_us();
+		for (i = chirp -> num_clients - 1; i >= 0; i--)
+		{
+			fake_chirp_client *client = chirp -> clients[i];
+			int RC = 0;
+			if (client -> due_us != 0)
+			{
+				if (client -> due_us <= now)
+				{
+					RC = send_delayed(chirp, client);
+				}
+			}
+			else if (fds[i + 2].revents != 0)
+			{
+				RC = read_requests(chirp, client);
+			}
+			if (RC != 0)
+			{
+				remove_client(chirp, i);
+			}
+		}
+		if (fds[1].revents != 0)
+		{
+			while ((fd = accept(chirp -> listen_fd, NULL, NULL)) >= 0)
+			{
+				if (add_client(chirp, fd) != 0)
+				{
+					close(fd);
+				}
+			}
+		}
+	}
+	free(fds);
+	return NULL;
+}
+
+/**
+ * Track a new connection
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int add_client(fake_chirp *chirp, int fd)
+{
+	if (chirp -> num_clients == chirp -> max_clients)
+	{
+		int size = chirp -> max_clients == 0 ? 64 : 2 * chirp -> max_clients;
+		fake_chirp_client **larger = (fake_chirp_client **) realloc(chirp -> clients,
+			size * sizeof(fake_chirp_client *));
+		if (larger == (fake_chirp_client **)NULL)
+		{
+			return 1;
+		}
+		chirp -> clients = larger;
+		chirp -> max_clients = size;
+	}
+	fake_chirp_client *client = (fake_chirp_client *) calloc(1, sizeof(fake_chirp_client));
+	if (client == (fake_chirp_client *)NULL)
+	{
+		return 2;
+	}
+	client -> fd = fd;
+	chirp -> clients[chirp -> num_clients++] = client;
+	return 0;
+}
+
+/**
+ * Close a connection (the last one takes its place)
+ */
+static void remove_client(fake_chirp *chirp, int index)
+{
+	close(chirp -> clients[index] -> fd);
+	free(chirp -> clients[index]);
+	chirp -> clients[index] = chirp -> clients[--chirp -> num_clients];
+}
+
+/**
+ * Read from a client and answer every complete request
+ *
+ * @return 0 while the connection stays open, otherwise 1
+ */
+static int read_requests(fake_chirp *chirp, fake_chirp_client *client)
+{
+	int count = read(client -> fd, client -> line + client -> length, FAKE_CHIRP_LINE - 1 - client -> length);
+	if (count <= 0)
+	{
+		return 1;
+	}
+	client -> length += count;
+	return process_requests(chirp, client);
+}
+
+/**
+ * Answer the complete requests received, up to the first delayed answer
+ *
+ * @return 0 while the connection stays open, otherwise 1
+ */
+static int process_requests(fake_chirp *chirp, fake_chirp_client *client)
+{
+	int start = 0;
+	int i;
+	for (i = 0; i < client -> length && client -> due_us == 0; i++)
+	{
+		if (client -> line[i] != '\n')
+		{
+			continue;
+		}
+		client -> line[i] = '\0';
+		if (handle_request(chirp, client, client -> line + start) != 0)
+		{
+			return 1;
+		}
+		start = i + 1;
+	}
+	if (start == 0 && client -> length == FAKE_CHIRP_LINE - 1)
+	{
+		return 1; /* Request too long */
+	}
+	memmove(client -> line, client -> line + start, client -> length - start);
+	client -> length -= start;
+	return 0;
+}
+
+/**
+ * Answer one request ("<COMMAND> [<NAME> [<VALUE>]]")
+ *
+ * @return 0 on success, otherwise failure (the connection is closed)
+ */
+static int handle_request(fake_chirp *chirp, fake_chirp_client *client, char *request)
+{
+	int i;
+	char answer[FAKE_CHIRP_LINE + 32];
+	char *name = strchr(request, ' ');
+	char *value = NULL;
+	chirp -> requests++;
+	if (name != (char *)NULL)
+	{
+		*name++ = '\0';
+		value = strchr(name, ' ');
+		if (value != (char *)NULL)
+		{
+			*value++ = '\0';
+		}
+	}
+	if (strcmp(request, "cookie") == 0)
+	{
+		return respond(chirp, client, "0\n", 2);
+	}
+	if (strcmp(request, "get_job_attr") == 0 && name != (char *)NULL)
+	{
+		int length = -1;
+		pthread_mutex_lock(&chirp -> mutex);
+		for (i = 0; i < chirp -> num_attrs; i++)
+		{
+			if (strcmp(chirp -> attrs[i].name, name) == 0)
+			{
+				length = snprintf(answer, sizeof(answer), "%d\n%s", (int) strlen(chirp -> attrs[i].value),
+					chirp -> attrs[i].value);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&chirp -> mutex);
+		if (length < 0)
+		{
+			return respond(chirp, client, "-3\n", 3); /* DOESNT_EXIST */
+		}
+		return respond(chirp, client, answer, length < (int) sizeof(answer) ? length : (int) sizeof(answer) - 1);
+	}
+	if (strcmp(request, "set_job_attr") == 0 && name != (char *)NULL && value != (char *)NULL)
+	{
+		if (fake_chirp_set(chirp, name, value) != 0)
+		{
+			return respond(chirp, client, "-6\n", 3); /* NO_SPACE */
+		}
+		return respond(chirp, client, "0\n", 2);
+	}
+	return respond(chirp, client, "-8\n", 3); /* INVALID_REQUEST */
+}
+
+/**
+ * Send an answer, after injecting the faults
+ *
+ * @return 0 on success, otherwise failure (the connection is closed)
+ */
+static int respond(fake_chirp *chirp, fake_chirp_client *client, const char *data, int length)
+{
+	uint64_t delay = 0;
+	pthread_mutex_lock(&chirp -> mutex);
+	fake_chirp_faults *faults = &chirp -> faults;
+	if (faults -> drop_rate > 0 && next_random(chirp) < faults -> drop_rate)
+	{
+		chirp -> drops++;
+		pthread_mutex_unlock(&chirp -> mutex);
+		return 1;
+	}
+	if (faults -> error_rate > 0 && next_random(chirp) < faults -> error_rate)
+	{
+		chirp -> errors++;
+		data = "-10\n"; /* BUSY */
+		length = 4;
+	}
+	delay = faults -> latency_us;
+	if (faults -> jitter_us > 0)
+	{
+		delay += (uint64_t) (next_random(chirp) * (faults -> jitter_us + 1.0));
+	}
+	pthread_mutex_unlock(&chirp -> mutex);
+	if (delay == 0)
+	{
+		return reply(client -> fd, data, length);
+	}
+	memcpy(client -> out, data, length);
+	client -> out_length = length;
+	client -> due_us = now_us() + delay;
+	return 0;
+}
+
+/**
+ * Send a delayed answer and go on with the requests behind it
+ *
+ * @return 0 while the connection stays open, otherwise 1
+ */
+static int send_delayed(fake_chirp *chirp, fake_chirp_client *client)
+{
+	client -> due_us = 0;
+	if (reply(client -> fd, client -> out, client -> out_length) != 0)
+	{
+		return 1;
+	}
+	return process_requests(chirp, client);
+}
+
+/**
+ * Send an answer
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int reply(int fd, const char *data, int length)
+{
+	while (length > 0)
+	{
+		int count = write(fd, data, length);
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return 1;
+		}
+		data += count;
+		length -= count;
+	}
+	return 0;
+}
+
+/**
+ * Returns the monotonic time in microseconds
+ */
+static uint64_t now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Returns the next number in [0, 1) of the fault generator (xorshift64*,
+ * called with the lock held)
+ */
+static double next_random(fake_chirp *chirp)
+{
+	uint64_t x = chirp -> random;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	chirp -> random = x;
+	return ((x * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
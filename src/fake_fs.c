@@ -0,0 +1,90 @@
+/**
+ * Construction of the fake shared file system
+ */
+
+#include "fake_fs.h"
+#include "batch.h"
+#include "namespace.h"
+#include "trace.h"
+
+/**
+ * Create the fake shared file system on every unique host
+ *
+ * In FS_MODE_BIND every unique host records a bind mount of its IWD onto
+ * fake_fs and of a node-local tmpfs directory onto local_fs. If any host
+ * is unable to do so, the wrapper falls back to FS_MODE_SYMLINK (a soft
+ * link from fake_fs to the IWD) on all hosts.
+ *
+ * @param par_wrapper The parallel wrapper (MASTER only)
+ * @param fake_fs The path of the fake shared file system
+ * @param local_fs The path of the node-local file system (bind mode only)
+ * @return The number of hosts without a fake file system
+ */
+int create_fake_fs(parallel_wrapper *par_wrapper, char *fake_fs, char *local_fs)
+{
+	int i, RC;
+	char local_src[1024];
+	char *bind_dest[2] = {fake_fs, local_fs};
+	pair_batch *batches = (pair_batch *) calloc(par_wrapper -> num_procs, sizeof(pair_batch));
+	char **sources = (char **) calloc(2 * par_wrapper -> num_procs, sizeof(char *));
+	if (batches == (pair_batch *)NULL || sources == (char **)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for link batches\n");
+		free(batches);
+		free(sources);
+		return par_wrapper -> num_procs;
+	}
+	/* The tmpfs directory has the same name as the fake FS */
+	char *name = strrchr(fake_fs, '/');
+	snprintf(local_src, 1024, "%s/%s", LOCAL_TMPFS, name == (char *)NULL ? fake_fs : name + 1);
+
+	if (par_wrapper -> fs_mode == FS_MODE_BIND)
+	{
+		for (i = 0; i < par_wrapper -> num_procs; i++)
+		{
+			if (! (par_wrapper -> ranks.flags[i] & RANK_UNIQUE))
+			{
+				continue;
+			}
+			sources[2*i] = par_wrapper -> machines[i] -> iwd;
+			sources[2*i + 1] = local_src;
+			batches[i].count = 2;
+			batches[i].keys = &sources[2*i];
+			batches[i].values = bind_dest;
+		}
+		int span = trace_begin("bind_mounts");
+		RC = send_pair_batches(par_wrapper, CMD_BIND_MOUNTS, batches);
+		trace_end(span);
+		if (RC == 0)
+		{
+			free(batches);
+			free(sources);
+			return 0;
+		}
+		print(PRNT_WARN, "Failed to create %d bind mounts - falling back to symlinks\n", RC);
+		par_wrapper -> fs_mode = FS_MODE_SYMLINK;
+		remove_bind_mounts(par_wrapper);
+	}
+
+	/* Link the fake FS to the IWD on every unique host in one exchange */
+	for (i = 0; i < par_wrapper -> num_procs; i++)
+	{
+		if (! (par_wrapper -> ranks.flags[i] & RANK_UNIQUE))
+		{
+			continue;
+		}
+		batches[i].count = 1;
+		batches[i].keys = &par_wrapper -> machines[i] -> iwd;
+		batches[i].values = bind_dest;
+	}
+	int span = trace_begin("create_links");
+	RC = send_pair_batches(par_wrapper, CMD_CREATE_LINKS, batches);
+	trace_end(span);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Failed to create %d links for the fake file system\n", RC);
+	}
+	free(batches);
+	free(sources);
+	return RC;
+}
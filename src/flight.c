@@ -0,0 +1,163 @@
+/**
+ * Flight recorder
+ *
+ * An always-on ring of compact binary events: packets in and out
+ * (command, sequence number, peer), state transitions and timer fires.
+ * Recording an event is one atomic add, a clock read and a few stores,
+ * so every packet can be recorded. The ring is written to the scratch
+ * directory on SIGUSR1 and when the job is aborted; flight_decode turns
+ * a dump back into text.
+ */
+
+#include "flight.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+
+static flight_event events[FLIGHT_EVENTS];
+static uint64_t recorded = 0;
+static int this_rank = -1;
+static __thread uint32_t thread_id = 0;
+
+/**
+ * Record the rank of this wrapper (and that it started)
+ */
+void flight_init(int rank)
+{
+	this_rank = rank;
+	flight_record(FLIGHT_STATE, FLIGHT_STARTED, 0, rank, NULL);
+}
+
+/**
+ * Record an event
+ *
+ * @param type FLIGHT_TYPE
+ * @param command CMD of a packet, otherwise the state or timer code
+ * @param seq Sequence number of a packet
+ * @param value Detail of a state transition or timer
+ * @param peer The peer of a packet (NULL: none)
+ */
+void flight_record(int type, int command, uint32_t seq, int32_t value, const struct sockaddr *peer)
+{
+	struct timespec now;
+	uint64_t number = __sync_fetch_and_add(&recorded, 1);
+	flight_event *event = &events[number & (FLIGHT_EVENTS - 1)];
+	if (thread_id == 0)
+	{
+		thread_id = (uint32_t) syscall(SYS_gettid);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* Mark the slot as being rewritten */
+	__atomic_store_n(&event -> index, 0, __ATOMIC_RELAXED);
+	event -> time_us = (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+	event -> seq = seq;
+	event -> type = (uint8_t) type;
+	event -> command = (uint8_t) command;
+	event -> value = value;
+	event -> thread = thread_id;
+	event -> peer_addr = 0;
+	event -> peer_port = 0;
+	if (peer != (struct sockaddr *)NULL && peer -> sa_family == AF_INET)
+	{
+		const struct sockaddr_in *address = (const struct sockaddr_in *) peer;
+		event -> peer_addr = address -> sin_addr.s_addr;
+		event -> peer_port = ntohs(address -> sin_port);
+	}
+	__atomic_store_n(&event -> index, (uint32_t) number + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record a packet ("<CMD>:<SEQ>[:<ARGS>]" - anything else is command 0)
+ *
+ * @param type FLIGHT_PACKET_IN or FLIGHT_PACKET_OUT
+ * @param message The packet
+ * @param peer Where it came from or went to
+ */
+void flight_packet(int type, const char *message, const struct sockaddr *peer)
+{
+	char *end;
+	int command = 0;
+	uint32_t seq = 0;
+	if (message != (char *)NULL)
+	{
+		command = (int) strtol(message, &end, 10);
+		if (*end == ':')
+		{
+			seq = (uint32_t) strtoul(end + 1, &end, 10);
+		}
+		else
+		{
+			command = 0;
+		}
+	}
+	flight_record(type, command, seq, 0, peer);
+}
+
+/**
+ * Write the ring (while events may still be recorded - those are marked
+ * by an index of 0 or out of sequence, and dropped by the decoder)
+ *
+ * @param path The file
+ * @return 0 on success, otherwise failure
+ */
+int flight_write(const char *path)
+{
+	struct timespec now;
+	flight_header header;
+	char temp[1040];
+	memset(&header, 0, sizeof(flight_header));
+	header.magic = FLIGHT_MAGIC;
+	header.version = FLIGHT_VERSION;
+	header.event_size = sizeof(flight_event);
+	header.capacity = FLIGHT_EVENTS;
+	header.rank = this_rank;
+	header.recorded = __atomic_load_n(&recorded, __ATOMIC_ACQUIRE);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	header.mono_us = (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+	clock_gettime(CLOCK_REALTIME, &now);
+	header.wall_us = (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+
+	snprintf(temp, 1040, "%s.tmp", path);
+	FILE *fp = fopen(temp, "w");
+	if (fp == (FILE *)NULL)
+	{
+		print(PRNT_WARN, "Unable to write the flight recorder to %s\n", temp);
+		return 1;
+	}
+	if (fwrite(&header, sizeof(flight_header), 1, fp) != 1 ||
+		fwrite(events, sizeof(flight_event), FLIGHT_EVENTS, fp) != FLIGHT_EVENTS)
+	{
+		print(PRNT_WARN, "Unable to write the flight recorder to %s\n", temp);
+		fclose(fp);
+		unlink(temp);
+		return 2;
+	}
+	fclose(fp);
+	if (rename(temp, path) != 0)
+	{
+		print(PRNT_WARN, "Unable to replace flight recorder file %s\n", path);
+		return 3;
+	}
+	return 0;
+}
+
+/**
+ * Write the ring to FLIGHT_FILE in the scratch directory
+ *
+ * @return 0 on success, otherwise failure
+ */
+int flight_dump(const char *scratch_dir)
+{
+	char path[1024];
+	if (scratch_dir == (char *)NULL)
+	{
+		return 1;
+	}
+	snprintf(path, 1024, "%s/%s", scratch_dir, FLIGHT_FILE);
+	return flight_write(path);
+}
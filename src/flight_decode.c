@@ -0,0 +1,236 @@
+/**
+ * Flight recorder decoder
+ *
+ * Prints the events of one or more flight recorder dumps (e.g. of every
+ * rank of a job) as text, merged in wall-clock order:
+ *
+ *     flight_decode flight.bin [flight.bin ...]
+ */
+
+#include "flight.h"
+#include "udp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/**
+ * An event with the dump it came from
+ */
+typedef struct decoded_event
+{
+	uint64_t wall_us; /**< Wall-clock time of the event */
+	uint64_t number; /**< Event number on its rank */
+	int rank; /**< Rank which recorded it */
+	flight_event event; /**< The event */
+} decoded_event;
+
+static int load_dump(const char *path, decoded_event **list, int *count, int *size);
+static int compare_events(const void *a, const void *b);
+static const char *command_name(int command);
+static const char *state_name(int state);
+static const char *timer_name(int timer);
+static void print_event(const decoded_event *decoded);
+
+int main(int argc, char **argv)
+{
+	int i;
+	int count = 0;
+	int size = 0;
+	decoded_event *list = NULL;
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <flight.bin> [<flight.bin> ...]\n", argv[0]);
+		return 1;
+	}
+	for (i = 1; i < argc; i++)
+	{
+		if (load_dump(argv[i], &list, &count, &size) != 0)
+		{
+			free(list);
+			return 2;
+		}
+	}
+	qsort(list, count, sizeof(decoded_event), compare_events);
+	for (i = 0; i < count; i++)
+	{
+		print_event(&list[i]);
+	}
+	free(list);
+	return 0;
+}
+
+/**
+ * Append the intact events of a dump to the list
+ *
+ * Slot s holds the latest event number n with n % capacity == s; the
+ * slot is dropped when its index does not match (being rewritten during
+ * the dump).
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int load_dump(const char *path, decoded_event **list, int *count, int *size)
+{
+	uint32_t slot;
+	flight_header header;
+	flight_event event;
+	int kept = 0;
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		fprintf(stderr, "Unable to open %s\n", path);
+		return 1;
+	}
+	if (fread(&header, sizeof(flight_header), 1, fp) != 1 || header.magic != FLIGHT_MAGIC ||
+		header.version != FLIGHT_VERSION || header.event_size != sizeof(flight_event) || header.capacity == 0)
+	{
+		fprintf(stderr, "%s is not a flight recorder dump (version %u)\n", path, FLIGHT_VERSION);
+		fclose(fp);
+		return 2;
+	}
+	for (slot = 0; slot < header.capacity; slot++)
+	{
+		if (fread(&event, sizeof(flight_event), 1, fp) != 1)
+		{
+			fprintf(stderr, "%s is truncated\n", path);
+			fclose(fp);
+			return 3;
+		}
+		if (event.index == 0 || header.recorded <= slot)
+		{
+			continue;
+		}
+		uint64_t number = header.recorded - 1 - ((header.recorded - 1 - slot) % header.capacity);
+		if ((uint32_t) (number + 1) != event.index)
+		{
+			continue;
+		}
+		if (*count == *size)
+		{
+			*size = (*size == 0) ? 1024 : 2 * *size;
+			decoded_event *larger = (decoded_event *) realloc(*list, *size * sizeof(decoded_event));
+			if (larger == (decoded_event *)NULL)
+			{
+				fprintf(stderr, "Unable to allocate space for the events\n");
+				fclose(fp);
+				return 4;
+			}
+			*list = larger;
+		}
+		decoded_event *decoded = &(*list)[(*count)++];
+		decoded -> wall_us = header.wall_us - (header.mono_us - event.time_us);
+		decoded -> number = number;
+		decoded -> rank = header.rank;
+		decoded -> event = event;
+		kept++;
+	}
+	fclose(fp);
+	printf("# %s: rank %d, %llu events recorded, %d kept\n", path, header.rank,
+		(unsigned long long) header.recorded, kept);
+	return 0;
+}
+
+/**
+ * Order by time, then rank, then event number
+ */
+static int compare_events(const void *a, const void *b)
+{
+	const decoded_event *first = (const decoded_event *) a;
+	const decoded_event *second = (const decoded_event *) b;
+	if (first -> wall_us != second -> wall_us)
+	{
+		return first -> wall_us < second -> wall_us ? -1 : 1;
+	}
+	if (first -> rank != second -> rank)
+	{
+		return first -> rank < second -> rank ? -1 : 1;
+	}
+	return first -> number < second -> number ? -1 : (first -> number > second -> number);
+}
+
+static const char *command_name(int command)
+{
+	switch (command)
+	{
+		case CMD_TERM: return "TERM";
+		case CMD_QUERY: return "QUERY";
+		case CMD_ACK: return "ACK";
+		case CMD_SEND_FILE: return "SEND_FILE";
+		case CMD_REGISTER: return "REGISTER";
+		case CMD_CREATE_LINK: return "CREATE_LINK";
+		case CMD_CREATE_LINKS: return "CREATE_LINKS";
+		case CMD_BIND_MOUNTS: return "BIND_MOUNTS";
+		case CMD_LAUNCH: return "LAUNCH";
+		case CMD_PMI_PUT: return "PMI_PUT";
+		case CMD_PMI_FENCE: return "PMI_FENCE";
+		case CMD_PMI_FENCE_DONE: return "PMI_FENCE_DONE";
+		case CMD_EXITED: return "EXITED";
+		case CMD_PMI_BCAST: return "PMI_BCAST";
+		case CMD_PMI_GET: return "PMI_GET";
+		case CMD_PMI_VALUE: return "PMI_VALUE";
+		case CMD_TRACE: return "TRACE";
+		default: return "INVALID";
+	}
+}
+
+static const char *state_name(int state)
+{
+	switch (state)
+	{
+		case FLIGHT_STARTED: return "STARTED";
+		case FLIGHT_REGISTERED: return "REGISTERED";
+		case FLIGHT_LAUNCHED: return "LAUNCHED";
+		case FLIGHT_RANK_EXITED: return "RANK_EXITED";
+		case FLIGHT_TIMED_OUT: return "TIMED_OUT";
+		case FLIGHT_SIGNALLED: return "SIGNALLED";
+		case FLIGHT_TERMINATED: return "TERMINATED";
+		case FLIGHT_CLEANUP: return "CLEANUP";
+		default: return "UNKNOWN";
+	}
+}
+
+static const char *timer_name(int timer)
+{
+	switch (timer)
+	{
+		case FLIGHT_KEEP_ALIVE: return "KEEP_ALIVE";
+		case FLIGHT_SAMPLE: return "SAMPLE";
+		default: return "UNKNOWN";
+	}
+}
+
+/**
+ * Print one event as "<time> rank <R> [<thread>] <what>"
+ */
+static void print_event(const decoded_event *decoded)
+{
+	char stamp[32];
+	char peer[INET_ADDRSTRLEN];
+	struct tm time_info;
+	time_t seconds = (time_t) (decoded -> wall_us / 1000000);
+	const flight_event *event = &decoded -> event;
+	localtime_r(&seconds, &time_info);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &time_info);
+	printf("%s.%06llu rank %d [%u] ", stamp, (unsigned long long) (decoded -> wall_us % 1000000),
+		decoded -> rank, event -> thread);
+	switch (event -> type)
+	{
+		case FLIGHT_PACKET_IN:
+		case FLIGHT_PACKET_OUT:
+			inet_ntop(AF_INET, &event -> peer_addr, peer, INET_ADDRSTRLEN);
+			printf("%-5s %-14s seq %-8u %s %s:%u\n", event -> type == FLIGHT_PACKET_IN ? "IN" : "OUT",
+				command_name(event -> command), event -> seq,
+				event -> type == FLIGHT_PACKET_IN ? "from" : "to", peer, event -> peer_port);
+			break;
+		case FLIGHT_STATE:
+			printf("STATE %-14s %d\n", state_name(event -> command), event -> value);
+			break;
+		case FLIGHT_TIMER:
+			printf("TIMER %-14s %d\n", timer_name(event -> command), event -> value);
+			break;
+		default:
+			printf("UNKNOWN type %u\n", event -> type);
+			break;
+	}
+}
@@ -0,0 +1,236 @@
+/**
+ * Thread-safe hash set of strings
+ */
+
+#include "hash_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int grow(hash_set *set);
+
+/**
+ * Get an empty hash set
+ *
+ * @return An initialized hash_set or NULL if error
+ */
+hash_set *hash_set_get(void)
+{
+	hash_set *set = (hash_set *)calloc(1, sizeof(struct hash_set));
+	if (set == (hash_set *)NULL)
+	{
+		return NULL;
+	}
+	set -> buckets = (struct hash_set_entry **)calloc(HASH_SET_MIN_BUCKETS, sizeof(struct hash_set_entry *));
+	if (set -> buckets == (struct hash_set_entry **)NULL)
+	{
+		free(set);
+		return NULL;
+	}
+	set -> mask = HASH_SET_MIN_BUCKETS - 1;
+	pthread_mutex_init(&set -> mutex, NULL);
+	return set;
+}
+
+/**
+ * Add a key to the set
+ *
+ * The membership test and the insert are performed atomically, so
+ * exactly one of several concurrent callers adding the same key
+ * observes a return value of 0.
+ *
+ * @param set The set to add to
+ * @param key The key to add (copied)
+ * @return 0 if the key was added, 1 if it was already present, otherwise failure
+ */
+int hash_set_add(hash_set *set, const char *key)
+{
+	if (set == (hash_set *)NULL || key == (char *)NULL)
+	{
+		return 2;
+	}
+	uint32_t hash = hash_string(key);
+	pthread_mutex_lock(&set -> mutex);
+	struct hash_set_entry *entry = set -> buckets[hash & set -> mask];
+	for ( ; entry != (struct hash_set_entry *)NULL; entry = entry -> next)
+	{
+		if (entry -> hash == hash && strcmp(entry -> key, key) == 0)
+		{
+			pthread_mutex_unlock(&set -> mutex);
+			return 1;
+		}
+	}
+	entry = (struct hash_set_entry *)calloc(1, sizeof(struct hash_set_entry));
+	if (entry == (struct hash_set_entry *)NULL)
+	{
+		pthread_mutex_unlock(&set -> mutex);
+		return 3;
+	}
+	entry -> key = strdup(key);
+	if (entry -> key == (char *)NULL)
+	{
+		free(entry);
+		pthread_mutex_unlock(&set -> mutex);
+		return 3;
+	}
+	entry -> hash = hash;
+	entry -> next = set -> buckets[hash & set -> mask];
+	set -> buckets[hash & set -> mask] = entry;
+	set -> num_elements++;
+	/* Keep the load factor below 1 */
+	if ((uint32_t) set -> num_elements > set -> mask)
+	{
+		grow(set);
+	}
+	pthread_mutex_unlock(&set -> mutex);
+	return 0;
+}
+
+/**
+ * Returns 1 if key is a member of the set, 0 otherwise
+ */
+int hash_set_contains(hash_set *set, const char *key)
+{
+	if (set == (hash_set *)NULL || key == (char *)NULL)
+	{
+		return 0;
+	}
+	uint32_t hash = hash_string(key);
+	pthread_mutex_lock(&set -> mutex);
+	struct hash_set_entry *entry = set -> buckets[hash & set -> mask];
+	for ( ; entry != (struct hash_set_entry *)NULL; entry = entry -> next)
+	{
+		if (entry -> hash == hash && strcmp(entry -> key, key) == 0)
+		{
+			pthread_mutex_unlock(&set -> mutex);
+			return 1;
+		}
+	}
+	pthread_mutex_unlock(&set -> mutex);
+	return 0;
+}
+
+/**
+ * Remove a key from the set
+ *
+ * @param set The set to remove from
+ * @param key The key to remove
+ * @return 0 if the key was removed, otherwise it was not present
+ */
+int hash_set_remove(hash_set *set, const char *key)
+{
+	if (set == (hash_set *)NULL || key == (char *)NULL)
+	{
+		return 1;
+	}
+	uint32_t hash = hash_string(key);
+	pthread_mutex_lock(&set -> mutex);
+	struct hash_set_entry **prev = &set -> buckets[hash & set -> mask];
+	while (*prev != (struct hash_set_entry *)NULL)
+	{
+		struct hash_set_entry *entry = *prev;
+		if (entry -> hash == hash && strcmp(entry -> key, key) == 0)
+		{
+			*prev = entry -> next;
+			set -> num_elements--;
+			pthread_mutex_unlock(&set -> mutex);
+			free(entry -> key);
+			free(entry);
+			return 0;
+		}
+		prev = &entry -> next;
+	}
+	pthread_mutex_unlock(&set -> mutex);
+	return 2;
+}
+
+/**
+ * Remove every key from the set in one operation
+ *
+ * The set is left empty. The caller owns the returned array and each
+ * of the keys in it.
+ *
+ * @param set The set to empty
+ * @param count (output) The number of keys returned
+ * @return An allocated array of keys (NULL if the set was empty or on error)
+ */
+char **hash_set_take_all(hash_set *set, int *count)
+{
+	uint32_t i;
+	int n = 0;
+	if (count != (int *)NULL)
+	{
+		*count = 0;
+	}
+	if (set == (hash_set *)NULL || count == (int *)NULL)
+	{
+		return NULL;
+	}
+	pthread_mutex_lock(&set -> mutex);
+	char **keys = (char **)calloc(set -> num_elements + 1, sizeof(char *));
+	if (keys == (char **)NULL)
+	{
+		pthread_mutex_unlock(&set -> mutex);
+		return NULL;
+	}
+	for (i = 0; i <= set -> mask; i++)
+	{
+		struct hash_set_entry *entry = set -> buckets[i];
+		while (entry != (struct hash_set_entry *)NULL)
+		{
+			struct hash_set_entry *next = entry -> next;
+			keys[n++] = entry -> key;
+			free(entry);
+			entry = next;
+		}
+		set -> buckets[i] = NULL;
+	}
+	set -> num_elements = 0;
+	pthread_mutex_unlock(&set -> mutex);
+	*count = n;
+	return keys;
+}
+
+/**
+ * FNV-1a hash of a NULL terminated string
+ */
+uint32_t hash_string(const char *key)
+{
+	uint32_t hash = 2166136261u;
+	while (*key != '\0')
+	{
+		hash ^= (unsigned char) *key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Double the number of buckets (the set mutex must be held)
+ *
+ * @return 0 on success, otherwise failure (the set is left unchanged)
+ */
+static int grow(hash_set *set)
+{
+	uint32_t i;
+	uint32_t new_mask = (set -> mask << 1) | 1;
+	struct hash_set_entry **buckets = (struct hash_set_entry **)calloc(new_mask + 1, sizeof(struct hash_set_entry *));
+	if (buckets == (struct hash_set_entry **)NULL)
+	{
+		return 1;
+	}
+	for (i = 0; i <= set -> mask; i++)
+	{
+		struct hash_set_entry *entry = set -> buckets[i];
+		while (entry != (struct hash_set_entry *)NULL)
+		{
+			struct hash_set_entry *next = entry -> next;
+			entry -> next = buckets[entry -> hash & new_mask];
+			buckets[entry -> hash & new_mask] = entry;
+			entry = next;
+		}
+	}
+	free(set -> buckets);
+	set -> buckets = buckets;
+	set -> mask = new_mask;
+	return 0;
+}
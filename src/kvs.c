@@ -0,0 +1,256 @@
+/**
+ * Thread-safe key-value store
+ *
+ * Holds the PMI key-value space of a job. Entries stored with the dirty
+ * flag set have not yet been published to the other ranks; they are
+ * collected (and the flag cleared) in one operation at the next fence.
+ */
+
+#include "kvs.h"
+#include "hash_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int grow(kvs *store);
+
+/**
+ * Get an empty key-value store
+ *
+ * @return An initialized kvs or NULL if error
+ */
+kvs *kvs_get(void)
+{
+	kvs *store = (kvs *)calloc(1, sizeof(struct kvs));
+	if (store == (kvs *)NULL)
+	{
+		return NULL;
+	}
+	store -> buckets = (struct kvs_entry **)calloc(KVS_MIN_BUCKETS, sizeof(struct kvs_entry *));
+	if (store -> buckets == (struct kvs_entry **)NULL)
+	{
+		free(store);
+		return NULL;
+	}
+	store -> mask = KVS_MIN_BUCKETS - 1;
+	pthread_mutex_init(&store -> mutex, NULL);
+	return store;
+}
+
+/**
+ * Free a key-value store and every entry in it
+ *
+ * @param store The store (NULL is ignored)
+ */
+void kvs_free(kvs *store)
+{
+	uint32_t i;
+	if (store == (kvs *)NULL)
+	{
+		return;
+	}
+	for (i = 0; i <= store -> mask; i++)
+	{
+		struct kvs_entry *entry = store -> buckets[i];
+		while (entry != (struct kvs_entry *)NULL)
+		{
+			struct kvs_entry *next = entry -> next;
+			free(entry -> key);
+			free(entry -> value);
+			free(entry);
+			entry = next;
+		}
+	}
+	pthread_mutex_destroy(&store -> mutex);
+	free(store -> buckets);
+	free(store);
+}
+
+/**
+ * Store a value (replacing any previous value of key)
+ *
+ * @param store The store
+ * @param key The key (copied)
+ * @param value The value (copied)
+ * @param dirty Non-zero if the entry must be published at the next fence
+ * @return 0 on success, otherwise failure
+ */
+int kvs_put(kvs *store, const char *key, const char *value, int dirty)
+{
+	if (store == (kvs *)NULL || key == (char *)NULL || value == (char *)NULL)
+	{
+		return 1;
+	}
+	char *new_value = strdup(value);
+	if (new_value == (char *)NULL)
+	{
+		return 2;
+	}
+	uint32_t hash = hash_string(key);
+	pthread_mutex_lock(&store -> mutex);
+	struct kvs_entry *entry = store -> buckets[hash & store -> mask];
+	for ( ; entry != (struct kvs_entry *)NULL; entry = entry -> next)
+	{
+		if (entry -> hash == hash && strcmp(entry -> key, key) == 0)
+		{
+			break;
+		}
+	}
+	if (entry == (struct kvs_entry *)NULL)
+	{
+		entry = (struct kvs_entry *)calloc(1, sizeof(struct kvs_entry));
+		if (entry == (struct kvs_entry *)NULL || (entry -> key = strdup(key)) == (char *)NULL)
+		{
+			pthread_mutex_unlock(&store -> mutex);
+			free(entry);
+			free(new_value);
+			return 3;
+		}
+		entry -> hash = hash;
+		entry -> next = store -> buckets[hash & store -> mask];
+		store -> buckets[hash & store -> mask] = entry;
+		store -> num_elements++;
+	}
+	free(entry -> value);
+	entry -> value = new_value;
+	if (dirty && ! entry -> dirty)
+	{
+		entry -> dirty = 1;
+		entry -> next_dirty = store -> dirty;
+		store -> dirty = entry;
+		store -> num_dirty++;
+	}
+	/* Keep the load factor below 1 */
+	if ((uint32_t) store -> num_elements > store -> mask)
+	{
+		grow(store);
+	}
+	pthread_mutex_unlock(&store -> mutex);
+	return 0;
+}
+
+/**
+ * Look up the value of a key
+ *
+ * @param store The store
+ * @param key The key to look up
+ * @param value (output) Buffer for the value
+ * @param value_len The length of the value buffer
+ * @return 0 if the key was found, otherwise it is not present
+ */
+int kvs_lookup(kvs *store, const char *key, char *value, size_t value_len)
+{
+	if (store == (kvs *)NULL || key == (char *)NULL || value == (char *)NULL || value_len == 0)
+	{
+		return 2;
+	}
+	uint32_t hash = hash_string(key);
+	pthread_mutex_lock(&store -> mutex);
+	struct kvs_entry *entry = store -> buckets[hash & store -> mask];
+	for ( ; entry != (struct kvs_entry *)NULL; entry = entry -> next)
+	{
+		if (entry -> hash == hash && strcmp(entry -> key, key) == 0)
+		{
+			strncpy(value, entry -> value, value_len - 1);
+			value[value_len - 1] = '\0';
+			pthread_mutex_unlock(&store -> mutex);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&store -> mutex);
+	return 1;
+}
+
+/**
+ * Collect every unpublished entry and mark it as published
+ *
+ * The caller owns the returned arrays (see kvs_free_pairs).
+ *
+ * @param store The store
+ * @param keys (output) The keys of the unpublished entries
+ * @param values (output) The values of the unpublished entries
+ * @return The number of entries returned (or -1 on error)
+ */
+int kvs_take_dirty(kvs *store, char ***keys, char ***values)
+{
+	int n = 0;
+	if (store == (kvs *)NULL || keys == (char ***)NULL || values == (char ***)NULL)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&store -> mutex);
+	*keys = (char **)calloc(store -> num_dirty + 1, sizeof(char *));
+	*values = (char **)calloc(store -> num_dirty + 1, sizeof(char *));
+	if (*keys == (char **)NULL || *values == (char **)NULL)
+	{
+		pthread_mutex_unlock(&store -> mutex);
+		free(*keys);
+		free(*values);
+		*keys = NULL;
+		*values = NULL;
+		return -1;
+	}
+	struct kvs_entry *entry = store -> dirty;
+	while (entry != (struct kvs_entry *)NULL)
+	{
+		struct kvs_entry *next = entry -> next_dirty;
+		(*keys)[n] = strdup(entry -> key);
+		(*values)[n] = strdup(entry -> value);
+		if ((*keys)[n] != (char *)NULL && (*values)[n] != (char *)NULL)
+		{
+			n++;
+		}
+		entry -> dirty = 0;
+		entry -> next_dirty = NULL;
+		entry = next;
+	}
+	store -> dirty = NULL;
+	store -> num_dirty = 0;
+	pthread_mutex_unlock(&store -> mutex);
+	return n;
+}
+
+/**
+ * Free the arrays returned by kvs_take_dirty
+ */
+void kvs_free_pairs(char **keys, char **values, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		free(keys[i]);
+		free(values[i]);
+	}
+	free(keys);
+	free(values);
+}
+
+/**
+ * Double the number of buckets (the store mutex must be held)
+ *
+ * @return 0 on success, otherwise failure (the store is left unchanged)
+ */
+static int grow(kvs *store)
+{
+	uint32_t i;
+	uint32_t new_mask = (store -> mask << 1) | 1;
+	struct kvs_entry **buckets = (struct kvs_entry **)calloc(new_mask + 1, sizeof(struct kvs_entry *));
+	if (buckets == (struct kvs_entry **)NULL)
+	{
+		return 1;
+	}
+	for (i = 0; i <= store -> mask; i++)
+	{
+		struct kvs_entry *entry = store -> buckets[i];
+		while (entry != (struct kvs_entry *)NULL)
+		{
+			struct kvs_entry *next = entry -> next;
+			entry -> next = buckets[entry -> hash & new_mask];
+			buckets[entry -> hash & new_mask] = entry;
+			entry = next;
+		}
+	}
+	free(store -> buckets);
+	store -> buckets = buckets;
+	store -> mask = new_mask;
+	return 0;
+}
@@ -0,0 +1,444 @@
+/**
+ * Launching of the user's processes
+ *
+ * By default only the master runs the executable (which usually calls
+ * mpiexec). In PMI and local launch modes the master hands every rank
+ * its slice of the job with LAUNCH, and every rank forks its local
+ * processes directly (in PMI mode each connected to the built-in PMI
+ * server). Each local process is bound to the CPUs chosen for it by the
+ * binding policy (see topology.c).
+ */
+
+#include "launcher.h"
+#include "pmi.h"
+#include "namespace.h"
+#include "scratch.h"
+#include "string_util.h"
+#include "topology.h"
+#include "cgroup.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static int send_launch(parallel_wrapper *par_wrapper, char *mapping, int *offsets, int *order, char **trees, uint32_t *seqs);
+
+/**
+ * Set the environment variables describing the job (in a forked child)
+ *
+ * @param par_wrapper The parallel wrapper
+ */
+void set_job_environment(parallel_wrapper *par_wrapper)
+{
+	int i;
+	char temp_str[1024];
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		char *machine_file = join_paths(par_wrapper -> scratch_dir, MACHINE_FILE);
+		char *ssh_config = join_paths(par_wrapper -> scratch_dir, SSH_CONFIG);
+		setenv("MACHINE_FILE", machine_file, 1);
+		setenv("SSH_CONFIG", ssh_config, 1);
+		free(machine_file);
+		free(ssh_config);
+		char *ssh_wrapper = join_paths(par_wrapper -> scratch_dir, SSH_WRAPPER);
+		setenv("SSH_WRAPPER", ssh_wrapper, 1);
+		free(ssh_wrapper);
+
+		snprintf(temp_str, 1024, "%d", par_wrapper -> num_procs);
+		setenv("NUM_MACHINES", temp_str, 1);
+
+		/* Determine the total number of cpus allocated to this task */
+		int total_cpus = 0;
+		for (i = 0; i < par_wrapper -> num_procs; i++)
+		{
+			total_cpus += par_wrapper -> ranks.cpus[i]; /* 0 if not registered */
+		}
+		snprintf(temp_str, 1024, "%d", total_cpus);
+		setenv("CPUS", temp_str, 1);
+		setenv("NUM_PROCS", temp_str, 1);
+	}
+	else if (par_wrapper -> pmi != (pmi_job *)NULL)
+	{
+		snprintf(temp_str, 1024, "%d", par_wrapper -> num_procs);
+		setenv("NUM_MACHINES", temp_str, 1);
+		snprintf(temp_str, 1024, "%d", par_wrapper -> pmi -> size);
+		setenv("CPUS", temp_str, 1);
+		setenv("NUM_PROCS", temp_str, 1);
+	}
+
+	snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> rank);
+	setenv("RANK", temp_str, 1);
+
+	snprintf(temp_str, 1024, "%d", par_wrapper -> cluster_id);
+	setenv("CLUSTER_ID", temp_str, 1);
+
+	snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> port);
+	setenv("CMD_PORT", temp_str, 1);
+
+	snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> cpus);
+	setenv("REQUEST_CPUS", temp_str, 1);
+
+	/* The IWD is shared unless a fake shared FS was created */
+	int shared_fs = (par_wrapper -> shared_fs == (char *)NULL ||
+		strcmp(par_wrapper -> shared_fs, par_wrapper -> this_machine -> iwd) == 0);
+	setenv("SCRATCH_DIR", par_wrapper -> scratch_dir, 1);
+	setenv("IWD", par_wrapper -> this_machine -> iwd, 1);
+	setenv("IP_ADDR", par_wrapper -> this_machine -> ip_addr, 1);
+	setenv("TRANSFER_FILES", shared_fs != 0 ? "TRUE" : "FALSE", 1);
+	setenv("SHARED_FS", shared_fs != 0 ? par_wrapper -> this_machine -> iwd : par_wrapper -> shared_fs, 1);
+	setenv("SHARED_DIR", shared_fs != 0 ? par_wrapper -> this_machine -> iwd : par_wrapper -> shared_fs, 1);
+	if (par_wrapper -> this_machine -> schedd_iwd != (char *)NULL)
+	{
+		setenv("SCHEDD_IWD", par_wrapper -> this_machine -> schedd_iwd, 1);
+	}
+	setenv("FS_MODE", par_wrapper -> fs_mode == FS_MODE_BIND ? "bind" : "symlink", 1);
+	if (par_wrapper -> local_fs != (char *)NULL)
+	{
+		setenv("LOCAL_FS", par_wrapper -> local_fs, 1);
+	}
+	setenv("BIND_POLICY", bind_policy_name(par_wrapper -> bind_policy), 1);
+	if (par_wrapper -> this_machine -> cpu_map != (char *)NULL)
+	{
+		setenv("CPU_MAP", par_wrapper -> this_machine -> cpu_map, 1);
+	}
+	/* TODO: SSH ENVS */
+}
+
+/**
+ * Hand every rank its slice of the job (MASTER only, PMI launch mode)
+ *
+ * Global ranks are assigned in rank order, each rank receiving as many
+ * processes as it has CPUs. Each LAUNCH also carries the neighbours of
+ * the rank in the PMI fence tree. The LAUNCH of every rank is
+ * outstanding at once and retransmitted until it is acknowledged.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure
+ */
+int launch_job(parallel_wrapper *par_wrapper)
+{
+	int i;
+	int RC = 1;
+	char *mapping = pmi_process_mapping(par_wrapper);
+	int *offsets = (int *)calloc(par_wrapper -> num_procs, sizeof(int));
+	int *order = (int *)calloc(par_wrapper -> num_procs, sizeof(int));
+	char **trees = (char **)calloc(par_wrapper -> num_procs, sizeof(char *));
+	uint32_t *seqs = (uint32_t *)calloc(par_wrapper -> num_procs, sizeof(uint32_t));
+	if (mapping == (char *)NULL || offsets == (int *)NULL || order == (int *)NULL ||
+		trees == (char **)NULL || seqs == (uint32_t *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space to launch the job\n");
+	}
+	else
+	{
+		RC = send_launch(par_wrapper, mapping, offsets, order, trees, seqs);
+	}
+	for (i = 0; trees != (char **)NULL && i < par_wrapper -> num_procs; i++)
+	{
+		free(trees[i]);
+	}
+	free(mapping);
+	free(offsets);
+	free(order);
+	free(trees);
+	free(seqs);
+	return RC;
+}
+
+/**
+ * Create the PMI job of the master and send LAUNCH to every other rank
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param mapping The PMI process mapping
+ * @param offsets (scratch) num_procs global rank offsets
+ * @param order (scratch) num_procs ranks in tree order
+ * @param trees (scratch) num_procs tree descriptions (allocated here)
+ * @param seqs (scratch) num_procs sequence numbers
+ * @return 0 on success, otherwise failure
+ */
+static int send_launch(parallel_wrapper *par_wrapper, char *mapping, int *offsets, int *order, char **trees, uint32_t *seqs)
+{
+	int i, RC;
+	int size = 0;
+	for (i = 0; i < par_wrapper -> num_procs; i++)
+	{
+		if (! rank_registered(&par_wrapper -> ranks, i))
+		{
+			continue;
+		}
+		offsets[i] = size;
+		size += par_wrapper -> ranks.cpus[i];
+	}
+	pmi_job *job = pmi_get_job(par_wrapper, 0, size, par_wrapper -> this_machine -> cpus, mapping);
+	if (job == (pmi_job *)NULL)
+	{
+		return 2;
+	}
+	debug(PRNT_INFO, "Launching %d processes (mapping %s)\n", size, mapping);
+
+	/* Lay the registered ranks out as the PMI fence tree */
+	int count = pmi_tree_order(par_wrapper, order);
+	for (i = 1; i < count; i++)
+	{
+		trees[order[i]] = (char *)calloc(MAX_MESSAGE + 1, sizeof(char));
+		if (trees[order[i]] == (char *)NULL ||
+			pmi_tree_fields(par_wrapper, order, count, i, trees[order[i]], MAX_MESSAGE + 1) != 0)
+		{
+			print(PRNT_ERR, "Unable to describe the PMI tree for rank %d\n", order[i]);
+			return 3;
+		}
+	}
+	for (i = 1; i <= PMI_TREE_ARITY && i < count; i++)
+	{
+		machine *child = par_wrapper -> machines[order[i]];
+		pmi_add_peer(par_wrapper, job, 0, child -> rank, child -> ip_addr, child -> port);
+	}
+	par_wrapper -> pmi = job;
+
+	for (i = 1; i < par_wrapper -> num_procs; i++)
+	{
+		if (par_wrapper -> machines[i] != (machine *)NULL)
+		{
+			pending_add(par_wrapper -> pending, i, &seqs[i]);
+		}
+	}
+	while ( 1 )
+	{
+		for (i = 1; i < par_wrapper -> num_procs; i++)
+		{
+			if (seqs[i] == 0 || pending_is_done(par_wrapper -> pending, seqs[i]))
+			{
+				continue;
+			}
+			RC = launch(par_wrapper -> command_socket, seqs[i], offsets[i], size,
+				par_wrapper -> shared_fs, mapping, trees[i], par_wrapper -> machines[i] -> ip_addr,
+				par_wrapper -> machines[i] -> port);
+			if (RC != 0)
+			{
+				print(PRNT_ERR, "Unable to send LAUNCH to rank %d\n", i);
+			}
+		}
+		if (pending_wait_all(par_wrapper -> pending, seqs, par_wrapper -> num_procs, 100000) == 0)
+		{
+			break;
+		}
+		debug(PRNT_INFO, "Waiting for LAUNCH ACKs\n");
+	}
+	for (i = 1; i < par_wrapper -> num_procs; i++)
+	{
+		if (seqs[i] != 0)
+		{
+			pending_remove(par_wrapper -> pending, seqs[i]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Fork the local processes of this rank (PMI and local launch modes)
+ *
+ * Every process is placed in a single process group so that cleanup can
+ * signal all of them at once, and bound to the CPUs the binding policy
+ * chose for it (CPU_BIND, NUMA_NODE). In PMI mode each process is connected to the PMI server
+ * through a socketpair (PMI_FD).
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure
+ */
+int launch_local(parallel_wrapper *par_wrapper)
+{
+	int i;
+	pmi_job *job = par_wrapper -> pmi;
+	int use_pmi = (par_wrapper -> launch_mode == LAUNCH_PMI);
+	if (job == (pmi_job *)NULL)
+	{
+		return 1;
+	}
+	par_wrapper -> local_pids = (pid_t *)calloc(job -> num_local, sizeof(pid_t));
+	if (par_wrapper -> local_pids == (pid_t *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for local processes\n");
+		return 2;
+	}
+	for (i = 0; i < job -> num_local; i++)
+	{
+		int fds[2] = {-1, -1};
+		if (use_pmi && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		{
+			print(PRNT_ERR, "Unable to create PMI socket\n");
+			return 3;
+		}
+		if (use_pmi)
+		{
+			fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		}
+		pid_t pid = fork();
+		if (pid == (pid_t) -1)
+		{
+			print(PRNT_ERR, "Fork failed\n");
+			if (use_pmi)
+			{
+				close(fds[0]);
+				close(fds[1]);
+			}
+			return 4;
+		}
+		else if (pid == (pid_t) 0)
+		{
+			/* I am the child */
+			char temp_str[1024];
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			setpgid(0, (i == 0) ? 0 : par_wrapper -> local_pids[0]);
+			cgroup_enter(par_wrapper);
+			set_job_environment(par_wrapper);
+			if (par_wrapper -> bindings != (char **)NULL && i < par_wrapper -> this_machine -> cpus &&
+				par_wrapper -> bindings[i] != (char *)NULL)
+			{
+				bind_to_cpus(par_wrapper -> bindings[i]);
+				setenv("CPU_BIND", par_wrapper -> bindings[i], 1);
+				snprintf(temp_str, 1024, "%d", par_wrapper -> binding_nodes[i]);
+				setenv("NUMA_NODE", temp_str, 1);
+			}
+			snprintf(temp_str, 1024, "%d", job -> offset + i);
+			setenv("PROC_RANK", temp_str, 1);
+			snprintf(temp_str, 1024, "%d", i);
+			setenv("LOCAL_RANK", temp_str, 1);
+			snprintf(temp_str, 1024, "%d", job -> num_local);
+			setenv("LOCAL_SIZE", temp_str, 1);
+			if (use_pmi)
+			{
+				close(fds[0]);
+				snprintf(temp_str, 1024, "%d", fds[1]);
+				setenv("PMI_FD", temp_str, 1);
+				snprintf(temp_str, 1024, "%d", job -> offset + i);
+				setenv("PMI_RANK", temp_str, 1);
+				snprintf(temp_str, 1024, "%d", job -> size);
+				setenv("PMI_SIZE", temp_str, 1);
+				setenv("PMI_JOBID", job -> kvsname, 1);
+			}
+			if (enter_fs_namespace(par_wrapper) != 0)
+			{
+				print(PRNT_ERR, "Unable to set up the bind mounts for the fake file system\n");
+				exit(11);
+			}
+			/* After entering the namespace, so that we land on the mount */
+			if (par_wrapper -> shared_fs != (char *)NULL && chdir(par_wrapper -> shared_fs) != 0)
+			{
+				print(PRNT_WARN, "Unable to change directory to %s\n", par_wrapper -> shared_fs);
+			}
+			int process_RC = execvp(par_wrapper -> executable[0], &par_wrapper -> executable[0]);
+			if (process_RC != 0)
+			{
+				print(PRNT_ERR, "%s\n", get_exec_error_msg(errno, par_wrapper -> executable[0]));
+			}
+			exit(process_RC);
+		}
+		/* I am the parent */
+		setpgid(pid, (i == 0) ? pid : par_wrapper -> local_pids[0]);
+		par_wrapper -> local_pids[i] = pid;
+		par_wrapper -> num_local_pids = i + 1;
+		if (i == 0)
+		{
+			par_wrapper -> child_pid = pid;
+			par_wrapper -> pgid = pid;
+		}
+		if (use_pmi)
+		{
+			close(fds[1]);
+			pmi_serve(par_wrapper, fds[0], job -> offset + i);
+		}
+	}
+	debug(PRNT_INFO, "Launched %d local processes (ranks %d-%d)\n", job -> num_local,
+		job -> offset, job -> offset + job -> num_local - 1);
+	return 0;
+}
+
+/**
+ * Wait for every local process to exit, or for the first one to fail
+ *
+ * Processes are reaped in the order they exit, so a failure is reported
+ * at once rather than after the processes launched before it exit. The
+ * survivors are torn down with the job.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return The first non-zero exit status (128 + signal if killed), otherwise 0
+ */
+int wait_local(parallel_wrapper *par_wrapper)
+{
+	int i;
+	int remaining = par_wrapper -> num_local_pids;
+	while (remaining > 0)
+	{
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (pid < 0)
+		{
+			break; /* No children left */
+		}
+		for (i = 0; i < par_wrapper -> num_local_pids; i++)
+		{
+			if (par_wrapper -> local_pids[i] == pid)
+			{
+				break;
+			}
+		}
+		if (i == par_wrapper -> num_local_pids)
+		{
+			continue; /* Not a local process */
+		}
+		remaining--;
+		int process_RC = 0;
+		if (WIFEXITED(status))
+		{
+			process_RC = WEXITSTATUS(status);
+		}
+		else if (WIFSIGNALED(status))
+		{
+			process_RC = 128 + WTERMSIG(status);
+		}
+		if (process_RC != 0)
+		{
+			return process_RC;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Report the exit status of the local processes to the master
+ *
+ * The EXITED command is retransmitted until the master acknowledges it
+ * (or the keep-alive timeout expires).
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param return_code The exit status of the local processes
+ * @return 0 on success, otherwise failure
+ */
+int report_exit(parallel_wrapper *par_wrapper, int return_code)
+{
+	int i;
+	uint32_t seq;
+	if (pending_add(par_wrapper -> pending, MASTER, &seq) != 0)
+	{
+		print(PRNT_ERR, "Unable to allocate a sequence number for EXITED\n");
+		return 1;
+	}
+	for (i = 0; i < 10 * par_wrapper -> timeout; i++)
+	{
+		exited(par_wrapper -> command_socket, seq, par_wrapper -> this_machine -> rank,
+			return_code, par_wrapper -> master -> ip_addr, par_wrapper -> master -> port);
+		if (pending_wait(par_wrapper -> pending, seq, 100000) == 0)
+		{
+			pending_remove(par_wrapper -> pending, seq);
+			return 0;
+		}
+	}
+	pending_remove(par_wrapper -> pending, seq);
+	print(PRNT_WARN, "Master did not acknowledge EXITED\n");
+	return 2;
+}
@@ -1,86 +1,357 @@
 /**
  * Logging utilities
+ *
+ * Messages are formatted into a per-thread buffer and pushed through a
+ * lock-free ring (bounded MPSC, one sequence number per slot) to a single
+ * writer thread, so handler threads never block on stdout/stderr. Until
+ * the writer runs, when the ring is full and in forked children, lines
+ * are written directly. Whatever is queued is written out at exit.
  */
 
-#define _GNU_SOURCE
 #include "log.h"
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
 
 int verbose = 0; /**< Verbose Flag */
+int log_json = 0; /**< Structured (JSON lines) output */
 
-/* Define functions for printing (both in the debug case and the non-debug case) */
-void print_message(enum PRINT_LEVEL type,  char *file, int line, __const char *__restrict __format, ...)
+/**
+ * A formatted line waiting for the writer
+ */
+typedef struct log_record
+{
+	uint64_t seq; /**< Ring position this slot is ready for (see log_push) */
+	int fd; /**< STDOUT_FILENO or STDERR_FILENO */
+	int length; /**< Length of text */
+	char text[LOG_LINE_MAX]; /**< The formatted line */
+} log_record;
+
+static log_record ring[LOG_RING_SLOTS];
+static uint64_t ring_head = 0; /**< Next slot to write out (writer only) */
+static uint64_t ring_tail = 0; /**< Next slot to fill */
+static sem_t ring_ready;
+static int writer_running = 0;
+static int draining = 0; /**< Held by whoever writes out the ring */
+static int forked = 0;
+static int debug_env = -1; /**< PARALLEL_DEBUG is set (-1: not looked up yet) */
+static __thread int in_drain = 0; /**< This thread holds draining */
+static __thread volatile int in_log = 0; /**< This thread is formatting, queueing or writing lines */
+static __thread char line[LOG_LINE_MAX];
+static __thread time_t stamp_time = (time_t) -1;
+static __thread int stamp_json = 0;
+static __thread char stamp[32];
+
+static void *log_writer(void *ptr);
+static void log_drain(void);
+static void log_forked(void);
+static int log_push(int fd, const char *text, int length);
+static int format_json(enum PRINT_LEVEL type, char *file, int line_number, const char *message);
+static void vlog_message(enum PRINT_LEVEL type, char *file, int line_number, const char *format, va_list args);
+
+/**
+ * Start the writer thread (lines are written directly until then)
+ *
+ * @return 0 on success, otherwise failure
+ */
+int log_start(void)
+{
+	int i;
+	pthread_t writer;
+	pthread_attr_t attr;
+	if (writer_running)
+	{
+		return 0;
+	}
+	for (i = 0; i < LOG_RING_SLOTS; i++)
+	{
+		ring[i].seq = i;
+	}
+	if (sem_init(&ring_ready, 0, 0) != 0)
+	{
+		return 1;
+	}
+	pthread_atfork(NULL, NULL, log_forked);
+	atexit(log_flush);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&writer, &attr, &log_writer, NULL) != 0)
+	{
+		pthread_attr_destroy(&attr);
+		return 2;
+	}
+	pthread_attr_destroy(&attr);
+	__atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Write out every queued line (at exit - the writer may be gone)
+ */
+void log_flush(void)
 {
-	time_t raw_time;
-	struct tm * time_info;
-	time (&raw_time);
-	time_info = localtime(&raw_time);
-	char *current_time = asctime(time_info);
-	/* Remove the mandatory \n at the end of the message */
-	int str_length = strlen(current_time);
-	if (str_length >= 2)
+	if (forked)
 	{
-		current_time[str_length - 6] = '\0';
+		return;
 	}
-	else
+	log_drain();
+}
+
+/**
+ * A forked child has no writer and must not repeat the parent's lines
+ */
+static void log_forked(void)
+{
+	forked = 1;
+	writer_running = 0;
+}
+
+/**
+ * The writer thread
+ */
+static void *log_writer(void *ptr)
+{
+	while ( 1 )
 	{
-		type = -1; /* Invalid type */
+		while (sem_wait(&ring_ready) != 0);
+		log_drain();
 	}
+	return NULL;
+}
 
+/**
+ * Write out the lines queued so far, batching consecutive lines to the
+ * same stream into one write
+ */
+static void log_drain(void)
+{
+	char batch[4 * LOG_LINE_MAX];
+	int length = 0;
+	int fd = -1;
+	if (in_drain)
+	{
+		return; /* exit() from a signal handler while writing */
+	}
+	in_log++;
+	while (__sync_lock_test_and_set(&draining, 1))
+	{
+		sched_yield();
+	}
+	in_drain = 1;
+	while ( 1 )
+	{
+		log_record *record = &ring[ring_head % LOG_RING_SLOTS];
+		int ready = __atomic_load_n(&record -> seq, __ATOMIC_ACQUIRE) == ring_head + 1;
+		if (length > 0 && (! ready || record -> fd != fd || length + record -> length > (int) sizeof(batch)))
+		{
+			if (write(fd, batch, length) < 0)
+			{
+				/* Nowhere left to report it */
+			}
+			length = 0;
+		}
+		if (! ready)
+		{
+			break;
+		}
+		fd = record -> fd;
+		memcpy(batch + length, record -> text, record -> length);
+		length += record -> length;
+		/* Hand the slot back to the producers (one lap later) */
+		__atomic_store_n(&record -> seq, ring_head + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+		ring_head++;
+	}
+	in_drain = 0;
+	__sync_lock_release(&draining);
+	in_log--;
+}
+
+/**
+ * Is this thread inside the logger ? (a signal handler must not jump
+ * out of it: a claimed slot would never be published)
+ */
+int log_busy(void)
+{
+	return in_log;
+}
+
+/**
+ * Queue a line for the writer, or write it directly
+ *
+ * @return 0 if queued, 1 if written directly
+ */
+static int log_push(int fd, const char *text, int length)
+{
+	log_record *record;
+	uint64_t position = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+	while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+	{
+		record = &ring[position % LOG_RING_SLOTS];
+		int64_t diff = (int64_t) (__atomic_load_n(&record -> seq, __ATOMIC_ACQUIRE) - position);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&ring_tail, &position, position + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				record -> fd = fd;
+				record -> length = length;
+				memcpy(record -> text, text, length);
+				__atomic_store_n(&record -> seq, position + 1, __ATOMIC_RELEASE);
+				sem_post(&ring_ready);
+				return 0;
+			}
+			/* position was reloaded by the failed exchange */
+		}
+		else if (diff < 0)
+		{
+			break; /* Full - the writer is behind */
+		}
+		else
+		{
+			position = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+		}
+	}
+	if (write(fd, text, length) < 0)
+	{
+		return 1;
+	}
+	return 1;
+}
+
+/**
+ * Format a message as one JSON object into the thread's line buffer
+ *
+ * @return The length of the line
+ */
+static int format_json(enum PRINT_LEVEL type, char *file, int line_number, const char *message)
+{
+	const char *level = type == PRNT_ERR ? "error" : (type == PRNT_WARN ? "warn" : "info");
+	int length = snprintf(line, LOG_LINE_MAX, "{\"time\":\"%s\",\"level\":\"%s\",\"file\":\"%s\",\"line\":%d,"
+		"\"thread\":%ld,\"msg\":\"", stamp, level, file, line_number, (long) syscall(SYS_gettid));
+	const char *c;
+	/* Leave room for the escapes and the closing "}\n */
+	for (c = message; *c != '\0' && length < LOG_LINE_MAX - 10; c++)
+	{
+		if (*c == '\n' && c[1] == '\0')
+		{
+			break;
+		}
+		if (*c == '"' || *c == '\\')
+		{
+			line[length++] = '\\';
+			line[length++] = *c;
+		}
+		else if (*c == '\n')
+		{
+			line[length++] = '\\';
+			line[length++] = 'n';
+		}
+		else if ((unsigned char) *c < 0x20)
+		{
+			length += snprintf(line + length, 7, "\\u%04x", (unsigned char) *c);
+		}
+		else
+		{
+			line[length++] = *c;
+		}
+	}
+	memcpy(line + length, "\"}\n", 3);
+	return length + 3;
+}
+
+/**
+ * Format a message and hand it to the writer
+ */
+static void vlog_message(enum PRINT_LEVEL type, char *file, int line_number, const char *format, va_list args)
+{
+	int length = 0;
+	int fd = (type == PRNT_ERR || type == PRNT_WARN) ? STDERR_FILENO : STDOUT_FILENO;
+	in_log++;
+	/* The time stamp only changes once a second */
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec != stamp_time || stamp_json != log_json)
+	{
+		struct tm time_info;
+		localtime_r(&now.tv_sec, &time_info);
+		strftime(stamp, sizeof(stamp), log_json ? "%Y-%m-%dT%H:%M:%S%z" : "%a %b %e %H:%M:%S", &time_info);
+		stamp_time = now.tv_sec;
+		stamp_json = log_json;
+	}
+	if (log_json)
+	{
+		char message[LOG_LINE_MAX];
+		vsnprintf(message, LOG_LINE_MAX, format, args);
+		length = format_json(type, file, line_number, message);
+		log_push(fd, line, length);
+		in_log--;
+		return;
+	}
 	/* NOTE: We assume that the message contains the return character */
 	switch (type)
 	{
 		case PRNT_ERR:
-			fprintf(stderr, "%s ERROR in %s:%d: ", current_time, file, line);
+			length = snprintf(line, LOG_LINE_MAX, "%s ERROR in %s:%d: ", stamp, file, line_number);
 			break;
 
 		case PRNT_WARN:
-			fprintf(stderr, "%s WARN in %s:%d: ", current_time, file, line);
+			length = snprintf(line, LOG_LINE_MAX, "%s WARN in %s:%d: ", stamp, file, line_number);
 			break;
 
 		case PRNT_INFO:
-			fprintf(stdout, "%s INFO: ", current_time);
+			length = snprintf(line, LOG_LINE_MAX, "%s INFO: ", stamp);
 			break;
 		default:
-			fprintf(stdout, "INFO: ");
+			length = snprintf(line, LOG_LINE_MAX, "INFO: ");
 			break;
-	}	
-	va_list args;
-	va_start(args, __format);
-	if (type == PRNT_ERR || type == PRNT_WARN)
+	}
+	if (length >= LOG_LINE_MAX)
 	{
-		vfprintf(stderr, __format, args);
+		length = LOG_LINE_MAX - 1;
 	}
-	else
+	length += vsnprintf(line + length, LOG_LINE_MAX - length, format, args);
+	if (length >= LOG_LINE_MAX)
 	{
-		/* Print to stdout */
-		vfprintf(stdout, __format, args);
+		/* Truncated - keep the line a line */
+		length = LOG_LINE_MAX - 1;
+		line[length - 1] = '\n';
 	}
+	log_push(fd, line, length);
+	in_log--;
+}
+
+/* Define functions for printing (both in the debug case and the non-debug case) */
+void print_message(enum PRINT_LEVEL type,  char *file, int line, __const char *__restrict __format, ...)
+{
+	va_list args;
+	va_start(args, __format);
+	vlog_message(type, file, line, __format, args);
 	va_end(args);
-	fflush(stdout);
-	fflush(stderr);
 }
 
 /* Print the message only if debugging is enabled
  * NOTE: There must be some environment variable 'PARALLEL_DEBUG'
- * that, if defined, we output values
+ * that, if defined, we output values (looked up once)
  */
 void debug_message(enum PRINT_LEVEL type,  char *file, int line, __const char *__restrict __format, ...)
 {
-	char *debug_val;
-	debug_val = getenv ("PARALLEL_DEBUG");
-	if (debug_val != NULL || type == PRNT_ERR || verbose)
+	if (debug_env < 0)
+	{
+		debug_env = getenv("PARALLEL_DEBUG") != NULL;
+	}
+	if (debug_env || type == PRNT_ERR || verbose)
 	{
 		va_list args;
 		va_start(args, __format);
-		char *expanded_string;
-		vasprintf(&expanded_string, __format, args);
-		print_message(type, file, line, expanded_string);
-		free(expanded_string);
+		vlog_message(type, file, line, __format, args);
 		va_end(args);
 	}
 }
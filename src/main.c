@@ -1,17 +1,31 @@
 #include "wrapper.h"
 #include "chirp_util.h"
 #include "scratch.h"
+#include "fake_fs.h"
+#include "namespace.h"
+#include "launcher.h"
+#include "pmi.h"
+#include "topology.h"
+#include "cgroup.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "trace.h"
+#include "flight.h"
+#include "netem.h"
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
-#include <pwd.h>
 
 /* Keep-alive mutex */
 pthread_mutex_t keep_alive_mutex;
 
 int main(int argc, char **argv)
 {
-	int RC;
+	int RC, span;
+	uint64_t entry_us = metrics_now_us();
+	/* The whole startup, up to the exec of the job */
+	int startup_span = trace_begin("startup");
 	pthread_attr_t attr;
 	default_pthead_attr(&attr);
 	pthread_mutex_init(&keep_alive_mutex, NULL);
@@ -29,6 +43,14 @@ int main(int argc, char **argv)
 	signal(SIGINT, handle_exit_signal);
 	signal(SIGTERM, handle_exit_signal);
 	signal(SIGHUP, handle_exit_signal);
+	signal(SIGUSR1, handle_dump_signal);
+	/* Hand log lines to a writer thread */
+	if (log_start() != 0)
+	{
+		print(PRNT_WARN, "Unable to start the log writer - logging directly\n");
+	}
+
+	arena_init(&par_wrapper -> job_arena, NULL, 0, 0, 1);
 
 	/* Create structures for this machine */
 	par_wrapper -> this_machine = calloc(1, sizeof(struct machine));
@@ -48,32 +70,26 @@ int main(int argc, char **argv)
 	par_wrapper -> pgid = -1;
 	par_wrapper -> ka_interval = KA_INTERVAL;
 	par_wrapper -> timeout = TIMEOUT;
+	par_wrapper -> bind_policy = BIND_COMPACT;
+	par_wrapper -> sample_interval = SAMPLE_INTERVAL;
 	/* Default mutex state */
 	pthread_mutex_init(&par_wrapper -> mutex, NULL);
-	/* Allocate a list of symlinks */
-	par_wrapper -> symlinks = sll_get_list();
+	pthread_cond_init(&par_wrapper -> cond, NULL);
+	/* Allocate the set of symlinks */
+	par_wrapper -> symlinks = hash_set_get();
+	par_wrapper -> mount_points = hash_set_get();
+	par_wrapper -> created_dirs = hash_set_get();
 	/* Get the initial working directory */
 	par_wrapper -> this_machine -> iwd = getcwd(NULL, 0); /* Allocates space */
-	/* Determine our name */
-	uid_t uid = getuid();
-	struct passwd *user_stats = getpwuid(uid);
-	if (user_stats == (struct passwd *)NULL)
-	{
-		print(PRNT_WARN, "Unable to determine the name of the current user - assuming 'nobody'\n");
-		par_wrapper -> this_machine -> user = strdup("nobody");
-	}
-	else
-	{
-		par_wrapper -> this_machine -> user = strdup(user_stats -> pw_name);	
-
-	}
 
 	/* Parse environment variables and command line arguments */
+	span = trace_begin("parse_args");
 	parse_environment_vars(par_wrapper);
 	parse_args(argc, argv, par_wrapper);
 
 	/* Set the environment variables */
 	set_environment_vars(par_wrapper);
+	trace_end(span);
 
 	/* Check that required values are filled in */
 	if (par_wrapper -> this_machine -> rank < 0)
@@ -88,6 +104,37 @@ int main(int argc, char **argv)
 			par_wrapper -> num_procs);
 		return 2;
 	}
+	/* Start the metrics clock (registration times are measured from here) */
+	if (metrics_init(par_wrapper -> this_machine -> rank == MASTER ? par_wrapper -> num_procs : 0) != 0)
+	{
+		print(PRNT_ERR, "Unable to allocate space for metrics\n");
+		return 2;
+	}
+	flight_init(par_wrapper -> this_machine -> rank);
+	if (netem_init(par_wrapper -> netem_spec, par_wrapper -> this_machine -> rank) != 0)
+	{
+		print(PRNT_ERR, "Invalid network emulation '%s'\n", par_wrapper -> netem_spec);
+		return 2;
+	}
+	if (trace_init(par_wrapper -> this_machine -> rank,
+		par_wrapper -> this_machine -> rank == MASTER ? par_wrapper -> num_procs : 0) != 0)
+	{
+		print(PRNT_ERR, "Unable to allocate space for the startup trace\n");
+		return 2;
+	}
+	/* Allocate the table of outstanding commands */
+	par_wrapper -> pending = pending_get_table(2 * par_wrapper -> num_procs);
+	if (par_wrapper -> pending == (pending_table *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for the pending request table\n");
+		return 2;
+	}
+	par_wrapper -> replay = replay_get_cache();
+	if (par_wrapper -> replay == (replay_cache *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for the replay cache\n");
+		return 2;
+	}
 	if (par_wrapper -> timeout <= (2*par_wrapper -> ka_interval))
 	{
 		print(PRNT_WARN, "Keep-alive interval and timeout too close. Using default values.\n");
@@ -96,7 +143,9 @@ int main(int argc, char **argv)
 	}
 
 	/* Get the IP address for this machine */
+	span = trace_begin("get_ip_addr");
 	par_wrapper -> this_machine -> ip_addr = get_ip_addr();
+	trace_end(span);
 	debug(PRNT_INFO, "IP Addr: %s\n", par_wrapper -> this_machine -> ip_addr);
 	if (par_wrapper -> this_machine -> ip_addr == (char *)NULL)
 	{
@@ -105,9 +154,11 @@ int main(int argc, char **argv)
 	}
 	
 	/* Get a command port for this machine */
+	span = trace_begin("bind_port");
 	RC = get_bound_dgram_socket_by_range(par_wrapper -> low_port, 
 		par_wrapper -> high_port, &par_wrapper -> this_machine -> port, 
 		&par_wrapper -> command_socket);		
+	trace_end(span);
 	if (RC != 0)
 	{
 		print(PRNT_ERR, "Unable to bind to command socket\n");
@@ -126,7 +177,10 @@ int main(int argc, char **argv)
 	{
 		par_wrapper -> master = par_wrapper -> this_machine;
 		par_wrapper -> machines = (machine **) calloc(par_wrapper -> num_procs, sizeof(machine *));
-		if (par_wrapper -> machines == (machine **)NULL)
+		par_wrapper -> machine_store = (machine *) arena_alloc(&par_wrapper -> job_arena,
+			par_wrapper -> num_procs * sizeof(machine));
+		if (par_wrapper -> machines == (machine **)NULL || par_wrapper -> machine_store == (machine *)NULL ||
+			rank_table_init(&par_wrapper -> ranks, &par_wrapper -> job_arena, par_wrapper -> num_procs) != 0)
 		{
 			print(PRNT_ERR, "Unable to allocate space for machines array\n");
 			return 3;
@@ -145,46 +199,124 @@ int main(int argc, char **argv)
 	}
 	
 	/* Create the scratch directory */
+	span = trace_begin("create_scratch");
 	create_scratch(par_wrapper);
+	trace_end(span);
 
 	/* Gather the necessary chirp information */
+	span = trace_begin("chirp_info");
 	RC = chirp_info(par_wrapper);
+	trace_end(span);
 	if (RC != 0)
 	{
 		print(PRNT_ERR, "Failure sending/recieving chirp information\n");
 		return 2;
 	}
 
+	/* Place the local processes (the map is registered with the master) */
+	span = trace_begin("cpu_bindings");
+	par_wrapper -> binding_nodes = (int *)calloc(par_wrapper -> this_machine -> cpus, sizeof(int));
+	if (par_wrapper -> binding_nodes == (int *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for NUMA nodes\n");
+		return 2;
+	}
+	par_wrapper -> bindings = get_bindings(par_wrapper -> bind_policy, par_wrapper -> this_machine -> cpus,
+		par_wrapper -> binding_nodes);
+	par_wrapper -> this_machine -> cpu_map = join_bindings(par_wrapper -> bindings, par_wrapper -> this_machine -> cpus);
+	debug(PRNT_INFO, "CPU map (%s): %s\n", bind_policy_name(par_wrapper -> bind_policy),
+		par_wrapper -> this_machine -> cpu_map == (char *)NULL ? "none" : par_wrapper -> this_machine -> cpu_map);
+	trace_end(span);
+
+	/* Give the processes we launch a cgroup of their own (before any threads exist) */
+	if (par_wrapper -> launch_mode != LAUNCH_MASTER || par_wrapper -> this_machine -> rank == MASTER)
+	{
+		span = trace_begin("cgroup_create");
+		cgroup_create(par_wrapper);
+		trace_end(span);
+	}
+
+	/* Telemetry of the job (SIGUSR1 writes out the MASTER's table through a pipe) */
+	par_wrapper -> telemetry = telemetry_get(par_wrapper -> this_machine -> rank == MASTER ? par_wrapper -> num_procs : 0);
+	if (par_wrapper -> telemetry == (struct telemetry *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for telemetry\n");
+		return 2;
+	}
+	if (pipe(dump_pipe) != 0)
+	{
+		print(PRNT_WARN, "Unable to create the telemetry request pipe\n");
+		dump_pipe[0] = dump_pipe[1] = -1;
+	}
+	else
+	{
+		int i;
+		for (i = 0; i < 2; i++)
+		{
+			fcntl(dump_pipe[i], F_SETFL, O_NONBLOCK);
+			fcntl(dump_pipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	}
+
+	/* The MASTER is rank 0 of its own table */
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		struct sockaddr_in self;
+		memset(&self, 0, sizeof(struct sockaddr_in));
+		self.sin_family = AF_INET;
+		self.sin_port = htons(par_wrapper -> this_machine -> port);
+		if (inet_pton(AF_INET, par_wrapper -> this_machine -> ip_addr, &self.sin_addr) != 1)
+		{
+			print(PRNT_ERR, "Unable to convert IP address %s\n", par_wrapper -> this_machine -> ip_addr);
+			return 3;
+		}
+		rank_table_register(&par_wrapper -> ranks, MASTER, &self, par_wrapper -> this_machine -> cpus);
+	}
+
 	/* Create the listener */
 	pthread_create(&par_wrapper -> listener, &attr, &udp_server, (void *)par_wrapper);
+	metrics_listening(entry_us);
+	if (par_wrapper -> sample_interval > 0)
+	{
+		pthread_t sampler;
+		pthread_attr_t sampler_attr;
+		default_pthead_attr(&sampler_attr);
+		pthread_attr_setdetachstate(&sampler_attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&sampler, &sampler_attr, &telemetry_sampler, (void *)par_wrapper) != 0)
+		{
+			print(PRNT_WARN, "Unable to start the telemetry sampler\n");
+		}
+	}
 
 	/* If I am the MASTER, wait for all ranks to register */
+	span = trace_begin("registration");
 	if (par_wrapper -> this_machine -> rank == MASTER)
 	{
 		int i, j;
+		/* Poll the table every 10ms (j counts the polls), rather than once a second */
+		const int polls_per_second = 100;
 		j = 0; /* Timeout = 0 */
 		while ( 1 )
 		{
 			int finished = 1;
 			for (i = 0; i < par_wrapper -> num_procs; i++)
 			{
-				if (par_wrapper -> machines[i] == NULL)
+				if (! rank_registered(&par_wrapper -> ranks, i))
 				{
 					finished = 0;
-				}
-				
-				if ((j % par_wrapper -> ka_interval) == 0 && par_wrapper -> machines[i] == NULL)
-				{
-					debug(PRNT_INFO, "Waiting for registration from rank %d\n", i);
+					if ((j % (par_wrapper -> ka_interval * polls_per_second)) == 0)
+					{
+						debug(PRNT_INFO, "Waiting for registration from rank %d\n", i);
+					}
 				}
 			}
 			j++; /* Waiting for timeout */
-			if (j >= par_wrapper -> timeout)
+			if (j >= par_wrapper -> timeout * polls_per_second)
 			{
 				finished = 1;
 				for (i = 0; i < par_wrapper -> num_procs; i++)
 				{
-					if (par_wrapper -> machines[i] == NULL)
+					if (! rank_registered(&par_wrapper -> ranks, i))
 					{
 						print(PRNT_WARN, "Rank %d not registered - giving up on it\n", i);
 					}
@@ -194,17 +326,22 @@ int main(int argc, char **argv)
 			{
 				break;
 			}
-			sleep(1);
+			usleep(1000000 / polls_per_second);
 		}
 		debug(PRNT_INFO, "Finished machine registration.\n", par_wrapper -> num_procs);
+		trace_end(span);
 		/* Create the machines file */
+		span = trace_begin("create_machine_file");
 		RC = create_machine_file(par_wrapper);
+		trace_end(span);
 		if (RC != 0)
 		{
 			print(PRNT_ERR, "Unable to create the machines files");
 			cleanup(par_wrapper, 5);
 		}
+		span = trace_begin("create_ssh_config");
 		RC = create_ssh_config(par_wrapper);
+		trace_end(span);
 		if (RC != 0)
 		{
 			print(PRNT_ERR, "Unable to create the machines files");
@@ -213,68 +350,43 @@ int main(int argc, char **argv)
 	}
 	else /* Register with the master */
 	{
-		struct timeval old_time = par_wrapper -> master -> last_alive;
+		uint32_t seq;
+		if (pending_add(par_wrapper -> pending, MASTER, &seq) != 0)
+		{
+			print(PRNT_ERR, "Unable to allocate a sequence number for REGISTER\n");
+			return 2;
+		}
 		while ( 1 )
 		{
-			RC = register_cmd(par_wrapper -> command_socket, par_wrapper -> this_machine -> rank,
+			RC = register_cmd(par_wrapper -> command_socket, seq, par_wrapper -> this_machine -> rank,
 				par_wrapper -> this_machine -> cpus,
-				par_wrapper -> this_machine -> iwd, par_wrapper -> this_machine -> user, par_wrapper -> master -> ip_addr, 
+				par_wrapper -> this_machine -> iwd, par_wrapper -> this_machine -> user,
+				par_wrapper -> this_machine -> cpu_map, par_wrapper -> master -> ip_addr, 
 				par_wrapper -> master -> port);		
-			sleep(1);
-			if (RC == 0 && 
-			   ((old_time.tv_sec != par_wrapper -> master -> last_alive.tv_sec) || 
-			   (old_time.tv_usec != par_wrapper -> master -> last_alive.tv_usec)))
+			/* Wait (up to one second) for the matching ACK */
+			if (RC == 0 && pending_wait(par_wrapper -> pending, seq, 1000000) == 0)
 			{
 				break;
 			}
-			debug(PRNT_INFO, "Waiting for ACK from mater\n"); 
+			if (RC != 0)
+			{
+				sleep(1);
+			}
+			debug(PRNT_INFO, "Waiting for ACK from master\n"); 
 			/* Retrieve chirp information (in case it changed since the last time) */
 			chirp_info(par_wrapper);
 		}
+		pending_remove(par_wrapper -> pending, seq);
+		trace_end(span);
 	}
 
 	/* MASTER - Identify unique hosts */
 	if (par_wrapper -> this_machine -> rank == MASTER)
 	{
-		int i, j;
-		for (i = 0; i < par_wrapper -> num_procs; i++)
-		{
-			if (par_wrapper -> machines[i] == (machine *)NULL)
-			{
-				continue;
-			}
-			/* All machines are initially unique */
-			par_wrapper -> machines[i] -> unique = 1; 
-		}
-		for (i = 0; i < par_wrapper -> num_procs; i++)
-		{
-			if (par_wrapper -> machines[i] == (machine *)NULL)
-			{
-				continue;
-			}
-			if (par_wrapper -> machines[i] -> unique == 0)
-			{
-				continue; /* This host is already not unique */
-			}
-			for (j = i + 1; j < par_wrapper -> num_procs; j++)
-			{
-				if (par_wrapper -> machines[j] == (machine *)NULL)
-				{
-					continue;
-				}
-				if (par_wrapper -> machines[j] -> unique == 0)
-				{
-					continue; /* This host is already not unique */
-				}	
-				if (strcmp(par_wrapper -> machines[i] -> ip_addr, par_wrapper -> machines[j] -> ip_addr) == 0)
-				{
-					par_wrapper -> machines[j] -> unique = 0;
-					debug(PRNT_INFO, "Rank %d (%s:%d) is not unique (some host as %d).\n", 
-							j, par_wrapper -> machines[j] -> ip_addr, 
-							par_wrapper -> machines[j] -> port, i);
-				}	
-			}
-		}
+		span = trace_begin("unique_hosts");
+		int unique = rank_table_find_unique(&par_wrapper -> ranks);
+		debug(PRNT_INFO, "%d unique hosts.\n", unique);
+		trace_end(span);
 	}
 	
 	int shared_fs = 1; /* Flag which denotes a shared fs */
@@ -301,32 +413,14 @@ int main(int argc, char **argv)
 			snprintf(fake_fs, 1024, "/tmp/condor_hydra_%d_%ld", par_wrapper -> cluster_id, 
 					(long)curr_time);
 			debug(PRNT_INFO, "Using fake file system (%s). IWD's across ranks differ\n", fake_fs);
-			for (i = 0; i < par_wrapper -> num_procs; i++)
+			char local_fs[1040];
+			snprintf(local_fs, 1040, "%s_local", fake_fs);
+			span = trace_begin("create_fake_fs");
+			create_fake_fs(par_wrapper, fake_fs, local_fs);
+			trace_end(span);
+			if (par_wrapper -> fs_mode == FS_MODE_BIND)
 			{
-				if (par_wrapper -> machines[i] == (machine *)NULL)
-				{
-					continue;
-				}
-				if (! par_wrapper -> machines[i] -> unique)
-				{
-					continue;
-				}
-				/* Send the command to create softlinks */
-				struct timeval old_time = par_wrapper -> machines[i] -> last_alive;
-				while ( 1 )
-				{
-					RC = create_link(par_wrapper -> command_socket, par_wrapper -> machines[i] -> iwd,
-							fake_fs, par_wrapper -> machines[i] -> ip_addr, 
-							par_wrapper -> machines[i] -> port);
-					usleep(100000); /* Sleep for 1/10th of a second */
-					if (RC == 0 && 
-					   ((old_time.tv_sec != par_wrapper -> machines[i] -> last_alive.tv_sec) || 
-					   (old_time.tv_usec != par_wrapper -> machines[i] -> last_alive.tv_usec)))
-					{
-						break;
-					}
-					debug(PRNT_INFO, "Waiting for ACK from rank %d\n", i);
-				}
+				par_wrapper -> local_fs = strdup(local_fs);
 			}
 			par_wrapper -> shared_fs = strdup(fake_fs);
 		}
@@ -339,9 +433,66 @@ int main(int argc, char **argv)
 	/* Unlock the keepalive mutex */
 	pthread_mutex_unlock(&keep_alive_mutex);
 
+	/* Every rank launches its own processes (under the PMI server in PMI mode) */
+	if (par_wrapper -> launch_mode == LAUNCH_PMI || par_wrapper -> launch_mode == LAUNCH_LOCAL)
+	{
+		if (par_wrapper -> this_machine -> rank == MASTER)
+		{
+			span = trace_begin("launch_job");
+			RC = launch_job(par_wrapper);
+			trace_end(span);
+			if (RC != 0)
+			{
+				print(PRNT_ERR, "Unable to launch the job\n");
+				cleanup(par_wrapper, 10);
+			}
+		}
+		else
+		{
+			/* Wait for the master to hand us our part of the job */
+			span = trace_begin("wait_launch");
+			pthread_mutex_lock(&par_wrapper -> mutex);
+			while (par_wrapper -> pmi == (struct pmi_job *)NULL)
+			{
+				pthread_cond_wait(&par_wrapper -> cond, &par_wrapper -> mutex);
+			}
+			pthread_mutex_unlock(&par_wrapper -> mutex);
+			trace_end(span);
+		}
+		span = trace_begin("launch_local");
+		RC = launch_local(par_wrapper);
+		trace_end(span);
+		trace_end(startup_span);
+		if (RC != 0)
+		{
+			print(PRNT_ERR, "Unable to launch the local processes\n");
+			cleanup(par_wrapper, 10);
+		}
+		flight_record(FLIGHT_STATE, FLIGHT_LAUNCHED, 0, par_wrapper -> num_local_pids, NULL);
+		trace_send(par_wrapper);
+		RC = wait_local(par_wrapper);
+		debug(PRNT_INFO, "Local processes exited with %d\n", RC);
+		if (par_wrapper -> this_machine -> rank == MASTER)
+		{
+			if (RC == 0)
+			{
+				pmi_wait_exited(par_wrapper);
+			}
+			cleanup(par_wrapper, RC);
+		}
+		report_exit(par_wrapper, RC);
+	}
 	/* Start up the MPI executable */
-	if (par_wrapper -> this_machine -> rank == MASTER)
+	else if (par_wrapper -> this_machine -> rank == MASTER)
 	{
+		/* The close-on-exec pipe reaches EOF once the child has exec'd (or exited) */
+		int exec_pipe[2] = {-1, -1};
+		if (pipe(exec_pipe) == 0)
+		{
+			fcntl(exec_pipe[0], F_SETFD, FD_CLOEXEC);
+			fcntl(exec_pipe[1], F_SETFD, FD_CLOEXEC);
+		}
+		span = trace_begin("exec");
 		par_wrapper -> child_pid = fork();
 		if (par_wrapper -> child_pid == (pid_t) -1)
 		{
@@ -352,56 +503,18 @@ int main(int argc, char **argv)
 		{
 			/* I am the child */
 			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			/* Lead a new group (also done by the parent, whichever runs first) */
+			setpgid(0, 0);
+			cgroup_enter(par_wrapper);
 			/* Set environment variables */
-			char *machine_file = join_paths(par_wrapper -> scratch_dir, MACHINE_FILE);
-			char *ssh_config = join_paths(par_wrapper -> scratch_dir, SSH_CONFIG);
-			setenv("MACHINE_FILE", machine_file, 1); 
-			setenv("SSH_CONFIG", ssh_config, 1);
-		   	free(machine_file);
-			free(ssh_config);	
-			char *ssh_wrapper = join_paths(par_wrapper -> scratch_dir, SSH_WRAPPER);
-			setenv("SSH_WRAPPER", ssh_wrapper, 1);
-			free(ssh_wrapper);
-			char temp_str[1024];
-			
-			snprintf(temp_str, 1024, "%d", par_wrapper -> num_procs);
-			setenv("NUM_MACHINES", temp_str, 1);
-		
-			/* Determine the total number of cpus allocated to this task */
-			int total_cpus = 0;
-			int i;
-			for (i = 0; i < par_wrapper -> num_procs; i++)
+			set_job_environment(par_wrapper);
+
+			/* Present the fake FS through bind mounts */
+			if (enter_fs_namespace(par_wrapper) != 0)
 			{
-				if (par_wrapper -> machines[i] == (machine *)NULL)
-				{
-					continue;
-				}
-				total_cpus += par_wrapper -> machines[i] -> cpus;
+				print(PRNT_ERR, "Unable to set up the bind mounts for the fake file system\n");
+				exit(11);
 			}
-			snprintf(temp_str, 1024, "%d", total_cpus);
-			setenv("CPUS", temp_str, 1);
-			setenv("NUM_PROCS", temp_str, 1);
-
-			snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> rank);
-			setenv("RANK", temp_str, 1);
-			
-			snprintf(temp_str, 1024, "%d", par_wrapper -> cluster_id);
-			setenv("CLUSTER_ID", temp_str, 1);
-			
-			snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> port);
-			setenv("CMD_PORT", temp_str, 1);
-			
-			snprintf(temp_str, 1024, "%d", par_wrapper -> this_machine -> cpus);
-			setenv("REQUEST_CPUS", temp_str, 1);
-
-			setenv("SCRATCH_DIR", par_wrapper -> scratch_dir, 1);
-			setenv("IWD", par_wrapper -> this_machine -> iwd, 1);
-			setenv("IP_ADDR", par_wrapper -> this_machine -> ip_addr, 1);
-			setenv("TRANSFER_FILES", shared_fs != 0 ? "TRUE" : "FALSE", 1); 
-			setenv("SHARED_FS", shared_fs != 0 ? par_wrapper -> this_machine -> iwd : par_wrapper -> shared_fs, 1);
-			setenv("SHARED_DIR", shared_fs != 0 ? par_wrapper -> this_machine -> iwd : par_wrapper -> shared_fs, 1);
-			setenv("SCHEDD_IWD", par_wrapper -> this_machine -> schedd_iwd, 1);
-			/* TODO: SSH ENVS */
 
 			/* Search in path */
 			int process_RC = execvp(par_wrapper -> executable[0], &par_wrapper -> executable[0]);
@@ -415,21 +528,45 @@ int main(int argc, char **argv)
 		{
 			/* I am the parent */
 			int child_status = 0;
+			char byte;
+			if (exec_pipe[1] >= 0)
+			{
+				close(exec_pipe[1]);
+				while (read(exec_pipe[0], &byte, 1) < 0 && errno == EINTR);
+				close(exec_pipe[0]);
+			}
+			trace_end(span);
+			trace_end(startup_span);
+			flight_record(FLIGHT_STATE, FLIGHT_LAUNCHED, 0, 1, NULL);
 			/* Create a new group for the child processes */
-			par_wrapper -> pgid = setpgid(par_wrapper -> child_pid, 
-					par_wrapper -> child_pid);			
-			if (par_wrapper -> pgid < 0)
+			if (setpgid(par_wrapper -> child_pid, par_wrapper -> child_pid) != 0 &&
+				getpgid(par_wrapper -> child_pid) != par_wrapper -> child_pid)
 			{
 				print(PRNT_WARN, "Unable to set process group for children\n");
 			}
+			else
+			{
+				par_wrapper -> pgid = par_wrapper -> child_pid;
+			}
 			
 			waitpid(par_wrapper -> child_pid, &child_status, WUNTRACED); /* Wait for the child to finish */
 			cleanup(par_wrapper, child_status);
 		}
 	}
+	else
+	{
+		/* The MASTER runs the job - this rank is started once registered */
+		trace_end(startup_span);
+		trace_send(par_wrapper);
+	}
 
 	/* Always wait for the listener */
 	pthread_join(par_wrapper -> listener, NULL);
+	/* A TERM cancels the listener - let its cleanup finish and exit */
+	if (cleaning_up)
+	{
+		pthread_exit(NULL);
+	}
 
 	return 0;
 }
@@ -0,0 +1,564 @@
+/**
+ * Control-plane metrics
+ *
+ * Packets sent and received per command, retransmits, handler latency
+ * per command, registration time and keep-alive round trip per rank, and
+ * the duration of the teardown. Counters are striped per thread and
+ * histograms are updated with atomic adds, so the hot paths never take a
+ * lock. A snapshot is written in Prometheus text format (or JSON, when
+ * the file name ends in ".json") on SIGUSR1 and at exit.
+ */
+
+#include "metrics.h"
+#include "udp.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/**
+ * Recently sent sequence numbers (for spotting retransmits)
+ */
+#define METRICS_RECENT (1024u)
+
+static metrics_shard shards[METRICS_SHARDS];
+static histogram handler_us[METRICS_COMMANDS];
+static histogram rtt_us;
+static metrics_rank *ranks = NULL;
+static int num_ranks = 0;
+static pthread_mutex_t ranks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t recent[METRICS_RECENT];
+static uint64_t start_us = 0;
+static uint64_t teardown_start_us = 0;
+static uint64_t teardown_us = 0;
+static uint64_t startup_us = 0;
+static double listening_at = 0;
+static int next_shard = 0;
+static __thread int shard = -1;
+
+static metrics_shard *get_shard(void);
+static int bucket_index(uint64_t value);
+static uint64_t bucket_limit(int index);
+static const char *command_name(int command);
+static int write_prometheus(FILE *fp, metrics_shard *total);
+static int write_json(FILE *fp, metrics_shard *total);
+
+/**
+ * Start the metrics clock and allocate the per-rank table
+ *
+ * @param count The number of ranks (MASTER), or 0
+ * @return 0 on success, otherwise failure
+ */
+int metrics_init(int count)
+{
+	start_us = metrics_now_us();
+	if (count <= 0)
+	{
+		return 0;
+	}
+	ranks = (metrics_rank *)calloc(count, sizeof(metrics_rank));
+	if (ranks == (metrics_rank *)NULL)
+	{
+		return 1;
+	}
+	num_ranks = count;
+	return 0;
+}
+
+/**
+ * Returns a monotonic timestamp in microseconds
+ */
+uint64_t metrics_now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+/**
+ * Count a packet about to be sent ("<CMD>:<SEQ>[:<ARGS>]")
+ *
+ * A command sent with a sequence number that was recently sent already
+ * is counted as a retransmit (ACKs and QUERYs are never retransmitted).
+ */
+void metrics_count_sent(const char *message)
+{
+	char *next;
+	long int command = strtol(message, &next, 10);
+	if (next == message || command < 0 || command >= METRICS_COMMANDS)
+	{
+		return;
+	}
+	metrics_shard *stripe = get_shard();
+	__sync_fetch_and_add(&stripe -> sent[command], 1);
+	if (command == CMD_ACK || command == CMD_QUERY || *next != ':')
+	{
+		return;
+	}
+	uint32_t seq = (uint32_t) strtoul(next + 1, NULL, 10);
+	if (seq != 0 && __sync_lock_test_and_set(&recent[seq & (METRICS_RECENT - 1)], seq) == seq)
+	{
+		__sync_fetch_and_add(&stripe -> retransmits, 1);
+	}
+}
+
+/**
+ * Count a packet received on the command socket
+ */
+void metrics_count_received(int command)
+{
+	if (command < 0 || command >= METRICS_COMMANDS)
+	{
+		return;
+	}
+	__sync_fetch_and_add(&get_shard() -> received[command], 1);
+}
+
+/**
+ * Record how long the handler of a command ran
+ */
+void metrics_record_handler(int command, uint64_t usec)
+{
+	if (command < 0 || command >= METRICS_COMMANDS)
+	{
+		return;
+	}
+	histogram_record(&handler_us[command], usec);
+}
+
+/**
+ * Record the time from startup to the first REGISTER of a rank (MASTER only)
+ */
+void metrics_registered(int rank)
+{
+	if (rank < 0 || rank >= num_ranks)
+	{
+		return;
+	}
+	pthread_mutex_lock(&ranks_mutex);
+	if (ranks[rank].registered_us == 0)
+	{
+		ranks[rank].registered_us = metrics_now_us() - start_us + 1;
+	}
+	pthread_mutex_unlock(&ranks_mutex);
+}
+
+/**
+ * Note the keep-alive QUERY sent to a rank (MASTER only)
+ */
+void metrics_query_sent(int rank, uint32_t seq)
+{
+	if (rank < 0 || rank >= num_ranks)
+	{
+		return;
+	}
+	pthread_mutex_lock(&ranks_mutex);
+	ranks[rank].query_seq = seq;
+	ranks[rank].query_sent_us = metrics_now_us();
+	pthread_mutex_unlock(&ranks_mutex);
+}
+
+/**
+ * Record the round trip of a keep-alive if the ACK answers the last QUERY
+ */
+void metrics_query_acked(int rank, uint32_t seq)
+{
+	if (rank < 0 || rank >= num_ranks)
+	{
+		return;
+	}
+	pthread_mutex_lock(&ranks_mutex);
+	metrics_rank *entry = &ranks[rank];
+	if (entry -> query_seq != seq || entry -> query_sent_us == 0)
+	{
+		pthread_mutex_unlock(&ranks_mutex);
+		return;
+	}
+	uint64_t rtt = metrics_now_us() - entry -> query_sent_us;
+	entry -> query_sent_us = 0; /* Only the first copy of the ACK counts */
+	entry -> rtt_count++;
+	entry -> rtt_sum_us += rtt;
+	entry -> rtt_last_us = rtt;
+	if (entry -> rtt_min_us == 0 || rtt < entry -> rtt_min_us)
+	{
+		entry -> rtt_min_us = rtt;
+	}
+	if (rtt > entry -> rtt_max_us)
+	{
+		entry -> rtt_max_us = rtt;
+	}
+	pthread_mutex_unlock(&ranks_mutex);
+	histogram_record(&rtt_us, rtt);
+}
+
+/**
+ * Mark that the command socket is being served
+ *
+ * The wall-clock time is kept as well, so that whoever exec'd the
+ * wrapper can measure exec-to-listening (dynamic loading included).
+ *
+ * @param entry_us When main was entered (metrics_now_us)
+ */
+void metrics_listening(uint64_t entry_us)
+{
+	struct timespec now;
+	startup_us = metrics_now_us() - entry_us;
+	clock_gettime(CLOCK_REALTIME, &now);
+	listening_at = now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Mark the start (finished = 0) or the end (finished = 1) of the teardown
+ */
+void metrics_teardown(int finished)
+{
+	if (! finished)
+	{
+		teardown_start_us = metrics_now_us();
+	}
+	else if (teardown_start_us != 0)
+	{
+		teardown_us = metrics_now_us() - teardown_start_us;
+	}
+}
+
+/**
+ * Add a value to a histogram (safe to call from any thread)
+ */
+void histogram_record(histogram *hist, uint64_t value)
+{
+	uint64_t max;
+	__sync_fetch_and_add(&hist -> buckets[bucket_index(value)], 1);
+	__sync_fetch_and_add(&hist -> count, 1);
+	__sync_fetch_and_add(&hist -> sum, value);
+	while ((max = hist -> max) < value && ! __sync_bool_compare_and_swap(&hist -> max, max, value));
+}
+
+/**
+ * Estimate a quantile of a histogram (the upper limit of its bucket)
+ *
+ * @param hist The histogram
+ * @param quantile The quantile (0.0 - 1.0)
+ * @return The estimate, or 0 for an empty histogram
+ */
+uint64_t histogram_quantile(const histogram *hist, double quantile)
+{
+	int i;
+	uint64_t seen = 0;
+	uint64_t target = (uint64_t) (quantile * hist -> count + 0.5);
+	if (hist -> count == 0)
+	{
+		return 0;
+	}
+	if (target == 0)
+	{
+		target = 1;
+	}
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += hist -> buckets[i];
+		if (seen >= target)
+		{
+			uint64_t limit = bucket_limit(i) - 1;
+			return (limit < hist -> max) ? limit : hist -> max;
+		}
+	}
+	return hist -> max;
+}
+
+/**
+ * Write a snapshot of the metrics
+ *
+ * @param path The file (JSON if it ends in ".json", otherwise Prometheus text)
+ * @return 0 on success, otherwise failure
+ */
+int metrics_write(const char *path)
+{
+	int i, j;
+	char temp[1040];
+	metrics_shard total;
+	memset(&total, 0, sizeof(metrics_shard));
+	for (i = 0; i < METRICS_SHARDS; i++)
+	{
+		for (j = 0; j < METRICS_COMMANDS; j++)
+		{
+			total.sent[j] += shards[i].sent[j];
+			total.received[j] += shards[i].received[j];
+		}
+		total.retransmits += shards[i].retransmits;
+	}
+	snprintf(temp, 1040, "%s.tmp", path);
+	FILE *fp = fopen(temp, "w");
+	if (fp == (FILE *)NULL)
+	{
+		print(PRNT_WARN, "Unable to write metrics to %s\n", temp);
+		return 1;
+	}
+	int length = strlen(path);
+	pthread_mutex_lock(&ranks_mutex);
+	if (length > 5 && strcmp(path + length - 5, ".json") == 0)
+	{
+		write_json(fp, &total);
+	}
+	else
+	{
+		write_prometheus(fp, &total);
+	}
+	pthread_mutex_unlock(&ranks_mutex);
+	fclose(fp);
+	if (rename(temp, path) != 0)
+	{
+		print(PRNT_WARN, "Unable to replace metrics file %s\n", path);
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Write a snapshot to file, or to METRICS_FILE in the scratch directory
+ *
+ * @return 0 on success, otherwise failure
+ */
+int metrics_dump(const char *file, const char *scratch_dir)
+{
+	char path[1024];
+	if (file != (char *)NULL)
+	{
+		return metrics_write(file);
+	}
+	if (scratch_dir == (char *)NULL)
+	{
+		return 1;
+	}
+	snprintf(path, 1024, "%s/%s", scratch_dir, METRICS_FILE);
+	return metrics_write(path);
+}
+
+/**
+ * Returns the counter stripe of the calling thread
+ */
+static metrics_shard *get_shard(void)
+{
+	if (shard < 0)
+	{
+		shard = __sync_fetch_and_add(&next_shard, 1) % METRICS_SHARDS;
+	}
+	return &shards[shard];
+}
+
+/**
+ * Returns the histogram bucket of a value
+ *
+ * Values below 2^HISTOGRAM_SUB_BITS have a bucket each; above that, the
+ * bucket is given by the exponent and the next HISTOGRAM_SUB_BITS bits.
+ */
+static int bucket_index(uint64_t value)
+{
+	int sub_buckets = 1 << HISTOGRAM_SUB_BITS;
+	if (value < (uint64_t) sub_buckets)
+	{
+		return (int) value;
+	}
+	int exponent = 63 - __builtin_clzll(value);
+	int index = (exponent - HISTOGRAM_SUB_BITS + 1) * sub_buckets +
+		(int) ((value >> (exponent - HISTOGRAM_SUB_BITS)) & (sub_buckets - 1));
+	return (index < HISTOGRAM_BUCKETS) ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Returns the (exclusive) upper limit of a histogram bucket
+ */
+static uint64_t bucket_limit(int index)
+{
+	int sub_buckets = 1 << HISTOGRAM_SUB_BITS;
+	if (index < sub_buckets)
+	{
+		return (uint64_t) index + 1;
+	}
+	int exponent = index / sub_buckets + HISTOGRAM_SUB_BITS - 1;
+	return (uint64_t) (sub_buckets + index % sub_buckets + 1) << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+/**
+ * Returns the name of a command (for labels), or NULL for unused values
+ */
+static const char *command_name(int command)
+{
+	switch (command)
+	{
+		case CMD_TERM: return "TERM";
+		case CMD_QUERY: return "QUERY";
+		case CMD_ACK: return "ACK";
+		case CMD_SEND_FILE: return "SEND_FILE";
+		case CMD_REGISTER: return "REGISTER";
+		case CMD_CREATE_LINK: return "CREATE_LINK";
+		case CMD_CREATE_LINKS: return "CREATE_LINKS";
+		case CMD_BIND_MOUNTS: return "BIND_MOUNTS";
+		case CMD_LAUNCH: return "LAUNCH";
+		case CMD_PMI_PUT: return "PMI_PUT";
+		case CMD_PMI_FENCE: return "PMI_FENCE";
+		case CMD_PMI_FENCE_DONE: return "PMI_FENCE_DONE";
+		case CMD_EXITED: return "EXITED";
+		case CMD_PMI_BCAST: return "PMI_BCAST";
+		case CMD_PMI_GET: return "PMI_GET";
+		case CMD_PMI_VALUE: return "PMI_VALUE";
+		case CMD_TRACE: return "TRACE";
+		default: return NULL;
+	}
+}
+
+/**
+ * Write the snapshot in the Prometheus text exposition format
+ */
+static int write_prometheus(FILE *fp, metrics_shard *total)
+{
+	int i, j;
+	const char *name;
+	fprintf(fp, "# HELP pw_uptime_seconds Time since the wrapper started\n");
+	fprintf(fp, "# TYPE pw_uptime_seconds gauge\n");
+	fprintf(fp, "pw_uptime_seconds %.6f\n", (metrics_now_us() - start_us) / 1e6);
+	fprintf(fp, "# HELP pw_startup_seconds Time from main to serving the command socket\n");
+	fprintf(fp, "# TYPE pw_startup_seconds gauge\n");
+	fprintf(fp, "pw_startup_seconds %.6f\n", startup_us / 1e6);
+	fprintf(fp, "# HELP pw_packets_sent_total Control-plane packets sent\n");
+	fprintf(fp, "# TYPE pw_packets_sent_total counter\n");
+	for (i = 0; i < METRICS_COMMANDS; i++)
+	{
+		if ((name = command_name(i)) != (char *)NULL)
+		{
+			fprintf(fp, "pw_packets_sent_total{command=\"%s\"} %llu\n", name, (unsigned long long) total -> sent[i]);
+		}
+	}
+	fprintf(fp, "# HELP pw_packets_received_total Control-plane packets received\n");
+	fprintf(fp, "# TYPE pw_packets_received_total counter\n");
+	for (i = 0; i < METRICS_COMMANDS; i++)
+	{
+		if ((name = command_name(i)) != (char *)NULL)
+		{
+			fprintf(fp, "pw_packets_received_total{command=\"%s\"} %llu\n", name, (unsigned long long) total -> received[i]);
+		}
+	}
+	fprintf(fp, "# HELP pw_retransmits_total Commands sent again after a missing ACK\n");
+	fprintf(fp, "# TYPE pw_retransmits_total counter\n");
+	fprintf(fp, "pw_retransmits_total %llu\n", (unsigned long long) total -> retransmits);
+
+	fprintf(fp, "# HELP pw_handler_latency_us Time spent in the handler of each command\n");
+	fprintf(fp, "# TYPE pw_handler_latency_us histogram\n");
+	for (i = 0; i < METRICS_COMMANDS; i++)
+	{
+		uint64_t seen = 0;
+		if ((name = command_name(i)) == (char *)NULL || handler_us[i].count == 0)
+		{
+			continue;
+		}
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+		{
+			if (handler_us[i].buckets[j] == 0)
+			{
+				continue;
+			}
+			seen += handler_us[i].buckets[j];
+			fprintf(fp, "pw_handler_latency_us_bucket{command=\"%s\",le=\"%llu\"} %llu\n", name,
+				(unsigned long long) (bucket_limit(j) - 1), (unsigned long long) seen);
+		}
+		fprintf(fp, "pw_handler_latency_us_bucket{command=\"%s\",le=\"+Inf\"} %llu\n", name,
+			(unsigned long long) handler_us[i].count);
+		fprintf(fp, "pw_handler_latency_us_sum{command=\"%s\"} %llu\n", name, (unsigned long long) handler_us[i].sum);
+		fprintf(fp, "pw_handler_latency_us_count{command=\"%s\"} %llu\n", name, (unsigned long long) handler_us[i].count);
+	}
+
+	if (num_ranks > 0)
+	{
+		fprintf(fp, "# HELP pw_registration_seconds Time from startup to the REGISTER of each rank\n");
+		fprintf(fp, "# TYPE pw_registration_seconds gauge\n");
+		for (i = 0; i < num_ranks; i++)
+		{
+			if (ranks[i].registered_us != 0)
+			{
+				fprintf(fp, "pw_registration_seconds{rank=\"%d\"} %.6f\n", i, (ranks[i].registered_us - 1) / 1e6);
+			}
+		}
+		fprintf(fp, "# HELP pw_keepalive_rtt_us Keep-alive round trip of each rank\n");
+		fprintf(fp, "# TYPE pw_keepalive_rtt_us gauge\n");
+		for (i = 0; i < num_ranks; i++)
+		{
+			if (ranks[i].rtt_count == 0)
+			{
+				continue;
+			}
+			fprintf(fp, "pw_keepalive_rtt_us{rank=\"%d\",stat=\"last\"} %llu\n", i, (unsigned long long) ranks[i].rtt_last_us);
+			fprintf(fp, "pw_keepalive_rtt_us{rank=\"%d\",stat=\"min\"} %llu\n", i, (unsigned long long) ranks[i].rtt_min_us);
+			fprintf(fp, "pw_keepalive_rtt_us{rank=\"%d\",stat=\"max\"} %llu\n", i, (unsigned long long) ranks[i].rtt_max_us);
+			fprintf(fp, "pw_keepalive_rtt_us{rank=\"%d\",stat=\"mean\"} %llu\n", i,
+				(unsigned long long) (ranks[i].rtt_sum_us / ranks[i].rtt_count));
+		}
+		fprintf(fp, "# HELP pw_keepalive_rtt_quantile_us Keep-alive round trip over all ranks\n");
+		fprintf(fp, "# TYPE pw_keepalive_rtt_quantile_us gauge\n");
+		fprintf(fp, "pw_keepalive_rtt_quantile_us{quantile=\"0.5\"} %llu\n", (unsigned long long) histogram_quantile(&rtt_us, 0.5));
+		fprintf(fp, "pw_keepalive_rtt_quantile_us{quantile=\"0.99\"} %llu\n", (unsigned long long) histogram_quantile(&rtt_us, 0.99));
+	}
+	if (teardown_us != 0)
+	{
+		fprintf(fp, "# HELP pw_teardown_seconds Duration of the teardown\n");
+		fprintf(fp, "# TYPE pw_teardown_seconds gauge\n");
+		fprintf(fp, "pw_teardown_seconds %.6f\n", teardown_us / 1e6);
+	}
+	return 0;
+}
+
+/**
+ * Write the snapshot as a JSON object
+ */
+static int write_json(FILE *fp, metrics_shard *total)
+{
+	int i;
+	int first = 1;
+	const char *name;
+	fprintf(fp, "{\n  \"uptime_s\": %.6f,\n  \"startup_s\": %.6f,\n  \"listening_at\": %.6f,\n  \"retransmits\": %llu,\n",
+		(metrics_now_us() - start_us) / 1e6, startup_us / 1e6, listening_at, (unsigned long long) total -> retransmits);
+	fprintf(fp, "  \"commands\": {");
+	for (i = 0; i < METRICS_COMMANDS; i++)
+	{
+		if ((name = command_name(i)) == (char *)NULL)
+		{
+			continue;
+		}
+		histogram *hist = &handler_us[i];
+		fprintf(fp, "%s\n    \"%s\": {\"sent\": %llu, \"received\": %llu, \"handler_us\": {\"count\": %llu, "
+			"\"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}}",
+			first ? "" : ",", name, (unsigned long long) total -> sent[i], (unsigned long long) total -> received[i],
+			(unsigned long long) hist -> count, (unsigned long long) (hist -> count ? hist -> sum / hist -> count : 0),
+			(unsigned long long) histogram_quantile(hist, 0.5), (unsigned long long) histogram_quantile(hist, 0.9),
+			(unsigned long long) histogram_quantile(hist, 0.99), (unsigned long long) hist -> max);
+		first = 0;
+	}
+	fprintf(fp, "\n  },\n  \"ranks\": [");
+	for (i = 0; i < num_ranks; i++)
+	{
+		fprintf(fp, "%s\n    {\"rank\": %d, \"registration_s\": ", i == 0 ? "" : ",", i);
+		if (ranks[i].registered_us != 0)
+		{
+			fprintf(fp, "%.6f", (ranks[i].registered_us - 1) / 1e6);
+		}
+		else
+		{
+			fprintf(fp, "null");
+		}
+		fprintf(fp, ", \"rtt_us\": {\"count\": %llu, \"last\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %llu}}",
+			(unsigned long long) ranks[i].rtt_count, (unsigned long long) ranks[i].rtt_last_us,
+			(unsigned long long) ranks[i].rtt_min_us, (unsigned long long) ranks[i].rtt_max_us,
+			(unsigned long long) (ranks[i].rtt_count ? ranks[i].rtt_sum_us / ranks[i].rtt_count : 0));
+	}
+	fprintf(fp, "\n  ],\n  \"teardown_s\": ");
+	if (teardown_us != 0)
+	{
+		fprintf(fp, "%.6f\n}\n", teardown_us / 1e6);
+	}
+	else
+	{
+		fprintf(fp, "null\n}\n");
+	}
+	return 0;
+}
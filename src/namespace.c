@@ -0,0 +1,337 @@
+/**
+ * Bind-mount mode for the fake shared file system
+ *
+ * Instead of a per-host symlink to the IWD, each host records a set of
+ * bind mounts. Processes launched by the wrapper enter a private mount
+ * namespace (inside an unprivileged user namespace when not running as
+ * root) in which the IWD is bind mounted onto the uniform fake FS path,
+ * so realpath() returns the same path on every host.
+ */
+
+#define _GNU_SOURCE
+#include "namespace.h"
+#include "string_util.h"
+#include <sched.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static int unshare_fs_namespace(void);
+static int write_file(const char *filename, const char *contents);
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw);
+
+/**
+ * Returns 1 if this host can create private mount namespaces, 0 otherwise
+ *
+ * The check is performed once (in a child process, since user namespaces
+ * cannot be created by a multithreaded process) and the result is cached.
+ */
+int fs_namespace_supported(void)
+{
+	static int supported = -1;
+	int status = 0;
+	if (supported >= 0)
+	{
+		return supported;
+	}
+	pid_t pid = fork();
+	if (pid == (pid_t) -1)
+	{
+		return 0; /* Do not cache - try again next time */
+	}
+	else if (pid == (pid_t) 0)
+	{
+		_exit(unshare_fs_namespace() == 0 ? 0 : 1);
+	}
+	if (waitpid(pid, &status, 0) != pid)
+	{
+		return 0;
+	}
+	supported = (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	if (! supported)
+	{
+		print(PRNT_WARN, "Unable to create a private mount namespace on this host\n");
+	}
+	return supported;
+}
+
+/**
+ * Record a bind mount from src onto dest for processes we launch
+ *
+ * The source is created (as a directory) if it does not exist, and the
+ * destination is created as an empty mount point. Anything created here
+ * is removed by cleanup_bind_mounts.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param src The directory to mount
+ * @param dest The mount point
+ * @return 0 on success, otherwise failure
+ */
+int add_bind_mount(parallel_wrapper *par_wrapper, char *src, char *dest)
+{
+	int i;
+	struct stat st;
+	if (! fs_namespace_supported())
+	{
+		return 6;
+	}
+	if (stat(src, &st) != 0)
+	{
+		if (mkdir(src, S_IRWXU) != 0)
+		{
+			print(PRNT_WARN, "Unable to create bind source %s\n", src);
+			return 3;
+		}
+		hash_set_add(par_wrapper -> created_dirs, src);
+	}
+	else if (! S_ISDIR(st.st_mode))
+	{
+		print(PRNT_WARN, "Bind source %s is not a directory\n", src);
+		return 3;
+	}
+	if (lstat(dest, &st) != 0)
+	{
+		if (mkdir(dest, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+		{
+			print(PRNT_WARN, "Unable to create mount point %s\n", dest);
+			return 4;
+		}
+		hash_set_add(par_wrapper -> mount_points, dest);
+	}
+	else if (! hash_set_contains(par_wrapper -> mount_points, dest))
+	{
+		print(PRNT_WARN, "Mount point %s already exists\n", dest);
+		return 4;
+	}
+
+	pthread_mutex_lock(&par_wrapper -> mutex);
+	for (i = 0; i < par_wrapper -> num_binds; i++)
+	{
+		if (strcmp(par_wrapper -> bind_dest[i], dest) == 0)
+		{
+			pthread_mutex_unlock(&par_wrapper -> mutex);
+			return 0; /* Already recorded */
+		}
+	}
+	char **bind_src = (char **)realloc(par_wrapper -> bind_src, (par_wrapper -> num_binds + 1) * sizeof(char *));
+	if (bind_src != (char **)NULL)
+	{
+		par_wrapper -> bind_src = bind_src;
+	}
+	char **bind_dest = (char **)realloc(par_wrapper -> bind_dest, (par_wrapper -> num_binds + 1) * sizeof(char *));
+	if (bind_dest != (char **)NULL)
+	{
+		par_wrapper -> bind_dest = bind_dest;
+	}
+	if (bind_src == (char **)NULL || bind_dest == (char **)NULL)
+	{
+		pthread_mutex_unlock(&par_wrapper -> mutex);
+		print(PRNT_WARN, "Unable to allocate space for bind mount\n");
+		return 5;
+	}
+	par_wrapper -> bind_src[par_wrapper -> num_binds] = strdup(src);
+	par_wrapper -> bind_dest[par_wrapper -> num_binds] = strdup(dest);
+	par_wrapper -> num_binds++;
+	pthread_mutex_unlock(&par_wrapper -> mutex);
+	return 0;
+}
+
+/**
+ * Forget the bind mount onto dest and remove its (empty) mount point
+ *
+ * Used when the master falls back to symlinks at the same path.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param dest The mount point
+ * @return 0 if a mount point was removed, otherwise there was none
+ */
+int remove_bind_mount(parallel_wrapper *par_wrapper, const char *dest)
+{
+	int i;
+	pthread_mutex_lock(&par_wrapper -> mutex);
+	for (i = 0; i < par_wrapper -> num_binds; i++)
+	{
+		if (strcmp(par_wrapper -> bind_dest[i], dest) == 0)
+		{
+			free(par_wrapper -> bind_src[i]);
+			free(par_wrapper -> bind_dest[i]);
+			par_wrapper -> num_binds--;
+			par_wrapper -> bind_src[i] = par_wrapper -> bind_src[par_wrapper -> num_binds];
+			par_wrapper -> bind_dest[i] = par_wrapper -> bind_dest[par_wrapper -> num_binds];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&par_wrapper -> mutex);
+	if (hash_set_remove(par_wrapper -> mount_points, dest) != 0)
+	{
+		return 1;
+	}
+	if (rmdir(dest) != 0)
+	{
+		print(PRNT_WARN, "Unable to remove mount point %s\n", dest);
+	}
+	return 0;
+}
+
+/**
+ * Forget every bind mount and remove their mount points
+ *
+ * Used when the job falls back to symlinks, so that no host still enters
+ * a namespace or exports LOCAL_FS.
+ *
+ * @param par_wrapper The parallel wrapper
+ */
+void remove_bind_mounts(parallel_wrapper *par_wrapper)
+{
+	char dest[PATH_MAX];
+	while ( 1 )
+	{
+		pthread_mutex_lock(&par_wrapper -> mutex);
+		if (par_wrapper -> num_binds == 0)
+		{
+			pthread_mutex_unlock(&par_wrapper -> mutex);
+			return;
+		}
+		snprintf(dest, PATH_MAX, "%s", par_wrapper -> bind_dest[par_wrapper -> num_binds - 1]);
+		pthread_mutex_unlock(&par_wrapper -> mutex);
+		remove_bind_mount(par_wrapper, dest);
+	}
+}
+
+/**
+ * Enter a private mount namespace and apply the recorded bind mounts
+ *
+ * Must be called from a single-threaded process (i.e. a forked child)
+ * just before exec.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure
+ */
+int enter_fs_namespace(parallel_wrapper *par_wrapper)
+{
+	int i;
+	if (par_wrapper -> num_binds == 0)
+	{
+		return 0; /* Nothing to do */
+	}
+	if (unshare_fs_namespace() != 0)
+	{
+		print(PRNT_WARN, "Unable to enter a private mount namespace\n");
+		return 1;
+	}
+	for (i = 0; i < par_wrapper -> num_binds; i++)
+	{
+		if (mount(par_wrapper -> bind_src[i], par_wrapper -> bind_dest[i], NULL, 
+			MS_BIND | MS_REC, NULL) != 0)
+		{
+			print(PRNT_WARN, "Unable to bind mount %s onto %s: %s\n", par_wrapper -> bind_src[i],
+				par_wrapper -> bind_dest[i], strerror(errno));
+			return 2;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Remove the mount points and bind sources created by this wrapper
+ *
+ * @param par_wrapper The parallel wrapper
+ */
+void cleanup_bind_mounts(parallel_wrapper *par_wrapper)
+{
+	int i, num_dirs = 0;
+	char **dirs = hash_set_take_all(par_wrapper -> mount_points, &num_dirs);
+	for (i = 0; i < num_dirs; i++)
+	{
+		if (rmdir(dirs[i]) != 0)
+		{
+			print(PRNT_WARN, "Unable to remove mount point %s\n", dirs[i]);
+		}
+		free(dirs[i]);
+	}
+	free(dirs);
+	/* Bind sources we created (e.g. node-local tmpfs) may hold staged files */
+	dirs = hash_set_take_all(par_wrapper -> created_dirs, &num_dirs);
+	for (i = 0; i < num_dirs; i++)
+	{
+		if (nftw(dirs[i], remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+		{
+			print(PRNT_WARN, "Unable to remove directory %s\n", dirs[i]);
+		}
+		free(dirs[i]);
+	}
+	free(dirs);
+}
+
+/**
+ * Move the calling process into a new (private) mount namespace
+ *
+ * Unprivileged callers also create a user namespace that maps their own
+ * uid/gid, which is what allows the mount namespace to be created.
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int unshare_fs_namespace(void)
+{
+	char map[256];
+	uid_t uid = geteuid();
+	gid_t gid = getegid();
+	int flags = CLONE_NEWNS;
+	if (uid != 0)
+	{
+		flags |= CLONE_NEWUSER;
+	}
+	if (unshare(flags) != 0)
+	{
+		return 1;
+	}
+	if (uid != 0)
+	{
+		write_file("/proc/self/setgroups", "deny");
+		snprintf(map, 256, "%u %u 1\n", (unsigned int) uid, (unsigned int) uid);
+		if (write_file("/proc/self/uid_map", map) != 0)
+		{
+			return 2;
+		}
+		snprintf(map, 256, "%u %u 1\n", (unsigned int) gid, (unsigned int) gid);
+		if (write_file("/proc/self/gid_map", map) != 0)
+		{
+			return 3;
+		}
+	}
+	/* Do not propagate our mounts back to the host */
+	if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0)
+	{
+		return 4;
+	}
+	return 0;
+}
+
+/**
+ * Write a string to a (proc) file
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int write_file(const char *filename, const char *contents)
+{
+	int fd = open(filename, O_WRONLY);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	int length = strlen(contents);
+	int RC = (write(fd, contents, length) == length) ? 0 : 2;
+	close(fd);
+	return RC;
+}
+
+/**
+ * nftw callback which removes a single file or directory
+ */
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
@@ -0,0 +1,471 @@
+/**
+ * Network emulator of the UDP control plane
+ *
+ * Sits under the sends of network_util and the receive of the UDP
+ * server and impairs the packets to and from chosen peers: loss in
+ * either direction, a delay (uniform or long-tailed), duplication and
+ * reordering. Delayed packets are sent by a thread of their own. The
+ * impairments are drawn from a generator seeded per rank, so a run can
+ * be repeated. Configured with --netem; without it packets go straight
+ * to the socket.
+ *
+ * Spec: rules separated by ';', each a comma separated list of
+ *
+ *   peer=IP[:PORT] drop=P rx_drop=P dup=P reorder=P delay=MS jitter=MS
+ *   gap=MS dist=uniform|exp seed=N
+ *
+ * e.g. "drop=0.05,delay=2,jitter=8,dist=exp;peer=10.0.0.1,drop=0.5"
+ * (the one rule without a peer, if any, is the default).
+ */
+
+#include "netem.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static int parse_rule(char *text, netem_rule *rule, uint64_t *seed);
+static int parse_rate(const char *value, double *rate);
+static int parse_ms(const char *value, uint32_t *us);
+static const netem_rule *find_rule(const struct sockaddr *peer);
+static void enqueue(netem_packet *packet);
+static void *deliver(void *arg);
+static uint64_t now_us(void);
+static double next_random(void);
+
+static netem_rule rules[NETEM_RULES];
+static int num_rules = 0;
+static int delaying = 0; /**< A rule delays or reorders (the thread runs) */
+static uint64_t random_state = 0;
+static netem_packet *queue = NULL; /**< Delayed packets, by due time */
+static pthread_mutex_t netem_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netem_cond;
+static uint64_t dropped = 0;
+static uint64_t rx_dropped = 0;
+static uint64_t duplicated = 0;
+static uint64_t delayed = 0;
+static uint64_t reordered = 0;
+
+/**
+ * Parse the impairments and start the delivery thread
+ *
+ * @param spec The rules (NULL: no emulation)
+ * @param rank The rank of this wrapper (mixed into the seed)
+ * @return 0 on success, otherwise failure
+ */
+int netem_init(const char *spec, int rank)
+{
+	int i;
+	int defaults = 0;
+	uint64_t seed = 1;
+	char *save = NULL;
+	if (spec == (char *)NULL)
+	{
+		return 0;
+	}
+	char *copy = strdup(spec);
+	if (copy == (char *)NULL)
+	{
+		return 1;
+	}
+	char *text;
+	for (text = strtok_r(copy, ";", &save); text != (char *)NULL; text = strtok_r(NULL, ";", &save))
+	{
+		if (num_rules == NETEM_RULES)
+		{
+			print(PRNT_ERR, "At most %u network emulation rules\n", NETEM_RULES);
+			free(copy);
+			return 2;
+		}
+		if (parse_rule(text, &rules[num_rules], &seed) != 0)
+		{
+			free(copy);
+			return 3;
+		}
+		if (rules[num_rules].peer_addr == 0 && ++defaults > 1)
+		{
+			print(PRNT_ERR, "At most one network emulation rule without a peer\n");
+			free(copy);
+			return 5;
+		}
+		num_rules++;
+	}
+	free(copy);
+	/* Rules with a peer are tried first - move the defaults to the end */
+	for (i = 0; i < num_rules; i++)
+	{
+		int j;
+		for (j = num_rules - 1; j > i; j--)
+		{
+			if (rules[j - 1].peer_addr == 0 && rules[j].peer_addr != 0)
+			{
+				netem_rule swap = rules[j - 1];
+				rules[j - 1] = rules[j];
+				rules[j] = swap;
+			}
+		}
+		delaying |= rules[i].delay_us != 0 || rules[i].jitter_us != 0 || rules[i].reorder > 0;
+	}
+	/* Every rank gets a stream of its own */
+	random_state = (seed ^ ((uint64_t) (rank + 1) * 0x9e3779b97f4a7c15ull)) | 1;
+	if (delaying)
+	{
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_condattr_t cond_attr;
+		pthread_condattr_init(&cond_attr);
+		pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&netem_cond, &cond_attr);
+		pthread_condattr_destroy(&cond_attr);
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, &deliver, NULL) != 0)
+		{
+			print(PRNT_ERR, "Unable to start the network emulator thread\n");
+			pthread_attr_destroy(&attr);
+			return 4;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	print(PRNT_INFO, "Emulating network impairments: %s\n", spec);
+	return 0;
+}
+
+/**
+ * Send a packet through the emulator
+ *
+ * @return length if it was sent (or lost, or queued), -1 on failure
+ */
+int netem_sendto(int socketfd, const char *data, int length, const struct sockaddr *addr, socklen_t addr_len)
+{
+	int i;
+	const netem_rule *rule = find_rule(addr);
+	if (rule == (netem_rule *)NULL)
+	{
+		return sendto(socketfd, data, length, 0, addr, addr_len);
+	}
+	pthread_mutex_lock(&netem_mutex);
+	if (rule -> drop > 0 && next_random() < rule -> drop)
+	{
+		dropped++;
+		pthread_mutex_unlock(&netem_mutex);
+		debug(PRNT_INFO, "netem: dropped '%.*s'\n", length, data);
+		return length;
+	}
+	int copies = 1;
+	if (rule -> dup > 0 && next_random() < rule -> dup)
+	{
+		duplicated++;
+		copies = 2;
+	}
+	for (i = 0; i < copies; i++)
+	{
+		uint64_t delay = rule -> delay_us;
+		if (rule -> jitter_us != 0)
+		{
+			double spread = rule -> dist == NETEM_EXPONENTIAL ? -log(1.0 - next_random()) : next_random();
+			delay += (uint64_t) (spread * rule -> jitter_us);
+		}
+		if (rule -> reorder > 0 && next_random() < rule -> reorder)
+		{
+			reordered++;
+			delay += rule -> gap_us;
+		}
+		if (delay == 0)
+		{
+			pthread_mutex_unlock(&netem_mutex);
+			if (sendto(socketfd, data, length, 0, addr, addr_len) != length)
+			{
+				return -1;
+			}
+			pthread_mutex_lock(&netem_mutex);
+			continue;
+		}
+		netem_packet *packet = (netem_packet *) malloc(sizeof(netem_packet) + length);
+		if (packet == (netem_packet *)NULL)
+		{
+			pthread_mutex_unlock(&netem_mutex);
+			return -1;
+		}
+		packet -> due_us = now_us() + delay;
+		packet -> socketfd = socketfd;
+		packet -> addr_len = addr_len <= sizeof(struct sockaddr_storage) ? addr_len : sizeof(struct sockaddr_storage);
+		memcpy(&packet -> addr, addr, packet -> addr_len);
+		packet -> length = length;
+		memcpy(packet -> data, data, length);
+		delayed++;
+		enqueue(packet);
+	}
+	pthread_mutex_unlock(&netem_mutex);
+	return length;
+}
+
+/**
+ * Decide whether a packet just received is lost
+ *
+ * @param from The peer it came from
+ * @return 1 if it should be discarded, otherwise 0
+ */
+int netem_drop_received(const struct sockaddr *from)
+{
+	const netem_rule *rule = find_rule(from);
+	if (rule == (netem_rule *)NULL || rule -> rx_drop <= 0)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&netem_mutex);
+	int drop = next_random() < rule -> rx_drop;
+	rx_dropped += drop;
+	pthread_mutex_unlock(&netem_mutex);
+	return drop;
+}
+
+/**
+ * Print what the emulator did
+ */
+void netem_report(void)
+{
+	if (num_rules == 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&netem_mutex);
+	print(PRNT_INFO, "netem: %llu dropped, %llu dropped on receipt, %llu duplicated, %llu delayed, %llu reordered\n",
+		(unsigned long long) dropped, (unsigned long long) rx_dropped, (unsigned long long) duplicated,
+		(unsigned long long) delayed, (unsigned long long) reordered);
+	pthread_mutex_unlock(&netem_mutex);
+}
+
+/**
+ * Parse one rule ("key=value,...")
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_rule(char *text, netem_rule *rule, uint64_t *seed)
+{
+	char *save = NULL;
+	char *item;
+	memset(rule, 0, sizeof(netem_rule));
+	rule -> gap_us = NETEM_DEFAULT_GAP_US;
+	for (item = strtok_r(text, ",", &save); item != (char *)NULL; item = strtok_r(NULL, ",", &save))
+	{
+		int RC = 0;
+		char *value = strchr(item, '=');
+		if (value == (char *)NULL)
+		{
+			print(PRNT_ERR, "Network emulation setting '%s' has no value\n", item);
+			return 1;
+		}
+		*value++ = '\0';
+		if (strcmp(item, "peer") == 0)
+		{
+			char *port = strchr(value, ':');
+			if (port != (char *)NULL)
+			{
+				*port++ = '\0';
+				rule -> peer_port = (uint16_t) atoi(port);
+			}
+			RC = inet_pton(AF_INET, value, &rule -> peer_addr) != 1 || rule -> peer_addr == 0;
+		}
+		else if (strcmp(item, "drop") == 0)
+		{
+			RC = parse_rate(value, &rule -> drop);
+		}
+		else if (strcmp(item, "rx_drop") == 0)
+		{
+			RC = parse_rate(value, &rule -> rx_drop);
+		}
+		else if (strcmp(item, "dup") == 0)
+		{
+			RC = parse_rate(value, &rule -> dup);
+		}
+		else if (strcmp(item, "reorder") == 0)
+		{
+			RC = parse_rate(value, &rule -> reorder);
+		}
+		else if (strcmp(item, "delay") == 0)
+		{
+			RC = parse_ms(value, &rule -> delay_us);
+		}
+		else if (strcmp(item, "jitter") == 0)
+		{
+			RC = parse_ms(value, &rule -> jitter_us);
+		}
+		else if (strcmp(item, "gap") == 0)
+		{
+			RC = parse_ms(value, &rule -> gap_us);
+		}
+		else if (strcmp(item, "dist") == 0)
+		{
+			if (strcmp(value, "uniform") == 0)
+			{
+				rule -> dist = NETEM_UNIFORM;
+			}
+			else if (strcmp(value, "exp") == 0)
+			{
+				rule -> dist = NETEM_EXPONENTIAL;
+			}
+			else
+			{
+				RC = 1;
+			}
+		}
+		else if (strcmp(item, "seed") == 0)
+		{
+			*seed = strtoull(value, NULL, 0);
+		}
+		else
+		{
+			print(PRNT_ERR, "Unknown network emulation setting '%s'\n", item);
+			return 2;
+		}
+		if (RC != 0)
+		{
+			print(PRNT_ERR, "Invalid value '%s' of network emulation setting '%s'\n", value, item);
+			return 3;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Parse a fraction in [0, 1]
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_rate(const char *value, double *rate)
+{
+	char *end = NULL;
+	errno = 0;
+	double parsed = strtod(value, &end);
+	if (errno != 0 || end == value || *end != '\0' || parsed < 0 || parsed > 1)
+	{
+		return 1;
+	}
+	*rate = parsed;
+	return 0;
+}
+
+/**
+ * Parse milliseconds (fractions allowed) into microseconds
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_ms(const char *value, uint32_t *us)
+{
+	char *end = NULL;
+	errno = 0;
+	double parsed = strtod(value, &end);
+	if (errno != 0 || end == value || *end != '\0' || parsed < 0 || parsed > 3600000)
+	{
+		return 1;
+	}
+	*us = (uint32_t) (parsed * 1000);
+	return 0;
+}
+
+/**
+ * Returns the rule for a peer (NULL: none applies)
+ */
+static const netem_rule *find_rule(const struct sockaddr *peer)
+{
+	int i;
+	if (num_rules == 0 || peer == (struct sockaddr *)NULL || peer -> sa_family != AF_INET)
+	{
+		return NULL;
+	}
+	const struct sockaddr_in *address = (const struct sockaddr_in *) peer;
+	for (i = 0; i < num_rules; i++)
+	{
+		if ((rules[i].peer_addr == 0 || rules[i].peer_addr == address -> sin_addr.s_addr) &&
+			(rules[i].peer_port == 0 || rules[i].peer_port == ntohs(address -> sin_port)))
+		{
+			return &rules[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Insert a packet in due order (after those due at the same time) and
+ * wake the delivery thread (called with the lock held)
+ */
+static void enqueue(netem_packet *packet)
+{
+	netem_packet **link = &queue;
+	while (*link != (netem_packet *)NULL && (*link) -> due_us <= packet -> due_us)
+	{
+		link = &(*link) -> next;
+	}
+	packet -> next = *link;
+	*link = packet;
+	if (queue == packet)
+	{
+		pthread_cond_signal(&netem_cond);
+	}
+}
+
+/**
+ * The delivery thread - sends the delayed packets when they are due
+ */
+static void *deliver(void *arg)
+{
+	pthread_mutex_lock(&netem_mutex);
+	while ( 1 )
+	{
+		if (queue == (netem_packet *)NULL)
+		{
+			pthread_cond_wait(&netem_cond, &netem_mutex);
+			continue;
+		}
+		uint64_t now = now_us();
+		if (queue -> due_us > now)
+		{
+			struct timespec until;
+			until.tv_sec = queue -> due_us / 1000000;
+			until.tv_nsec = (queue -> due_us % 1000000) * 1000;
+			pthread_cond_timedwait(&netem_cond, &netem_mutex, &until);
+			continue;
+		}
+		netem_packet *packet = queue;
+		queue = packet -> next;
+		pthread_mutex_unlock(&netem_mutex);
+		if (sendto(packet -> socketfd, packet -> data, packet -> length, 0,
+			(struct sockaddr *)&packet -> addr, packet -> addr_len) != packet -> length)
+		{
+			debug(PRNT_WARN, "netem: unable to send a delayed packet\n");
+		}
+		free(packet);
+		pthread_mutex_lock(&netem_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Returns the monotonic time in microseconds
+ */
+static uint64_t now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Returns the next number in [0, 1) (xorshift64*, called with the lock held)
+ */
+static double next_random(void)
+{
+	uint64_t x = random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	random_state = x;
+	return ((x * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
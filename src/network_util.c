@@ -4,6 +4,9 @@
 
 #include "network_util.h"
 #include "log.h"
+#include "metrics.h"
+#include "flight.h"
+#include "netem.h"
 
 /**
  * Returns the IP address associated with this host.
@@ -378,7 +381,8 @@ int get_bound_dgram_socket_by_range(uint16_t start, uint16_t end, uint16_t *port
  * Sends a string to the destination IP and PORT via UDP
  *
  * Sends a null terminated string to an IP address on a particular port. The
- * passed socket file descriptor is used to send the string.
+ * passed socket file descriptor is used to send the string. A numeric IPv4
+ * address is used as-is; anything else is resolved with getaddrinfo.
  *
  * @param ip A string containing the IPv4 or IPv6 (or hostname) of the dest
  * @param port The destination port
@@ -409,6 +413,15 @@ int send_string_to_ip_port(char *ip, uint16_t port, char *string, int socketfd)
 		print(PRNT_ERR, "Invalid socket file descriptor\n");
 		return 2;
 	}
+	/* Peers are addressed by IP - only resolve real host names */
+	struct sockaddr_in numeric;
+	memset(&numeric, 0, sizeof(numeric));
+	if (inet_pton(AF_INET, ip, &numeric.sin_addr) == 1)
+	{
+		numeric.sin_family = AF_INET;
+		numeric.sin_port = htons(port);
+		return send_string_to_sockaddr((struct sockaddr *)&numeric, sizeof(numeric), string, socketfd);
+	}
 	/* Attempt to send the string */
 	memset(&hints, 0, sizeof(hints));
 	
@@ -424,11 +437,13 @@ int send_string_to_ip_port(char *ip, uint16_t port, char *string, int socketfd)
 	}
 	for (curr = info; curr != NULL; curr = curr -> ai_next)
 	{
-		int length = sendto(socketfd, string, str_len, 0, curr -> ai_addr,
+		int length = netem_sendto(socketfd, string, str_len, curr -> ai_addr,
 					curr -> ai_addrlen);
 		if (length == str_len)
 		{
 			freeaddrinfo(info);
+			metrics_count_sent(string);
+			flight_packet(FLIGHT_PACKET_OUT, string, curr -> ai_addr);
 			return 0;
 		}
 	}
@@ -487,3 +502,37 @@ int send_string_reply(const struct sockaddr *addr, char *string, int socketfd)
 	free(ip_addr);
 	return RC;
 }
+
+/**
+ * Sends the string directly to the address contained in addr
+ *
+ * Unlike send_string_reply, the address is used as-is; no IP string is
+ * formatted and no name resolution is performed.
+ *
+ * @param addr A sock addr structure
+ * @param addr_len The length of the sockaddr structure
+ * @param string The string to send
+ * @param socketfd The socket to send the message on
+ * @return 0 on success, otherwise failure
+ */
+int send_string_to_sockaddr(const struct sockaddr *addr, socklen_t addr_len, char *string, int socketfd)
+{
+	if (addr == (struct sockaddr *)NULL)
+	{
+		print(PRNT_ERR, "sockaddr structure is not valid\n");
+		return 1;
+	}
+	if (string == (char *)NULL)
+	{
+		return 0; /* Nothing to do */
+	}
+	int str_len = strlen(string);
+	if (netem_sendto(socketfd, string, str_len, addr, addr_len) != str_len)
+	{
+		print(PRNT_WARN, "Unable to send reply '%s'. Length error.\n", string);
+		return 2;
+	}
+	metrics_count_sent(string);
+	flight_packet(FLIGHT_PACKET_OUT, string, addr);
+	return 0;
+}
@@ -1,6 +1,7 @@
 #include "wrapper.h"
 #include "string_util.h"
 #include <getopt.h>
+#include <pwd.h>
 
 /**
  * Parse environment variables
@@ -14,6 +15,33 @@ void parse_environment_vars(parallel_wrapper *par_wrapper)
 	value = getenv("_CONDOR_NPROCS");
 	parse_integer(value, &par_wrapper -> num_procs);
 
+	/**
+	 * Our user name: from the environment, which avoids a lookup (a slow
+	 * directory service would delay every rank). Only when it is not set
+	 * is it resolved here, so the MASTER writes the SSH config without
+	 * asking NSS (which a static MASTER cannot load).
+	 */
+	value = getenv("USER");
+	if (value == (char *)NULL || value[0] == '\0')
+	{
+		value = getenv("LOGNAME");
+	}
+	if (value == (char *)NULL || value[0] == '\0')
+	{
+		struct passwd *entry = getpwuid(getuid());
+		value = entry == (struct passwd *)NULL ? NULL : entry -> pw_name;
+	}
+	if (value != (char *)NULL && value[0] != '\0')
+	{
+		par_wrapper -> this_machine -> user = strdup(value);
+	}
+	else
+	{
+		char uid[32];
+		print(PRNT_WARN, "Unable to determine the name of uid %u\n", (unsigned int) getuid());
+		snprintf(uid, sizeof(uid), "%u", (unsigned int) getuid());
+		par_wrapper -> this_machine -> user = strdup(uid);
+	}
 	return;
 }
 
@@ -25,17 +53,17 @@ void set_environment_vars(parallel_wrapper *par_wrapper)
 	/* Get the path variable */
 	int string_length = 2048; /* Minimum string length */
 	char *temp = getenv("PATH");
-	char *path = (char *) calloc(2048, sizeof(char));
+	if (temp != (char *)NULL)
+	{
+		string_length += strlen(temp);
+	}
+	char *path = (char *) calloc(string_length, sizeof(char));
 	if (path == (char *)NULL)
 	{
 		print(PRNT_WARN, "Unable to allocate space for new path variable\n");
 		return;
 	}
-	if (temp != (char *)NULL)
-	{
-		string_length += strlen(temp);
-	}
-	snprintf(path, string_length - 1, "%s:/usr/local/bin:/usr/bin:/bin:/usr/local/sbin:/usr/sbin:/sbin:.", temp == (char *)NULL ? "" : temp);
+	snprintf(path, string_length, "%s:/usr/local/bin:/usr/bin:/bin:/usr/local/sbin:/usr/sbin:/sbin:.", temp == (char *)NULL ? "" : temp);
 	setenv("PATH", path, 1); /* Replace path */
 	free(path);
 }
@@ -51,17 +79,27 @@ int parse_args(int argc, char **argv, parallel_wrapper *par_wrapper)
 		static struct option long_options[] = 
 		{
 			{"verbose", no_argument, &verbose, 1},
+			{"log-json", no_argument, &log_json, 1},
 			{"help", no_argument, 0, 'h'},
 			{"rank", required_argument, 0, 'r'},
 			{"ports", required_argument, 0, 'p'},
 			{"timeout", required_argument, 0, 't'},
 			{"ka-interval", required_argument, 0, 'k'},
+			{"fs-mode", required_argument, 0, 'f'},
+			{"launch", required_argument, 0, 'l'},
+			{"bind", required_argument, 0, 'b'},
+			{"mem-high", required_argument, 0, 'm'},
+			{"sample-interval", required_argument, 0, 's'},
+			{"telemetry", required_argument, 0, 'T'},
+			{"metrics", required_argument, 0, 'M'},
+			{"trace", required_argument, 0, 'x'},
+			{"netem", required_argument, 0, 'N'},
 			{"no-timeout", no_argument, &disable_timeout, 1},
 			{0, 0, 0, 0}
 		};
 		int option_index = 0;
 		/* The '+' make sure all arguments are processed in order */
-		c =getopt_long(argc, argv, "+hr:p:n:t:k:",
+		c =getopt_long(argc, argv, "+hr:p:n:t:k:f:l:b:m:s:T:M:x:N:",
 			   long_options, &option_index);
 		/* Detect the end of the options */
 		if (c == -1)
@@ -137,6 +175,96 @@ int parse_args(int argc, char **argv, parallel_wrapper *par_wrapper)
 					par_wrapper -> ka_interval = 1;
 				}
 				break;	
+			case 'f': /* Fake file system mode */
+				if (strcmp(optarg, "symlink") == 0)
+				{
+					par_wrapper -> fs_mode = FS_MODE_SYMLINK;
+				}
+				else if (strcmp(optarg, "bind") == 0)
+				{
+					par_wrapper -> fs_mode = FS_MODE_BIND;
+				}
+				else
+				{
+					print(PRNT_ERR, "Unknown file system mode %s\n", optarg);
+					help();
+					exit(1);
+				}
+				break;
+			case 'l': /* Launch mode */
+				if (strcmp(optarg, "master") == 0)
+				{
+					par_wrapper -> launch_mode = LAUNCH_MASTER;
+				}
+				else if (strcmp(optarg, "pmi") == 0)
+				{
+					par_wrapper -> launch_mode = LAUNCH_PMI;
+				}
+				else if (strcmp(optarg, "local") == 0)
+				{
+					par_wrapper -> launch_mode = LAUNCH_LOCAL;
+				}
+				else
+				{
+					print(PRNT_ERR, "Unknown launch mode %s\n", optarg);
+					help();
+					exit(1);
+				}
+				break;
+			case 'b': /* CPU binding policy */
+				if (strcmp(optarg, "none") == 0)
+				{
+					par_wrapper -> bind_policy = BIND_NONE;
+				}
+				else if (strcmp(optarg, "compact") == 0)
+				{
+					par_wrapper -> bind_policy = BIND_COMPACT;
+				}
+				else if (strcmp(optarg, "scatter") == 0)
+				{
+					par_wrapper -> bind_policy = BIND_SCATTER;
+				}
+				else if (strcmp(optarg, "socket") == 0)
+				{
+					par_wrapper -> bind_policy = BIND_SOCKET;
+				}
+				else
+				{
+					print(PRNT_ERR, "Unknown binding policy %s\n", optarg);
+					help();
+					exit(1);
+				}
+				break;
+			case 'm': /* memory.high of the job (MB) */
+				RC = parse_integer(optarg, &par_wrapper -> mem_high);
+				if (RC != 0 || par_wrapper -> mem_high < 0)
+				{
+					print(PRNT_ERR, "Unable to parse memory limit\n");
+					help();
+					exit(1);
+				}
+				break;
+			case 's': /* Telemetry sampling interval */
+				RC = parse_integer(optarg, &par_wrapper -> sample_interval);
+				if (RC != 0 || par_wrapper -> sample_interval < 0)
+				{
+					print(PRNT_ERR, "Unable to parse sampling interval\n");
+					help();
+					exit(1);
+				}
+				break;
+			case 'T': /* Telemetry table */
+				par_wrapper -> telemetry_file = strdup(optarg);
+				break;
+			case 'M': /* Metrics snapshot */
+				par_wrapper -> metrics_file = strdup(optarg);
+				break;
+			case 'x': /* Startup trace */
+				par_wrapper -> trace_file = strdup(optarg);
+				break;
+			case 'N': /* Network emulation */
+				par_wrapper -> netem_spec = strdup(optarg);
+				break;
 			default:
 				printf("\n");
 				help();
@@ -149,6 +277,13 @@ int parse_args(int argc, char **argv, parallel_wrapper *par_wrapper)
 		print(PRNT_ERR, "No executable passed to the wrapper\n");
 		exit(2);
 	}
+	/* Only processes started by a wrapper enter its mount namespace (not those mpiexec starts over ssh) */
+	if (par_wrapper -> fs_mode == FS_MODE_BIND && par_wrapper -> launch_mode == LAUNCH_MASTER)
+	{
+		print(PRNT_ERR, "The bind file system mode requires --launch=pmi or --launch=local\n");
+		help();
+		exit(1);
+	}
 
 	/** 
 	 * The length of the executable and its arguments is given by
@@ -175,6 +310,7 @@ void help(void)
 	printf("\n");
 	printf("Flags:\n");
 	printf(" --verbose                  verbose mode\n");
+	printf(" --log-json                 log one JSON object per line\n");
 	printf(" --no-timeout               disable aborts due to timeouts\n");
 	printf("\n");
 	
@@ -185,6 +321,38 @@ void help(void)
 	printf(" -p, --ports={low:high}     port range to use\n");
 	printf(" -t, --timeout={value}      set the execute timeouts (sec)\n");
 	printf(" -k, --ka-interval={value}  interval between subsequent keep-alives\n");
+	printf(" -f, --fs-mode={mode}       fake shared FS mode: 'symlink' (default)\n");
+	printf("                            or 'bind' (private mount namespace,\n");
+	printf("                            'pmi'/'local' launch only: processes\n");
+	printf("                            mpiexec starts over ssh would not see it)\n");
+	printf(" -l, --launch={mode}        'master' (default): rank 0 runs the\n");
+	printf("                            executable. 'pmi': every rank runs\n");
+	printf("                            [REQUEST_CPUS] copies of it under the\n");
+	printf("                            built-in PMI server. 'local': every\n");
+	printf("                            rank runs [REQUEST_CPUS] copies of it\n");
+	printf("                            without a PMI server\n");
+	printf(" -b, --bind={policy}        CPU binding of local processes ('pmi'/\n");
+	printf("                            'local'): 'compact' (default) fills one\n");
+	printf("                            socket core by core, 'scatter' spreads\n");
+	printf("                            over NUMA nodes, 'socket' binds to whole\n");
+	printf("                            sockets, 'none' leaves placement alone\n");
+	printf(" -m, --mem-high={MB}        memory.high of the job cgroup (default:\n");
+	printf("                            90%% of the enclosing memory.max)\n");
+	printf(" -s, --sample-interval={s}  seconds between telemetry samples of the\n");
+	printf("                            job (default 5, 0 disables telemetry)\n");
+	printf(" -T, --telemetry={file}     where rank 0 writes the per-rank usage\n");
+	printf("                            table (default: [SCRATCH_DIR]/telemetry)\n");
+	printf(" -M, --metrics={file}       control-plane metrics snapshot, written on\n");
+	printf("                            SIGUSR1 and at exit (JSON if the name ends\n");
+	printf("                            in .json, default: [SCRATCH_DIR]/metrics.prom)\n");
+	printf(" -x, --trace={file}         Chrome trace-event JSON of the startup\n");
+	printf("                            phases of every rank, written by rank 0\n");
+	printf("                            on SIGUSR1 and at exit (default:\n");
+	printf("                            [SCRATCH_DIR]/trace.json)\n");
+	printf(" -N, --netem={spec}         emulate loss, delay, duplication and\n");
+	printf("                            reordering of the control packets, e.g.\n");
+	printf("                            'drop=0.05,delay=2,jitter=8,dist=exp'\n");
+	printf("                            (see README)\n");
 	printf("\n");
 
 	printf("Environment Variables:\n");
@@ -216,6 +384,17 @@ void help(void)
 	printf("                            [TRANSFER_FILES]='FALSE', this is a 'fake'\n");
 	printf("                            shared FS\n");
 	printf(" [SHARED_DIR]               identical to [SHARED_FS]\n");
+	printf(" [FS_MODE]                  'symlink'/'bind' - how the fake shared\n");
+	printf("                            FS is presented\n");
+	printf(" [LOCAL_FS]                 node-local tmpfs directory (bind mode)\n");
+	printf(" [PMI_FD], [PMI_RANK],      PMI connection, rank, job size and\n");
+	printf(" [PMI_SIZE], [PMI_JOBID]    job id ('pmi' launch mode)\n");
+	printf(" [PROC_RANK]                global rank of this process ('pmi'/'local')\n");
+	printf(" [LOCAL_RANK], [LOCAL_SIZE] rank of this process on this host and\n");
+	printf("                            the number of processes on this host\n");
+	printf(" [BIND_POLICY], [CPU_MAP]   binding policy and the CPUs of each local\n");
+	printf("                            process, e.g. '0;1;2-3'\n");
+	printf(" [CPU_BIND], [NUMA_NODE]    CPUs and NUMA node of this process\n");
 	printf("\n");
 	printf("\n");
 	
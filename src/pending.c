@@ -0,0 +1,295 @@
+/**
+ * Pending request table
+ *
+ * Every command that expects an ACK is sent with a sequence number
+ * and recorded in this table. The listener completes the request when
+ * an ACK echoing the sequence number arrives from the expected rank.
+ * A request lives in slot (seq & mask), so lookups are O(1).
+ */
+
+#include "pending.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static void deadline_from_now(long int usec, struct timespec *deadline);
+
+/**
+ * Allocate a new pending request table
+ *
+ * @param slots The minimum number of simultaneously outstanding requests
+ * @return An initialized pending_table or NULL on error
+ */
+pending_table *pending_get_table(int slots)
+{
+	uint32_t size = PENDING_MIN_SLOTS;
+	while (slots > 0 && size < (uint32_t) slots)
+	{
+		size <<= 1;
+	}
+	pending_table *table = (pending_table *)calloc(1, sizeof(struct pending_table));
+	if (table == (pending_table *)NULL)
+	{
+		return NULL;
+	}
+	table -> requests = (pending_request *)calloc(size, sizeof(struct pending_request));
+	if (table -> requests == (pending_request *)NULL)
+	{
+		free(table);
+		return NULL;
+	}
+	table -> mask = size - 1;
+	table -> next_seq = 1; /* Sequence number 0 is never used */
+	pthread_mutex_init(&table -> mutex, NULL);
+	pthread_cond_init(&table -> cond, NULL);
+	return table;
+}
+
+/**
+ * Returns a fresh sequence number which is not tracked in the table
+ *
+ * Used for commands that do not expect a matched reply (e.g. QUERY)
+ *
+ * @param table The pending table
+ * @return A non-zero sequence number
+ */
+uint32_t pending_next_seq(pending_table *table)
+{
+	uint32_t seq;
+	if (table == (pending_table *)NULL)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	seq = table -> next_seq++;
+	if (seq == 0)
+	{
+		seq = table -> next_seq++;
+	}
+	pthread_mutex_unlock(&table -> mutex);
+	return seq;
+}
+
+/**
+ * Allocate a sequence number and record it as outstanding
+ *
+ * Sequence numbers whose slot is still occupied are skipped, so every
+ * outstanding request owns exactly one slot.
+ *
+ * @param table The pending table
+ * @param rank The rank the command will be sent to
+ * @param seq (output) The sequence number to send with the command
+ * @return 0 on success, otherwise failure (table full)
+ */
+int pending_add(pending_table *table, int rank, uint32_t *seq)
+{
+	uint32_t i;
+	if (table == (pending_table *)NULL || seq == (uint32_t *)NULL)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	for (i = 0; i <= table -> mask; i++)
+	{
+		uint32_t candidate = table -> next_seq++;
+		if (candidate == 0)
+		{
+			continue;
+		}
+		pending_request *request = &table -> requests[candidate & table -> mask];
+		if (request -> state != PENDING_FREE)
+		{
+			continue;
+		}
+		request -> seq = candidate;
+		request -> rank = rank;
+		request -> state = PENDING_WAITING;
+		pthread_mutex_unlock(&table -> mutex);
+		*seq = candidate;
+		return 0;
+	}
+	pthread_mutex_unlock(&table -> mutex);
+	print(PRNT_WARN, "Pending request table is full\n");
+	return 2;
+}
+
+/**
+ * Complete the outstanding request with the given sequence number
+ *
+ * @param table The pending table
+ * @param seq The sequence number echoed in the ACK
+ * @param rank The rank the ACK originated from
+ * @param status The status carried in the ACK (or NULL)
+ * @return 0 if a request was completed, otherwise no matching request
+ */
+int pending_complete(pending_table *table, uint32_t seq, int rank, const char *status)
+{
+	if (table == (pending_table *)NULL || seq == 0)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	pending_request *request = &table -> requests[seq & table -> mask];
+	if (request -> state != PENDING_WAITING || request -> seq != seq ||
+		request -> rank != rank)
+	{
+		pthread_mutex_unlock(&table -> mutex);
+		return 2;
+	}
+	request -> status[0] = '\0';
+	if (status != (char *)NULL)
+	{
+		strncpy(request -> status, status, PENDING_STATUS_LEN - 1);
+		request -> status[PENDING_STATUS_LEN - 1] = '\0';
+	}
+	request -> state = PENDING_DONE;
+	pthread_cond_broadcast(&table -> cond);
+	pthread_mutex_unlock(&table -> mutex);
+	return 0;
+}
+
+/**
+ * Returns 1 if the request has been answered, 0 otherwise
+ */
+int pending_is_done(pending_table *table, uint32_t seq)
+{
+	int done;
+	if (table == (pending_table *)NULL)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	pending_request *request = &table -> requests[seq & table -> mask];
+	done = (request -> seq == seq && request -> state == PENDING_DONE);
+	pthread_mutex_unlock(&table -> mutex);
+	return done;
+}
+
+/**
+ * Copy out the status returned with the ACK of a completed request
+ *
+ * @param table The pending table
+ * @param seq The sequence number of the request
+ * @param status (output) Buffer for the status string
+ * @param status_len The length of the status buffer
+ * @return 0 on success, otherwise the request has not been answered
+ */
+int pending_get_status(pending_table *table, uint32_t seq, char *status, size_t status_len)
+{
+	if (table == (pending_table *)NULL || status == (char *)NULL || status_len == 0)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	pending_request *request = &table -> requests[seq & table -> mask];
+	if (request -> seq != seq || request -> state != PENDING_DONE)
+	{
+		pthread_mutex_unlock(&table -> mutex);
+		return 2;
+	}
+	strncpy(status, request -> status, status_len - 1);
+	status[status_len - 1] = '\0';
+	pthread_mutex_unlock(&table -> mutex);
+	return 0;
+}
+
+/**
+ * Wait for a single request to be answered
+ *
+ * @param table The pending table
+ * @param seq The sequence number to wait on
+ * @param usec The maximum time to wait (microseconds)
+ * @return 0 if the request was answered, otherwise timeout
+ */
+int pending_wait(pending_table *table, uint32_t seq, long int usec)
+{
+	return pending_wait_all(table, &seq, 1, usec);
+}
+
+/**
+ * Wait for a set of requests to be answered
+ *
+ * Entries in seqs that are 0 are ignored.
+ *
+ * @param table The pending table
+ * @param seqs The sequence numbers to wait on
+ * @param count The length of seqs
+ * @param usec The maximum time to wait (microseconds)
+ * @return The number of requests that are still outstanding
+ */
+int pending_wait_all(pending_table *table, uint32_t *seqs, int count, long int usec)
+{
+	int i;
+	int outstanding = 0;
+	struct timespec deadline;
+	if (table == (pending_table *)NULL || seqs == (uint32_t *)NULL)
+	{
+		return count;
+	}
+	deadline_from_now(usec, &deadline);
+	pthread_mutex_lock(&table -> mutex);
+	while ( 1 )
+	{
+		outstanding = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (seqs[i] == 0)
+			{
+				continue;
+			}
+			pending_request *request = &table -> requests[seqs[i] & table -> mask];
+			if (request -> seq != seqs[i] || request -> state != PENDING_DONE)
+			{
+				outstanding++;
+			}
+		}
+		if (outstanding == 0)
+		{
+			break;
+		}
+		if (pthread_cond_timedwait(&table -> cond, &table -> mutex, &deadline) == ETIMEDOUT)
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&table -> mutex);
+	return outstanding;
+}
+
+/**
+ * Release the slot associated with a request
+ *
+ * @param table The pending table
+ * @param seq The sequence number to release
+ * @return 0 on success, otherwise failure
+ */
+int pending_remove(pending_table *table, uint32_t seq)
+{
+	if (table == (pending_table *)NULL)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&table -> mutex);
+	pending_request *request = &table -> requests[seq & table -> mask];
+	if (request -> seq != seq)
+	{
+		pthread_mutex_unlock(&table -> mutex);
+		return 2;
+	}
+	request -> state = PENDING_FREE;
+	pthread_mutex_unlock(&table -> mutex);
+	return 0;
+}
+
+/**
+ * Fill in an absolute deadline usec microseconds from now
+ */
+static void deadline_from_now(long int usec, struct timespec *deadline)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	long int total_usec = now.tv_usec + (usec % 1000000);
+	deadline -> tv_sec = now.tv_sec + (usec / 1000000) + (total_usec / 1000000);
+	deadline -> tv_nsec = (total_usec % 1000000) * 1000;
+}
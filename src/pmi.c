@@ -0,0 +1,1336 @@
+/**
+ * Built-in PMI server
+ *
+ * Every local process launched by the wrapper is connected to it with
+ * a socketpair (PMI_FD). A thread per process speaks the PMI-1 and PMI-2
+ * wire protocols. Puts are stored in the local key-value space, which
+ * also caches the keys of other ranks.
+ *
+ * Fences run over a PMI_TREE_ARITY-ary tree of the registered ranks
+ * rooted at the master. Once its local processes and every child have
+ * entered, a rank passes the new keys of its subtree to its parent with
+ * PMI_PUT and enters the fence there with PMI_FENCE. The root then
+ * broadcasts the new keys down the tree (PMI_BCAST) and completes the
+ * fence (PMI_FENCE_DONE), so the master only exchanges messages with its
+ * own children. When a fence produced more than PMI_BROADCAST_MAX keys
+ * they are not broadcast; a get that misses the local cache asks the
+ * parent (PMI_GET), which answers from its cache or asks its own parent,
+ * and the value is cached on the way down (PMI_VALUE).
+ */
+
+#include "pmi.h"
+#include "batch.h"
+#include "launcher.h"
+#include "string_util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+
+/**
+ * A single connected PMI client
+ */
+struct pmi_client
+{
+	parallel_wrapper *par_wrapper; /**< The parallel wrapper */
+	int fd; /**< The PMI socket */
+	int rank; /**< The global rank of the client */
+	int version; /**< The PMI version negotiated at init */
+	int start; /**< The first unread byte in buffer */
+	int end; /**< One past the last unread byte in buffer */
+	char buffer[PMI_LINE_MAX]; /**< Bytes read from the socket */
+};
+
+static void *serve_client(void *ptr);
+static int read_command(struct pmi_client *client, char *command, int command_len);
+static int handle_pmi1(struct pmi_client *client, char *command);
+static int handle_pmi2(struct pmi_client *client, char *command);
+static int get_pmi1_value(const char *command, const char *key, char *value, int value_len);
+static int get_pmi2_value(const char *command, const char *key, char *value, int value_len);
+static int reply_pmi2(struct pmi_client *client, const char *format, ...);
+static void escape_pmi2(char *value, int value_len);
+static int write_all(int fd, const char *buffer, int length);
+static int local_fence(parallel_wrapper *par_wrapper);
+static int try_advance(parallel_wrapper *par_wrapper, uint32_t epoch);
+static int pass_up(parallel_wrapper *par_wrapper, uint32_t epoch);
+static int release(parallel_wrapper *par_wrapper, uint32_t epoch);
+static int send_fence(parallel_wrapper *par_wrapper, CMD command, uint32_t epoch, machine **hosts, int count);
+static void escape_pairs(char **keys, char **values, int count);
+static void local_abort(parallel_wrapper *par_wrapper, int return_code);
+
+/**
+ * Allocate the PMI state of a job
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param offset The global rank of the first local process
+ * @param size The number of processes in the job
+ * @param num_local The number of local processes
+ * @param mapping The PMI process mapping
+ * @return An initialized pmi_job or NULL on error
+ */
+pmi_job *pmi_get_job(parallel_wrapper *par_wrapper, int offset, int size, int num_local, const char *mapping)
+{
+	pmi_job *job = (pmi_job *)calloc(1, sizeof(struct pmi_job));
+	if (job == (pmi_job *)NULL)
+	{
+		return NULL;
+	}
+	job -> store = kvs_get();
+	job -> node_store = kvs_get();
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		job -> rank_exited = (char *)calloc(par_wrapper -> num_procs, sizeof(char));
+	}
+	if (job -> store == (kvs *)NULL || job -> node_store == (kvs *)NULL ||
+		(par_wrapper -> this_machine -> rank == MASTER && job -> rank_exited == (char *)NULL))
+	{
+		print(PRNT_ERR, "Unable to allocate space for the PMI job\n");
+		kvs_free(job -> store);
+		kvs_free(job -> node_store);
+		free(job -> rank_exited);
+		free(job);
+		return NULL;
+	}
+	job -> offset = offset;
+	job -> size = size;
+	job -> num_local = num_local;
+	snprintf(job -> kvsname, PMI_KVSNAME_MAX, "condor_%d_kvs", par_wrapper -> cluster_id);
+	kvs_put(job -> store, PMI_PROCESS_MAPPING, mapping, 0);
+	pthread_mutex_init(&job -> mutex, NULL);
+	pthread_cond_init(&job -> cond, NULL);
+	return job;
+}
+
+/**
+ * Build the PMI process mapping of the job (MASTER only)
+ *
+ * Each registered rank is a node holding its CPU count of consecutive
+ * processes. Runs of ranks with the same CPU count are compressed into a
+ * single (start node, node count, processes per node) block.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return The (allocated) mapping, e.g. "(vector,(0,4,2))", or NULL on error
+ */
+char *pmi_process_mapping(parallel_wrapper *par_wrapper)
+{
+	int i;
+	int node = 0;
+	int block_start = 0;
+	int block_nodes = 0;
+	int block_cpus = -1;
+	char *mapping = (char *)calloc(MAX_MESSAGE + 1, sizeof(char));
+	if (mapping == (char *)NULL)
+	{
+		return NULL;
+	}
+	int length = snprintf(mapping, MAX_MESSAGE + 1, "(vector");
+	for (i = 0; i <= par_wrapper -> num_procs; i++)
+	{
+		machine *host = (i < par_wrapper -> num_procs) ? par_wrapper -> machines[i] : NULL;
+		if (i < par_wrapper -> num_procs && host == (machine *)NULL)
+		{
+			continue;
+		}
+		if (host != (machine *)NULL && host -> cpus == block_cpus)
+		{
+			block_nodes++;
+			node++;
+			continue;
+		}
+		if (block_nodes > 0)
+		{
+			length += snprintf(mapping + length, MAX_MESSAGE + 1 - length, ",(%d,%d,%d)",
+				block_start, block_nodes, block_cpus);
+		}
+		if (host != (machine *)NULL)
+		{
+			block_start = node;
+			block_nodes = 1;
+			block_cpus = host -> cpus;
+			node++;
+		}
+	}
+	snprintf(mapping + length, MAX_MESSAGE + 1 - length, ")");
+	if (length >= MAX_MESSAGE - 1)
+	{
+		print(PRNT_WARN, "PMI process mapping is too long\n");
+		free(mapping);
+		return NULL;
+	}
+	return mapping;
+}
+
+/**
+ * Serve a PMI client on fd (in a new detached thread)
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param fd The PMI socket of the client
+ * @param rank The global rank of the client
+ * @return 0 on success, otherwise failure
+ */
+int pmi_serve(parallel_wrapper *par_wrapper, int fd, int rank)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	struct pmi_client *client = (struct pmi_client *)calloc(1, sizeof(struct pmi_client));
+	if (client == (struct pmi_client *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for a PMI client\n");
+		return 1;
+	}
+	client -> par_wrapper = par_wrapper;
+	client -> fd = fd;
+	client -> rank = rank;
+	client -> version = 1;
+	default_pthead_attr(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, &serve_client, (void *)client) != 0)
+	{
+		print(PRNT_ERR, "Unable to create a PMI client thread\n");
+		free(client);
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * List the registered ranks in fence tree order (MASTER only)
+ *
+ * The rank at position p is the parent of the ranks at positions
+ * p * PMI_TREE_ARITY + 1 to p * PMI_TREE_ARITY + PMI_TREE_ARITY. The
+ * master is at position 0.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param order (output) An array of at least num_procs ranks
+ * @return The number of registered ranks
+ */
+int pmi_tree_order(parallel_wrapper *par_wrapper, int *order)
+{
+	int i;
+	int count = 0;
+	for (i = 0; i < par_wrapper -> num_procs; i++)
+	{
+		if (par_wrapper -> machines[i] != (machine *)NULL)
+		{
+			order[count++] = i;
+		}
+	}
+	return count;
+}
+
+/**
+ * Describe the fence tree neighbours of a rank for LAUNCH (MASTER only)
+ *
+ * The fields are <PARENT>:<IP>:<PORT>:<NUM_CHILDREN> followed by
+ * <RANK>:<IP>:<PORT> for each child, with the IP addresses escaped.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param order The ranks in tree order (see pmi_tree_order)
+ * @param count The number of ranks in order
+ * @param position The position of the rank in order (> 0)
+ * @param fields (output) Buffer for the fields
+ * @param fields_len The length of the buffer
+ * @return 0 on success, otherwise failure
+ */
+int pmi_tree_fields(parallel_wrapper *par_wrapper, int *order, int count, int position, char *fields, int fields_len)
+{
+	int i;
+	char ip_addr[3*INET6_ADDRSTRLEN + 1];
+	if (position <= 0 || position >= count)
+	{
+		return 1;
+	}
+	machine *parent = par_wrapper -> machines[order[(position - 1) / PMI_TREE_ARITY]];
+	int first = position * PMI_TREE_ARITY + 1;
+	int num_children = (first >= count) ? 0 : count - first;
+	if (num_children > PMI_TREE_ARITY)
+	{
+		num_children = PMI_TREE_ARITY;
+	}
+	escape_field(parent -> ip_addr, ip_addr, sizeof(ip_addr));
+	int length = snprintf(fields, fields_len, "%d:%s:%u:%d", parent -> rank, ip_addr,
+		parent -> port, num_children);
+	for (i = 0; i < num_children && length < fields_len; i++)
+	{
+		machine *child = par_wrapper -> machines[order[first + i]];
+		escape_field(child -> ip_addr, ip_addr, sizeof(ip_addr));
+		length += snprintf(fields + length, fields_len - length, ":%d:%s:%u", child -> rank,
+			ip_addr, child -> port);
+	}
+	return (length < fields_len) ? 0 : 2;
+}
+
+/**
+ * Record the parent or a child of this rank in the fence tree
+ *
+ * Ranks the wrapper already knows (the master, or every rank on the
+ * master) are reused; others are added with only their address.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param job The PMI job
+ * @param is_parent Set if rank is the parent, otherwise it is a child
+ * @param rank The rank of the neighbour
+ * @param ip_addr The IP address of the neighbour
+ * @param port The command port of the neighbour
+ * @return 0 on success, otherwise failure
+ */
+int pmi_add_peer(parallel_wrapper *par_wrapper, pmi_job *job, int is_parent, int rank, const char *ip_addr, uint16_t port)
+{
+	machine *host = (machine *)NULL;
+	if (job == (pmi_job *)NULL || ip_addr == (char *)NULL)
+	{
+		return 1;
+	}
+	if (! is_parent && job -> num_children >= PMI_TREE_ARITY)
+	{
+		print(PRNT_WARN, "Rank %d has too many children in the PMI tree\n",
+			par_wrapper -> this_machine -> rank);
+		return 2;
+	}
+	if (par_wrapper -> machines != (machine **)NULL && rank >= 0 && rank < par_wrapper -> num_procs)
+	{
+		host = par_wrapper -> machines[rank];
+	}
+	else if (rank == MASTER)
+	{
+		host = par_wrapper -> master;
+	}
+	if (host == (machine *)NULL)
+	{
+		host = (machine *) arena_alloc(&par_wrapper -> job_arena, sizeof(struct machine));
+		if (host == (machine *)NULL || (host -> ip_addr = arena_strdup(&par_wrapper -> job_arena, ip_addr)) == (char *)NULL)
+		{
+			print(PRNT_ERR, "Unable to allocate space for a PMI tree neighbour\n");
+			return 3;
+		}
+		host -> rank = rank;
+		host -> port = port;
+	}
+	if (is_parent)
+	{
+		job -> parent = host;
+	}
+	else
+	{
+		job -> children[job -> num_children++] = host;
+	}
+	return 0;
+}
+
+/**
+ * Returns the machine associated with rank (or NULL if unknown)
+ *
+ * The master knows every machine; other ranks know the master and
+ * their neighbours in the fence tree.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param rank The rank to look up
+ * @return The machine or NULL
+ */
+machine *pmi_find_peer(parallel_wrapper *par_wrapper, int rank)
+{
+	int i;
+	if (par_wrapper -> machines != (machine **)NULL)
+	{
+		return (rank >= 0 && rank < par_wrapper -> num_procs) ? par_wrapper -> machines[rank] : NULL;
+	}
+	if (rank == MASTER)
+	{
+		return par_wrapper -> master;
+	}
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL)
+	{
+		return NULL;
+	}
+	if (job -> parent != (machine *)NULL && job -> parent -> rank == rank)
+	{
+		return job -> parent;
+	}
+	for (i = 0; i < job -> num_children; i++)
+	{
+		if (job -> children[i] -> rank == rank)
+		{
+			return job -> children[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Store a batch of key-value pairs received from another rank
+ *
+ * Pairs passed up by a child (PMI_PUT) are new to this subtree and are
+ * passed up again at the end of the fence. Pairs broadcast by the parent
+ * (PMI_BCAST) are passed down to the children before they are cached;
+ * fetched pairs (PMI_VALUE) are only cached.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param command CMD_PMI_PUT, CMD_PMI_BCAST or CMD_PMI_VALUE
+ * @param keys The (escaped) keys - unescaped in place
+ * @param values The (escaped) values - unescaped in place
+ * @param count The number of pairs
+ * @param status (output) One digit per pair (0 = stored); count + 1 bytes
+ * @return 0 on success, otherwise failure
+ */
+int pmi_receive(parallel_wrapper *par_wrapper, CMD command, char **keys, char **values, int count, char *status)
+{
+	int i, RC;
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL)
+	{
+		return 1;
+	}
+	if (command == CMD_PMI_BCAST && job -> num_children > 0)
+	{
+		pair_batch *batches = (pair_batch *)calloc(par_wrapper -> num_procs, sizeof(pair_batch));
+		if (batches == (pair_batch *)NULL)
+		{
+			print(PRNT_ERR, "Unable to allocate space to broadcast PMI keys\n");
+			return 2;
+		}
+		for (i = 0; i < job -> num_children; i++)
+		{
+			batches[job -> children[i] -> rank].count = count;
+			batches[job -> children[i] -> rank].keys = keys;
+			batches[job -> children[i] -> rank].values = values;
+		}
+		RC = send_pair_batches(par_wrapper, CMD_PMI_BCAST, batches);
+		if (RC != 0)
+		{
+			print(PRNT_WARN, "Failed to broadcast %d PMI keys\n", RC);
+		}
+		free(batches);
+	}
+	for (i = 0; i < count; i++)
+	{
+		unescape_field(keys[i]);
+		unescape_field(values[i]);
+		RC = kvs_put(job -> store, keys[i], values[i], command == CMD_PMI_PUT);
+		status[i] = (RC == 0) ? '0' : '2';
+	}
+	status[count] = '\0';
+	return 0;
+}
+
+/**
+ * Look up a key, fetching it from the parent if it is not cached
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param key The key
+ * @param value (output) Buffer for the value
+ * @param value_len The length of the value buffer
+ * @return 0 if found, otherwise the key does not exist (or was unreachable)
+ */
+int pmi_fetch(parallel_wrapper *par_wrapper, const char *key, char *value, int value_len)
+{
+	int i;
+	uint32_t seq;
+	char escaped[MAX_MESSAGE + 1];
+	char status[PENDING_STATUS_LEN] = "";
+	pmi_job *job = par_wrapper -> pmi;
+	if (kvs_lookup(job -> store, key, value, value_len) == 0)
+	{
+		return 0;
+	}
+	if (job -> parent == (machine *)NULL)
+	{
+		return 1; /* Every key reaches the root at a fence */
+	}
+	if (escape_field(key, escaped, MAX_MESSAGE + 1) != 0 ||
+		pending_add(par_wrapper -> pending, job -> parent -> rank, &seq) != 0)
+	{
+		return 2;
+	}
+	debug(PRNT_INFO, "Fetching PMI key %s from rank %d\n", key, job -> parent -> rank);
+	for (i = 0; i < 10 * par_wrapper -> timeout; i++)
+	{
+		fetch(par_wrapper -> command_socket, seq, escaped, par_wrapper -> this_machine -> rank,
+			job -> parent -> ip_addr, job -> parent -> port);
+		if (pending_wait(par_wrapper -> pending, seq, 100000) == 0)
+		{
+			pending_get_status(par_wrapper -> pending, seq, status, PENDING_STATUS_LEN);
+			break;
+		}
+	}
+	pending_remove(par_wrapper -> pending, seq);
+	if (strcmp(status, "0") != 0)
+	{
+		return 3;
+	}
+	return kvs_lookup(job -> store, key, value, value_len) == 0 ? 0 : 4;
+}
+
+/**
+ * Answer a PMI_GET from a child with a PMI_VALUE
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param rank The child which asked
+ * @param key The (escaped) key - unescaped in place
+ * @return 0 if the value was delivered, otherwise the key was not found
+ */
+int pmi_answer_fetch(parallel_wrapper *par_wrapper, int rank, char *key)
+{
+	char value[PMI_VALLEN_MAX];
+	char escaped_key[MAX_MESSAGE + 1];
+	char escaped_value[MAX_MESSAGE + 1];
+	if (par_wrapper -> pmi == (pmi_job *)NULL || pmi_find_peer(par_wrapper, rank) == (machine *)NULL)
+	{
+		return 1;
+	}
+	unescape_field(key);
+	if (pmi_fetch(par_wrapper, key, value, PMI_VALLEN_MAX) != 0 ||
+		escape_field(key, escaped_key, MAX_MESSAGE + 1) != 0 ||
+		escape_field(value, escaped_value, MAX_MESSAGE + 1) != 0)
+	{
+		return 2;
+	}
+	pair_batch *batches = (pair_batch *)calloc(par_wrapper -> num_procs, sizeof(pair_batch));
+	if (batches == (pair_batch *)NULL)
+	{
+		return 3;
+	}
+	char *keys[] = {escaped_key};
+	char *values[] = {escaped_value};
+	batches[rank].count = 1;
+	batches[rank].keys = keys;
+	batches[rank].values = values;
+	int RC = send_pair_batches(par_wrapper, CMD_PMI_VALUE, batches);
+	free(batches);
+	return (RC == 0) ? 0 : 4;
+}
+
+/**
+ * Record that the subtree of a child entered a fence
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param rank The child whose subtree entered the fence
+ * @param epoch The fence epoch
+ * @return 0 on success, otherwise failure
+ */
+int pmi_fence_enter(parallel_wrapper *par_wrapper, int rank, uint32_t epoch)
+{
+	int i;
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&job -> mutex);
+	for (i = 0; i < job -> num_children; i++)
+	{
+		if (job -> children[i] -> rank != rank)
+		{
+			continue;
+		}
+		if (job -> child_epochs[i] < epoch)
+		{
+			job -> child_epochs[i] = epoch;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&job -> mutex);
+	if (i == job -> num_children)
+	{
+		print(PRNT_WARN, "PMI fence from rank %d which is not a child of this rank\n", rank);
+		return 2;
+	}
+	return try_advance(par_wrapper, epoch);
+}
+
+/**
+ * Complete a fence in the subtree of this rank
+ *
+ * Passes the completion down to the children, then releases the waiting
+ * local processes.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param epoch The fence epoch
+ * @return 0 on success, otherwise failure
+ */
+int pmi_fence_complete(parallel_wrapper *par_wrapper, uint32_t epoch)
+{
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL)
+	{
+		return 1;
+	}
+	pthread_mutex_lock(&job -> mutex);
+	if (job -> done_epoch >= epoch)
+	{
+		pthread_mutex_unlock(&job -> mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&job -> mutex);
+	if (job -> num_children > 0)
+	{
+		send_fence(par_wrapper, CMD_PMI_FENCE_DONE, epoch, job -> children, job -> num_children);
+	}
+	pthread_mutex_lock(&job -> mutex);
+	if (job -> done_epoch < epoch)
+	{
+		job -> done_epoch = epoch;
+	}
+	pthread_cond_broadcast(&job -> cond);
+	pthread_mutex_unlock(&job -> mutex);
+	return 0;
+}
+
+/**
+ * Record that the local processes of a rank have exited (MASTER only)
+ *
+ * A non-zero return code aborts the whole job.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param rank The rank whose processes exited
+ * @param return_code The exit status of those processes
+ * @return 0 on success, otherwise failure
+ */
+int pmi_rank_exited(parallel_wrapper *par_wrapper, int rank, int return_code)
+{
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL || job -> rank_exited == (char *)NULL ||
+		rank < 0 || rank >= par_wrapper -> num_procs)
+	{
+		return 1;
+	}
+	if (return_code != 0)
+	{
+		print(PRNT_WARN, "Processes on rank %d exited with %d - aborting the job\n", rank, return_code);
+		cleanup(par_wrapper, return_code);
+	}
+	pthread_mutex_lock(&job -> mutex);
+	if (! job -> rank_exited[rank])
+	{
+		job -> rank_exited[rank] = 1;
+		job -> num_exited++;
+	}
+	pthread_cond_broadcast(&job -> cond);
+	pthread_mutex_unlock(&job -> mutex);
+	return 0;
+}
+
+/**
+ * Wait until the processes of every other rank have exited (MASTER only)
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure
+ */
+int pmi_wait_exited(parallel_wrapper *par_wrapper)
+{
+	int i;
+	pmi_job *job = par_wrapper -> pmi;
+	if (job == (pmi_job *)NULL || job -> rank_exited == (char *)NULL)
+	{
+		return 1;
+	}
+	int num_ranks = 0;
+	for (i = 1; i < par_wrapper -> num_procs; i++)
+	{
+		if (par_wrapper -> machines[i] != (machine *)NULL)
+		{
+			num_ranks++;
+		}
+	}
+	pthread_mutex_lock(&job -> mutex);
+	while (job -> num_exited < num_ranks)
+	{
+		pthread_cond_wait(&job -> cond, &job -> mutex);
+	}
+	pthread_mutex_unlock(&job -> mutex);
+	return 0;
+}
+
+/**
+ * Serve PMI commands from a single client until it disconnects
+ */
+static void *serve_client(void *ptr)
+{
+	struct pmi_client *client = (struct pmi_client *)ptr;
+	char command[PMI_LINE_MAX + 1];
+	while (read_command(client, command, PMI_LINE_MAX + 1) == 0)
+	{
+		int RC;
+		if (strncmp(command, "cmd=", 4) == 0 && strchr(command, ';') == (char *)NULL)
+		{
+			RC = handle_pmi1(client, command);
+		}
+		else
+		{
+			RC = handle_pmi2(client, command);
+		}
+		if (RC != 0)
+		{
+			break;
+		}
+	}
+	close(client -> fd);
+	free(client);
+	return NULL;
+}
+
+/**
+ * Read the next command from a client
+ *
+ * PMI-1 commands are terminated by a newline. PMI-2 commands are
+ * preceded by their length as six ASCII characters.
+ *
+ * @return 0 on success, otherwise the client disconnected or misbehaved
+ */
+static int read_command(struct pmi_client *client, char *command, int command_len)
+{
+	int length = -1;
+	while ( 1 )
+	{
+		int available = client -> end - client -> start;
+		char *data = client -> buffer + client -> start;
+		if (available > 0 && isdigit((unsigned char) data[0]) && available >= 6)
+		{
+			char header[7];
+			memcpy(header, data, 6);
+			header[6] = '\0';
+			if (parse_integer(header, &length) != 0 || length < 0 || length + 6 > PMI_LINE_MAX ||
+				length >= command_len)
+			{
+				print(PRNT_WARN, "Invalid PMI-2 command length from rank %d\n", client -> rank);
+				return 1;
+			}
+			if (available >= length + 6)
+			{
+				memcpy(command, data + 6, length);
+				command[length] = '\0';
+				client -> start += length + 6;
+				return 0;
+			}
+		}
+		else if (available > 0 && ! isdigit((unsigned char) data[0]))
+		{
+			char *newline = (char *)memchr(data, '\n', available);
+			if (newline != (char *)NULL)
+			{
+				length = newline - data;
+				if (length >= command_len)
+				{
+					return 2;
+				}
+				memcpy(command, data, length);
+				command[length] = '\0';
+				client -> start += length + 1;
+				return 0;
+			}
+		}
+		/* Need more data: compact the buffer and read */
+		memmove(client -> buffer, data, available);
+		client -> start = 0;
+		client -> end = available;
+		if (client -> end >= PMI_LINE_MAX)
+		{
+			print(PRNT_WARN, "PMI command from rank %d is too long\n", client -> rank);
+			return 3;
+		}
+		int bytes = read(client -> fd, client -> buffer + client -> end, PMI_LINE_MAX - client -> end);
+		if (bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes <= 0)
+		{
+			return 4;
+		}
+		client -> end += bytes;
+	}
+}
+
+/**
+ * Handle a single PMI-1 command
+ *
+ * @return 0 to keep serving the client, otherwise stop
+ */
+static int handle_pmi1(struct pmi_client *client, char *command)
+{
+	char cmd[64];
+	char key[PMI_KEYLEN_MAX];
+	char value[PMI_VALLEN_MAX];
+	char reply[PMI_LINE_MAX];
+	parallel_wrapper *par_wrapper = client -> par_wrapper;
+	pmi_job *job = par_wrapper -> pmi;
+	get_pmi1_value(command, "cmd", cmd, 64);
+	reply[0] = '\0';
+	if (strcmp(cmd, "init") == 0)
+	{
+		if (get_pmi1_value(command, "pmi_version", value, PMI_VALLEN_MAX) == 0 &&
+			strcmp(value, "2") == 0)
+		{
+			client -> version = 2;
+			snprintf(reply, PMI_LINE_MAX, "cmd=response_to_init pmi_version=2 pmi_subversion=0 rc=0\n");
+		}
+		else
+		{
+			snprintf(reply, PMI_LINE_MAX, "cmd=response_to_init pmi_version=1 pmi_subversion=1 rc=0\n");
+		}
+	}
+	else if (strcmp(cmd, "get_maxes") == 0)
+	{
+		snprintf(reply, PMI_LINE_MAX, "cmd=maxes kvsname_max=%u keylen_max=%u vallen_max=%u\n",
+			PMI_KVSNAME_MAX, PMI_KEYLEN_MAX, PMI_VALLEN_MAX);
+	}
+	else if (strcmp(cmd, "get_appnum") == 0)
+	{
+		snprintf(reply, PMI_LINE_MAX, "cmd=appnum appnum=0\n");
+	}
+	else if (strcmp(cmd, "get_my_kvsname") == 0)
+	{
+		snprintf(reply, PMI_LINE_MAX, "cmd=my_kvsname kvsname=%s\n", job -> kvsname);
+	}
+	else if (strcmp(cmd, "get_universe_size") == 0)
+	{
+		snprintf(reply, PMI_LINE_MAX, "cmd=universe_size size=%d\n", job -> size);
+	}
+	else if (strcmp(cmd, "put") == 0)
+	{
+		if (get_pmi1_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			get_pmi1_value(command, "value", value, PMI_VALLEN_MAX) != 0 ||
+			kvs_put(job -> store, key, value, 1) != 0)
+		{
+			snprintf(reply, PMI_LINE_MAX, "cmd=put_result rc=-1 msg=invalid_put\n");
+		}
+		else
+		{
+			snprintf(reply, PMI_LINE_MAX, "cmd=put_result rc=0 msg=success\n");
+		}
+	}
+	else if (strcmp(cmd, "get") == 0)
+	{
+		if (get_pmi1_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			pmi_fetch(par_wrapper, key, value, PMI_VALLEN_MAX) != 0)
+		{
+			snprintf(reply, PMI_LINE_MAX, "cmd=get_result rc=-1 msg=key_not_found\n");
+		}
+		else
+		{
+			snprintf(reply, PMI_LINE_MAX, "cmd=get_result rc=0 msg=success value=%s\n", value);
+		}
+	}
+	else if (strcmp(cmd, "barrier_in") == 0)
+	{
+		local_fence(par_wrapper);
+		snprintf(reply, PMI_LINE_MAX, "cmd=barrier_out\n");
+	}
+	else if (strcmp(cmd, "finalize") == 0)
+	{
+		snprintf(reply, PMI_LINE_MAX, "cmd=finalize_ack\n");
+	}
+	else if (strcmp(cmd, "abort") == 0)
+	{
+		int return_code = 1;
+		if (get_pmi1_value(command, "exitcode", value, PMI_VALLEN_MAX) == 0)
+		{
+			parse_integer(value, &return_code);
+		}
+		print(PRNT_WARN, "PMI abort from rank %d (exit code %d)\n", client -> rank, return_code);
+		local_abort(par_wrapper, return_code == 0 ? 1 : return_code);
+		return 1;
+	}
+	else
+	{
+		print(PRNT_WARN, "Unsupported PMI-1 command from rank %d: %s\n", client -> rank, command);
+		snprintf(reply, PMI_LINE_MAX, "cmd=%s_response rc=-1\n", cmd);
+	}
+	return write_all(client -> fd, reply, strlen(reply));
+}
+
+/**
+ * Handle a single PMI-2 command
+ *
+ * @return 0 to keep serving the client, otherwise stop
+ */
+static int handle_pmi2(struct pmi_client *client, char *command)
+{
+	char cmd[64];
+	char key[PMI_KEYLEN_MAX];
+	char value[PMI_VALLEN_MAX];
+	parallel_wrapper *par_wrapper = client -> par_wrapper;
+	pmi_job *job = par_wrapper -> pmi;
+	if (get_pmi2_value(command, "cmd", cmd, 64) != 0)
+	{
+		print(PRNT_WARN, "Invalid PMI-2 command from rank %d\n", client -> rank);
+		return 1;
+	}
+	if (strcmp(cmd, "fullinit") == 0)
+	{
+		return reply_pmi2(client, "cmd=fullinit-response;rc=0;pmi-version=2;pmi-subversion=0;"
+			"rank=%d;size=%d;appnum=0;spawner-jobid=%s;debugged=FALSE;pmiverbose=FALSE;",
+			client -> rank, job -> size, job -> kvsname);
+	}
+	else if (strcmp(cmd, "job-getid") == 0)
+	{
+		return reply_pmi2(client, "cmd=job-getid-response;rc=0;jobid=%s;", job -> kvsname);
+	}
+	else if (strcmp(cmd, "kvs-put") == 0)
+	{
+		if (get_pmi2_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			get_pmi2_value(command, "value", value, PMI_VALLEN_MAX) != 0 ||
+			kvs_put(job -> store, key, value, 1) != 0)
+		{
+			return reply_pmi2(client, "cmd=kvs-put-response;rc=1;errmsg=invalid put;");
+		}
+		return reply_pmi2(client, "cmd=kvs-put-response;rc=0;");
+	}
+	else if (strcmp(cmd, "kvs-get") == 0)
+	{
+		if (get_pmi2_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			pmi_fetch(par_wrapper, key, value, PMI_VALLEN_MAX) != 0)
+		{
+			return reply_pmi2(client, "cmd=kvs-get-response;rc=0;found=FALSE;");
+		}
+		escape_pmi2(value, PMI_VALLEN_MAX);
+		return reply_pmi2(client, "cmd=kvs-get-response;rc=0;found=TRUE;value=%s;", value);
+	}
+	else if (strcmp(cmd, "kvs-fence") == 0)
+	{
+		local_fence(par_wrapper);
+		return reply_pmi2(client, "cmd=kvs-fence-response;rc=0;");
+	}
+	else if (strcmp(cmd, "info-getjobattr") == 0)
+	{
+		if (get_pmi2_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			kvs_lookup(job -> store, key, value, PMI_VALLEN_MAX) != 0)
+		{
+			return reply_pmi2(client, "cmd=info-getjobattr-response;rc=0;found=FALSE;");
+		}
+		escape_pmi2(value, PMI_VALLEN_MAX);
+		return reply_pmi2(client, "cmd=info-getjobattr-response;rc=0;found=TRUE;value=%s;", value);
+	}
+	else if (strcmp(cmd, "info-putnodeattr") == 0)
+	{
+		if (get_pmi2_value(command, "key", key, PMI_KEYLEN_MAX) != 0 ||
+			get_pmi2_value(command, "value", value, PMI_VALLEN_MAX) != 0 ||
+			kvs_put(job -> node_store, key, value, 0) != 0)
+		{
+			return reply_pmi2(client, "cmd=info-putnodeattr-response;rc=1;");
+		}
+		pthread_mutex_lock(&job -> mutex);
+		pthread_cond_broadcast(&job -> cond);
+		pthread_mutex_unlock(&job -> mutex);
+		return reply_pmi2(client, "cmd=info-putnodeattr-response;rc=0;");
+	}
+	else if (strcmp(cmd, "info-getnodeattr") == 0)
+	{
+		char wait[8] = "FALSE";
+		if (get_pmi2_value(command, "key", key, PMI_KEYLEN_MAX) != 0)
+		{
+			return reply_pmi2(client, "cmd=info-getnodeattr-response;rc=1;");
+		}
+		get_pmi2_value(command, "wait", wait, 8);
+		int RC = kvs_lookup(job -> node_store, key, value, PMI_VALLEN_MAX);
+		/* Block until another local process puts the attribute */
+		pthread_mutex_lock(&job -> mutex);
+		while (RC != 0 && strcmp(wait, "TRUE") == 0)
+		{
+			pthread_cond_wait(&job -> cond, &job -> mutex);
+			RC = kvs_lookup(job -> node_store, key, value, PMI_VALLEN_MAX);
+		}
+		pthread_mutex_unlock(&job -> mutex);
+		if (RC != 0)
+		{
+			return reply_pmi2(client, "cmd=info-getnodeattr-response;rc=0;found=FALSE;");
+		}
+		escape_pmi2(value, PMI_VALLEN_MAX);
+		return reply_pmi2(client, "cmd=info-getnodeattr-response;rc=0;found=TRUE;value=%s;", value);
+	}
+	else if (strcmp(cmd, "finalize") == 0)
+	{
+		return reply_pmi2(client, "cmd=finalize-response;rc=0;");
+	}
+	else if (strcmp(cmd, "abort") == 0)
+	{
+		print(PRNT_WARN, "PMI abort from rank %d\n", client -> rank);
+		local_abort(par_wrapper, 1);
+		return 1;
+	}
+	print(PRNT_WARN, "Unsupported PMI-2 command from rank %d: %s\n", client -> rank, command);
+	return reply_pmi2(client, "cmd=%s-response;rc=1;errmsg=unsupported;", cmd);
+}
+
+/**
+ * Find the value of key in a PMI-1 command ("cmd=put key=a value=b")
+ *
+ * @return 0 if found, otherwise the key is not present
+ */
+static int get_pmi1_value(const char *command, const char *key, char *value, int value_len)
+{
+	int key_len = strlen(key);
+	const char *token = command;
+	while (*token != '\0')
+	{
+		while (*token == ' ')
+		{
+			token++;
+		}
+		int token_len = strcspn(token, " ");
+		if (token_len > key_len && strncmp(token, key, key_len) == 0 && token[key_len] == '=')
+		{
+			int length = token_len - key_len - 1;
+			if (length >= value_len)
+			{
+				return 2;
+			}
+			memcpy(value, token + key_len + 1, length);
+			value[length] = '\0';
+			return 0;
+		}
+		token += token_len;
+	}
+	return 1;
+}
+
+/**
+ * Find the value of key in a PMI-2 command ("cmd=kvs-put;key=a;value=b;")
+ *
+ * A ';' within a value is escaped as ";;".
+ *
+ * @return 0 if found, otherwise the key is not present
+ */
+static int get_pmi2_value(const char *command, const char *key, char *value, int value_len)
+{
+	int key_len = strlen(key);
+	const char *token = command;
+	while (*token != '\0')
+	{
+		int match = (strncmp(token, key, key_len) == 0 && token[key_len] == '=');
+		const char *in = strchr(token, '=');
+		if (in == (char *)NULL)
+		{
+			return 1;
+		}
+		in++;
+		int length = 0;
+		while (*in != '\0')
+		{
+			if (in[0] == ';' && in[1] == ';')
+			{
+				in++; /* Escaped ';' */
+			}
+			else if (in[0] == ';')
+			{
+				break;
+			}
+			if (match && length < value_len - 1)
+			{
+				value[length++] = *in;
+			}
+			in++;
+		}
+		if (match)
+		{
+			value[length] = '\0';
+			return 0;
+		}
+		token = (*in == ';') ? in + 1 : in;
+	}
+	return 1;
+}
+
+/**
+ * Send a PMI-2 reply (prefixed with its length)
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int reply_pmi2(struct pmi_client *client, const char *format, ...)
+{
+	char reply[PMI_LINE_MAX];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(reply + 6, PMI_LINE_MAX - 6, format, args);
+	va_end(args);
+	if (length < 0 || length >= PMI_LINE_MAX - 6)
+	{
+		print(PRNT_WARN, "PMI-2 reply to rank %d is too long\n", client -> rank);
+		return 1;
+	}
+	char header[7];
+	snprintf(header, 7, "%-6d", length);
+	memcpy(reply, header, 6);
+	return write_all(client -> fd, reply, length + 6);
+}
+
+/**
+ * Escape each ';' in a PMI-2 value as ";;" (in place, truncating if needed)
+ */
+static void escape_pmi2(char *value, int value_len)
+{
+	int i;
+	int length = strlen(value);
+	for (i = 0; i < length; i++)
+	{
+		if (value[i] != ';')
+		{
+			continue;
+		}
+		if (length + 1 >= value_len)
+		{
+			value[i] = '\0'; /* No room - drop the rest */
+			return;
+		}
+		memmove(value + i + 1, value + i, length - i + 1);
+		length++;
+		i++;
+	}
+}
+
+/**
+ * Write an entire buffer to a file descriptor
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int write_all(int fd, const char *buffer, int length)
+{
+	while (length > 0)
+	{
+		int bytes = write(fd, buffer, length);
+		if (bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes <= 0)
+		{
+			return 1;
+		}
+		buffer += bytes;
+		length -= bytes;
+	}
+	return 0;
+}
+
+/**
+ * Enter a fence on behalf of one local process and wait for it to complete
+ *
+ * The last local process to arrive enters the fence for this rank.
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int local_fence(parallel_wrapper *par_wrapper)
+{
+	pmi_job *job = par_wrapper -> pmi;
+	pthread_mutex_lock(&job -> mutex);
+	uint32_t epoch = job -> epoch + 1;
+	job -> arrived++;
+	if (job -> arrived >= job -> num_local)
+	{
+		job -> arrived = 0;
+		job -> epoch = epoch;
+		pthread_mutex_unlock(&job -> mutex);
+		try_advance(par_wrapper, epoch);
+		pthread_mutex_lock(&job -> mutex);
+	}
+	while (job -> done_epoch < epoch)
+	{
+		pthread_cond_wait(&job -> cond, &job -> mutex);
+	}
+	pthread_mutex_unlock(&job -> mutex);
+	return 0;
+}
+
+/**
+ * Move a fence on once this rank and the subtree of every child entered
+ *
+ * Only the first caller to see the complete set moves the fence on: up
+ * to the parent, or (at the root) down to every rank.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param epoch The fence epoch
+ * @return 0 on success, otherwise failure
+ */
+static int try_advance(parallel_wrapper *par_wrapper, uint32_t epoch)
+{
+	int i;
+	pmi_job *job = par_wrapper -> pmi;
+	pthread_mutex_lock(&job -> mutex);
+	if (job -> epoch < epoch || job -> published_epoch >= epoch)
+	{
+		pthread_mutex_unlock(&job -> mutex);
+		return 0;
+	}
+	for (i = 0; i < job -> num_children; i++)
+	{
+		if (job -> child_epochs[i] < epoch)
+		{
+			pthread_mutex_unlock(&job -> mutex);
+			return 0; /* Still waiting on this subtree */
+		}
+	}
+	job -> published_epoch = epoch;
+	pthread_mutex_unlock(&job -> mutex);
+	if (job -> parent == (machine *)NULL)
+	{
+		debug(PRNT_INFO, "All ranks entered PMI fence %u\n", epoch);
+		return release(par_wrapper, epoch);
+	}
+	return pass_up(par_wrapper, epoch);
+}
+
+/**
+ * Pass the new keys of this subtree to the parent and enter the fence there
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param epoch The fence epoch
+ * @return 0 on success, otherwise failure
+ */
+static int pass_up(parallel_wrapper *par_wrapper, uint32_t epoch)
+{
+	int RC;
+	char **keys = NULL;
+	char **values = NULL;
+	pmi_job *job = par_wrapper -> pmi;
+	int count = kvs_take_dirty(job -> store, &keys, &values);
+	pair_batch *batches = (pair_batch *)calloc(par_wrapper -> num_procs, sizeof(pair_batch));
+	if (count < 0 || batches == (pair_batch *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space to publish PMI keys\n");
+		local_abort(par_wrapper, 1);
+		return 1;
+	}
+	if (count > 0)
+	{
+		escape_pairs(keys, values, count);
+		batches[job -> parent -> rank].count = count;
+		batches[job -> parent -> rank].keys = keys;
+		batches[job -> parent -> rank].values = values;
+		RC = send_pair_batches(par_wrapper, CMD_PMI_PUT, batches);
+		if (RC != 0)
+		{
+			print(PRNT_WARN, "Failed to publish %d PMI keys\n", RC);
+		}
+	}
+	kvs_free_pairs(keys, values, count);
+	free(batches);
+	return send_fence(par_wrapper, CMD_PMI_FENCE, epoch, &job -> parent, 1);
+}
+
+/**
+ * Broadcast the new keys of a fence and complete it everywhere (root only)
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param epoch The fence epoch
+ * @return 0 on success, otherwise failure
+ */
+static int release(parallel_wrapper *par_wrapper, uint32_t epoch)
+{
+	int i, RC;
+	char **keys = NULL;
+	char **values = NULL;
+	pmi_job *job = par_wrapper -> pmi;
+	int count = kvs_take_dirty(job -> store, &keys, &values);
+	pair_batch *batches = (pair_batch *)calloc(par_wrapper -> num_procs, sizeof(pair_batch));
+	if (count < 0 || batches == (pair_batch *)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space to publish PMI keys\n");
+		local_abort(par_wrapper, 1);
+		return 1;
+	}
+	if (count > PMI_BROADCAST_MAX)
+	{
+		debug(PRNT_INFO, "Leaving %d PMI keys to be fetched on demand\n", count);
+	}
+	else if (count > 0 && job -> num_children > 0)
+	{
+		escape_pairs(keys, values, count);
+		for (i = 0; i < job -> num_children; i++)
+		{
+			batches[job -> children[i] -> rank].count = count;
+			batches[job -> children[i] -> rank].keys = keys;
+			batches[job -> children[i] -> rank].values = values;
+		}
+		RC = send_pair_batches(par_wrapper, CMD_PMI_BCAST, batches);
+		if (RC != 0)
+		{
+			print(PRNT_WARN, "Failed to broadcast %d PMI keys\n", RC);
+		}
+	}
+	kvs_free_pairs(keys, values, count);
+	free(batches);
+	return pmi_fence_complete(par_wrapper, epoch);
+}
+
+/**
+ * Send a fence command to a set of hosts and wait until all of them ACK
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param command CMD_PMI_FENCE or CMD_PMI_FENCE_DONE
+ * @param epoch The fence epoch
+ * @param hosts The destinations
+ * @param count The number of destinations
+ * @return 0 on success, otherwise failure
+ */
+static int send_fence(parallel_wrapper *par_wrapper, CMD command, uint32_t epoch, machine **hosts, int count)
+{
+	int i;
+	uint32_t seqs[PMI_TREE_ARITY];
+	if (count > PMI_TREE_ARITY)
+	{
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		seqs[i] = 0;
+		pending_add(par_wrapper -> pending, hosts[i] -> rank, &seqs[i]);
+	}
+	while ( 1 )
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (seqs[i] == 0 || pending_is_done(par_wrapper -> pending, seqs[i]))
+			{
+				continue;
+			}
+			fence(par_wrapper -> command_socket, command, seqs[i], epoch,
+				par_wrapper -> this_machine -> rank, hosts[i] -> ip_addr, hosts[i] -> port);
+		}
+		if (pending_wait_all(par_wrapper -> pending, seqs, count, 100000) == 0)
+		{
+			break;
+		}
+		debug(PRNT_INFO, "Waiting for ACK of PMI fence %u\n", epoch);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (seqs[i] != 0)
+		{
+			pending_remove(par_wrapper -> pending, seqs[i]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Escape a list of pairs (in place) for the control plane
+ */
+static void escape_pairs(char **keys, char **values, int count)
+{
+	int i;
+	char escaped[MAX_MESSAGE + 1];
+	for (i = 0; i < count; i++)
+	{
+		if (escape_field(keys[i], escaped, MAX_MESSAGE + 1) == 0)
+		{
+			free(keys[i]);
+			keys[i] = strdup(escaped);
+		}
+		if (escape_field(values[i], escaped, MAX_MESSAGE + 1) == 0)
+		{
+			free(values[i]);
+			values[i] = strdup(escaped);
+		}
+	}
+}
+
+/**
+ * Abort the job on behalf of a local process
+ */
+static void local_abort(parallel_wrapper *par_wrapper, int return_code)
+{
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		cleanup(par_wrapper, return_code);
+	}
+	report_exit(par_wrapper, return_code);
+}
@@ -0,0 +1,153 @@
+/**
+ * Rank table of the MASTER
+ *
+ * Keeps what the MASTER touches for every rank on each keep-alive
+ * round, while waiting for registrations and when terminating the job
+ * (flags, CPUs, last ACK, binary command address) in contiguous arrays,
+ * so those scans stay in cache and never format or compare strings.
+ */
+
+#include "ranks.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/**
+ * Host address and rank, for sorting
+ */
+typedef struct rank_host
+{
+	uint32_t addr; /**< IPv4 address (host order) */
+	int rank; /**< The rank */
+} rank_host;
+
+static int compare_hosts(const void *a, const void *b);
+
+/**
+ * Allocate the arrays of a table (zeroed: nothing registered)
+ *
+ * @param table The table
+ * @param pool The arena holding the arrays
+ * @param count The number of ranks
+ * @return 0 on success, otherwise failure
+ */
+int rank_table_init(rank_table *table, arena *pool, int count)
+{
+	memset(table, 0, sizeof(rank_table));
+	table -> flags = (uint8_t *) arena_alloc(pool, count * sizeof(uint8_t));
+	table -> cpus = (int *) arena_alloc(pool, count * sizeof(int));
+	table -> last_alive = (struct timeval *) arena_alloc(pool, count * sizeof(struct timeval));
+	table -> addrs = (struct sockaddr_in *) arena_alloc(pool, count * sizeof(struct sockaddr_in));
+	if (table -> flags == (uint8_t *)NULL || table -> cpus == (int *)NULL ||
+		table -> last_alive == (struct timeval *)NULL || table -> addrs == (struct sockaddr_in *)NULL)
+	{
+		return 1;
+	}
+	table -> count = count;
+	return 0;
+}
+
+/**
+ * Record a registered rank (its clock starts now)
+ *
+ * The flag is published last, so a scan which sees the rank registered
+ * also sees its address.
+ *
+ * @param table The table
+ * @param rank The rank
+ * @param addr Its command address
+ * @param cpus Its number of CPUs
+ */
+void rank_table_register(rank_table *table, int rank, const struct sockaddr_in *addr, int cpus)
+{
+	if (rank < 0 || rank >= table -> count)
+	{
+		return;
+	}
+	table -> addrs[rank] = *addr;
+	table -> cpus[rank] = cpus;
+	gettimeofday(&table -> last_alive[rank], NULL);
+	__atomic_or_fetch(&table -> flags[rank], RANK_REGISTERED, __ATOMIC_RELEASE);
+}
+
+/**
+ * Note an ACK from a rank if it comes from its registered address
+ *
+ * @param table The table
+ * @param rank The rank the ACK claims to come from
+ * @param from Where it came from
+ * @return 0 on success, 1 if the rank has not registered, 2 if the address differs
+ */
+int rank_table_alive(rank_table *table, int rank, const struct sockaddr *from)
+{
+	if (rank < 0 || rank >= table -> count || ! rank_registered(table, rank))
+	{
+		return 1;
+	}
+	const struct sockaddr_in *address = (const struct sockaddr_in *) from;
+	if (from -> sa_family != AF_INET || address -> sin_addr.s_addr != table -> addrs[rank].sin_addr.s_addr ||
+		address -> sin_port != table -> addrs[rank].sin_port)
+	{
+		return 2;
+	}
+	gettimeofday(&table -> last_alive[rank], NULL);
+	return 0;
+}
+
+/**
+ * Flag the lowest registered rank of every host as unique
+ *
+ * @param table The table
+ * @return The number of unique hosts (negative on failure)
+ */
+int rank_table_find_unique(rank_table *table)
+{
+	int i;
+	int count = 0;
+	int unique = 0;
+	rank_host *hosts = (rank_host *) malloc(table -> count * sizeof(rank_host));
+	if (hosts == (rank_host *)NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < table -> count; i++)
+	{
+		table -> flags[i] &= ~RANK_UNIQUE;
+		if (table -> flags[i] & RANK_REGISTERED)
+		{
+			hosts[count].addr = ntohl(table -> addrs[i].sin_addr.s_addr);
+			hosts[count].rank = i;
+			count++;
+		}
+	}
+	qsort(hosts, count, sizeof(rank_host), compare_hosts);
+	for (i = 0; i < count; i++)
+	{
+		if (i == 0 || hosts[i].addr != hosts[i - 1].addr)
+		{
+			table -> flags[hosts[i].rank] |= RANK_UNIQUE;
+			unique++;
+		}
+		else
+		{
+			debug(PRNT_INFO, "Rank %d is not unique (same host as %d).\n", hosts[i].rank, hosts[i - 1].rank);
+		}
+	}
+	free(hosts);
+	return unique;
+}
+
+/**
+ * Order by address, then rank
+ */
+static int compare_hosts(const void *a, const void *b)
+{
+	const rank_host *first = (const rank_host *) a;
+	const rank_host *second = (const rank_host *) b;
+	if (first -> addr != second -> addr)
+	{
+		return first -> addr < second -> addr ? -1 : 1;
+	}
+	return first -> rank - second -> rank;
+}
@@ -0,0 +1,161 @@
+/**
+ * Replay cache for retransmitted commands
+ *
+ * Commands are retransmitted until they are acknowledged, so a receiver
+ * routinely sees several copies of the same (peer, sequence) pair. The
+ * first copy runs the handler and its reply is cached here; later copies
+ * are answered with the cached reply without parsing the message or
+ * re-running the handler.
+ */
+
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+static uint32_t replay_hash(const struct sockaddr *peer, uint32_t seq);
+static int same_peer(const struct sockaddr_storage *a, const struct sockaddr *b);
+
+/**
+ * Allocate an empty replay cache
+ *
+ * @return An initialized replay_cache or NULL on error
+ */
+replay_cache *replay_get_cache(void)
+{
+	replay_cache *cache = (replay_cache *)calloc(1, sizeof(struct replay_cache));
+	if (cache == (replay_cache *)NULL)
+	{
+		return NULL;
+	}
+	pthread_mutex_init(&cache -> mutex, NULL);
+	return cache;
+}
+
+/**
+ * Look up (peer, seq) and claim the entry if it is not present
+ *
+ * If the command has already been handled, the cached reply is copied
+ * into reply and REPLAY_HIT is returned. If this is the first copy, the
+ * entry is marked busy and REPLAY_NEW is returned; the caller must later
+ * call replay_finish.
+ *
+ * @param cache The replay cache
+ * @param peer The source of the command
+ * @param seq The sequence number of the command
+ * @param reply (output) Buffer for the cached reply
+ * @param reply_len The length of the reply buffer
+ * @return A REPLAY_RESULT
+ */
+REPLAY_RESULT replay_begin(replay_cache *cache, const struct sockaddr *peer, uint32_t seq, char *reply, size_t reply_len)
+{
+	if (cache == (replay_cache *)NULL || peer == (struct sockaddr *)NULL)
+	{
+		return REPLAY_NEW;
+	}
+	replay_entry *entry = &cache -> entries[replay_hash(peer, seq)];
+	pthread_mutex_lock(&cache -> mutex);
+	if (entry -> state != REPLAY_FREE && entry -> seq == seq && same_peer(&entry -> peer, peer))
+	{
+		REPLAY_RESULT result = REPLAY_IN_FLIGHT;
+		if (entry -> state == REPLAY_DONE && reply != (char *)NULL && reply_len > 0)
+		{
+			strncpy(reply, entry -> reply, reply_len - 1);
+			reply[reply_len - 1] = '\0';
+			result = REPLAY_HIT;
+		}
+		pthread_mutex_unlock(&cache -> mutex);
+		return result;
+	}
+	/* Claim the entry (evicting whatever was there) */
+	memset(&entry -> peer, 0, sizeof(struct sockaddr_storage));
+	memcpy(&entry -> peer, peer, peer -> sa_family == AF_INET6 ? 
+		sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+	entry -> seq = seq;
+	entry -> state = REPLAY_BUSY;
+	entry -> reply[0] = '\0';
+	pthread_mutex_unlock(&cache -> mutex);
+	return REPLAY_NEW;
+}
+
+/**
+ * Record the reply for a command claimed by replay_begin
+ *
+ * If reply is NULL and no reply has been recorded, the entry is released
+ * so that a retransmitted copy runs the handler again.
+ *
+ * @param cache The replay cache
+ * @param peer The source of the command
+ * @param seq The sequence number of the command
+ * @param reply The reply that was sent (or NULL)
+ */
+void replay_finish(replay_cache *cache, const struct sockaddr *peer, uint32_t seq, const char *reply)
+{
+	if (cache == (replay_cache *)NULL || peer == (struct sockaddr *)NULL)
+	{
+		return;
+	}
+	replay_entry *entry = &cache -> entries[replay_hash(peer, seq)];
+	pthread_mutex_lock(&cache -> mutex);
+	if (entry -> state == REPLAY_BUSY && entry -> seq == seq && same_peer(&entry -> peer, peer))
+	{
+		if (reply == (char *)NULL)
+		{
+			entry -> state = REPLAY_FREE;
+		}
+		else
+		{
+			strncpy(entry -> reply, reply, REPLAY_REPLY_LEN - 1);
+			entry -> reply[REPLAY_REPLY_LEN - 1] = '\0';
+			entry -> state = REPLAY_DONE;
+		}
+	}
+	pthread_mutex_unlock(&cache -> mutex);
+}
+
+/**
+ * Hash (peer, seq) into a slot index
+ */
+static uint32_t replay_hash(const struct sockaddr *peer, uint32_t seq)
+{
+	uint32_t hash = seq * 2654435761u; /* Knuth multiplicative hash */
+	if (peer -> sa_family == AF_INET)
+	{
+		const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+		hash ^= in -> sin_addr.s_addr ^ ((uint32_t) in -> sin_port << 16);
+	}
+	else if (peer -> sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)peer;
+		uint32_t words[4];
+		memcpy(words, &in6 -> sin6_addr, sizeof(words));
+		hash ^= words[0] ^ words[1] ^ words[2] ^ words[3] ^ ((uint32_t) in6 -> sin6_port << 16);
+	}
+	hash ^= hash >> 15;
+	return hash & (REPLAY_SLOTS - 1);
+}
+
+/**
+ * Returns 1 if the two socket addresses refer to the same address and port
+ */
+static int same_peer(const struct sockaddr_storage *a, const struct sockaddr *b)
+{
+	if (a -> ss_family != b -> sa_family)
+	{
+		return 0;
+	}
+	if (b -> sa_family == AF_INET)
+	{
+		const struct sockaddr_in *x = (const struct sockaddr_in *)a;
+		const struct sockaddr_in *y = (const struct sockaddr_in *)b;
+		return x -> sin_port == y -> sin_port && x -> sin_addr.s_addr == y -> sin_addr.s_addr;
+	}
+	if (b -> sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *x = (const struct sockaddr_in6 *)a;
+		const struct sockaddr_in6 *y = (const struct sockaddr_in6 *)b;
+		return x -> sin6_port == y -> sin6_port && 
+			memcmp(&x -> sin6_addr, &y -> sin6_addr, sizeof(struct in6_addr)) == 0;
+	}
+	return 0;
+}
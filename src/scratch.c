@@ -1,5 +1,9 @@
 #include "scratch.h"
 #include "string_util.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "trace.h"
+#include "flight.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -127,8 +131,11 @@ int create_machine_file(parallel_wrapper *par_wrapper)
 	{
 		if (par_wrapper -> machines[i] != (machine *)NULL)
 		{
-			fprintf(fp, "%s:%d # %s\n", par_wrapper -> machines[i] -> ip_addr,
-					par_wrapper -> machines[i] -> cpus, "TODO HOSTNAME");
+			/* The comment carries the CPUs of each local process, e.g. "cpus=0;1" */
+			fprintf(fp, "%s:%d # %s%s%s\n", par_wrapper -> machines[i] -> ip_addr,
+					par_wrapper -> machines[i] -> cpus, "TODO HOSTNAME",
+					par_wrapper -> machines[i] -> cpu_map == (char *)NULL ? "" : " cpus=",
+					par_wrapper -> machines[i] -> cpu_map == (char *)NULL ? "" : par_wrapper -> machines[i] -> cpu_map);
 		}
 	}
 	free(machine_file_name);
@@ -288,6 +295,30 @@ int cleanup_scratch(const char *scratch)
 	{
 		free(temp);
 	}
+	temp = join_paths(scratch, TELEMETRY_FILE);
+	remove_file(temp);
+	if (temp != (char *)NULL)
+	{
+		free(temp);
+	}
+	temp = join_paths(scratch, METRICS_FILE);
+	remove_file(temp);
+	if (temp != (char *)NULL)
+	{
+		free(temp);
+	}
+	temp = join_paths(scratch, TRACE_FILE);
+	remove_file(temp);
+	if (temp != (char *)NULL)
+	{
+		free(temp);
+	}
+	temp = join_paths(scratch, FLIGHT_FILE);
+	remove_file(temp);
+	if (temp != (char *)NULL)
+	{
+		free(temp);
+	}
 	/* Now attempt to remove the directory */
 	errno = 0;
 	rmdir(scratch);
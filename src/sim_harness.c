@@ -0,0 +1,708 @@
+/**
+ * Loopback simulation harness
+ *
+ * Starts N wrappers on this host, each in a directory of its own with
+ * _CONDOR_PROCNO/_CONDOR_NPROCS set and a chirp.config pointing at an
+ * in-process stand-in chirp server, and reports the control-plane
+ * latencies of the launch:
+ *
+ *   listen    exec of a wrapper to serving its command socket, from the
+ *             metrics of every rank (median over the ranks)
+ *   register  registration of the last rank, from the MASTER's metrics
+ *   exec      first exec of the job, from the start of the wrappers
+ *   teardown  exit of the last wrapper, from the exit of the job
+ *
+ * optionally for a list of packet loss rates of the control plane
+ * (--netem of the wrappers):
+ *
+ *   sim_harness [-n N[,N...]] [-r repeats] [-l mode] [-t timeout]
+ *               [-w wrapper] [-c csv] [-k] [-L latency] [-J jitter]
+ *               [-E error rate] [-D drop rate] [-S seed]
+ *               [-P loss[,loss...]] [-e netem spec] [-- wrapper options]
+ *
+ * The job is the harness itself (--mark), which records when it ran.
+ */
+
+#define _GNU_SOURCE
+#include "fake_chirp.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SIM_MAX_RANKS (4096)
+#define SIM_DEFAULT_SIZES "2,4,8,16,32,64"
+#define SIM_MAX_LOSSES (32)
+
+/**
+ * Options of a run
+ */
+typedef struct sim_options
+{
+	char *wrapper; /**< The parallel_wrapper binary */
+	char *harness; /**< This binary (the job) */
+	char *launch_mode; /**< --launch of the wrappers (NULL: master) */
+	int timeout; /**< Seconds before the wrappers are killed */
+	int repeats; /**< Runs per size */
+	int keep; /**< Keep the directories of the runs */
+	FILE *csv; /**< Results in CSV (NULL: none) */
+	fake_chirp_faults faults; /**< Faults of the chirp server */
+	int num_losses; /**< Packet loss rates to run */
+	double losses[SIM_MAX_LOSSES]; /**< The loss rates (negative: no loss emulated) */
+	char *netem; /**< Further impairments of the wrappers (NULL: none) */
+	int num_extra; /**< Extra wrapper options */
+	char **extra; /**< The extra wrapper options */
+} sim_options;
+
+/**
+ * Measurements of a run (seconds, negative: not measured)
+ */
+typedef struct sim_result
+{
+	int ranks; /**< Wrappers started */
+	double loss; /**< Packet loss rate (negative: none emulated) */
+	int succeeded; /**< Wrappers which exited with 0 */
+	int registered; /**< Ranks the MASTER saw register */
+	int marks; /**< Job processes which ran */
+	double listen_ms; /**< Median exec-to-listening of the wrappers (milliseconds) */
+	double register_s; /**< Registration of the last rank */
+	double exec_s; /**< First exec of the job */
+	double teardown_s; /**< Exit of the last wrapper after the job */
+	double master_teardown_s; /**< Teardown of the MASTER (its metrics) */
+	double total_s; /**< Start to exit of the last wrapper */
+	uint64_t chirp_requests; /**< Requests the chirp server answered */
+	uint64_t chirp_errors; /**< Of which with an injected error */
+	uint64_t chirp_drops; /**< Connections dropped by injection */
+} sim_result;
+
+static double now_s(void);
+static int mark(const char *path);
+static int parse_losses(sim_options *options, char *list);
+static int run(sim_options *options, int num_ranks, double loss, sim_result *result);
+static pid_t start_rank(sim_options *options, const char *root, int rank, int num_ranks, const char *netem);
+static int wait_ranks(pid_t *pids, int num_ranks, double deadline, double *last_exit);
+static void read_marks(const char *path, sim_result *result, double start);
+static void read_metrics(const char *path, sim_result *result);
+static void read_listening(const char *root, const double *started, int num_ranks, sim_result *result);
+static int compare_doubles(const void *a, const void *b);
+static int remove_entry(const char *path, const struct stat *stats, int flag, struct FTW *ftw);
+static void print_result(sim_options *options, const sim_result *result);
+static void usage(const char *name);
+
+int main(int argc, char **argv)
+{
+	int i, j, c;
+	char path[PATH_MAX];
+	char *sizes = SIM_DEFAULT_SIZES;
+	sim_options options;
+	/* The job: record when it ran */
+	if (argc == 3 && strcmp(argv[1], "--mark") == 0)
+	{
+		return mark(argv[2]);
+	}
+	memset(&options, 0, sizeof(options));
+	options.wrapper = "./parallel_wrapper";
+	options.timeout = 120;
+	options.repeats = 1;
+	options.num_losses = 1;
+	options.losses[0] = -1;
+	while ((c = getopt(argc, argv, "+hn:r:l:t:w:c:kL:J:E:D:S:P:e:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				sizes = optarg;
+				break;
+			case 'r':
+				options.repeats = atoi(optarg);
+				break;
+			case 'l':
+				options.launch_mode = optarg;
+				break;
+			case 't':
+				options.timeout = atoi(optarg);
+				break;
+			case 'w':
+				options.wrapper = optarg;
+				break;
+			case 'c':
+				options.csv = fopen(optarg, "w");
+				if (options.csv == (FILE *)NULL)
+				{
+					print(PRNT_ERR, "Unable to open %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'k':
+				options.keep = 1;
+				break;
+			case 'L':
+				options.faults.latency_us = (uint32_t) (atof(optarg) * 1000);
+				break;
+			case 'J':
+				options.faults.jitter_us = (uint32_t) (atof(optarg) * 1000);
+				break;
+			case 'E':
+				options.faults.error_rate = atof(optarg);
+				break;
+			case 'D':
+				options.faults.drop_rate = atof(optarg);
+				break;
+			case 'S':
+				options.faults.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'P':
+				if (parse_losses(&options, optarg) != 0)
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'e':
+				options.netem = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	options.extra = &argv[optind];
+	options.num_extra = argc - optind;
+	if (options.repeats < 1 || options.timeout < 10 || options.faults.error_rate < 0 ||
+		options.faults.error_rate > 1 || options.faults.drop_rate < 0 || options.faults.drop_rate > 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	/* Absolute paths - every wrapper runs in a directory of its own */
+	if (realpath(options.wrapper, path) == (char *)NULL || access(path, X_OK) != 0)
+	{
+		print(PRNT_ERR, "Unable to find the wrapper %s\n", options.wrapper);
+		return 1;
+	}
+	options.wrapper = strdup(path);
+	if (realpath("/proc/self/exe", path) == (char *)NULL)
+	{
+		print(PRNT_ERR, "Unable to find the harness binary\n");
+		return 1;
+	}
+	options.harness = strdup(path);
+
+	/* One descriptor per wrapper (and chirp client) */
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%6s %6s %6s %6s %6s %10s %10s %10s %10s %10s %10s\n", "ranks", "loss", "ok", "reg", "execs",
+		"listen_ms", "register_s", "exec_s", "teardown_s", "master_s", "total_s");
+	if (options.csv != (FILE *)NULL)
+	{
+		fprintf(options.csv, "ranks,loss,succeeded,registered,execs,listen_ms,register_s,exec_s,teardown_s,master_teardown_s,total_s,"
+			"chirp_requests,chirp_errors,chirp_drops\n");
+	}
+	char *list = strdup(sizes);
+	char *save = NULL;
+	char *size;
+	int failures = 0;
+	for (size = strtok_r(list, ",", &save); size != (char *)NULL; size = strtok_r(NULL, ",", &save))
+	{
+		int num_ranks = atoi(size);
+		if (num_ranks < 1 || num_ranks > SIM_MAX_RANKS)
+		{
+			print(PRNT_ERR, "Invalid number of ranks %s (1 to %d)\n", size, SIM_MAX_RANKS);
+			failures++;
+			continue;
+		}
+		for (j = 0; j < options.num_losses; j++)
+		{
+			for (i = 0; i < options.repeats; i++)
+			{
+				sim_result result;
+				if (run(&options, num_ranks, options.losses[j], &result) != 0 || result.succeeded != num_ranks)
+				{
+					failures++;
+				}
+				print_result(&options, &result);
+			}
+		}
+	}
+	free(list);
+	if (options.csv != (FILE *)NULL)
+	{
+		fclose(options.csv);
+	}
+	return failures == 0 ? 0 : 2;
+}
+
+/**
+ * Returns the wall-clock time in seconds
+ */
+static double now_s(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Append the current time to a file (the job)
+ */
+static int mark(const char *path)
+{
+	char line[64];
+	int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	int length = snprintf(line, sizeof(line), "%.6f\n", now_s());
+	int RC = (write(fd, line, length) == length) ? 0 : 2;
+	close(fd);
+	return RC;
+}
+
+/**
+ * Parse a list of packet loss rates ("0,0.01,0.05")
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_losses(sim_options *options, char *list)
+{
+	char *save = NULL;
+	char *rate;
+	options -> num_losses = 0;
+	for (rate = strtok_r(list, ",", &save); rate != (char *)NULL; rate = strtok_r(NULL, ",", &save))
+	{
+		char *end = NULL;
+		double loss = strtod(rate, &end);
+		if (options -> num_losses == SIM_MAX_LOSSES || end == rate || *end != '\0' || loss < 0 || loss > 1)
+		{
+			print(PRNT_ERR, "Invalid loss rate %s (0 to 1, at most %d rates)\n", rate, SIM_MAX_LOSSES);
+			return 1;
+		}
+		options -> losses[options -> num_losses++] = loss;
+	}
+	return options -> num_losses == 0;
+}
+
+/**
+ * Launch N wrappers, wait for them and collect the measurements
+ *
+ * @param loss Packet loss rate of the wrappers (negative: not emulated)
+ * @return 0 on success, otherwise failure
+ */
+static int run(sim_options *options, int num_ranks, double loss, sim_result *result)
+{
+	int i;
+	char root[] = "/tmp/pw_sim_XXXXXX";
+	char path[PATH_MAX];
+	char value[PATH_MAX + 2];
+	char netem[1024];
+	memset(result, 0, sizeof(sim_result));
+	result -> ranks = num_ranks;
+	result -> loss = loss;
+	if (loss >= 0)
+	{
+		snprintf(netem, sizeof(netem), "drop=%g%s%s", loss, options -> netem != (char *)NULL ? "," : "",
+			options -> netem != (char *)NULL ? options -> netem : "");
+	}
+	else if (options -> netem != (char *)NULL)
+	{
+		snprintf(netem, sizeof(netem), "%s", options -> netem);
+	}
+	else
+	{
+		netem[0] = '\0';
+	}
+	result -> listen_ms = result -> register_s = result -> exec_s = result -> teardown_s = -1;
+	result -> master_teardown_s = result -> total_s = -1;
+	if (mkdtemp(root) == (char *)NULL)
+	{
+		print(PRNT_ERR, "Unable to create a directory for the run\n");
+		return 1;
+	}
+	fake_chirp *chirp = fake_chirp_start();
+	if (chirp == (fake_chirp *)NULL)
+	{
+		return 2;
+	}
+	fake_chirp_set_faults(chirp, &options -> faults);
+	/* The job ad (one CPU per rank) */
+	snprintf(value, sizeof(value), "%d", num_ranks);
+	fake_chirp_set(chirp, "ClusterId", value);
+	fake_chirp_set(chirp, "RequestCpus", "1");
+	snprintf(value, sizeof(value), "%ld", (long) time(NULL));
+	fake_chirp_set(chirp, "EnteredCurrentStatus", value);
+	snprintf(value, sizeof(value), "\"%s\"", root);
+	fake_chirp_set(chirp, "IWD", value);
+	for (i = 0; i < num_ranks; i++)
+	{
+		snprintf(path, PATH_MAX, "%s/r%d", root, i);
+		if (mkdir(path, 0755) != 0 || fake_chirp_write_config(chirp, path) != 0)
+		{
+			print(PRNT_ERR, "Unable to prepare %s\n", path);
+			fake_chirp_stop(chirp);
+			return 3;
+		}
+	}
+
+	pid_t *pids = (pid_t *) calloc(num_ranks, sizeof(pid_t));
+	double *started = (double *) calloc(num_ranks, sizeof(double));
+	if (pids == (pid_t *)NULL || started == (double *)NULL)
+	{
+		free(pids);
+		fake_chirp_stop(chirp);
+		return 4;
+	}
+	double start = now_s();
+	for (i = 0; i < num_ranks; i++)
+	{
+		started[i] = now_s();
+		pids[i] = start_rank(options, root, i, num_ranks, netem[0] != '\0' ? netem : NULL);
+	}
+	double last_exit = start;
+	result -> succeeded = wait_ranks(pids, num_ranks, start + options -> timeout, &last_exit);
+	result -> total_s = last_exit - start;
+	free(pids);
+	result -> chirp_requests = chirp -> requests;
+	result -> chirp_errors = chirp -> errors;
+	result -> chirp_drops = chirp -> drops;
+	fake_chirp_stop(chirp);
+
+	snprintf(path, PATH_MAX, "%s/marks", root);
+	read_marks(path, result, start);
+	if (result -> exec_s >= 0)
+	{
+		/* The job exits right away - what follows is teardown */
+		result -> teardown_s = last_exit - (start + result -> exec_s);
+	}
+	snprintf(path, PATH_MAX, "%s/metrics.json", root);
+	read_metrics(path, result);
+	read_listening(root, started, num_ranks, result);
+	free(started);
+	if (options -> keep)
+	{
+		print(PRNT_INFO, "Kept %s\n", root);
+	}
+	else
+	{
+		nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	}
+	return 0;
+}
+
+/**
+ * Start the wrapper of a rank in its own directory
+ *
+ * @param netem --netem of the wrapper (NULL: none)
+ * @return The pid of the wrapper (-1 on failure)
+ */
+static pid_t start_rank(sim_options *options, const char *root, int rank, int num_ranks, const char *netem)
+{
+	int i;
+	char dir[PATH_MAX];
+	char marks[PATH_MAX];
+	char metrics[PATH_MAX];
+	char timeout[16];
+	char value[16];
+	snprintf(dir, PATH_MAX, "%s/r%d", root, rank);
+	snprintf(marks, PATH_MAX, "%s/marks", root);
+	/* The MASTER's metrics are in the root, the others' in their directory */
+	snprintf(metrics, PATH_MAX, "%s/metrics.json", rank == 0 ? root : dir);
+	snprintf(timeout, sizeof(timeout), "%d", options -> timeout);
+	pid_t pid = fork();
+	if (pid != 0)
+	{
+		if (pid < 0)
+		{
+			print(PRNT_WARN, "Unable to start rank %d\n", rank);
+		}
+		return pid;
+	}
+	/* The wrapper reads chirp.config (and creates its scratch directory) in TMPDIR */
+	if (chdir(dir) != 0)
+	{
+		_exit(126);
+	}
+	unsetenv("TMP");
+	unsetenv("TEMPDIR");
+	unsetenv("_CONDOR_SCRATCH_DIR");
+	setenv("TMPDIR", dir, 1);
+	snprintf(value, sizeof(value), "%d", rank);
+	setenv("_CONDOR_PROCNO", value, 1);
+	snprintf(value, sizeof(value), "%d", num_ranks);
+	setenv("_CONDOR_NPROCS", value, 1);
+	int fd = open("out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0)
+	{
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+	char **argv = (char **) calloc(options -> num_extra + 14, sizeof(char *));
+	if (argv == (char **)NULL)
+	{
+		_exit(126);
+	}
+	int argc = 0;
+	argv[argc++] = options -> wrapper;
+	argv[argc++] = "-t";
+	argv[argc++] = timeout;
+	if (options -> launch_mode != (char *)NULL)
+	{
+		argv[argc++] = "-l";
+		argv[argc++] = options -> launch_mode;
+	}
+	argv[argc++] = "-M";
+	argv[argc++] = metrics;
+	if (netem != (char *)NULL)
+	{
+		argv[argc++] = "-N";
+		argv[argc++] = (char *) netem;
+	}
+	for (i = 0; i < options -> num_extra; i++)
+	{
+		argv[argc++] = options -> extra[i];
+	}
+	argv[argc++] = options -> harness;
+	argv[argc++] = "--mark";
+	argv[argc++] = marks;
+	argv[argc] = NULL;
+	execv(options -> wrapper, argv);
+	_exit(127);
+}
+
+/**
+ * Wait for the wrappers (killing them at the deadline)
+ *
+ * @param last_exit Set to when the last one exited
+ * @return The number of wrappers which exited with 0
+ */
+static int wait_ranks(pid_t *pids, int num_ranks, double deadline, double *last_exit)
+{
+	int i, status;
+	int succeeded = 0;
+	int running = 0;
+	int killed = 0;
+	for (i = 0; i < num_ranks; i++)
+	{
+		running += (pids[i] > 0);
+	}
+	while (running > 0)
+	{
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0)
+		{
+			running--;
+			*last_exit = now_s();
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			{
+				succeeded++;
+			}
+			continue;
+		}
+		if (pid < 0 && errno == ECHILD)
+		{
+			break;
+		}
+		if (now_s() > deadline + 5 * killed)
+		{
+			print(PRNT_WARN, "%d wrappers still running - sending %s\n", running, killed ? "SIGKILL" : "SIGTERM");
+			for (i = 0; i < num_ranks; i++)
+			{
+				if (pids[i] > 0)
+				{
+					kill(pids[i], killed ? SIGKILL : SIGTERM);
+				}
+			}
+			killed = 1;
+		}
+		usleep(1000);
+	}
+	return succeeded;
+}
+
+/**
+ * Read the times the job processes ran
+ */
+static void read_marks(const char *path, sim_result *result, double start)
+{
+	double when;
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return;
+	}
+	while (fscanf(fp, "%lf", &when) == 1)
+	{
+		if (result -> marks == 0 || when - start < result -> exec_s)
+		{
+			result -> exec_s = when - start;
+		}
+		result -> marks++;
+	}
+	fclose(fp);
+}
+
+/**
+ * Read the registration times and the teardown from the MASTER's metrics
+ */
+static void read_metrics(const char *path, sim_result *result)
+{
+	char line[1024];
+	double value;
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) != (char *)NULL)
+	{
+		char *field = strstr(line, "\"registration_s\": ");
+		if (field != (char *)NULL && sscanf(field + 18, "%lf", &value) == 1)
+		{
+			result -> registered++;
+			if (value > result -> register_s)
+			{
+				result -> register_s = value;
+			}
+		}
+		field = strstr(line, "\"teardown_s\": ");
+		if (field != (char *)NULL && sscanf(field + 14, "%lf", &value) == 1)
+		{
+			result -> master_teardown_s = value;
+		}
+	}
+	fclose(fp);
+}
+
+/**
+ * Read when every wrapper served its command socket
+ *
+ * @param started When each wrapper was started (now_s)
+ */
+static void read_listening(const char *root, const double *started, int num_ranks, sim_result *result)
+{
+	int i;
+	int count = 0;
+	char path[PATH_MAX];
+	char line[1024];
+	double *listen = (double *) calloc(num_ranks, sizeof(double));
+	if (listen == (double *)NULL)
+	{
+		return;
+	}
+	for (i = 0; i < num_ranks; i++)
+	{
+		double value;
+		if (i == 0)
+		{
+			snprintf(path, PATH_MAX, "%s/metrics.json", root);
+		}
+		else
+		{
+			snprintf(path, PATH_MAX, "%s/r%d/metrics.json", root, i);
+		}
+		FILE *fp = fopen(path, "r");
+		if (fp == (FILE *)NULL)
+		{
+			continue;
+		}
+		while (fgets(line, sizeof(line), fp) != (char *)NULL)
+		{
+			char *field = strstr(line, "\"listening_at\": ");
+			if (field != (char *)NULL && sscanf(field + 16, "%lf", &value) == 1 && value > 0)
+			{
+				listen[count++] = (value - started[i]) * 1000;
+				break;
+			}
+		}
+		fclose(fp);
+	}
+	if (count > 0)
+	{
+		qsort(listen, count, sizeof(double), compare_doubles);
+		result -> listen_ms = listen[count / 2];
+	}
+	free(listen);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double first = *(const double *) a;
+	double second = *(const double *) b;
+	return (first > second) - (first < second);
+}
+
+/**
+ * Remove one entry of a run directory (nftw callback)
+ */
+static int remove_entry(const char *path, const struct stat *stats, int flag, struct FTW *ftw)
+{
+	if (remove(path) != 0)
+	{
+		print(PRNT_WARN, "Unable to remove %s\n", path);
+	}
+	return 0;
+}
+
+/**
+ * Print a row of results (and the CSV line)
+ */
+static void print_result(sim_options *options, const sim_result *result)
+{
+	printf("%6d %6.3f %6d %6d %6d %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", result -> ranks,
+		result -> loss > 0 ? result -> loss : 0.0, result -> succeeded,
+		result -> registered, result -> marks, result -> listen_ms, result -> register_s, result -> exec_s, result -> teardown_s,
+		result -> master_teardown_s, result -> total_s);
+	if (result -> chirp_errors != 0 || result -> chirp_drops != 0)
+	{
+		printf("       chirp: %llu requests, %llu errors, %llu dropped\n",
+			(unsigned long long) result -> chirp_requests, (unsigned long long) result -> chirp_errors,
+			(unsigned long long) result -> chirp_drops);
+	}
+	fflush(stdout);
+	if (options -> csv != (FILE *)NULL)
+	{
+		fprintf(options -> csv, "%d,%g,%d,%d,%d,%.3f,%.6f,%.6f,%.6f,%.6f,%.6f,%llu,%llu,%llu\n", result -> ranks,
+			result -> loss > 0 ? result -> loss : 0.0, result -> succeeded, result -> registered, result -> marks,
+			result -> listen_ms, result -> register_s, result -> exec_s,
+			result -> teardown_s, result -> master_teardown_s, result -> total_s,
+			(unsigned long long) result -> chirp_requests, (unsigned long long) result -> chirp_errors,
+			(unsigned long long) result -> chirp_drops);
+		fflush(options -> csv);
+	}
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] [-- wrapper options]\n", name);
+	printf(" -n N[,N...]   numbers of ranks to run (default %s, at most %d)\n", SIM_DEFAULT_SIZES, SIM_MAX_RANKS);
+	printf(" -r repeats    runs per number of ranks (default 1)\n");
+	printf(" -l mode       --launch of the wrappers (default master)\n");
+	printf(" -t seconds    wrapper timeout; stragglers are killed after it (default 120)\n");
+	printf(" -w wrapper    the parallel_wrapper binary (default ./parallel_wrapper)\n");
+	printf(" -c file       also write the results as CSV\n");
+	printf(" -k            keep the directories of the runs\n");
+	printf(" -L ms         delay every chirp answer by this much\n");
+	printf(" -J ms         and by up to this much more (uniform)\n");
+	printf(" -E rate       fraction of chirp requests answered with an error\n");
+	printf(" -D rate       fraction of chirp requests whose connection is dropped\n");
+	printf(" -S seed       seed of the chirp faults (runs with the same seed repeat)\n");
+	printf(" -P loss,...   packet loss rates of the control plane to run with\n");
+	printf(" -e spec       further --netem impairments of the wrappers\n");
+}
@@ -206,6 +206,72 @@ int count_tokens(char *delim, char *string)
 	return tokens;
 }
 
+/**
+ * Build the lookup table of a set of delimiters for tokenize()
+ *
+ * @param delim A character array of delimiters
+ * @param table (output) The table
+ */
+void make_delimiter_table(const char *delim, delimiter_table *table)
+{
+	memset(table -> class, TOKEN_CHAR, sizeof(table -> class));
+	for ( ; delim != (char *)NULL && *delim != '\0'; delim++)
+	{
+		table -> class[(unsigned char) *delim] = TOKEN_DELIMITER;
+	}
+	table -> class[0] = TOKEN_END;
+}
+
+/**
+ * Split a string into tokens in place
+ *
+ * Tokens are delimited as by strsplit (consecutive delimiters are one;
+ * leading delimiters are skipped rather than giving an empty token), but
+ * in a single pass without copying: the first delimiter after every
+ * token is overwritten with a terminator and tokens points into the
+ * string.
+ *
+ * @param table The delimiters (see make_delimiter_table)
+ * @param string The string to split (modified)
+ * @param tokens (output) The tokens
+ * @param capacity The length of tokens
+ * @return The number of tokens, or -1 if there are more than capacity
+ */
+int tokenize(const delimiter_table *table, char *string, char **tokens, int capacity)
+{
+	int count = 0;
+	unsigned char *next = (unsigned char *) string;
+	if (string == (char *)NULL)
+	{
+		return 0;
+	}
+	while ( 1 )
+	{
+		while (table -> class[*next] == TOKEN_DELIMITER)
+		{
+			next++;
+		}
+		if (*next == '\0')
+		{
+			return count;
+		}
+		if (count == capacity)
+		{
+			return -1;
+		}
+		tokens[count++] = (char *) next;
+		while (table -> class[*next] == TOKEN_CHAR)
+		{
+			next++;
+		}
+		if (*next == '\0')
+		{
+			return count;
+		}
+		*next++ = '\0';
+	}
+}
+
 /**
  * Remove the quotes from a string
  * 
@@ -276,6 +342,38 @@ int parse_integer(char *string, int *value)
 	return 0;
 }
 
+/**
+ * Parses the unsigned 32-bit value of a string.
+ *
+ * Parses the value of string and places the result in ``value''. If an
+ * error occurs, ``value'' is left unchanged and a non-zero return value
+ * is provided.
+ *
+ * @param string The unsigned integer string to parse
+ * @param value (output) The final value
+ * @return 0 if success, otherwise failure
+ */
+int parse_uint32(char *string, uint32_t *value)
+{
+	if (string == (char *)NULL)
+	{
+		return 1;
+	}
+	if (value == (uint32_t *)NULL)
+	{
+		return 2;
+	}
+	char *next = NULL;
+	errno = 0;
+	unsigned long new_value = strtoul(string, &next, 10); /* Base 10 */
+	if (errno != 0 || next == (char *)NULL || string == next || new_value > UINT32_MAX)
+	{
+		return 3;
+	}
+	*value = (uint32_t) new_value;
+	return 0;
+}
+
 /**
  * Remove preceeding or trailing whitespace
  *
@@ -393,4 +491,81 @@ char *join_paths(const char *path_1, const char *path_2)
 	return output_path;
 }
 
+/**
+ * Escape a field for use in a control plane message
+ *
+ * The message delimiters (':' and '|'), '%' and whitespace are replaced
+ * by %XX. The parser drops empty tokens, so an empty field is sent as %00.
+ *
+ * @param string The field to escape
+ * @param escaped (output) The escaped field
+ * @param len The length of escaped
+ * @return 0 on success, otherwise the escaped field does not fit
+ */
+int escape_field(const char *string, char *escaped, size_t len)
+{
+	size_t j = 0;
+	if (string == (char *)NULL || escaped == (char *)NULL || len < 4)
+	{
+		return 1;
+	}
+	if (*string == '\0')
+	{
+		strcpy(escaped, "%00");
+		return 0;
+	}
+	for ( ; *string != '\0'; string++)
+	{
+		unsigned char c = (unsigned char) *string;
+		if (c == ':' || c == '|' || c == '%' || c <= ' ')
+		{
+			if (j + 3 >= len)
+			{
+				return 2;
+			}
+			snprintf(escaped + j, 4, "%%%02X", c);
+			j += 3;
+		}
+		else
+		{
+			if (j + 1 >= len)
+			{
+				return 2;
+			}
+			escaped[j++] = (char) c;
+		}
+	}
+	escaped[j] = '\0';
+	return 0;
+}
 
+/**
+ * Reverse escape_field (in place)
+ *
+ * @param string The field to unescape
+ */
+void unescape_field(char *string)
+{
+	char *out = string;
+	if (string == (char *)NULL)
+	{
+		return;
+	}
+	while (*string != '\0')
+	{
+		unsigned int c;
+		if (string[0] == '%' && string[1] != '\0' && string[2] != '\0' &&
+			sscanf(string + 1, "%2x", &c) == 1)
+		{
+			if (c == 0)
+			{
+				break; /* Empty field */
+			}
+			*out++ = (char) c;
+			string += 3;
+			continue;
+		}
+		*out++ = *string++;
+	}
+	*out = '\0';
+}
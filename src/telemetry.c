@@ -0,0 +1,442 @@
+/**
+ * Live resource telemetry of the job
+ *
+ * Every rank samples the CPU time, resident memory, context switches and
+ * storage I/O of its local job (from the job cgroup when there is one,
+ * otherwise from /proc) every --sample-interval seconds. Whenever the
+ * MASTER sends a keep-alive QUERY, the rank answers with the usage since
+ * its previous answer in the status of the ACK. The MASTER keeps the
+ * last TELEMETRY_HISTORY reports of every rank and writes the resulting
+ * table to a file each keep-alive round and on SIGUSR1.
+ */
+
+#include "telemetry.h"
+#include "cgroup.h"
+#include "flight.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+
+static int read_counters(parallel_wrapper *par_wrapper, telemetry_counters *counters);
+static void add_process(pid_t pid, pid_t pgid, telemetry_counters *counters);
+static uint64_t delta(uint64_t now, uint64_t before);
+
+/**
+ * Allocate the telemetry state
+ *
+ * @param num_ranks The number of ranks to keep reports for (0 on non-MASTER ranks)
+ * @return The (allocated) state, or NULL on failure
+ */
+telemetry *telemetry_get(int num_ranks)
+{
+	telemetry *state = (telemetry *)calloc(1, sizeof(telemetry));
+	if (state == (telemetry *)NULL)
+	{
+		return NULL;
+	}
+	if (num_ranks > 0)
+	{
+		state -> ranks = (telemetry_rank *)calloc(num_ranks, sizeof(telemetry_rank));
+		if (state -> ranks == (telemetry_rank *)NULL)
+		{
+			free(state);
+			return NULL;
+		}
+		state -> num_ranks = num_ranks;
+	}
+	pthread_mutex_init(&state -> mutex, NULL);
+	pthread_mutex_init(&state -> dump_mutex, NULL);
+	gettimeofday(&state -> reported_at, NULL);
+	return state;
+}
+
+/**
+ * Thread Entry Point: Sample the usage of the local job
+ *
+ * Processes which exit take their usage with them, so only increases of
+ * the raw counters are accumulated. Resident memory is the peak seen
+ * since the last report.
+ *
+ * @param ptr A void pointer to the parallel_wrapper
+ * @return NULL
+ */
+void *telemetry_sampler(void *ptr)
+{
+	parallel_wrapper *par_wrapper = (parallel_wrapper *)ptr;
+	telemetry *state = par_wrapper -> telemetry;
+	telemetry_counters now;
+	while ( 1 )
+	{
+		int RC = read_counters(par_wrapper, &now);
+		flight_record(FLIGHT_TIMER, FLIGHT_SAMPLE, 0, RC, NULL);
+		if (RC == 0)
+		{
+			pthread_mutex_lock(&state -> mutex);
+			state -> current.cpu_ms += delta(now.cpu_ms, state -> raw.cpu_ms);
+			state -> current.ctx_switches += delta(now.ctx_switches, state -> raw.ctx_switches);
+			state -> current.read_kb += delta(now.read_kb, state -> raw.read_kb);
+			state -> current.write_kb += delta(now.write_kb, state -> raw.write_kb);
+			if (now.rss_kb > state -> current.rss_kb)
+			{
+				state -> current.rss_kb = now.rss_kb;
+			}
+			state -> raw = now;
+			pthread_mutex_unlock(&state -> mutex);
+		}
+		sleep(par_wrapper -> sample_interval);
+	}
+	return NULL;
+}
+
+/**
+ * Format the usage of the local job since the last report
+ *
+ * The report reads "T<ID>,<MS>,<CPU_MS>,<RSS_KB>,<CTX>,<READ_KB>,<WRITE_KB>"
+ * and is sent as the status of the ACK to a QUERY.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param status (output) The report
+ * @param len The length of status
+ * @return 0 on success, otherwise failure (nothing to report)
+ */
+int telemetry_report(parallel_wrapper *par_wrapper, char *status, int len)
+{
+	struct timeval now, diff;
+	telemetry *state = par_wrapper -> telemetry;
+	if (state == (telemetry *)NULL || par_wrapper -> sample_interval <= 0 ||
+		(par_wrapper -> pgid <= 0 && par_wrapper -> cgroup == (char *)NULL))
+	{
+		return 1;
+	}
+	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&state -> mutex);
+	timersub(&now, &state -> reported_at, &diff);
+	snprintf(status, len, "%c%u,%ld,%llu,%llu,%llu,%llu,%llu", TELEMETRY_PREFIX, ++state -> report_id,
+		(long) (diff.tv_sec * 1000 + diff.tv_usec / 1000),
+		(unsigned long long) (state -> current.cpu_ms - state -> reported.cpu_ms),
+		(unsigned long long) state -> current.rss_kb,
+		(unsigned long long) (state -> current.ctx_switches - state -> reported.ctx_switches),
+		(unsigned long long) (state -> current.read_kb - state -> reported.read_kb),
+		(unsigned long long) (state -> current.write_kb - state -> reported.write_kb));
+	state -> reported = state -> current;
+	state -> reported_at = now;
+	/* The next report carries the peak from here on */
+	state -> current.rss_kb = state -> raw.rss_kb;
+	pthread_mutex_unlock(&state -> mutex);
+	return 0;
+}
+
+/**
+ * Add a report from a rank to the table (MASTER only)
+ *
+ * Duplicate reports are ignored; reports lost in transit are counted.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param rank The rank which sent the report
+ * @param status The report (see telemetry_report)
+ * @return 0 on success, otherwise failure
+ */
+int telemetry_record(parallel_wrapper *par_wrapper, int rank, const char *status)
+{
+	telemetry_sample sample;
+	unsigned long long cpu_ms, rss_kb, ctx_switches, read_kb, write_kb;
+	long interval_ms;
+	telemetry *state = par_wrapper -> telemetry;
+	if (state == (telemetry *)NULL || rank < 0 || rank >= state -> num_ranks)
+	{
+		return 1;
+	}
+	if (status[0] != TELEMETRY_PREFIX || sscanf(status + 1, "%u,%ld,%llu,%llu,%llu,%llu,%llu", &sample.id,
+		&interval_ms, &cpu_ms, &rss_kb, &ctx_switches, &read_kb, &write_kb) != 7 || interval_ms < 0)
+	{
+		print(PRNT_WARN, "Invalid telemetry from rank %d\n", rank);
+		return 2;
+	}
+	sample.interval_ms = (uint32_t) interval_ms;
+	sample.cpu_ms = cpu_ms;
+	sample.rss_kb = rss_kb;
+	sample.ctx_switches = ctx_switches;
+	sample.read_kb = read_kb;
+	sample.write_kb = write_kb;
+
+	pthread_mutex_lock(&state -> mutex);
+	telemetry_rank *entry = &state -> ranks[rank];
+	if (entry -> count > 0)
+	{
+		uint32_t last = entry -> samples[(entry -> next + TELEMETRY_HISTORY - 1) % TELEMETRY_HISTORY].id;
+		if (sample.id <= last)
+		{
+			pthread_mutex_unlock(&state -> mutex);
+			return 0; /* Duplicate */
+		}
+		entry -> missed += sample.id - last - 1;
+	}
+	entry -> samples[entry -> next] = sample;
+	entry -> next = (entry -> next + 1) % TELEMETRY_HISTORY;
+	if (entry -> count < TELEMETRY_HISTORY)
+	{
+		entry -> count++;
+	}
+	entry -> total.cpu_ms += sample.cpu_ms;
+	entry -> total.ctx_switches += sample.ctx_switches;
+	entry -> total.read_kb += sample.read_kb;
+	entry -> total.write_kb += sample.write_kb;
+	if (sample.rss_kb > entry -> total.rss_kb)
+	{
+		entry -> total.rss_kb = sample.rss_kb;
+	}
+	pthread_mutex_unlock(&state -> mutex);
+	return 0;
+}
+
+/**
+ * Write the per-rank table to the telemetry file (MASTER only)
+ *
+ * Rates are averaged over the reports held for each rank. Ranks using
+ * less than half the mean CPU are listed as stragglers. The file is
+ * replaced atomically, so it can be watched while the job runs, and one
+ * writer at a time (keep-alive rounds, SIGUSR1 and cleanup share it).
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise failure
+ */
+int telemetry_dump(parallel_wrapper *par_wrapper)
+{
+	int i, j, RC;
+	char path[1024];
+	char temp[1040];
+	telemetry *state = par_wrapper -> telemetry;
+	if (state == (telemetry *)NULL || state -> num_ranks == 0)
+	{
+		return 1;
+	}
+	if (par_wrapper -> telemetry_file != (char *)NULL)
+	{
+		snprintf(path, 1024, "%s", par_wrapper -> telemetry_file);
+	}
+	else if (par_wrapper -> scratch_dir != (char *)NULL)
+	{
+		snprintf(path, 1024, "%s/%s", par_wrapper -> scratch_dir, TELEMETRY_FILE);
+	}
+	else
+	{
+		return 1;
+	}
+	double *cpu = (double *)calloc(state -> num_ranks, sizeof(double));
+	if (cpu == (double *)NULL)
+	{
+		return 2;
+	}
+	snprintf(temp, 1040, "%s.tmp", path);
+	pthread_mutex_lock(&state -> dump_mutex);
+	FILE *fp = fopen(temp, "w");
+	if (fp == (FILE *)NULL)
+	{
+		pthread_mutex_unlock(&state -> dump_mutex);
+		print(PRNT_WARN, "Unable to write telemetry to %s\n", temp);
+		free(cpu);
+		return 3;
+	}
+
+	double mean = 0.0;
+	int reporting = 0;
+	char stamp[64];
+	struct tm time_info;
+	time_t now = time(NULL);
+	localtime_r(&now, &time_info);
+	strftime(stamp, sizeof(stamp), "%a %b %e %H:%M:%S %Y", &time_info);
+	fprintf(fp, "# Telemetry of %d ranks (last %u reports), %s\n", state -> num_ranks,
+		TELEMETRY_HISTORY, stamp);
+	fprintf(fp, "# rank reports missed cpu%% rss_kB ctxsw/s read_kB/s write_kB/s cpu_s peak_rss_kB\n");
+	pthread_mutex_lock(&state -> mutex);
+	for (i = 0; i < state -> num_ranks; i++)
+	{
+		telemetry_rank *entry = &state -> ranks[i];
+		uint64_t interval_ms = 0, cpu_ms = 0, ctx_switches = 0, read_kb = 0, write_kb = 0;
+		if (entry -> count == 0)
+		{
+			fprintf(fp, "%d 0 %u - - - - - - -\n", i, entry -> missed);
+			continue;
+		}
+		for (j = 0; j < entry -> count; j++)
+		{
+			interval_ms += entry -> samples[j].interval_ms;
+			cpu_ms += entry -> samples[j].cpu_ms;
+			ctx_switches += entry -> samples[j].ctx_switches;
+			read_kb += entry -> samples[j].read_kb;
+			write_kb += entry -> samples[j].write_kb;
+		}
+		double seconds = (interval_ms == 0) ? 1.0 : interval_ms / 1000.0;
+		cpu[i] = 100.0 * cpu_ms / (seconds * 1000.0);
+		mean += cpu[i];
+		reporting++;
+		fprintf(fp, "%d %d %u %.1f %llu %.1f %.1f %.1f %.1f %llu\n", i, entry -> count, entry -> missed, cpu[i],
+			(unsigned long long) entry -> samples[(entry -> next + TELEMETRY_HISTORY - 1) % TELEMETRY_HISTORY].rss_kb,
+			ctx_switches / seconds, read_kb / seconds, write_kb / seconds,
+			entry -> total.cpu_ms / 1000.0, (unsigned long long) entry -> total.rss_kb);
+	}
+	if (reporting > 0)
+	{
+		mean /= reporting;
+		fprintf(fp, "# mean cpu%% %.1f, stragglers (below half the mean):", mean);
+		for (i = 0; i < state -> num_ranks; i++)
+		{
+			if (state -> ranks[i].count > 0 && cpu[i] < mean / 2.0)
+			{
+				fprintf(fp, " %d", i);
+			}
+		}
+		fprintf(fp, "\n");
+	}
+	pthread_mutex_unlock(&state -> mutex);
+	fclose(fp);
+	free(cpu);
+	RC = rename(temp, path);
+	pthread_mutex_unlock(&state -> dump_mutex);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to replace telemetry file %s\n", path);
+		return 4;
+	}
+	return 0;
+}
+
+/**
+ * Read the usage of the live processes of the local job
+ *
+ * The processes are the members of the job cgroup, or else of the job's
+ * process group. CPU and I/O come from the cgroup when it has them.
+ *
+ * @return 0 on success, otherwise failure (no job)
+ */
+static int read_counters(parallel_wrapper *par_wrapper, telemetry_counters *counters)
+{
+	char path[1024];
+	char line[64];
+	memset(counters, 0, sizeof(telemetry_counters));
+	if (par_wrapper -> cgroup != (char *)NULL)
+	{
+		cgroup_usage usage;
+		snprintf(path, 1024, "%s/cgroup.procs", par_wrapper -> cgroup);
+		FILE *fp = fopen(path, "r");
+		while (fp != (FILE *)NULL && fgets(line, 64, fp) != (char *)NULL)
+		{
+			add_process((pid_t) atoi(line), 0, counters);
+		}
+		if (fp != (FILE *)NULL)
+		{
+			fclose(fp);
+		}
+		if (cgroup_read_usage(par_wrapper, &usage) == 0)
+		{
+			counters -> cpu_ms = usage.cpu_usec / 1000;
+			if (usage.io_read_bytes != 0 || usage.io_write_bytes != 0)
+			{
+				counters -> read_kb = usage.io_read_bytes / 1024;
+				counters -> write_kb = usage.io_write_bytes / 1024;
+			}
+		}
+		return 0;
+	}
+	if (par_wrapper -> pgid <= 0)
+	{
+		return 1;
+	}
+	DIR *dir = opendir("/proc");
+	struct dirent *entry;
+	while (dir != (DIR *)NULL && (entry = readdir(dir)) != (struct dirent *)NULL)
+	{
+		if (isdigit(entry -> d_name[0]))
+		{
+			add_process((pid_t) atoi(entry -> d_name), par_wrapper -> pgid, counters);
+		}
+	}
+	if (dir != (DIR *)NULL)
+	{
+		closedir(dir);
+	}
+	return 0;
+}
+
+/**
+ * Add the usage of a single process (from /proc) to the counters
+ *
+ * @param pid The process
+ * @param pgid Only count the process if it is in this group (0 for any)
+ * @param counters (output) The counters to add to
+ */
+static void add_process(pid_t pid, pid_t pgid, telemetry_counters *counters)
+{
+	char path[64];
+	char line[1024];
+	int group;
+	unsigned long utime, stime;
+	long cutime, cstime, rss;
+	unsigned long long value;
+	if (pid <= 0)
+	{
+		return;
+	}
+	/* The command name may hold spaces - the fields follow its closing ')' */
+	snprintf(path, 64, "/proc/%d/stat", (int) pid);
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return;
+	}
+	char *fields = (fgets(line, 1024, fp) != (char *)NULL) ? strrchr(line, ')') : NULL;
+	fclose(fp);
+	if (fields == (char *)NULL || sscanf(fields + 2, "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld "
+		"%*d %*d %*d %*d %*u %*u %ld", &group, &utime, &stime, &cutime, &cstime, &rss) != 6)
+	{
+		return;
+	}
+	if (pgid > 0 && group != pgid)
+	{
+		return;
+	}
+	long ticks = sysconf(_SC_CLK_TCK);
+	counters -> cpu_ms += (utime + stime + cutime + cstime) * 1000 / (ticks > 0 ? ticks : 100);
+	counters -> rss_kb += rss * (sysconf(_SC_PAGESIZE) / 1024);
+
+	snprintf(path, 64, "/proc/%d/status", (int) pid);
+	fp = fopen(path, "r");
+	while (fp != (FILE *)NULL && fgets(line, 1024, fp) != (char *)NULL)
+	{
+		if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1 ||
+			sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1)
+		{
+			counters -> ctx_switches += value;
+		}
+	}
+	if (fp != (FILE *)NULL)
+	{
+		fclose(fp);
+	}
+
+	snprintf(path, 64, "/proc/%d/io", (int) pid);
+	fp = fopen(path, "r");
+	while (fp != (FILE *)NULL && fgets(line, 1024, fp) != (char *)NULL)
+	{
+		if (sscanf(line, "read_bytes: %llu", &value) == 1)
+		{
+			counters -> read_kb += value / 1024;
+		}
+		else if (sscanf(line, "write_bytes: %llu", &value) == 1)
+		{
+			counters -> write_kb += value / 1024;
+		}
+	}
+	if (fp != (FILE *)NULL)
+	{
+		fclose(fp);
+	}
+}
+
+/**
+ * Returns the increase from before to now (0 if the counter went down)
+ */
+static uint64_t delta(uint64_t now, uint64_t before)
+{
+	return (now > before) ? now - before : 0;
+}
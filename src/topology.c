@@ -0,0 +1,500 @@
+/**
+ * CPU and NUMA aware placement of local processes
+ *
+ * The CPUs this wrapper may use are those in its affinity mask, further
+ * limited by the effective cpuset of its cgroup (v2) when one is set.
+ * Each CPU is tagged with its socket and core (from sysfs topology) and
+ * its NUMA node, and a binding policy turns that list into one CPU list
+ * per local process. Bindings are applied in the forked child, just
+ * before exec.
+ */
+
+#define _GNU_SOURCE
+#include "topology.h"
+#include "cgroup.h"
+#include <sched.h>
+#include <dirent.h>
+#include <ctype.h>
+
+/**
+ * A single usable CPU
+ */
+struct cpu_info
+{
+	int cpu; /**< The logical CPU number */
+	int package; /**< The physical package (socket) */
+	int core; /**< The core within the package */
+	int node; /**< The NUMA node */
+};
+
+static int get_allowed_cpus(cpu_set_t *allowed);
+static int get_topology(struct cpu_info **cpus);
+static int compare_cpus(const void *a, const void *b);
+static int compact_order(struct cpu_info *cpus, int start, int end, int *order);
+static int read_line(const char *path, char *line, int line_len);
+static int parse_cpu_list(const char *list, cpu_set_t *set);
+static int format_cpu_list(const cpu_set_t *set, char *list, int list_len);
+
+/**
+ * Returns the name of a binding policy (as accepted by --bind)
+ */
+const char *bind_policy_name(BIND_POLICY policy)
+{
+	switch (policy)
+	{
+		case BIND_COMPACT:
+			return "compact";
+		case BIND_SCATTER:
+			return "scatter";
+		case BIND_SOCKET:
+			return "socket";
+		default:
+			return "none";
+	}
+}
+
+/**
+ * Work out where each local process should run
+ *
+ * compact: one core per process, filling each socket before the next
+ * (hyperthread siblings are only used once every core is taken).
+ * scatter: one core per process, round robin across NUMA nodes.
+ * socket: consecutive blocks of processes share every CPU of a socket.
+ * Processes beyond the number of CPUs wrap around.
+ *
+ * @param policy The binding policy
+ * @param num_procs The number of local processes
+ * @param nodes (output) The NUMA node of each process (-1 if unbound)
+ * @return num_procs (allocated) CPU lists - NULL entries are unbound
+ */
+char **get_bindings(BIND_POLICY policy, int num_procs, int *nodes)
+{
+	int i, j;
+	struct cpu_info *cpus = NULL;
+	char list[CPU_LIST_MAX];
+	char **bindings = (char **)calloc(num_procs, sizeof(char *));
+	if (bindings == (char **)NULL)
+	{
+		print(PRNT_ERR, "Unable to allocate space for CPU bindings\n");
+		return NULL;
+	}
+	for (i = 0; i < num_procs; i++)
+	{
+		nodes[i] = -1;
+	}
+	int count = (policy == BIND_NONE) ? 0 : get_topology(&cpus);
+	int *order = (int *)calloc(count + 1, sizeof(int));
+	if (count <= 0 || order == (int *)NULL)
+	{
+		free(cpus);
+		free(order);
+		return bindings; /* Unbound */
+	}
+
+	if (policy == BIND_COMPACT)
+	{
+		compact_order(cpus, 0, count, order);
+	}
+	else if (policy == BIND_SCATTER)
+	{
+		/* Deal the cores of each node out in turn */
+		int *starts = (int *)calloc(count + 1, sizeof(int));
+		int *sorted = (int *)calloc(count, sizeof(int));
+		int num_nodes = 0;
+		if (starts == (int *)NULL || sorted == (int *)NULL)
+		{
+			free(starts);
+			free(sorted);
+			compact_order(cpus, 0, count, order);
+		}
+		else
+		{
+			for (i = 0; i < count; i++)
+			{
+				if (i == 0 || cpus[i].node != cpus[i - 1].node)
+				{
+					starts[num_nodes++] = i;
+				}
+			}
+			starts[num_nodes] = count;
+			for (j = 0; j < num_nodes; j++)
+			{
+				compact_order(cpus, starts[j], starts[j + 1], sorted + starts[j]);
+			}
+			int k = 0;
+			for (i = 0; k < count; i++)
+			{
+				for (j = 0; j < num_nodes; j++)
+				{
+					if (starts[j] + i < starts[j + 1])
+					{
+						order[k++] = sorted[starts[j] + i];
+					}
+				}
+			}
+			free(starts);
+			free(sorted);
+		}
+	}
+
+	for (i = 0; i < num_procs; i++)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (policy == BIND_SOCKET)
+		{
+			/* Split the processes into one block per socket */
+			int num_packages = 0;
+			int package = -1;
+			for (j = 0; j < count; j++)
+			{
+				if (j == 0 || cpus[j].package != cpus[j - 1].package)
+				{
+					num_packages++;
+				}
+			}
+			int target = (int)(((long) i * num_packages) / num_procs);
+			for (j = 0; j < count; j++)
+			{
+				if (j == 0 || cpus[j].package != cpus[j - 1].package)
+				{
+					package++;
+				}
+				if (package == target)
+				{
+					CPU_SET(cpus[j].cpu, &set);
+					if (nodes[i] < 0)
+					{
+						nodes[i] = cpus[j].node;
+					}
+				}
+			}
+		}
+		else
+		{
+			struct cpu_info *cpu = &cpus[order[i % count]];
+			CPU_SET(cpu -> cpu, &set);
+			nodes[i] = cpu -> node;
+		}
+		if (format_cpu_list(&set, list, CPU_LIST_MAX) == 0)
+		{
+			bindings[i] = strdup(list);
+		}
+	}
+	free(cpus);
+	free(order);
+	return bindings;
+}
+
+/**
+ * Join the CPU lists of the local processes with ';' (e.g. "0;1;2-3")
+ *
+ * @param bindings The CPU list of each process
+ * @param count The number of processes
+ * @return The (allocated) map, or NULL if no process is bound
+ */
+char *join_bindings(char **bindings, int count)
+{
+	int i;
+	int length = 0;
+	int bound = 0;
+	if (bindings == (char **)NULL)
+	{
+		return NULL;
+	}
+	for (i = 0; i < count; i++)
+	{
+		length += (bindings[i] == (char *)NULL ? 1 : strlen(bindings[i])) + 1;
+		bound |= (bindings[i] != (char *)NULL);
+	}
+	char *map = bound ? (char *)calloc(length + 1, sizeof(char)) : NULL;
+	if (map == (char *)NULL)
+	{
+		return NULL;
+	}
+	for (i = 0; i < count; i++)
+	{
+		strcat(map, bindings[i] == (char *)NULL ? "-" : bindings[i]);
+		if (i + 1 < count)
+		{
+			strcat(map, ";");
+		}
+	}
+	return map;
+}
+
+/**
+ * Pin the calling process to a CPU list
+ *
+ * @param cpu_list The CPUs (e.g. "0-3,8"), or NULL to leave placement alone
+ * @return 0 on success, otherwise failure
+ */
+int bind_to_cpus(const char *cpu_list)
+{
+	cpu_set_t set;
+	if (cpu_list == (char *)NULL)
+	{
+		return 0;
+	}
+	if (parse_cpu_list(cpu_list, &set) != 0 || CPU_COUNT(&set) == 0)
+	{
+		print(PRNT_WARN, "Invalid CPU list %s\n", cpu_list);
+		return 1;
+	}
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0)
+	{
+		print(PRNT_WARN, "Unable to bind to CPUs %s\n", cpu_list);
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Find the CPUs this wrapper may use
+ *
+ * @param allowed (output) The affinity mask, limited to the cgroup cpuset
+ * @return 0 on success, otherwise failure
+ */
+static int get_allowed_cpus(cpu_set_t *allowed)
+{
+	char list[1024];
+	char path[1024];
+	cpu_set_t cpuset;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), allowed) != 0)
+	{
+		return 1;
+	}
+	char *cgroup = cgroup_self_path();
+	if (cgroup == (char *)NULL)
+	{
+		return 0;
+	}
+	snprintf(path, 1024, "%s/cpuset.cpus.effective", cgroup);
+	if (read_line(path, list, 1024) == 0 && list[0] != '\0' &&
+		parse_cpu_list(list, &cpuset) == 0)
+	{
+		CPU_AND(allowed, allowed, &cpuset);
+	}
+	free(cgroup);
+	return 0;
+}
+
+/**
+ * Describe each usable CPU, sorted by NUMA node, socket, core and CPU
+ *
+ * @param cpus (output) The (allocated) usable CPUs
+ * @return The number of usable CPUs, or -1 on error
+ */
+static int get_topology(struct cpu_info **cpus)
+{
+	int cpu, i;
+	cpu_set_t allowed;
+	char path[1024];
+	char line[1024];
+	if (get_allowed_cpus(&allowed) != 0 || CPU_COUNT(&allowed) == 0)
+	{
+		return -1;
+	}
+	*cpus = (struct cpu_info *)calloc(CPU_COUNT(&allowed), sizeof(struct cpu_info));
+	if (*cpus == (struct cpu_info *)NULL)
+	{
+		return -1;
+	}
+	int count = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (! CPU_ISSET(cpu, &allowed))
+		{
+			continue;
+		}
+		struct cpu_info *info = &(*cpus)[count++];
+		info -> cpu = cpu;
+		snprintf(path, 1024, "%s/cpu%d/topology/physical_package_id", SYSFS_CPU, cpu);
+		info -> package = (read_line(path, line, 1024) == 0) ? atoi(line) : 0;
+		snprintf(path, 1024, "%s/cpu%d/topology/core_id", SYSFS_CPU, cpu);
+		info -> core = (read_line(path, line, 1024) == 0) ? atoi(line) : cpu;
+		info -> node = 0;
+	}
+
+	/* Each nodeN directory lists the CPUs of NUMA node N */
+	DIR *dir = opendir(SYSFS_NODE);
+	struct dirent *entry;
+	while (dir != (DIR *)NULL && (entry = readdir(dir)) != (struct dirent *)NULL)
+	{
+		cpu_set_t node_cpus;
+		if (strncmp(entry -> d_name, "node", 4) != 0 || ! isdigit(entry -> d_name[4]))
+		{
+			continue;
+		}
+		snprintf(path, 1024, "%s/%s/cpulist", SYSFS_NODE, entry -> d_name);
+		if (read_line(path, line, 1024) != 0 || parse_cpu_list(line, &node_cpus) != 0)
+		{
+			continue;
+		}
+		for (i = 0; i < count; i++)
+		{
+			if (CPU_ISSET((*cpus)[i].cpu, &node_cpus))
+			{
+				(*cpus)[i].node = atoi(entry -> d_name + 4);
+			}
+		}
+	}
+	if (dir != (DIR *)NULL)
+	{
+		closedir(dir);
+	}
+	qsort(*cpus, count, sizeof(struct cpu_info), compare_cpus);
+	return count;
+}
+
+/**
+ * Order CPUs by NUMA node, socket, core and CPU number
+ */
+static int compare_cpus(const void *a, const void *b)
+{
+	const struct cpu_info *x = (const struct cpu_info *)a;
+	const struct cpu_info *y = (const struct cpu_info *)b;
+	if (x -> node != y -> node)
+	{
+		return x -> node - y -> node;
+	}
+	if (x -> package != y -> package)
+	{
+		return x -> package - y -> package;
+	}
+	if (x -> core != y -> core)
+	{
+		return x -> core - y -> core;
+	}
+	return x -> cpu - y -> cpu;
+}
+
+/**
+ * List the (sorted) CPUs in [start, end) one core at a time: the first
+ * thread of every core, then the remaining hyperthread siblings
+ *
+ * @return The number of entries written to order
+ */
+static int compact_order(struct cpu_info *cpus, int start, int end, int *order)
+{
+	int i;
+	int k = 0;
+	for (i = start; i < end; i++)
+	{
+		if (i == start || cpus[i].core != cpus[i - 1].core || cpus[i].package != cpus[i - 1].package)
+		{
+			order[k++] = i;
+		}
+	}
+	for (i = start; i < end; i++)
+	{
+		if (! (i == start || cpus[i].core != cpus[i - 1].core || cpus[i].package != cpus[i - 1].package))
+		{
+			order[k++] = i;
+		}
+	}
+	return k;
+}
+
+/**
+ * Read the first line of a (sysfs) file, without the newline
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int read_line(const char *path, char *line, int line_len)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == (FILE *)NULL)
+	{
+		return 1;
+	}
+	if (fgets(line, line_len, fp) == (char *)NULL)
+	{
+		fclose(fp);
+		return 2;
+	}
+	fclose(fp);
+	line[strcspn(line, "\n")] = '\0';
+	return 0;
+}
+
+/**
+ * Parse a kernel CPU list (e.g. "0-3,8,10-11")
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	while (*list != '\0')
+	{
+		char *end;
+		long first = strtol(list, &end, 10);
+		long last = first;
+		if (end == list || first < 0)
+		{
+			return 1;
+		}
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first)
+			{
+				return 2;
+			}
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+		{
+			CPU_SET(first, set);
+		}
+		if (*end == ',')
+		{
+			end++;
+		}
+		else if (*end != '\0')
+		{
+			return 3;
+		}
+		list = end;
+	}
+	return 0;
+}
+
+/**
+ * Format a CPU set as a kernel CPU list (e.g. "0-3,8")
+ *
+ * @return 0 on success, otherwise failure (empty set or list too long)
+ */
+static int format_cpu_list(const cpu_set_t *set, char *list, int list_len)
+{
+	int cpu;
+	int length = 0;
+	list[0] = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (! CPU_ISSET(cpu, set))
+		{
+			continue;
+		}
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+		{
+			last++;
+		}
+		if (last == cpu)
+		{
+			length += snprintf(list + length, list_len - length, "%s%d", length ? "," : "", cpu);
+		}
+		else
+		{
+			length += snprintf(list + length, list_len - length, "%s%d-%d", length ? "," : "", cpu, last);
+		}
+		if (length >= list_len)
+		{
+			return 1;
+		}
+		cpu = last;
+	}
+	return (length == 0) ? 2 : 0;
+}
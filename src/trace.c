@@ -0,0 +1,334 @@
+/**
+ * Startup timeline
+ *
+ * Every rank records begin/end spans of its startup phases (chirp
+ * discovery, port binding, registration, fake FS, machine file, exec...).
+ * The other ranks send theirs to the MASTER once started (TRACE), which
+ * merges them into one Chrome trace-event JSON file (one process per
+ * rank) on SIGUSR1 and at exit. Timestamps are wall-clock so the spans of
+ * different hosts line up as well as their clocks agree.
+ */
+
+#include "trace.h"
+#include "udp.h"
+#include <time.h>
+
+static trace_span spans[TRACE_MAX_SPANS];
+static int num_spans = 0;
+static int this_rank = 0;
+static trace_rank **ranks = NULL;
+static int num_ranks = 0;
+static pthread_mutex_t ranks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int parse_span(char *string, trace_span *span);
+static void write_spans(FILE *fp, int rank, const trace_span *list, int count, uint64_t origin, int *first);
+
+/**
+ * Set the rank of the local spans and allocate the per-rank table
+ *
+ * @param rank The rank of this host
+ * @param count The number of ranks (0 unless MASTER)
+ * @return 0 on success, otherwise failure
+ */
+int trace_init(int rank, int count)
+{
+	this_rank = rank;
+	if (count <= 0)
+	{
+		return 0;
+	}
+	ranks = (trace_rank **) calloc(count, sizeof(trace_rank *));
+	if (ranks == (trace_rank **)NULL)
+	{
+		return 1;
+	}
+	num_ranks = count;
+	return 0;
+}
+
+/**
+ * Returns a wall-clock timestamp in microseconds
+ */
+uint64_t trace_now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+/**
+ * Begin a span
+ *
+ * @param name The name of the phase
+ * @return The span to pass to trace_end (negative once the table is full)
+ */
+int trace_begin(const char *name)
+{
+	int span = __sync_fetch_and_add(&num_spans, 1);
+	if (span >= TRACE_MAX_SPANS)
+	{
+		num_spans = TRACE_MAX_SPANS;
+		return -1;
+	}
+	snprintf(spans[span].name, TRACE_NAME_LEN, "%s", name);
+	spans[span].start_us = trace_now_us();
+	return span;
+}
+
+/**
+ * End a span (spans which never end are left out of the trace)
+ */
+void trace_end(int span)
+{
+	if (span < 0 || span >= TRACE_MAX_SPANS)
+	{
+		return;
+	}
+	spans[span].end_us = trace_now_us();
+}
+
+/**
+ * Send the finished spans which the MASTER does not have yet
+ *
+ * Spans are packed into as few TRACE commands as fit in a message; each
+ * is retransmitted until the MASTER acknowledges it.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return 0 on success, otherwise the number of spans not delivered
+ */
+int trace_send(parallel_wrapper *par_wrapper)
+{
+	int i, j, first, last, length;
+	uint32_t seq;
+	int failed = 0;
+	char list[MAX_MESSAGE + 1];
+	int count = num_spans < TRACE_MAX_SPANS ? num_spans : TRACE_MAX_SPANS;
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		return 0;
+	}
+	for (first = 0; first < count; first = last)
+	{
+		/* Leave room for the header (<TRACE>:<SEQ>:<RANK>:) */
+		length = 0;
+		for (last = first; last < count; last++)
+		{
+			if (spans[last].sent || spans[last].end_us == 0)
+			{
+				continue;
+			}
+			int added = snprintf(list + length, MAX_MESSAGE + 1 - length, "%s%s,%llu,%llu",
+				length == 0 ? "" : "|", spans[last].name, (unsigned long long) spans[last].start_us,
+				(unsigned long long) spans[last].end_us);
+			if (length + added > MAX_MESSAGE - 32)
+			{
+				list[length] = '\0';
+				break;
+			}
+			length += added;
+		}
+		if (length == 0)
+		{
+			continue;
+		}
+		if (pending_add(par_wrapper -> pending, MASTER, &seq) != 0)
+		{
+			print(PRNT_WARN, "Unable to allocate a sequence number for TRACE\n");
+			return count - first;
+		}
+		for (i = 0; i < 10; i++)
+		{
+			send_spans(par_wrapper -> command_socket, seq, par_wrapper -> this_machine -> rank,
+				list, par_wrapper -> master -> ip_addr, par_wrapper -> master -> port);
+			if (pending_wait(par_wrapper -> pending, seq, 100000) == 0)
+			{
+				break;
+			}
+		}
+		pending_remove(par_wrapper -> pending, seq);
+		for (j = first; j < last; j++)
+		{
+			if (spans[j].sent || spans[j].end_us == 0)
+			{
+				continue;
+			}
+			if (i < 10)
+			{
+				spans[j].sent = 1;
+			}
+			else
+			{
+				failed++;
+			}
+		}
+	}
+	if (failed > 0)
+	{
+		print(PRNT_WARN, "Master did not acknowledge %d trace spans\n", failed);
+	}
+	return failed;
+}
+
+/**
+ * Parse a span sent by another rank (<NAME>,<START>,<END>)
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int parse_span(char *string, trace_span *span)
+{
+	char *end;
+	char *comma = strchr(string, ',');
+	if (comma == (char *)NULL || comma == string || comma - string >= TRACE_NAME_LEN)
+	{
+		return 1;
+	}
+	memcpy(span -> name, string, comma - string);
+	span -> name[comma - string] = '\0';
+	span -> start_us = strtoull(comma + 1, &end, 10);
+	if (*end != ',')
+	{
+		return 2;
+	}
+	span -> end_us = strtoull(end + 1, &end, 10);
+	if (*end != '\0' || span -> end_us < span -> start_us)
+	{
+		return 3;
+	}
+	return 0;
+}
+
+/**
+ * Store the spans of a rank (MASTER only)
+ *
+ * @param rank The rank which sent them
+ * @param list The spans (<NAME>,<START>,<END>)
+ * @param count The number of spans
+ * @return 0 on success, otherwise failure
+ */
+int trace_record(int rank, char **list, int count)
+{
+	int i;
+	if (rank <= MASTER || rank >= num_ranks)
+	{
+		print(PRNT_WARN, "Trace from unknown rank %d\n", rank);
+		return 1;
+	}
+	pthread_mutex_lock(&ranks_mutex);
+	if (ranks[rank] == (trace_rank *)NULL)
+	{
+		ranks[rank] = (trace_rank *) calloc(1, sizeof(trace_rank));
+		if (ranks[rank] == (trace_rank *)NULL)
+		{
+			pthread_mutex_unlock(&ranks_mutex);
+			print(PRNT_WARN, "Unable to allocate space for the trace of rank %d\n", rank);
+			return 2;
+		}
+	}
+	trace_rank *table = ranks[rank];
+	for (i = 0; i < count && table -> count < TRACE_MAX_SPANS; i++)
+	{
+		if (parse_span(list[i], &table -> spans[table -> count]) != 0)
+		{
+			print(PRNT_WARN, "Invalid trace span from rank %d: %s\n", rank, list[i]);
+			continue;
+		}
+		table -> count++;
+	}
+	pthread_mutex_unlock(&ranks_mutex);
+	return 0;
+}
+
+/**
+ * Write the finished spans of a rank as complete ("X") events
+ */
+static void write_spans(FILE *fp, int rank, const trace_span *list, int count, uint64_t origin, int *first)
+{
+	int i;
+	fprintf(fp, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"rank %d\"}}",
+		*first ? "" : ",", rank, rank);
+	fprintf(fp, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"sort_index\":%d}}",
+		rank, rank);
+	*first = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (list[i].end_us == 0)
+		{
+			continue;
+		}
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":0}",
+			list[i].name, (unsigned long long) (list[i].start_us - origin),
+			(unsigned long long) (list[i].end_us - list[i].start_us), rank);
+	}
+}
+
+/**
+ * Write the merged trace (timestamps relative to the earliest span)
+ *
+ * @param path The file (Chrome trace-event JSON, loads in Perfetto)
+ * @return 0 on success, otherwise failure
+ */
+int trace_write(const char *path)
+{
+	int i, j;
+	int first = 1;
+	char temp[1040];
+	int count = num_spans < TRACE_MAX_SPANS ? num_spans : TRACE_MAX_SPANS;
+	snprintf(temp, 1040, "%s.tmp", path);
+	FILE *fp = fopen(temp, "w");
+	if (fp == (FILE *)NULL)
+	{
+		print(PRNT_WARN, "Unable to write trace to %s\n", temp);
+		return 1;
+	}
+	pthread_mutex_lock(&ranks_mutex);
+	uint64_t origin = count > 0 ? spans[0].start_us : 0;
+	for (i = 0; i < num_ranks; i++)
+	{
+		for (j = 0; ranks[i] != (trace_rank *)NULL && j < ranks[i] -> count; j++)
+		{
+			if (ranks[i] -> spans[j].start_us < origin)
+			{
+				origin = ranks[i] -> spans[j].start_us;
+			}
+		}
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	write_spans(fp, this_rank, spans, count, origin, &first);
+	for (i = 0; i < num_ranks; i++)
+	{
+		if (ranks[i] != (trace_rank *)NULL)
+		{
+			write_spans(fp, i, ranks[i] -> spans, ranks[i] -> count, origin, &first);
+		}
+	}
+	pthread_mutex_unlock(&ranks_mutex);
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	if (rename(temp, path) != 0)
+	{
+		print(PRNT_WARN, "Unable to replace trace file %s\n", path);
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Write the trace to file (MASTER only), or to TRACE_FILE in the scratch
+ * directory
+ *
+ * @return 0 on success, otherwise failure
+ */
+int trace_dump(const char *file, const char *scratch_dir)
+{
+	char path[1024];
+	if (file != (char *)NULL && this_rank == MASTER)
+	{
+		return trace_write(file);
+	}
+	if (scratch_dir == (char *)NULL)
+	{
+		return 1;
+	}
+	snprintf(path, 1024, "%s/%s", scratch_dir, TRACE_FILE);
+	return trace_write(path);
+}
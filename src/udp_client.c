@@ -4,51 +4,19 @@
 #include <unistd.h>
 
 /**
- * Send an ACK back to the host specified in the sockaddr structure
+ * Send a QUERY to the host listening on addr
  *
  * @param socketfd The socket to send the message on
- * @param rank The rank of the current host 
- * @param sockaddr The socket to reply to 
+ * @param seq The sequence number of this command
+ * @param addr The command address of the host
  * @return 0 on success, otherwise failure
  */
-int ack(int socketfd, int rank, const struct sockaddr *addr)
+int query(int socketfd, uint32_t seq, const struct sockaddr_in *addr)
 {
 	int RC = 0;
-	if (addr == (struct sockaddr *)NULL)
+	if (addr == (struct sockaddr_in *)NULL)
 	{
-		print(PRNT_WARN, "Socket address is null\n");
-		return 1;
-	}
-	if (rank < 0)
-	{
-		print(PRNT_WARN, "Invalid rank\n");
-		return 2;
-	}
-	if (socketfd < 0)
-	{
-		print(PRNT_WARN, "Invalid socket descriptor\n");
-		return 3;
-	}
-	char message[1024];
-	snprintf(message, 1024, "%d:%d", CMD_ACK, rank);
-	RC = send_string_reply(addr, message, socketfd);
-	return RC;
-}
-
-/**
- * Send a QUERY to the host listening on ip_addr and port
- *
- * @param socketfd The socket to send the message on
- * @param ip_addr The ipaddress to send to 
- * @param port The port to send to 
- * @return 0 on success, otherwise failure
- */
-int query(int socketfd, char *ip_addr, uint16_t port)
-{
-	int RC = 0;
-	if (ip_addr == (char *)NULL)
-	{
-		print(PRNT_WARN, "IP Address is null\n");
+		print(PRNT_WARN, "Address is null\n");
 		return 1;
 	}
 	if (socketfd < 0)
@@ -57,33 +25,33 @@ int query(int socketfd, char *ip_addr, uint16_t port)
 		return 3;
 	}
 	char message[1024];
-	snprintf(message, 1024, "%d", CMD_QUERY);
-	RC = send_string_to_ip_port(ip_addr, port, message, socketfd);
+	snprintf(message, 1024, "%d:%u", CMD_QUERY, seq);
+	RC = send_string_to_sockaddr((const struct sockaddr *) addr, sizeof(struct sockaddr_in), message, socketfd);
 	return RC;
 }
 /**
- * Send the term signal to a host with the given ip_addr and port.
+ * Send the term signal to the host listening on addr
  *
- * Sends the TERM command to a host with the given ip and port. A
+ * Sends the TERM command to a host with the given address. A
  * return code is also sent with the packet.
  *
  * @param socketfd The socket to send the message on 
+ * @param seq The sequence number of this command
  * @param return_code The return code to send with the TERM signal
- * @param ip_addr The ipaddress of the receiving server
- * @param port The port of the receiving server 
+ * @param addr The command address of the receiving server
  */
-int term(int socketfd, int return_code, char *ip_addr, uint16_t port)
+int term(int socketfd, uint32_t seq, int return_code, const struct sockaddr_in *addr)
 {
 	int RC = 0;
-	if (ip_addr == (char *)NULL)
+	if (addr == (struct sockaddr_in *)NULL)
 	{
-		print(PRNT_WARN, "Invalid IP address\n");
+		print(PRNT_WARN, "Invalid address\n");
 		return 1;
 	}
 
 	char message[1024];
-	snprintf(message, 1024, "%d:%d", CMD_TERM, return_code);
-	RC = send_string_to_ip_port(ip_addr, port, message, socketfd);
+	snprintf(message, 1024, "%d:%u:%d", CMD_TERM, seq, return_code);
+	RC = send_string_to_sockaddr((const struct sockaddr *) addr, sizeof(struct sockaddr_in), message, socketfd);
 	return RC;
 }
 
@@ -95,12 +63,13 @@ int term(int socketfd, int return_code, char *ip_addr, uint16_t port)
  * to be sent with the packet
  * 
  * @param socketfd The socket to send the message on
+ * @param seq The sequence number of this command
  * @param rank The rank of this host
  * @param iwd The initial working directory of this host
  * @param ip_addr The ipaddress of the receiving server
  * @param port The port of the receiving server
  */
-int register_cmd(int socketfd, int rank, int cpus, char *iwd, char *username, char *ip_addr, uint16_t port)
+int register_cmd(int socketfd, uint32_t seq, int rank, int cpus, char *iwd, char *username, char *cpu_map, char *ip_addr, uint16_t port)
 {
 	if (ip_addr == (char *)NULL)
 	{
@@ -132,7 +101,8 @@ int register_cmd(int socketfd, int rank, int cpus, char *iwd, char *username, ch
 		print(PRNT_WARN, "Username is NULL. Assuming 'nobody'\n");
 	}
 	char message[1024];
-	snprintf(message, 1024, "%d:%d:%s:%d:%s", CMD_REGISTER, rank, iwd, cpus, username == (char *)NULL ? "nobody" : username);
+	snprintf(message, 1024, "%d:%u:%d:%s:%d:%s%s%s", CMD_REGISTER, seq, rank, iwd, cpus, username == (char *)NULL ? "nobody" : username,
+		cpu_map == (char *)NULL ? "" : ":", cpu_map == (char *)NULL ? "" : cpu_map);
 	int RC = send_string_to_ip_port(ip_addr, port, message, socketfd);
 	return RC;
 }
@@ -144,11 +114,11 @@ int register_cmd(int socketfd, int rank, int cpus, char *iwd, char *username, ch
  * command is send to the passed IP address and port.
  *
  * @param socketfd The socket to send the message on
- * @param rank The rank of this host
+ * @param seq The sequence number of this command
  * @param ip_addr The ip address of the receiving server
  * @param The port of the receiving server
  */
-int create_link(int socketfd, char *src, char *dest, char *ip_addr, uint16_t port)
+int create_link(int socketfd, uint32_t seq, char *src, char *dest, char *ip_addr, uint16_t port)
 {
 	if (ip_addr == (char *)NULL)
 	{
@@ -171,8 +141,219 @@ int create_link(int socketfd, char *src, char *dest, char *ip_addr, uint16_t por
 		return 4;
 	}
 	char message[1024];
-	snprintf(message, 1024, "%d:%s:%s", CMD_CREATE_LINK, src, dest);
+	snprintf(message, 1024, "%d:%u:%s:%s", CMD_CREATE_LINK, seq, src, dest);
 	int RC = send_string_to_ip_port(ip_addr, port, message, socketfd);
 	return RC;
 }
 
+/**
+ * Sends a batch of <KEY>:<VALUE> pairs to a given ip address and port
+ *
+ * Packs as many pairs (starting with the first) as fit in a single
+ * message and sends them as one CREATE_LINKS, BIND_MOUNTS or PMI pair
+ * command. The number of pairs that were packed is returned in packed;
+ * the caller sends the remaining pairs in further messages. Packing is
+ * deterministic, so a retransmit with the same arguments sends the same
+ * pairs.
+ *
+ * @param socketfd The socket to send the message on
+ * @param command CMD_CREATE_LINKS, CMD_BIND_MOUNTS, CMD_PMI_PUT, CMD_PMI_BCAST or CMD_PMI_VALUE
+ * @param seq The sequence number of this command
+ * @param keys The keys (link sources)
+ * @param values The values (link destinations)
+ * @param count The number of pairs in keys/values
+ * @param ip_addr The ip address of the receiving server
+ * @param port The port of the receiving server
+ * @param packed (output) The number of pairs sent
+ * @return 0 on success, otherwise failure
+ */
+int send_pairs(int socketfd, CMD command, uint32_t seq, char **keys, char **values, int count, char *ip_addr, uint16_t port, int *packed)
+{
+	int i;
+	if (ip_addr == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address is null\n");
+		return 1;
+	}
+	if (keys == (char **)NULL || values == (char **)NULL || count <= 0)
+	{
+		print(PRNT_WARN, "Invalid list of pairs\n");
+		return 2;
+	}
+	if (socketfd < 0)
+	{
+		print(PRNT_WARN, "Invalid socket descriptor\n");
+		return 3;
+	}
+	if (packed == (int *)NULL)
+	{
+		return 4;
+	}
+	if (command != CMD_CREATE_LINKS && command != CMD_BIND_MOUNTS && command != CMD_PMI_PUT &&
+		command != CMD_PMI_BCAST && command != CMD_PMI_VALUE)
+	{
+		print(PRNT_WARN, "Invalid batch command %d\n", command);
+		return 6;
+	}
+	char message[MAX_MESSAGE + 1];
+	int length = snprintf(message, MAX_MESSAGE + 1, "%d:%u", command, seq);
+	for (i = 0; i < count && i < MAX_PAIRS_PER_MESSAGE; i++)
+	{
+		int pair_length = strlen(keys[i]) + strlen(values[i]) + 2;
+		if (length + pair_length > MAX_MESSAGE)
+		{
+			break;
+		}
+		length += snprintf(message + length, MAX_MESSAGE + 1 - length, ":%s:%s", keys[i], values[i]);
+	}
+	if (i == 0)
+	{
+		print(PRNT_WARN, "Pair %s -> %s does not fit in a single message\n", keys[0], values[0]);
+		return 5;
+	}
+	*packed = i;
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
+
+/**
+ * Tell a rank to launch its local processes (PMI launch mode)
+ *
+ * @param socketfd The socket to send the message on
+ * @param seq The sequence number of this command
+ * @param offset The global rank of the first process on the receiving host
+ * @param size The total number of processes in the job
+ * @param shared_fs The working directory for the processes
+ * @param mapping The PMI process mapping of the job
+ * @param tree The fence tree neighbours of the receiving host (see pmi_tree_fields)
+ * @param ip_addr The ip address of the receiving server
+ * @param port The port of the receiving server
+ * @return 0 on success, otherwise failure
+ */
+int launch(int socketfd, uint32_t seq, int offset, int size, char *shared_fs, char *mapping, char *tree, char *ip_addr, uint16_t port)
+{
+	if (ip_addr == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address is null\n");
+		return 1;
+	}
+	if (shared_fs == (char *)NULL || mapping == (char *)NULL || tree == (char *)NULL)
+	{
+		print(PRNT_WARN, "Invalid launch parameters\n");
+		return 2;
+	}
+	char message[MAX_MESSAGE + 1];
+	int length = snprintf(message, MAX_MESSAGE + 1, "%d:%u:%d:%d:%s:%s:%s", CMD_LAUNCH, seq, 
+		offset, size, shared_fs, mapping, tree);
+	if (length > MAX_MESSAGE)
+	{
+		print(PRNT_WARN, "LAUNCH does not fit in a single message\n");
+		return 3;
+	}
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
+
+/**
+ * Send a fence command (PMI_FENCE or PMI_FENCE_DONE) for a given epoch
+ *
+ * @param socketfd The socket to send the message on
+ * @param command CMD_PMI_FENCE or CMD_PMI_FENCE_DONE
+ * @param seq The sequence number of this command
+ * @param epoch The fence epoch
+ * @param rank The rank of this host
+ * @param ip_addr The ip address of the receiving server
+ * @param port The port of the receiving server
+ * @return 0 on success, otherwise failure
+ */
+int fence(int socketfd, CMD command, uint32_t seq, uint32_t epoch, int rank, char *ip_addr, uint16_t port)
+{
+	if (ip_addr == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address is null\n");
+		return 1;
+	}
+	char message[1024];
+	snprintf(message, 1024, "%d:%u:%u:%d", command, seq, epoch, rank);
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
+
+/**
+ * Ask the parent in the fence tree for a PMI key which was not broadcast
+ *
+ * The parent answers with a PMI_VALUE before it ACKs (with status 0 if
+ * the key was found).
+ *
+ * @param socketfd The socket to send the message on
+ * @param seq The sequence number of this command
+ * @param key The (escaped) key
+ * @param rank The rank of this host
+ * @param ip_addr The ip address of the parent
+ * @param port The port of the parent
+ * @return 0 on success, otherwise failure
+ */
+int fetch(int socketfd, uint32_t seq, char *key, int rank, char *ip_addr, uint16_t port)
+{
+	if (ip_addr == (char *)NULL || key == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address or key is null\n");
+		return 1;
+	}
+	char message[MAX_MESSAGE + 1];
+	int length = snprintf(message, MAX_MESSAGE + 1, "%d:%u:%s:%d", CMD_PMI_GET, seq, key, rank);
+	if (length > MAX_MESSAGE)
+	{
+		print(PRNT_WARN, "PMI_GET does not fit in a single message\n");
+		return 2;
+	}
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
+
+/**
+ * Report the exit status of this rank's local processes to the master
+ *
+ * @param socketfd The socket to send the message on
+ * @param seq The sequence number of this command
+ * @param rank The rank of this host
+ * @param return_code The exit status of the local processes
+ * @param ip_addr The ip address of the master
+ * @param port The port of the master
+ * @return 0 on success, otherwise failure
+ */
+int exited(int socketfd, uint32_t seq, int rank, int return_code, char *ip_addr, uint16_t port)
+{
+	if (ip_addr == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address is null\n");
+		return 1;
+	}
+	char message[1024];
+	snprintf(message, 1024, "%d:%u:%d:%d", CMD_EXITED, seq, rank, return_code);
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
+
+/**
+ * Send the startup spans of this rank to the master
+ *
+ * @param socketfd The socket to send the message on
+ * @param seq The sequence number of this command
+ * @param rank The rank of this host
+ * @param spans The spans (<NAME>,<START>,<END> separated by '|')
+ * @param ip_addr The ip address of the master
+ * @param port The port of the master
+ * @return 0 on success, otherwise failure
+ */
+int send_spans(int socketfd, uint32_t seq, int rank, const char *spans, char *ip_addr, uint16_t port)
+{
+	if (ip_addr == (char *)NULL || spans == (char *)NULL)
+	{
+		print(PRNT_WARN, "IP address or spans are null\n");
+		return 1;
+	}
+	char message[MAX_MESSAGE + 1];
+	int length = snprintf(message, MAX_MESSAGE + 1, "%d:%u:%d:%s", CMD_TRACE, seq, rank, spans);
+	if (length > MAX_MESSAGE)
+	{
+		print(PRNT_WARN, "TRACE does not fit in a single message\n");
+		return 2;
+	}
+	return send_string_to_ip_port(ip_addr, port, message, socketfd);
+}
@@ -1,47 +1,107 @@
 #include "wrapper.h"
 #include "string_util.h"
+#include "namespace.h"
+#include "pmi.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "trace.h"
+#include "flight.h"
+#include "netem.h"
 #include <pthread.h>
 /* STAT */
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <setjmp.h>
+#include <limits.h>
+
+#define BUFFER_SIZE (MAX_MESSAGE + 1)
+
+/**
+ * Scratch memory of a message before its arena needs malloc
+ */
+#define MESSAGE_SCRATCH_SIZE (256u)
+
+/**
+ * A numeric field of a message, decoded against the schema of its command
+ */
+union udp_value
+{
+	int integer; /**< FIELD_INTEGER */
+	uint32_t uint32; /**< FIELD_UINT32 */
+};
+
 /**
  * Define a structure which represents a single UDP message
  */
 struct udp_message
 {
 	parallel_wrapper *par_wrapper; /**< The parallel wrapper */
-	strarray *args; /**< The arguments */
+	strarray *args; /**< The arguments (points to arguments) */
+	strarray arguments; /**< The fields of buffer */
+	char **tokens; /**< The fields (in buffer), allocated from pool */
+	union udp_value *values; /**< The numeric fields (by index in tokens), allocated from pool */
+	CMD command; /**< The command */
+	char buffer[BUFFER_SIZE]; /**< The datagram, split in place */
+	arena pool; /**< Memory of the handler, released with the message */
+	char scratch[MESSAGE_SCRATCH_SIZE] __attribute__((aligned(ARENA_ALIGN))); /**< The first buffer of pool */
+	uint32_t seq; /**< The sequence number of this message */
+	int replay; /**< Flag noting the message was claimed in the replay cache */
   	struct sockaddr_storage from; /**< The sockaddr associated with this message */
 	socklen_t len; /**< The length of the sockaddr_storage element */	
 };
 
 /**
- * Define a structure which contains the udp handlers for
- * the various commands
+ * Types of the fields of a command, one character each in its schema
+ */
+#define FIELD_INTEGER 'i' /**< An int (parse_integer), decoded into values */
+#define FIELD_UINT32 'u' /**< A uint32_t (parse_uint32), decoded into values */
+#define FIELD_STRING 's' /**< Left as sent */
+#define FIELD_TEXT 't' /**< Quotes removed and trimmed in place */
+
+/**
+ * The schema of a command and its handler
+ *
+ * A message is <CMD>:<SEQ>, then one field per character of fields (the
+ * last optional ones may be omitted), then the fields of group repeated
+ * between min_groups and max_groups times. If count_field is set, that
+ * field holds the number of repeats. Messages are decoded against the
+ * schema before the handler runs, so handlers neither check dim nor
+ * parse the numeric fields.
  */
-struct udp_handler
+struct udp_command
 {
-	CMD command;
+	const char *name; /**< Name of the command (for warnings) */
 	int (*handler)(struct udp_message *); /**< The handler */
-#if 0
-	int (*query_handler)(struct udp_message *); /**< Handler for QUERY */	
-	int (*ack_handler)(struct udp_message *); /**< Handler for ACK */
-	int (*term_handler)(struct udp_message *); /**< Handler for TERM */
-	int (*create_link_handler)(struct udp_message *); /**< Create link handler */
-	int (*send_file_handler)(struct udp_message *); /**< Send file */
-	int (*register_handler)(struct udp_message *); /**< Register */
-#endif
+	const char *fields; /**< Types of the fields after <SEQ> */
+	int num_fields; /**< Length of fields */
+	int optional; /**< How many of the last fields may be omitted */
+	const char *group; /**< Types of the repeated fields */
+	int group_length; /**< Length of group (0: none) */
+	int min_groups; /**< Fewest repeats of group */
+	int max_groups; /**< Most repeats of group */
+	int count_field; /**< Index of the field counting the repeats (0: none) */
+	const char *usage; /**< The expected format */
 };
 
-#define BUFFER_SIZE (1024u)
+/**
+ * Entry of the command table (the lengths are taken from the literals)
+ */
+#define COMMAND(cmd, handler, fields, optional, group, min_groups, max_groups, count_field, usage) \
+	[cmd] = {#cmd + 4, handler, fields, sizeof(fields) - 1, optional, group, sizeof(group) - 1, \
+		min_groups, max_groups, count_field, usage}
 
 /**
  * Global Variables
  */
 int disable_timeout = 0; /* Keep timeouts enabled */
 
+/**
+ * Lookup table of MESSAGE_DELIMITERS
+ */
+static delimiter_table message_delimiters;
+static pthread_once_t message_delimiters_once = PTHREAD_ONCE_INIT;
+
 /* Local Function Prototypes */
 static void *keep_alive(void *ptr);
 static void *process_message(void *ptr);
@@ -49,25 +109,72 @@ static int handle_ack(struct udp_message *message);
 static int handle_query(struct udp_message *message);
 static int handle_term(struct udp_message *message);
 static int handle_create_link(struct udp_message *message);
+static int handle_create_links(struct udp_message *message);
+static int handle_bind_mounts(struct udp_message *message);
+static int handle_launch(struct udp_message *message);
+static int handle_pmi_pairs(struct udp_message *message);
+static int handle_pmi_get(struct udp_message *message);
+static int handle_pmi_fence(struct udp_message *message);
+static int handle_pmi_fence_done(struct udp_message *message);
+static int handle_exited(struct udp_message *message);
 static int handle_send_file(struct udp_message *message);
 static int handle_register(struct udp_message *message);
+static int handle_trace(struct udp_message *message);
+static int reply_ack(struct udp_message *message, const char *status);
+static int make_link(parallel_wrapper *par_wrapper, char *src, char *dest);
+static int is_link_to(const char *path, const char *target);
+static void init_message_delimiters(void);
+static struct udp_message *new_message(parallel_wrapper *par_wrapper);
+static void split_message(struct udp_message *message);
+static int prepare_message(struct udp_message *message);
+static void free_message(struct udp_message *message);
+static int peek_header(const char *buffer, int *command, uint32_t *seq);
+static int decode_message(struct udp_message *message, const struct udp_command *schema);
 
 /**
- * Instance of udp_handlers defining the various handler functions
+ * The commands, indexed by CMD (unused values have no handler)
  */
-static struct udp_handler handlers[] = 
+static const struct udp_command commands[CMD_COUNT] =
 {
-	{CMD_QUERY, handle_query},
-	{CMD_ACK, handle_ack},
-	{CMD_TERM, handle_term},
-	{CMD_CREATE_LINK, handle_create_link},
-	{CMD_SEND_FILE, handle_send_file},
-	{CMD_REGISTER, handle_register},
-	{CMD_NULL, NULL}
-} ;
+	COMMAND(CMD_QUERY, handle_query, "", 0, "", 0, 0, 0,
+		"<QUERY>:<SEQ>"),
+	COMMAND(CMD_ACK, handle_ack, "is", 1, "", 0, 0, 0,
+		"<ACK>:<SEQ>:<RANK>[:<STATUS>]"),
+	COMMAND(CMD_TERM, handle_term, "i", 0, "", 0, 0, 0,
+		"<TERM>:<SEQ>:<RC>"),
+	COMMAND(CMD_CREATE_LINK, handle_create_link, "ss", 0, "", 0, 0, 0,
+		"<CREATE_LINK>:<SEQ>:<SRC>:<DEST>"),
+	COMMAND(CMD_CREATE_LINKS, handle_create_links, "", 0, "ss", 1, MAX_PAIRS_PER_MESSAGE, 0,
+		"<CREATE_LINKS>:<SEQ>:<SRC>:<DEST>[:<SRC>:<DEST>...]"),
+	COMMAND(CMD_BIND_MOUNTS, handle_bind_mounts, "", 0, "tt", 1, MAX_PAIRS_PER_MESSAGE, 0,
+		"<BIND_MOUNTS>:<SEQ>:<SRC>:<DEST>[:<SRC>:<DEST>...]"),
+	COMMAND(CMD_LAUNCH, handle_launch, "iissisui", 0, "isu", 0, PMI_TREE_ARITY, 9,
+		"<LAUNCH>:<SEQ>:<OFFSET>:<SIZE>:<SHARED_FS>:<MAPPING>:<PARENT>:<IP>:<PORT>:<NUM_CHILDREN>[:<RANK>:<IP>:<PORT>...]"),
+	COMMAND(CMD_PMI_PUT, handle_pmi_pairs, "", 0, "ss", 1, MAX_PAIRS_PER_MESSAGE, 0,
+		"<PMI_PUT>:<SEQ>:<KEY>:<VALUE>[:<KEY>:<VALUE>...]"),
+	COMMAND(CMD_PMI_BCAST, handle_pmi_pairs, "", 0, "ss", 1, MAX_PAIRS_PER_MESSAGE, 0,
+		"<PMI_BCAST>:<SEQ>:<KEY>:<VALUE>[:<KEY>:<VALUE>...]"),
+	COMMAND(CMD_PMI_VALUE, handle_pmi_pairs, "", 0, "ss", 1, MAX_PAIRS_PER_MESSAGE, 0,
+		"<PMI_VALUE>:<SEQ>:<KEY>:<VALUE>[:<KEY>:<VALUE>...]"),
+	COMMAND(CMD_PMI_GET, handle_pmi_get, "si", 0, "", 0, 0, 0,
+		"<PMI_GET>:<SEQ>:<KEY>:<RANK>"),
+	COMMAND(CMD_PMI_FENCE, handle_pmi_fence, "ui", 0, "", 0, 0, 0,
+		"<PMI_FENCE>:<SEQ>:<EPOCH>:<RANK>"),
+	COMMAND(CMD_PMI_FENCE_DONE, handle_pmi_fence_done, "ui", 0, "", 0, 0, 0,
+		"<PMI_FENCE_DONE>:<SEQ>:<EPOCH>:<RANK>"),
+	COMMAND(CMD_EXITED, handle_exited, "ii", 0, "", 0, 0, 0,
+		"<EXITED>:<SEQ>:<RANK>:<RC>"),
+	COMMAND(CMD_SEND_FILE, handle_send_file, "", 0, "s", 0, MAX_MESSAGE_TOKENS, 0,
+		"<SEND_FILE>:<SEQ>[:<ARGS>...]"),
+	COMMAND(CMD_REGISTER, handle_register, "itits", 1, "", 0, 0, 0,
+		"<REGISTER>:<SEQ>:<RANK>:<IWD>:<CPUS>:<USER>[:<CPU_MAP>]"),
+	COMMAND(CMD_TRACE, handle_trace, "i", 0, "s", 1, MAX_MESSAGE_TOKENS, 0,
+		"<TRACE>:<SEQ>:<RANK>:<NAME>,<START>,<END>[|<NAME>,<START>,<END>...]")
+};
 
 int jmpset = 0;
 sigjmp_buf jmpbuf;
+pthread_t jmpthread;
 
 /**
  * Keep-alive semaphore
@@ -102,9 +209,12 @@ void *udp_server(void *ptr)
 
 	fd_set readfds;
 
-	char delim[] = {':', '|'};
+	char reply[REPLAY_REPLY_LEN];
+	int command;
+	uint32_t seq;
 
-	/* Create a small buffer to hold messages */
+	pthread_once(&message_delimiters_once, init_message_delimiters);
+	/* Create a small buffer to drain the dump pipe */
 	char *buffer = (char *) malloc(sizeof(char) * BUFFER_SIZE);
 	if (buffer == (char *)NULL)
 	{
@@ -113,7 +223,7 @@ void *udp_server(void *ptr)
 	}
 
 	/* At this point, we already have socket and a port */
-	int n = par_wrapper -> command_socket + 1;
+	int n = (par_wrapper -> command_socket > dump_pipe[0] ? par_wrapper -> command_socket : dump_pipe[0]) + 1;
 	struct timeval timeout;
 	timeout.tv_sec = par_wrapper -> ka_interval;
 	timeout.tv_usec = 0;
@@ -121,12 +231,17 @@ void *udp_server(void *ptr)
 	{
 		FD_ZERO(&readfds);
 		FD_SET(par_wrapper -> command_socket, &readfds);
-		memset(buffer, 0, sizeof(char) * BUFFER_SIZE);
+		if (dump_pipe[0] >= 0)
+		{
+			FD_SET(dump_pipe[0], &readfds);
+		}
 		sigsetjmp(jmpbuf, 1); /* NOTE: This line must be right before we check exit_flag */
+		jmpthread = pthread_self();
 		jmpset = 1;
 		if (exit_flag)
 		{
-			cleanup(par_wrapper, 250);
+			print(PRNT_INFO, "Received signal %d\n", (int) exit_flag);
+			cleanup(par_wrapper, ABORT_CODE);
 		}
 		if (par_wrapper -> this_machine -> rank != MASTER)
 		{
@@ -141,30 +256,79 @@ void *udp_server(void *ptr)
 			print(PRNT_ERR, "Select statement failed\n");
 			return NULL;
 		}
+		if (RC > 0 && dump_pipe[0] >= 0 && FD_ISSET(dump_pipe[0], &readfds))
+		{
+			/* SIGUSR1 - write out the telemetry table, the metrics and the flight recorder */
+			while (read(dump_pipe[0], buffer, BUFFER_SIZE) > 0);
+			if (exit_flag)
+			{
+				continue; /* Woken by an exit signal (see handle_exit_signal) */
+			}
+			telemetry_dump(par_wrapper);
+			flight_dump(par_wrapper -> scratch_dir);
+			metrics_dump(par_wrapper -> metrics_file, par_wrapper -> scratch_dir);
+			trace_dump(par_wrapper -> trace_file, par_wrapper -> scratch_dir);
+			if (! FD_ISSET(par_wrapper -> command_socket, &readfds))
+			{
+				continue;
+			}
+		}
 		else if (RC > 0 && FD_ISSET(par_wrapper -> command_socket, &readfds))
 		{
 			/* Service the message on the command port */
-			struct udp_message *message = (struct udp_message *)calloc(1, sizeof(struct udp_message));
+			struct udp_message *message = new_message(par_wrapper);
 			if (message == (struct udp_message *)NULL)
 			{
 				print(PRNT_ERR, "Unable to allocate space for message\n");
 				return NULL;
 			}
-			/* Fill in the message structure as well as we can */
-			message -> par_wrapper = par_wrapper;
 			/* NOTE: This must be set before calling receive from */
 			message -> len = sizeof(struct sockaddr_storage);
 			/* Receive the message */
-			recvfrom(par_wrapper -> command_socket, buffer, BUFFER_SIZE, 0, 
+			ssize_t length = recvfrom(par_wrapper -> command_socket, message -> buffer, BUFFER_SIZE - 1, 0, 
 				(struct sockaddr *)&message -> from, &message -> len);
-			/* Parse the buffer into arguments using the delims */
-			message -> args = strsplit(delim, buffer); 
+			message -> buffer[length > 0 ? length : 0] = '\0';
+			if (netem_drop_received((struct sockaddr *)&message -> from))
+			{
+				free(message);
+				continue;
+			}
+			RC = peek_header(message -> buffer, &command, &seq);
+			flight_record(FLIGHT_PACKET_IN, RC == 0 ? command : 0, RC == 0 ? seq : 0, 0,
+				(struct sockaddr *)&message -> from);
+			if (RC == 0)
+			{
+				metrics_count_received(command);
+			}
+			/* Answer retransmitted commands from the replay cache */
+			if (RC == 0 && command != CMD_ACK && command != CMD_QUERY)
+			{
+				RC = replay_begin(par_wrapper -> replay, (struct sockaddr *)&message -> from,
+					seq, reply, REPLAY_REPLY_LEN);
+				if (RC == REPLAY_HIT)
+				{
+					send_string_to_sockaddr((struct sockaddr *)&message -> from, message -> len,
+						reply, par_wrapper -> command_socket);
+				}
+				if (RC != REPLAY_NEW)
+				{
+					/* Duplicate - do not run the handler again */
+					free(message);
+					continue;
+				}
+				/* The slot is keyed by this seq - free_message releases it even if the message is rejected */
+				message -> seq = seq;
+				message -> replay = 1;
+			}
+			/* Split the buffer into arguments in place */
+			split_message(message);
 
 			/* Create the thread */
 			RC = pthread_create(&thread, &attr, &process_message, (void *)message);
 			if (RC != 0)
 			{
 				print(PRNT_WARN, "Unable to create message thread, RC = %d\n", RC);
+				free_message(message);
 			}
 		}
 		else
@@ -219,17 +383,20 @@ static void *keep_alive(void *ptr)
 		/* We weren't able to obtain the mutex */
 		return NULL;
 	}
+	flight_record(FLIGHT_TIMER, FLIGHT_KEEP_ALIVE, 0, par_wrapper -> num_procs, NULL);
 		
 	/* Send keep-alives to all registered machines */
-	for (i = 0; i < par_wrapper -> num_procs; i++)
+	rank_table *ranks = &par_wrapper -> ranks;
+	for (i = 0; i < ranks -> count; i++)
 	{
-		if (par_wrapper -> machines[i] == (machine *)NULL)
+		if (! rank_registered(ranks, i))
 		{
 			continue; /* This machine has not yet registered */
 		}
 		/* Send the query command */
-		RC = query(par_wrapper -> command_socket, par_wrapper -> machines[i] -> ip_addr,
-				par_wrapper -> machines[i] -> port);
+		uint32_t seq = pending_next_seq(par_wrapper -> pending);
+		metrics_query_sent(i, seq);
+		RC = query(par_wrapper -> command_socket, seq, &ranks -> addrs[i]);
 		if (RC != 0)
 		{
 			print(PRNT_WARN, "Failed to send QUERY to rank %d\n", i);
@@ -249,24 +416,26 @@ static void *keep_alive(void *ptr)
 	gettimeofday(&curr_time, NULL);
 	struct timeval diff_time;
 	/* Make sure that all machines are alive */
-	for (i = 0; i < par_wrapper -> num_procs; i++)
+	for (i = 0; i < ranks -> count; i++)
 	{
-		if (par_wrapper -> machines[i] == (machine *)NULL)
+		if (! rank_registered(ranks, i))
 		{
 			continue; /* This machine has not yet registered */
 		}
-		timersub(&curr_time, &par_wrapper -> machines[i] -> last_alive, &diff_time);
+		timersub(&curr_time, &ranks -> last_alive[i], &diff_time);
 		if (diff_time.tv_sec > par_wrapper -> timeout)
 		{
 			pthread_mutex_unlock(&keep_alive_mutex);
 			print(PRNT_WARN, "Rank %d (%s:%d) has exceeded the timeout interval (%d). Aborting\n",
-					i, par_wrapper -> machines[i] -> ip_addr, 
-					par_wrapper -> machines[i] -> port, par_wrapper -> timeout);
-			cleanup(par_wrapper, 250);
+					i, inet_ntoa(ranks -> addrs[i].sin_addr), 
+					ntohs(ranks -> addrs[i].sin_port), par_wrapper -> timeout);
+			flight_record(FLIGHT_STATE, FLIGHT_TIMED_OUT, 0, i, NULL);
+			cleanup(par_wrapper, ABORT_CODE);
 		}
 	}
 	pthread_mutex_unlock(&keep_alive_mutex);
 	debug(PRNT_INFO, "All machines alive.\n");
+	telemetry_dump(par_wrapper);
 	return NULL;
 }
 
@@ -291,51 +460,329 @@ static void *process_message(void *ptr)
 		print(PRNT_WARN, "Null message passed to message handler\n");
 		return NULL;
 	}
-	if (! is_valid_strarray(message -> args))
+	temp = prepare_message(message);
+	if (temp < 0)
 	{
-		free_strarray(message -> args);
-		free(message);
-		print(PRNT_WARN, "Null message arguments passed to message handler\n");
+		free_message(message);
 		return NULL;
 	}
-	
-	RC = parse_integer(message -> args -> strings[0], &temp);
+	command = message -> command;
+	/* Call the handler (timed) */
+	uint64_t start = metrics_now_us();
+	RC = commands[temp].handler(message);
+	metrics_record_handler(command, metrics_now_us() - start);
 	if (RC != 0)
 	{
-		free_strarray(message -> args);
-		free(message);
-		print(PRNT_WARN, "Unable to parse message. Invalid command.\n");
+		print(PRNT_WARN, "Failed to handle command %d. RC = %d\n", command, RC);
+	}
+	free_message(message);
+	return NULL;
+}
+
+static void init_message_delimiters(void)
+{
+	make_delimiter_table(MESSAGE_DELIMITERS, &message_delimiters);
+}
+
+/**
+ * Allocate a message (not zeroed: only the header is set, the datagram
+ * fills the rest)
+ *
+ * @param par_wrapper The parallel wrapper
+ * @return The message, or NULL on failure
+ */
+static struct udp_message *new_message(parallel_wrapper *par_wrapper)
+{
+	struct udp_message *message = (struct udp_message *)malloc(sizeof(struct udp_message));
+	if (message == (struct udp_message *)NULL)
+	{
 		return NULL;
 	}
-	command = (CMD) temp;
+	message -> par_wrapper = par_wrapper;
+	message -> args = (strarray *)NULL;
+	message -> tokens = (char **)NULL;
+	message -> values = (union udp_value *)NULL;
+	message -> command = 0;
+	message -> seq = 0;
+	message -> replay = 0;
+	arena_init(&message -> pool, message -> scratch, MESSAGE_SCRATCH_SIZE, 0, 0);
+	return message;
+}
+
+/**
+ * Split the datagram of a message into its fields in place, keeping
+ * only as many token pointers (in the message arena) as it has fields
+ */
+static void split_message(struct udp_message *message)
+{
+	char *tokens[MAX_MESSAGE_TOKENS];
+	message -> arguments.dim = tokenize(&message_delimiters, message -> buffer, tokens, MAX_MESSAGE_TOKENS);
+	if (message -> arguments.dim > 0)
+	{
+		message -> tokens = (char **) arena_alloc(&message -> pool, message -> arguments.dim * sizeof(char *));
+		if (message -> tokens != (char **)NULL)
+		{
+			memcpy(message -> tokens, tokens, message -> arguments.dim * sizeof(char *));
+		}
+	}
+	message -> arguments.strings = message -> tokens;
+	message -> args = &message -> arguments;
+}
+
+/**
+ * Parse the header of a split message, find its handler and decode its
+ * fields against the schema of the command
+ *
+ * @param message The message
+ * @return The index of its entry in commands, or -1 if it is invalid
+ */
+static int prepare_message(struct udp_message *message)
+{
+	int temp;
+	if (! is_valid_strarray(message -> args))
+	{
+		print(PRNT_WARN, "Null message arguments passed to message handler\n");
+		return -1;
+	}
+	if (parse_integer(message -> args -> strings[0], &temp) != 0)
+	{
+		print(PRNT_WARN, "Unable to parse message. Invalid command.\n");
+		return -1;
+	}
+	message -> command = (CMD) temp;
+
+	/* Every command carries a sequence number: <CMD>:<SEQ>[:<ARGS>] */
+	if (message -> args -> dim < 2 || 
+		parse_uint32(message -> args -> strings[1], &message -> seq) != 0)
+	{
+		print(PRNT_WARN, "Unable to parse message. Invalid sequence number.\n");
+		return -1;
+	}
 
 	/* Determine the handler for this command */
-	temp = 0;
-	while ((handlers[temp].handler != NULL) && handlers[temp].command != CMD_NULL)
+	temp = udp_find_handler(message -> command);
+	if (temp < 0)
 	{
-		if (command == handlers[temp].command)
+		print(PRNT_WARN, "No handler for command %d or unrecognized command\n", message -> command);
+		return -1;
+	}
+	/* Check the fields against the schema of the command */
+	if (decode_message(message, &commands[temp]) != 0)
+	{
+		print(PRNT_WARN, "Invalid %s packet. Expected %s\n", commands[temp].name, commands[temp].usage);
+		return -1;
+	}
+	return temp;
+}
+
+/**
+ * The work of the listener and of process_message on a datagram up to
+ * its handler: allocate the message, split and decode it, free it (the
+ * replay cache and the recording are left out). For the benchmarks.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param datagram The datagram
+ * @param length Its length
+ * @return The index of its handler, or -1 if it is invalid
+ */
+int udp_decode_datagram(parallel_wrapper *par_wrapper, const char *datagram, int length)
+{
+	int command;
+	uint32_t seq;
+	pthread_once(&message_delimiters_once, init_message_delimiters);
+	struct udp_message *message = new_message(par_wrapper);
+	if (message == (struct udp_message *)NULL)
+	{
+		return -1;
+	}
+	if (length > BUFFER_SIZE - 1)
+	{
+		length = BUFFER_SIZE - 1;
+	}
+	memcpy(message -> buffer, datagram, length);
+	message -> buffer[length] = '\0';
+	int RC = peek_header(message -> buffer, &command, &seq);
+	split_message(message);
+	RC = RC == 0 ? prepare_message(message) : -1;
+	free_message(message);
+	return RC;
+}
+
+/**
+ * Find the handler of a command
+ *
+ * @param command The command
+ * @return The index of its entry in commands, or -1 if there is none
+ */
+int udp_find_handler(CMD command)
+{
+	if ((unsigned int) command >= CMD_COUNT || commands[command].handler == NULL)
+	{
+		return -1;
+	}
+	return (int) command;
+}
+
+/**
+ * Check the fields of a message against the schema of its command
+ *
+ * The numeric fields are decoded into message -> values and the text
+ * fields are unquoted and trimmed in place.
+ *
+ * @param message The message (split into args)
+ * @param schema The schema of its command
+ * @return 0 on success, otherwise the message does not match the schema
+ */
+static int decode_message(struct udp_message *message, const struct udp_command *schema)
+{
+	int i;
+	int dim = message -> args -> dim;
+	int fixed = 2 + schema -> num_fields;
+	int groups = 0;
+	if (dim < fixed - schema -> optional)
+	{
+		return 1;
+	}
+	/* Omitted optional fields decode as 0 */
+	message -> values = (union udp_value *) arena_alloc(&message -> pool,
+		(dim > fixed ? dim : fixed) * sizeof(union udp_value));
+	if (message -> values == (union udp_value *)NULL)
+	{
+		return 7;
+	}
+	if (schema -> group_length == 0)
+	{
+		if (dim > fixed)
 		{
-			/* Call the handler */
-			RC = handlers[temp].handler(message);
-			if (RC != 0)
-			{
-				print(PRNT_WARN, "Failed to handle command %d. RC = %d\n", command, RC);
-			}
-			free_strarray(message -> args);
-			if (message != (struct udp_message *)NULL)
-			{
-				free(message);
-			}
-			return NULL;
+			return 2;
 		}
-		temp++; /* Move on to next handler */
-	}	
+	}
+	else
+	{
+		if (dim < fixed || (dim - fixed) % schema -> group_length != 0)
+		{
+			return 3;
+		}
+		groups = (dim - fixed) / schema -> group_length;
+		if (groups < schema -> min_groups || groups > schema -> max_groups)
+		{
+			return 4;
+		}
+	}
+	for (i = 2; i < dim; i++)
+	{
+		char *field = message -> args -> strings[i];
+		char type = i < fixed ? schema -> fields[i - 2] : schema -> group[(i - fixed) % schema -> group_length];
+		switch (type)
+		{
+			case FIELD_INTEGER:
+				if (parse_integer(field, &message -> values[i].integer) != 0)
+				{
+					return 5;
+				}
+				break;
+			case FIELD_UINT32:
+				if (parse_uint32(field, &message -> values[i].uint32) != 0)
+				{
+					return 5;
+				}
+				break;
+			case FIELD_TEXT:
+				remove_quotes(field);
+				trim(field);
+				break;
+			default:
+				break;
+		}
+	}
+	if (schema -> count_field != 0 && message -> values[schema -> count_field].integer != groups)
+	{
+		return 6;
+	}
+	return 0;
+}
+
+/**
+ * Send an ACK for the passed message back to its source
+ *
+ * The ACK echoes the sequence number of the message. If the message was
+ * claimed in the replay cache, the reply is cached so that retransmitted
+ * copies are answered without running the handler again.
+ *
+ * @param message The message to acknowledge
+ * @param status An optional status string to return with the ACK (or NULL)
+ * @return 0 on success, otherwise failure
+ */
+static int reply_ack(struct udp_message *message, const char *status)
+{
+	parallel_wrapper *par_wrapper = message -> par_wrapper;
+	char reply[REPLAY_REPLY_LEN];
+	if (status == (char *)NULL)
+	{
+		snprintf(reply, REPLAY_REPLY_LEN, "%d:%u:%d", CMD_ACK, message -> seq, 
+			par_wrapper -> this_machine -> rank);
+	}
+	else
+	{
+		snprintf(reply, REPLAY_REPLY_LEN, "%d:%u:%d:%s", CMD_ACK, message -> seq, 
+			par_wrapper -> this_machine -> rank, status);
+	}
+	int RC = send_string_to_sockaddr((struct sockaddr *)&message -> from, message -> len,
+		reply, par_wrapper -> command_socket);
+	if (message -> replay)
+	{
+		replay_finish(par_wrapper -> replay, (struct sockaddr *)&message -> from,
+			message -> seq, reply);
+	}
+	return RC;
+}
 
-	print(PRNT_WARN, "No handler for command %d or unrecognized command\n", command);
-	/* Clean up */
-	free_strarray(message -> args);
+/**
+ * Free a message (and release its replay cache entry if unanswered)
+ *
+ * @param message The message to free
+ */
+static void free_message(struct udp_message *message)
+{
+	if (message == (struct udp_message *)NULL)
+	{
+		return;
+	}
+	if (message -> replay)
+	{
+		replay_finish(message -> par_wrapper -> replay, 
+			(struct sockaddr *)&message -> from, message -> seq, NULL);
+	}
+	arena_release(&message -> pool);
 	free(message);
-	return NULL;
+}
+
+/**
+ * Parse the <CMD>:<SEQ> header of a raw message without splitting it
+ *
+ * @param buffer The received message
+ * @param command (output) The command
+ * @param seq (output) The sequence number
+ * @return 0 on success, otherwise failure
+ */
+static int peek_header(const char *buffer, int *command, uint32_t *seq)
+{
+	char *next = NULL;
+	errno = 0;
+	long int cmd = strtol(buffer, &next, 10);
+	if (errno != 0 || next == buffer || *next != ':')
+	{
+		return 1;
+	}
+	const char *start = next + 1;
+	unsigned long int value = strtoul(start, &next, 10);
+	if (errno != 0 || next == start || value > UINT32_MAX)
+	{
+		return 2;
+	}
+	*command = (int) cmd;
+	*seq = (uint32_t) value;
+	return 0;
 }
 
 /*--------------------------------------------------------------------------*/
@@ -345,119 +792,100 @@ static void *process_message(void *ptr)
 static int handle_ack(struct udp_message *message)
 {
 	int RC, rank;
-	/* CMD <RANK> */
+	/* CMD <SEQ> <RANK> [<STATUS>] */
 	parallel_wrapper *par_wrapper = message -> par_wrapper;	
-	/* Make sure the format is correct */
-	if (message -> args -> dim != 2)
-	{
-		print(PRNT_WARN, "Invalid ACK packet. Expected '<ACK>:<RANK>'\n");
-		return 1;
-	}
-	RC = parse_integer(message -> args -> strings[1], &rank);
-	if (RC != 0)
-	{
-		print(PRNT_WARN, "Failed to parse rank\n");
-		return 2;
-	}
+	char *status = message -> args -> dim == 4 ? message -> args -> strings[3] : NULL;
+	rank = message -> values[2].integer;
 	if (rank < 0 || rank >= par_wrapper -> num_procs)
 	{
 		print(PRNT_WARN, "Invalid rank (%d)\n", rank);
 		return 3;
 	}
-	if (par_wrapper -> this_machine -> rank != MASTER && rank != 0)
-	{
-		print(PRNT_WARN, "Unable to receive ACK from non-MASTER rank\n");
-		return 3;
-	}
+	/* Other ranks only hear from the MASTER and their PMI tree neighbours */
+	machine *peer = pmi_find_peer(par_wrapper, rank);
 	if (par_wrapper -> this_machine -> rank != MASTER && 
-			(par_wrapper -> master == NULL || par_wrapper -> master -> ip_addr == NULL))
+			(peer == (machine *)NULL || peer -> ip_addr == (char *)NULL))
 	{
-		print(PRNT_WARN, "MASTER not intialized yet\n");
+		print(PRNT_WARN, "Unable to receive ACK from rank %d. It is not a known neighbour\n", rank);
 		return 4;
 	}	
 
 	/* Make sure that the source matches the registered machine */
-	char *ip_addr = (char *)malloc(INET6_ADDRSTRLEN * sizeof(char));
-	if (ip_addr == (char *)NULL)
-	{
-		print(PRNT_WARN, "Unable to allocate space for an IP address string\n");
-		return 3;
-	}
-	RC = ip_str_from_sockaddr((struct sockaddr *)&message -> from,
-		   ip_addr, INET6_ADDRSTRLEN);
-	if (RC != 0)
-	{
-		free(ip_addr);
-		print(PRNT_WARN, "Unable to obtain source of ACK signal\n");
-		return 4;
-	}	
-	uint16_t port = port_from_sockaddr((struct sockaddr *)&message -> from);
 	if (par_wrapper -> this_machine -> rank != MASTER)
 	{
-		/* Check for correct source */
-		if (strcmp(message -> par_wrapper -> master -> ip_addr, ip_addr) != 0 ||
-			message -> par_wrapper -> master -> port != port)
+		char *ip_addr = (char *) arena_alloc(&message -> pool, INET6_ADDRSTRLEN);
+		if (ip_addr == (char *)NULL)
 		{
-			print(PRNT_WARN, "ACK from MASTER (%s:%d) does not match IP address of source (%s:%d)\n", 
-				rank, par_wrapper -> master -> ip_addr, 
-				par_wrapper -> master -> port, ip_addr, port);
-			free(ip_addr);
+			print(PRNT_WARN, "Unable to allocate space for an IP address string\n");
+			return 3;
+		}
+		RC = ip_str_from_sockaddr((struct sockaddr *)&message -> from,
+			   ip_addr, INET6_ADDRSTRLEN);
+		if (RC != 0)
+		{
+			print(PRNT_WARN, "Unable to obtain source of ACK signal\n");
+			return 4;
+		}	
+		uint16_t port = port_from_sockaddr((struct sockaddr *)&message -> from);
+		if (strcmp(peer -> ip_addr, ip_addr) != 0 || peer -> port != port)
+		{
+			print(PRNT_WARN, "ACK from rank %d (%s:%d) does not match IP address of source (%s:%d)\n", 
+				rank, peer -> ip_addr, peer -> port, ip_addr, port);
 			return 4;
 		}
-		free(ip_addr);
 		pthread_mutex_lock(&par_wrapper -> mutex);
-		gettimeofday(&par_wrapper -> master -> last_alive, NULL);
+		gettimeofday(&peer -> last_alive, NULL);
 		pthread_mutex_unlock(&par_wrapper -> mutex);
+		pending_complete(par_wrapper -> pending, message -> seq, rank, status);
 		return 0;
 	}
-	else if (par_wrapper -> machines[rank] == (machine *)NULL)
+
+	/* The MASTER compares the binary source address with the rank table */
+	pthread_mutex_lock(&par_wrapper -> mutex);
+	RC = rank_table_alive(&par_wrapper -> ranks, rank, (struct sockaddr *)&message -> from);
+	pthread_mutex_unlock(&par_wrapper -> mutex);
+	if (RC == 1)
 	{
 		print(PRNT_WARN, "Cannot receive an ACK from rank %d. It has not registered yet\n", rank);
-		free(ip_addr);
 		return 4;
 	}
-	
-	if (strcmp(message -> par_wrapper -> machines[rank] -> ip_addr, ip_addr) != 0 ||
-			message -> par_wrapper -> machines[rank] -> port != port)
+	if (RC != 0)
 	{
+		const struct sockaddr_in *registered = &par_wrapper -> ranks.addrs[rank];
+		char ip_addr[INET6_ADDRSTRLEN] = "?";
+		ip_str_from_sockaddr((struct sockaddr *)&message -> from, ip_addr, INET6_ADDRSTRLEN);
 		print(PRNT_WARN, "Registered rank %d (%s:%d) does not match IP address of source (%s:%d)\n", 
-				rank, ip_addr, port, 
-				par_wrapper -> machines[rank] -> ip_addr, par_wrapper -> machines[rank] -> port);
-	  	free(ip_addr);
+				rank, inet_ntoa(registered -> sin_addr), ntohs(registered -> sin_port),
+				ip_addr, port_from_sockaddr((struct sockaddr *)&message -> from));
 	   	return 5;	
 	}
-	free(ip_addr);
 	/*debug(PRNT_INFO, "Received ACK from rank %d\n", rank);*/
-	/* Update the last seen from time */
-	pthread_mutex_lock(&par_wrapper -> mutex);
-	gettimeofday(&par_wrapper -> machines[rank] -> last_alive, NULL);
-	pthread_mutex_unlock(&par_wrapper -> mutex);
+	metrics_query_acked(rank, message -> seq);
+	if (status != (char *)NULL && status[0] == TELEMETRY_PREFIX)
+	{
+		telemetry_record(par_wrapper, rank, status);
+	}
+	pending_complete(par_wrapper -> pending, message -> seq, rank, status);
 	return 0;
 }
 
 static int handle_query(struct udp_message *message)
 {
 	/* Response with an ACK */
-	if (message -> args -> dim != 1)
+	/* Piggyback the usage of the local job on the keep-alive */
+	char status[REPLAY_REPLY_LEN / 2];
+	if (telemetry_report(message -> par_wrapper, status, REPLAY_REPLY_LEN / 2) == 0)
 	{
-		print(PRNT_WARN, "Invalid QUERY packet. Expected <QUERY>\n");
-		return 1;	
+		return reply_ack(message, status);
 	}
-
-	return ack(message -> par_wrapper -> command_socket, 
-			message -> par_wrapper -> this_machine -> rank, 
-			(struct sockaddr *)&message -> from); 
+	return reply_ack(message, NULL);
 }
 
 static int handle_term(struct udp_message *message)
 {
-	int RC, return_code;
+	int RC;
+	int return_code = message -> values[2].integer;
 	uint16_t port;
-	if (message -> args -> dim != 2)
-	{
-		print(PRNT_WARN, "Invalid TERM packet. Expected <TERM>:<RC>\n");
-		return 1;
-	}
 	/* 1) If I am MASTER, I am not allowed to get a term signal */
 	if (message -> par_wrapper -> this_machine -> rank == MASTER)
 	{
@@ -470,16 +898,9 @@ static int handle_term(struct udp_message *message)
 		print(PRNT_WARN, "MASTER process not yet initialized\n");
 		return 1;
 	}
-	
-	RC = parse_integer(message -> args -> strings[1], &return_code);
-	if (RC != 0)
-	{
-		print(PRNT_WARN, "Failed to parse return code\n");
-		return 2;
-	}
 
 	/* 2) The TERM signal must come from the master's command port */
-	char *ip_addr = (char *)malloc(INET6_ADDRSTRLEN * sizeof(char));
+	char *ip_addr = (char *) arena_alloc(&message -> pool, INET6_ADDRSTRLEN);
 	if (ip_addr == (char *)NULL)
 	{
 		print(PRNT_WARN, "Unable to allocate space for an IP address string\n");
@@ -489,7 +910,6 @@ static int handle_term(struct udp_message *message)
 		   ip_addr, INET6_ADDRSTRLEN);
 	if (RC != 0)
 	{
-		free(ip_addr);
 		print(PRNT_WARN, "Unable to obtain source of TERM signal\n");
 		return 4;
 	}	
@@ -497,155 +917,399 @@ static int handle_term(struct udp_message *message)
 	if (strcmp(message -> par_wrapper -> master -> ip_addr, ip_addr) == 0 &&
 			message -> par_wrapper -> master -> port == port)
 	{
-		RC = ack(message -> par_wrapper -> command_socket, 
-			message -> par_wrapper -> this_machine -> rank, 
-			(struct sockaddr *)&message -> from); 
+		RC = reply_ack(message, NULL);
 		if (RC != 0)
 		{
 			print(PRNT_WARN, "Unable to send ACK for TERM\n");
 		}
 
 		/* Term signal is valid */
+		flight_record(FLIGHT_STATE, FLIGHT_TERMINATED, 0, return_code, NULL);
 		debug(PRNT_INFO, "Received valid term signal from master. Exitting.\n");
+		/* Claim the cleanup first, so main does not exit once the listener is gone */
+		if (claim_cleanup() != 0)
+		{
+			pthread_exit(NULL);
+		}
 		/* Cancel the listener thread */
 		pthread_cancel(message -> par_wrapper -> listener);
-		free(ip_addr);
 		cleanup(message -> par_wrapper, return_code);
 	}
 	print(PRNT_WARN, "Source of TERM signal was not MASTER\n");
-	free(ip_addr);
 	return 5;
 }
 
 static int handle_create_link(struct udp_message *message)
 {
-	/* CREATE_LINK <SRC> <DEST> */
+	/* CREATE_LINK <SEQ> <SRC> <DEST> */
 	int RC;
-	if (message -> args -> dim != 3)
+	RC = make_link(message -> par_wrapper, message -> args -> strings[2],
+		message -> args -> strings[3]);
+	if (RC != 0)
 	{
-		print(PRNT_WARN, "Invalid CREATE_LINK packet. Expected <CREATE_LINK>:<SRC>:<DEST>\n");
-		return 1;
+		return RC;
 	}
-	/* Make sure that the symlinks list is initialized */
-	if (!is_valid_sll(message -> par_wrapper -> symlinks))
+
+	/* Send ACK back */
+	RC = reply_ack(message, NULL);
+	if (RC != 0)
 	{
-		print(PRNT_WARN, "SLL symlinks list is not initialized\n");
-		return 2;
+		print(PRNT_WARN, "Unable to send ACK for CREATE_LINK\n");
 	}
+	return 0;
+}
 
-	remove_quotes(message -> args -> strings[1]);
-	remove_quotes(message -> args -> strings[2]);
-	trim(message -> args -> strings[1]);
-	trim(message -> args -> strings[2]);
+static int handle_create_links(struct udp_message *message)
+{
+	/* CREATE_LINKS <SEQ> <SRC> <DEST> [<SRC> <DEST> ...] */
+	int RC, i;
+	int num_links = (message -> args -> dim - 2) / 2;
+	/* One status digit per link (0 = created or already present) */
+	char status[MAX_PAIRS_PER_MESSAGE + 1];
+	/* The fake FS is linked when bind mode is off or has failed on some host - drop any mounts recorded here */
+	remove_bind_mounts(message -> par_wrapper);
+	message -> par_wrapper -> fs_mode = FS_MODE_SYMLINK;
+	for (i = 0; i < num_links; i++)
+	{
+		RC = make_link(message -> par_wrapper, message -> args -> strings[2 + 2*i],
+			message -> args -> strings[3 + 2*i]);
+		status[i] = (char)('0' + (RC > 9 ? 9 : RC));
+	}
+	status[num_links] = '\0';
 
-	/* Make sure that the source exists */
-	struct stat st;
-	if (stat(message -> args -> strings[1], &st) != 0)
+	/* Send a single ACK back carrying the per-link status */
+	RC = reply_ack(message, status);
+	if (RC != 0)
 	{
-		print(PRNT_WARN, "Unable to create softlink from %s -> %s. Source does not exist.\n",
-				message -> args -> strings[1], message -> args -> strings[2]);
-		return 3;
+		print(PRNT_WARN, "Unable to send ACK for CREATE_LINKS\n");
+	}
+	return 0;
+}
+
+static int handle_bind_mounts(struct udp_message *message)
+{
+	/* BIND_MOUNTS <SEQ> <SRC> <DEST> [<SRC> <DEST> ...] */
+	int RC, i;
+	int num_mounts = (message -> args -> dim - 2) / 2;
+	/* One status digit per mount (0 = recorded) */
+	char status[MAX_PAIRS_PER_MESSAGE + 1];
+	for (i = 0; i < num_mounts; i++)
+	{
+		RC = add_bind_mount(message -> par_wrapper, message -> args -> strings[2 + 2*i],
+			message -> args -> strings[3 + 2*i]);
+		status[i] = (char)('0' + (RC > 9 ? 9 : RC));
 	}
+	status[num_mounts] = '\0';
 
-	/* Look for this destination in the list of already created softlinks */
-	struct sll_element *curr_element = message -> par_wrapper -> symlinks -> head -> next;
-	while (curr_element != (struct sll_element *)NULL)
+	RC = reply_ack(message, status);
+	if (RC != 0)
 	{
-		char *link_name = (char *)curr_element -> ptr;
-		if (link_name != (char *)NULL)
+		print(PRNT_WARN, "Unable to send ACK for BIND_MOUNTS\n");
+	}
+	return 0;
+}
+
+static int handle_launch(struct udp_message *message)
+{
+	/* <LAUNCH>:<SEQ>:<OFFSET>:<SIZE>:<SHARED_FS>:<MAPPING>:<PARENT>:<IP>:<PORT>:<NUM_CHILDREN>
+	   [:<RANK>:<IP>:<PORT>...] */
+	int RC, i;
+	parallel_wrapper *par_wrapper = message -> par_wrapper;
+	char **strings = message -> args -> strings;
+	int offset = message -> values[2].integer;
+	int size = message -> values[3].integer;
+	int num_children = message -> values[9].integer;
+	if (par_wrapper -> this_machine -> rank == MASTER)
+	{
+		print(PRNT_WARN, "MASTER does not accept LAUNCH packets\n");
+		return 2;
+	}
+	pthread_mutex_lock(&par_wrapper -> mutex);
+	if (par_wrapper -> pmi == (pmi_job *)NULL)
+	{
+		pmi_job *job = pmi_get_job(par_wrapper, offset, size, par_wrapper -> this_machine -> cpus,
+			strings[5]);
+		if (job == (pmi_job *)NULL)
+		{
+			pthread_mutex_unlock(&par_wrapper -> mutex);
+			return 4;
+		}
+		/* Neighbours in the fence tree */
+		for (i = -1; i < num_children; i++)
 		{
-			if (strcmp(link_name, message -> args -> strings[2]) == 0)
+			int first = (i < 0) ? 6 : 10 + 3*i;
+			char **peer = strings + first;
+			unescape_field(peer[1]);
+			if (pmi_add_peer(par_wrapper, job, i < 0, message -> values[first].integer, peer[1],
+				(uint16_t) message -> values[first + 2].uint32) != 0)
 			{
-				print(PRNT_WARN, "Symlink at %s already exists. Sending ACK\n",
-						message -> args -> strings[2]);
-				RC = ack(message -> par_wrapper -> command_socket, 
-					message -> par_wrapper -> this_machine -> rank, 
-					(struct sockaddr *)&message -> from); 
-				if (RC != 0)
-				{
-					print(PRNT_WARN, "Unable to send ACK for CREATE_LINK\n");
-				}
-				return 0;
+				print(PRNT_WARN, "Failed to parse LAUNCH tree neighbour %s\n", peer[0]);
+				pthread_mutex_unlock(&par_wrapper -> mutex);
+				return 5;
 			}
 		}
-		curr_element = curr_element -> next; /* Move onto the next element */
+		free(par_wrapper -> shared_fs);
+		par_wrapper -> shared_fs = strdup(message -> args -> strings[4]);
+		/* Bind mode mounts the node-local FS next to the fake FS */
+		if (par_wrapper -> num_binds > 0 && strcmp(par_wrapper -> shared_fs, par_wrapper -> this_machine -> iwd) != 0)
+		{
+			char local_fs[1040];
+			snprintf(local_fs, 1040, "%s_local", par_wrapper -> shared_fs);
+			par_wrapper -> local_fs = strdup(local_fs);
+		}
+		par_wrapper -> pmi = job;
+		pthread_cond_broadcast(&par_wrapper -> cond);
+	}
+	pthread_mutex_unlock(&par_wrapper -> mutex);
+
+	RC = reply_ack(message, NULL);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to send ACK for LAUNCH\n");
 	}
-	/* This is a unique symlink destination */
+	return 0;
+}
 
-	/* Attempt to create the softlink */
-	if (symlink(message -> args -> strings[1], message -> args -> strings[2]) != 0)
+static int handle_pmi_pairs(struct udp_message *message)
+{
+	/* <PMI_PUT|PMI_BCAST|PMI_VALUE>:<SEQ>:<KEY>:<VALUE>[:<KEY>:<VALUE>...] */
+	int RC, i;
+	int num_pairs = (message -> args -> dim - 2) / 2;
+	char *keys[MAX_PAIRS_PER_MESSAGE];
+	char *values[MAX_PAIRS_PER_MESSAGE];
+	for (i = 0; i < num_pairs; i++)
 	{
-		print(PRNT_WARN, "Unable to create symlink from %s -> %s\n", 
-				message -> args -> strings[1], message -> args -> strings[2]);
-		return 4;
+		keys[i] = message -> args -> strings[2 + 2*i];
+		values[i] = message -> args -> strings[3 + 2*i];
+	}
+	/* One status digit per pair (0 = stored) */
+	char status[MAX_PAIRS_PER_MESSAGE + 1];
+	if (pmi_receive(message -> par_wrapper, message -> command, keys, values, num_pairs, status) != 0)
+	{
+		/* Not launched yet - the sender retransmits */
+		return 3;
 	}
 
-	/* Save this information for later */
-	char *dest = strdup(message -> args -> strings[2]);
-	pthread_mutex_lock(&message -> par_wrapper -> mutex);
-	sll_add_element(message -> par_wrapper -> symlinks, (void *)dest);
-	pthread_mutex_unlock(&message -> par_wrapper -> mutex);
-	
-	/* Send ACK back */
-	RC = ack(message -> par_wrapper -> command_socket, 
-		message -> par_wrapper -> this_machine -> rank, 
-		(struct sockaddr *)&message -> from); 
+	RC = reply_ack(message, status);
 	if (RC != 0)
 	{
-		print(PRNT_WARN, "Unable to send ACK for CREATE_LINK\n");
+		print(PRNT_WARN, "Unable to send ACK for PMI pairs\n");
 	}
 	return 0;
 }
 
-static int handle_send_file(struct udp_message *message)
+static int handle_pmi_get(struct udp_message *message)
 {
-	print(PRNT_INFO, "NOT IMPLEMENTED -- SEND_FILE Handler\n");
+	/* <PMI_GET>:<SEQ>:<KEY>:<RANK> */
+	int RC;
+	int rank = message -> values[3].integer;
+	if (message -> par_wrapper -> pmi == (pmi_job *)NULL)
+	{
+		return 3;
+	}
+	/* The value (if any) is delivered with a PMI_VALUE before the ACK */
+	RC = pmi_answer_fetch(message -> par_wrapper, rank, message -> args -> strings[2]);
+	RC = reply_ack(message, RC == 0 ? "0" : "1");
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to send ACK for PMI_GET\n");
+	}
 	return 0;
 }
 
-static int handle_register(struct udp_message *message)
+static int handle_pmi_fence(struct udp_message *message)
 {
-	/* <REGISTER>:<RANK>:<IWD>:<CPUS>:<USERNAME>*/
-	int RC, rank;
-	int cpus = 1;
-	if (message -> args -> dim != 5)
+	/* <PMI_FENCE>:<SEQ>:<EPOCH>:<RANK> */
+	int RC;
+	uint32_t epoch = message -> values[2].uint32;
+	int rank = message -> values[3].integer;
+	if (message -> par_wrapper -> pmi == (pmi_job *)NULL)
 	{
-		print(PRNT_WARN, "Invalid CREATE_LINK packet. Expected <REGISTER>:<RANK>:<IWD>:<CPUS>:<USER>\n");
-		return 1;
+		/* Not launched yet - the child retransmits */
+		return 4;
 	}
-	/* Only the MASTER is allowed to register ranks */
+	/* ACK first - completing the fence may take a while */
+	RC = reply_ack(message, NULL);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to send ACK for PMI_FENCE\n");
+	}
+	return pmi_fence_enter(message -> par_wrapper, rank, epoch);
+}
+
+static int handle_pmi_fence_done(struct udp_message *message)
+{
+	/* <PMI_FENCE_DONE>:<SEQ>:<EPOCH>:<RANK> */
+	int RC;
+	uint32_t epoch = message -> values[2].uint32;
+	if (message -> par_wrapper -> pmi == (pmi_job *)NULL)
+	{
+		return 3;
+	}
+	/* ACK first - the completion is passed down the tree */
+	RC = reply_ack(message, NULL);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to send ACK for PMI_FENCE_DONE\n");
+	}
+	return pmi_fence_complete(message -> par_wrapper, epoch);
+}
+
+static int handle_exited(struct udp_message *message)
+{
+	/* <EXITED>:<SEQ>:<RANK>:<RC> */
+	int RC;
+	int rank = message -> values[2].integer;
+	int return_code = message -> values[3].integer;
 	if (message -> par_wrapper -> this_machine -> rank != MASTER)
 	{
-		print(PRNT_WARN, "Only the MASTER is allowed to register individuals\n");
+		print(PRNT_WARN, "Only the MASTER accepts EXITED packets\n");
 		return 2;
 	}
+	RC = reply_ack(message, NULL);
+	if (RC != 0)
+	{
+		print(PRNT_WARN, "Unable to send ACK for EXITED\n");
+	}
+	flight_record(FLIGHT_STATE, FLIGHT_RANK_EXITED, 0, rank, NULL);
+	return pmi_rank_exited(message -> par_wrapper, rank, return_code);
+}
 
-	/* Attempt to parse the rank */
-	RC = parse_integer(message -> args -> strings[1], &rank);
+/**
+ * Store the startup spans of another rank (MASTER only)
+ */
+static int handle_trace(struct udp_message *message)
+{
+	/* <TRACE>:<SEQ>:<RANK>:<NAME>,<START>,<END>[|<NAME>,<START>,<END>...] */
+	int RC;
+	int rank = message -> values[2].integer;
+	if (message -> par_wrapper -> this_machine -> rank != MASTER)
+	{
+		print(PRNT_WARN, "Only the MASTER accepts TRACE packets\n");
+		return 2;
+	}
+	RC = trace_record(rank, &message -> args -> strings[3], message -> args -> dim - 3);
+	if (RC != 0)
+	{
+		return 4;
+	}
+	RC = reply_ack(message, NULL);
 	if (RC != 0)
 	{
-		print(PRNT_WARN, "Failed to parse rank\n");
+		print(PRNT_WARN, "Unable to send ACK for TRACE\n");
+	}
+	return 0;
+}
+
+/**
+ * Create a soft link from src to dest and record it for cleanup
+ *
+ * The source and destination are trimmed (in place). A destination which
+ * this wrapper has already linked is treated as success.
+ *
+ * @param par_wrapper The parallel wrapper
+ * @param src The source of the link
+ * @param dest The destination (the link itself)
+ * @return 0 on success, otherwise failure
+ */
+static int make_link(parallel_wrapper *par_wrapper, char *src, char *dest)
+{
+	int RC;
+	/* Make sure that the symlinks set is initialized */
+	if (par_wrapper -> symlinks == (hash_set *)NULL)
+	{
+		print(PRNT_WARN, "Symlinks set is not initialized\n");
+		return 2;
+	}
+
+	remove_quotes(src);
+	remove_quotes(dest);
+	trim(src);
+	trim(dest);
+
+	/* Make sure that the source exists */
+	struct stat st;
+	if (stat(src, &st) != 0)
+	{
+		print(PRNT_WARN, "Unable to create softlink from %s -> %s. Source does not exist.\n",
+				src, dest);
 		return 3;
 	}
+
+	/* A mount point left by a failed BIND_MOUNTS is replaced by the link */
+	remove_bind_mount(par_wrapper, dest);
+
+	/* Links are only recorded once created, so a recorded one exists */
+	if (hash_set_contains(par_wrapper -> symlinks, dest))
+	{
+		print(PRNT_WARN, "Symlink at %s already exists.\n", dest);
+		return 0;
+	}
+
+	/* Attempt to create the softlink (a concurrent request for the same link may win) */
+	if (symlink(src, dest) != 0 && ! (errno == EEXIST && is_link_to(dest, src)))
+	{
+		print(PRNT_WARN, "Unable to create symlink from %s -> %s\n", src, dest);
+		return 4;
+	}
+	RC = hash_set_add(par_wrapper -> symlinks, dest);
+	if (RC != 0 && RC != 1)
+	{
+		print(PRNT_WARN, "Unable to record symlink %s\n", dest);
+		return 5;
+	}
+	return 0;
+}
+
+/**
+ * Is path a symlink to target ?
+ */
+static int is_link_to(const char *path, const char *target)
+{
+	char buffer[PATH_MAX];
+	ssize_t length = readlink(path, buffer, sizeof(buffer) - 1);
+	if (length < 0)
+	{
+		return 0;
+	}
+	buffer[length] = '\0';
+	return strcmp(buffer, target) == 0;
+}
+
+static int handle_send_file(struct udp_message *message)
+{
+	print(PRNT_INFO, "NOT IMPLEMENTED -- SEND_FILE Handler\n");
+	return 0;
+}
+
+static int handle_register(struct udp_message *message)
+{
+	/* <REGISTER>:<SEQ>:<RANK>:<IWD>:<CPUS>:<USERNAME>[:<CPU_MAP>]*/
+	int RC;
+	int rank = message -> values[2].integer;
+	int cpus = message -> values[4].integer;
+	/* Only the MASTER is allowed to register ranks */
+	if (message -> par_wrapper -> this_machine -> rank != MASTER)
+	{
+		print(PRNT_WARN, "Only the MASTER is allowed to register individuals\n");
+		return 2;
+	}
+
 	if (rank < 0 || rank >= message -> par_wrapper -> num_procs)
 	{
 		print(PRNT_WARN, "Invalid rank (%d)\n", rank);
 		return 4;
 	}
 
-	/* Trim and remove quotes on the IWD */
-	remove_quotes(message -> args -> strings[2]);
-	trim(message -> args -> strings[2]);
-	RC = parse_integer(message -> args -> strings[3], &cpus);
-	if (RC != 0)
+	/* The rank table only holds IPv4 addresses */
+	if (message -> from.ss_family != AF_INET)
 	{
-		print(PRNT_WARN, "Unable to parse number of cpus - assuming 1\n");
+		print(PRNT_WARN, "Command REGISTER from rank %d is not from an IPv4 address\n", rank);
+		return 7;
 	}
-	remove_quotes(message -> args -> strings[4]);
-	trim(message -> args -> strings[4]);
 
 	/* Get the IP Address and port of this host */
-	char *ip_addr = (char *)malloc(INET6_ADDRSTRLEN * sizeof(char));
+	char *ip_addr = (char *) arena_alloc(&message -> pool, INET6_ADDRSTRLEN);
 	if (ip_addr == (char *)NULL)
 	{
 		print(PRNT_WARN, "Unable to allocate space for an IP address string\n");
@@ -655,32 +1319,43 @@ static int handle_register(struct udp_message *message)
 		   ip_addr, INET6_ADDRSTRLEN);
 	if (RC != 0)
 	{
-		free(ip_addr);
 		print(PRNT_WARN, "Unable to obtain source of TERM signal\n");
 		return 4;
 	}	
 	uint16_t port = port_from_sockaddr((struct sockaddr *)&message -> from);
 	
 	/**
-	 * Check if this machine has already been registered
+	 * Check if this machine has already been registered (under the lock:
+	 * copies of a REGISTER may be handled at the same time)
 	 */
-	if (message -> par_wrapper -> machines[rank] == NULL)
+	parallel_wrapper *par_wrapper = message -> par_wrapper;
+	pthread_mutex_lock(&par_wrapper -> mutex);
+	machine *host = par_wrapper -> machines[rank];
+	if (host == (machine *)NULL)
 	{
-		message -> par_wrapper -> machines[rank] = (machine *) calloc(1, sizeof(struct machine));
-		if (message -> par_wrapper -> machines[rank] == (machine *)NULL)
+		/* The record is in the machine store, its strings in the job arena */
+		host = &par_wrapper -> machine_store[rank];
+		host -> ip_addr = arena_strdup(&par_wrapper -> job_arena, ip_addr);
+		host -> rank = rank;
+		host -> cpus = cpus;
+		host -> iwd = arena_strdup(&par_wrapper -> job_arena, message -> args -> strings[3]);
+		host -> port = port;
+		host -> user = arena_strdup(&par_wrapper -> job_arena, message -> args -> strings[5]);
+		if (message -> args -> dim == 7)
+		{
+			host -> cpu_map = arena_strdup(&par_wrapper -> job_arena, message -> args -> strings[6]);
+		}
+		if (host -> ip_addr == (char *)NULL || host -> iwd == (char *)NULL || host -> user == (char *)NULL)
 		{
+			pthread_mutex_unlock(&par_wrapper -> mutex);
 			print(PRNT_WARN, "Unable to allocate space for new machine\n");
-			free(ip_addr);
 			return 5;
 		}
-		pthread_mutex_lock(&message -> par_wrapper -> mutex);
-		message -> par_wrapper -> machines[rank] -> ip_addr = strdup(ip_addr);
-		message -> par_wrapper -> machines[rank] -> rank = rank;
-		message -> par_wrapper -> machines[rank] -> cpus = cpus;
-		message -> par_wrapper -> machines[rank] -> iwd = strdup(message -> args -> strings[2]);
-		message -> par_wrapper -> machines[rank] -> port = port;	
-		message -> par_wrapper -> machines[rank] -> user = strdup(message -> args -> strings[4]);
-		pthread_mutex_unlock(&message -> par_wrapper -> mutex);
+		par_wrapper -> machines[rank] = host;
+		rank_table_register(&par_wrapper -> ranks, rank, (struct sockaddr_in *)&message -> from, cpus);
+		metrics_registered(rank);
+		flight_record(FLIGHT_STATE, FLIGHT_REGISTERED, 0, rank, NULL);
+		pthread_mutex_unlock(&par_wrapper -> mutex);
 	}
 	else
 	{
@@ -688,26 +1363,22 @@ static int handle_register(struct udp_message *message)
 		 * This machine has already been allocated -
 		 * check if this is the same machine
 		 */
-		if (strcmp(message -> par_wrapper -> machines[rank] -> ip_addr, ip_addr) != 0 ||
-			message -> par_wrapper -> machines[rank] -> port != port)
+		int same = strcmp(host -> ip_addr, ip_addr) == 0 && host -> port == port;
+		pthread_mutex_unlock(&par_wrapper -> mutex);
+		if (! same)
 		{
 			print(PRNT_WARN, "Command REGISTER from rank %d (%s:%d) does not originate from already registered address (%s:%d)\n",
-				rank, ip_addr, port, message -> par_wrapper -> machines[rank] -> ip_addr, 
-				message -> par_wrapper -> machines[rank] -> port);
-			free(ip_addr);
+				rank, ip_addr, port, host -> ip_addr, host -> port);
 			return 6;
 		}
 		print(PRNT_INFO, "Received command REGISTER from rank %d, but already registered. Sending ACK\n", rank);
 	}
 
 	/* Send ACK back */
-	RC = ack(message -> par_wrapper -> command_socket, 
-		message -> par_wrapper -> this_machine -> rank, 
-		(struct sockaddr *)&message -> from); 
+	RC = reply_ack(message, NULL);
 	if (RC != 0)
 	{
 		print(PRNT_WARN, "Unable to send ACK for REGISTER\n");
 	}
-	free(ip_addr);
 	return 0;
 }